@@ -40,6 +40,7 @@ add_test(ANTS_CC_1_INVERSEWARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R1
 add_test(ANTS_CC_1_INVERSEWARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.1606 0.05)
 add_test(ANTS_CC_1_INVERSEWARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.61 0.05)
 add_test(ANTS_CC_1_INVERSEWARP_METRIC_2 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 2 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.000380545 0.05)
+add_test(ANTS_CC_LOCAL_SUMS_BENCHMARK ${TEST_BINARY_DIR}/CCLocalSumsBenchmark 2 ${R16_IMAGE} ${R64_IMAGE} 8 3 4)
 add_test(ANTS_CC_2   ${TEST_BINARY_DIR}/ANTS 2 -m  PR[${R16_IMAGE},${R64_IMAGE},1,4] -r Gauss[3,0] -t SyN[0.5] -i 50x50x30 -o ${OUTPUT_PREFIX}.nii.gz --go-faster true )
 add_test(ANTS_CC_2_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${WARP_IMAGE} ${WARP}  -R ${R16_IMAGE} )
 add_test(ANTS_CC_2_JPG  ${TEST_BINARY_DIR}/ConvertToJpg ${WARP_IMAGE} ANTSCC2.jpg)
@@ -74,6 +75,7 @@ add_test(ANTS_MSQ_INVERSEWARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity
 add_test(ANTS_MSQ_INVERSEWARP_METRIC_2 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 2 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -1.2 0.05)
 add_test(ANTS_MI_1   ${TEST_BINARY_DIR}/ANTS 2 -m  MI[${R16_IMAGE},${R64_IMAGE},1,32] -r Gauss[3,0] -t SyN[0.25] -i 50x50x30 -o ${OUTPUT_PREFIX}.nii.gz)
 add_test(ANTS_MI_1_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${WARP_IMAGE} ${WARP}  -R ${R16_IMAGE} )
+add_test(ANTS_MI_1_WARP_DENSE ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${CMAKE_BINARY_DIR}/SAMPLINGMIdense.nii.gz ${WARP}  -R ${R16_IMAGE} )
 add_test(ANTS_MI_1_JPG  ${TEST_BINARY_DIR}/ConvertToJpg ${WARP_IMAGE} ANTSMI1.jpg)
 add_test(ANTS_MI_1_WARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R16_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.4 0.05)
 add_test(ANTS_MI_1_WARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R16_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.45 0.05)
@@ -92,6 +94,39 @@ add_test(ANTS_MI_2_INVERSEWARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R1
 add_test(ANTS_MI_2_INVERSEWARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.6 0.05)
 add_test(ANTS_MI_2_INVERSEWARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.45 0.05)
 add_test(ANTS_MI_2_INVERSEWARP_METRIC_2 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 2 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.000366879 0.05)
+add_test(ANTS_SMI   ${TEST_BINARY_DIR}/ANTS 2 -m  SMI[${R16_IMAGE},${R64_IMAGE},1,32] -r Gauss[3,0] -t SyN[0.25] -i 50x50x30 -o ${OUTPUT_PREFIX}.nii.gz)
+add_test(ANTS_SMI_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${WARP_IMAGE} ${WARP}  -R ${R16_IMAGE} )
+add_test(ANTS_SMI_WARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R16_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.4 0.05)
+add_test(ANTS_SMI_WARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R16_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.45 0.05)
+add_test(ANTS_SMI_INVERSEWARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R16_IMAGE} ${INVERSEWARP_IMAGE} ${INVERSEWARP}  -R ${R16_IMAGE} )
+add_test(ANTS_SMI_INVERSEWARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.6 0.05)
+add_test(SMI_DERIVATIVE_TABLE_VS_DIRECT ${TEST_BINARY_DIR}/SpatialMutualInformationTableTest 2 ${R16_IMAGE} ${R64_IMAGE} 32 4 0.05)
+# the sampled runs must land close to their dense counterparts (ANTS_MI_1 and ANTS_CC_DENSE)
+set(SAMPLING_PREFIX ${CMAKE_BINARY_DIR}/SAMPLING)
+add_test(ANTS_MI_SAMPLED ${TEST_BINARY_DIR}/ANTS 2 -m  MI[${R16_IMAGE},${R64_IMAGE},1,32] -r Gauss[3,0] -t SyN[0.25] -i 50x50x30 -o ${SAMPLING_PREFIX}MI.nii.gz --metric-sampling Random[0.25x0.5x1])
+add_test(ANTS_MI_SAMPLED_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${SAMPLING_PREFIX}MIwarped.nii.gz ${SAMPLING_PREFIX}MIWarp.nii.gz ${SAMPLING_PREFIX}MIAffine.txt  -R ${R16_IMAGE} )
+add_test(ANTS_MI_SAMPLED_WARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R16_IMAGE} ${SAMPLING_PREFIX}MIwarped.nii.gz ${SAMPLING_PREFIX}log.txt ${SAMPLING_PREFIX}metric.nii.gz 12.4 0.5)
+add_test(ANTS_MI_SAMPLED_WARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R16_IMAGE} ${SAMPLING_PREFIX}MIwarped.nii.gz ${SAMPLING_PREFIX}log.txt ${SAMPLING_PREFIX}metric.nii.gz -0.45 0.05)
+add_test(ANTS_MI_SAMPLED_VS_DENSE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CMAKE_BINARY_DIR}/SAMPLINGMIdense.nii.gz ${SAMPLING_PREFIX}MIwarped.nii.gz ${SAMPLING_PREFIX}log.txt ${SAMPLING_PREFIX}metric.nii.gz 0 3)
+add_test(ANTS_CC_DENSE ${TEST_BINARY_DIR}/ANTS 2 -m  CC[${R16_IMAGE},${R64_IMAGE},1,2] -r Gauss[3,0] -t SyN[0.5] -i 50x50x30 -o ${SAMPLING_PREFIX}CCdense.nii.gz)
+add_test(ANTS_CC_DENSE_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${SAMPLING_PREFIX}CCdensewarped.nii.gz ${SAMPLING_PREFIX}CCdenseWarp.nii.gz ${SAMPLING_PREFIX}CCdenseAffine.txt  -R ${R16_IMAGE} )
+add_test(ANTS_CC_SAMPLED ${TEST_BINARY_DIR}/ANTS 2 -m  CC[${R16_IMAGE},${R64_IMAGE},1,2] -r Gauss[3,0] -t SyN[0.5] -i 50x50x30 -o ${SAMPLING_PREFIX}CC.nii.gz --metric-sampling Regular[0.25])
+add_test(ANTS_CC_SAMPLED_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${SAMPLING_PREFIX}CCwarped.nii.gz ${SAMPLING_PREFIX}CCWarp.nii.gz ${SAMPLING_PREFIX}CCAffine.txt  -R ${R16_IMAGE} )
+add_test(ANTS_CC_SAMPLED_WARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R16_IMAGE} ${SAMPLING_PREFIX}CCwarped.nii.gz ${SAMPLING_PREFIX}log.txt ${SAMPLING_PREFIX}metric.nii.gz 12.0 0.5)
+add_test(ANTS_CC_SAMPLED_WARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R16_IMAGE} ${SAMPLING_PREFIX}CCwarped.nii.gz ${SAMPLING_PREFIX}log.txt ${SAMPLING_PREFIX}metric.nii.gz -0.6 0.05)
+add_test(ANTS_CC_SAMPLED_VS_DENSE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${SAMPLING_PREFIX}CCdensewarped.nii.gz ${SAMPLING_PREFIX}CCwarped.nii.gz ${SAMPLING_PREFIX}log.txt ${SAMPLING_PREFIX}metric.nii.gz 0 3)
+set(CHECKPOINT_PREFIX ${CMAKE_BINARY_DIR}/CHECKPOINT)
+add_test(ANTS_CHECKPOINT_UNINTERRUPTED ${TEST_BINARY_DIR}/ANTS 2 -m  CC[${R16_IMAGE},${R64_IMAGE},1,2] -r Gauss[3,0] -t SyN[0.5] -i 50x50x30 -o ${CHECKPOINT_PREFIX}Whole.nii.gz)
+add_test(ANTS_CHECKPOINT_UNINTERRUPTED_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${CHECKPOINT_PREFIX}Wholewarped.nii.gz ${CHECKPOINT_PREFIX}WholeWarp.nii.gz ${CHECKPOINT_PREFIX}WholeAffine.txt -R ${R16_IMAGE} )
+add_test(ANTS_CHECKPOINT ${TEST_BINARY_DIR}/ANTS 2 -m  CC[${R16_IMAGE},${R64_IMAGE},1,2] -r Gauss[3,0] -t SyN[0.5] -i 50x50x10 -o ${CHECKPOINT_PREFIX}.nii.gz --checkpoint ${CHECKPOINT_PREFIX}.ckpt[5])
+add_test(ANTS_RESUME ${TEST_BINARY_DIR}/ANTS 2 -m  CC[${R16_IMAGE},${R64_IMAGE},1,2] -r Gauss[3,0] -t SyN[0.5] -i 50x50x30 -o ${CHECKPOINT_PREFIX}.nii.gz --resume ${CHECKPOINT_PREFIX}.ckpt)
+add_test(ANTS_RESUME_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${CHECKPOINT_PREFIX}warped.nii.gz ${CHECKPOINT_PREFIX}Warp.nii.gz ${CHECKPOINT_PREFIX}Affine.txt -R ${R16_IMAGE} )
+add_test(ANTS_RESUME_VS_UNINTERRUPTED ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CHECKPOINT_PREFIX}warped.nii.gz ${CHECKPOINT_PREFIX}Wholewarped.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.05)
+# antsRegistration resumes at stage granularity:  the interrupted run stops after the affine stage.
+add_test(ANTSREG_CHECKPOINT_UNINTERRUPTED ${TEST_BINARY_DIR}/antsRegistration -d 2 -m MI[${R16_IMAGE},${R64_IMAGE},1,32] -t Affine[0.1] -i 20x10 -s 1x0 -f 2x1 -m CC[${R16_IMAGE},${R64_IMAGE},1,2] -t SyN[0.25,3,0] -i 20x10 -s 1x0 -f 2x1 -o [${CHECKPOINT_PREFIX}RegWhole,${CHECKPOINT_PREFIX}RegWholewarped.nii.gz])
+add_test(ANTSREG_CHECKPOINT ${TEST_BINARY_DIR}/antsRegistration -d 2 -m MI[${R16_IMAGE},${R64_IMAGE},1,32] -t Affine[0.1] -i 20x10 -s 1x0 -f 2x1 -o ${CHECKPOINT_PREFIX}Reg --checkpoint ${CHECKPOINT_PREFIX}Reg.ckpt)
+add_test(ANTSREG_RESUME ${TEST_BINARY_DIR}/antsRegistration -d 2 -m MI[${R16_IMAGE},${R64_IMAGE},1,32] -t Affine[0.1] -i 20x10 -s 1x0 -f 2x1 -m CC[${R16_IMAGE},${R64_IMAGE},1,2] -t SyN[0.25,3,0] -i 20x10 -s 1x0 -f 2x1 -o [${CHECKPOINT_PREFIX}Reg,${CHECKPOINT_PREFIX}Regwarped.nii.gz] --resume ${CHECKPOINT_PREFIX}Reg.ckpt)
+add_test(ANTSREG_RESUME_VS_UNINTERRUPTED ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CHECKPOINT_PREFIX}Regwarped.nii.gz ${CHECKPOINT_PREFIX}RegWholewarped.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.05)
 ###
 #  ANTS transform testing
 ###
@@ -122,6 +157,15 @@ add_test(ANTS_EXP_INVERSEWARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R16
 add_test(ANTS_EXP_INVERSEWARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.349 0.05)
 add_test(ANTS_EXP_INVERSEWARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.5 0.05)
 add_test(ANTS_EXP_INVERSEWARP_METRIC_2 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 2 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.000339606 0.05)
+set(EXPSS_PREFIX ${CMAKE_BINARY_DIR}/EXPSS)
+add_test(ANTS_EXP_SS     ${TEST_BINARY_DIR}/ANTS 2 -m PR[${R16_IMAGE},${R64_IMAGE},1,4] -t Exp[0.5,2,0.5]       -i 50x50x50 -r Gauss[0.5,0.25] -o ${EXPSS_PREFIX}.nii.gz --exponential-integration ScalingAndSquaring[0,double])
+add_test(ANTS_EXP_SS_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${EXPSS_PREFIX}warped.nii.gz ${EXPSS_PREFIX}Warp.nii.gz ${EXPSS_PREFIX}Affine.txt  -R ${R16_IMAGE} )
+add_test(ANTS_EXP_SS_INVERSEWARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R16_IMAGE} ${EXPSS_PREFIX}inversewarped.nii.gz -i ${EXPSS_PREFIX}Affine.txt ${EXPSS_PREFIX}InverseWarp.nii.gz   -R ${R16_IMAGE} )
+add_test(ANTS_EXP_SS_VS_EULER_WARP ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${WARP_IMAGE} ${EXPSS_PREFIX}warped.nii.gz ${EXPSS_PREFIX}log.txt ${EXPSS_PREFIX}metric.nii.gz 0 2)
+add_test(ANTS_EXP_SS_VS_EULER_INVERSEWARP ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${INVERSEWARP_IMAGE} ${EXPSS_PREFIX}inversewarped.nii.gz ${EXPSS_PREFIX}log.txt ${EXPSS_PREFIX}metric.nii.gz 0 2)
+add_test(EXPONENTIATE_VELOCITY_FIELD ${TEST_BINARY_DIR}/ExponentiateVelocityFieldTest 2 ${R16_IMAGE} 3 256 0.1)
+add_test(VELOCITY_INTEGRATION_BATCHED_VS_POINT ${TEST_BINARY_DIR}/VelocityIntegrationTest 2 ${R16_IMAGE} 3 5 0.1 1.e-6)
+add_test(INVERT_FIELD_VS_OLD ${TEST_BINARY_DIR}/InvertFieldTest 2 ${R16_IMAGE} 2 0.05)
 #add_test(ANTS_GSYN    ${TEST_BINARY_DIR}/ANTS 2 -m PR[${R16_IMAGE},${R64_IMAGE},1,2] -t SyN[0.75]            -i 50x50x50 -r Gauss[3,0.0,32] -o ${OUTPUT_PREFIX}.nii.gz)
  add_test(ANTS_SYN     ${TEST_BINARY_DIR}/ANTS 2 -m PR[${R16_IMAGE},${R64_IMAGE},1,2] -t SyN[0.5,2,0.05] -i 50x50x50 -r Gauss[3,0.0,32] -o ${OUTPUT_PREFIX}.nii.gz)
 add_test(ANTS_SYN_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${WARP_IMAGE} ${WARP}  -R ${R16_IMAGE}  )
@@ -129,11 +173,36 @@ add_test(ANTS_SYN_JPG  ${TEST_BINARY_DIR}/ConvertToJpg ${WARP_IMAGE} ANTSSYN.jpg
 add_test(ANTS_SYN_WARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R16_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.0239 0.05)
 add_test(ANTS_SYN_WARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R16_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.6 0.05)
 add_test(ANTS_SYN_WARP_METRIC_2 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 2 ${R16_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.000461922 0.05)
+add_test(ANTS_SYN_WARP_STREAMED ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${CMAKE_BINARY_DIR}/warped_streamed.nii.gz ${WARP}  -R ${R16_IMAGE} --memory-budget 0.01 )
+add_test(ANTS_SYN_WARP_STREAMED_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R16_IMAGE} ${CMAKE_BINARY_DIR}/warped_streamed.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.0239 0.05)
+add_test(ANTS_SYN_WARP_STREAMED_VS_WHOLE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${WARP_IMAGE} ${CMAKE_BINARY_DIR}/warped_streamed.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+# an uncompressed warp is read slab by slab;  the second copy in the chain is
+# interpolated at the points the first one maps to
+add_test(ANTS_SYN_WARP_STREAMED_FIELD_CONVERT ${TEST_BINARY_DIR}/ComposeMultiTransform 2 ${CMAKE_BINARY_DIR}/streamedfield.nii -R ${R16_IMAGE} ${OUTPUT_PREFIX}Warp.nii.gz )
+add_test(ANTS_SYN_WARP_STREAMED_FIELD_WHOLE ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${CMAKE_BINARY_DIR}/warped_field_whole.nii ${CMAKE_BINARY_DIR}/streamedfield.nii ${CMAKE_BINARY_DIR}/streamedfield.nii ${OUTPUT_PREFIX}Affine.txt -R ${R16_IMAGE} )
+add_test(ANTS_SYN_WARP_STREAMED_FIELD ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${CMAKE_BINARY_DIR}/warped_field_streamed.nii ${CMAKE_BINARY_DIR}/streamedfield.nii ${CMAKE_BINARY_DIR}/streamedfield.nii ${OUTPUT_PREFIX}Affine.txt -R ${R16_IMAGE} --memory-budget 0.01 )
+add_test(ANTS_SYN_WARP_STREAMED_FIELD_VS_WHOLE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CMAKE_BINARY_DIR}/warped_field_whole.nii ${CMAKE_BINARY_DIR}/warped_field_streamed.nii ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+add_test(ANTS_SYN_WARP_COMPOSED ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${WARP_IMAGE} ${WARP}  -R ${R16_IMAGE} --extra-image ${R64_IMAGE} ${CMAKE_BINARY_DIR}/warped2.nii.gz --write-composed-warp ${OUTPUT_PREFIX}ComposedWarp.nii.gz )
+add_test(ANTS_SYN_WARP_COMPOSED_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R16_IMAGE} ${CMAKE_BINARY_DIR}/warped2.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.0239 0.05)
+add_test(ANTS_SYN_WARP_COMPOSED_REUSE ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}ComposedWarp.nii.gz  -R ${R16_IMAGE} )
+add_test(ANTS_SYN_WARP_COMPOSED_REUSE_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R16_IMAGE} ${WARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.0239 0.05)
+add_test(ANTS_SYN_WARP_EXTRA ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${CMAKE_BINARY_DIR}/extra_first.nii.gz ${WARP}  -R ${R16_IMAGE} --extra-image ${R16_IMAGE} ${CMAKE_BINARY_DIR}/extra_second.nii.gz )
+add_test(ANTS_SYN_WARP_EXTRA_SEPARATE ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R16_IMAGE} ${CMAKE_BINARY_DIR}/extra_separate.nii.gz ${WARP}  -R ${R16_IMAGE} )
+add_test(ANTS_SYN_WARP_EXTRA_VS_SEPARATE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CMAKE_BINARY_DIR}/extra_separate.nii.gz ${CMAKE_BINARY_DIR}/extra_second.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.05)
+add_test(ANTS_SYN_WARP_TIMESERIES_EXTRA ${TEST_BINARY_DIR}/WarpTimeSeriesImageMultiTransform 2 ${R64_IMAGE} ${CMAKE_BINARY_DIR}/ts_first.nii.gz -R ${R16_IMAGE} ${WARP} --extra-image ${R16_IMAGE} ${CMAKE_BINARY_DIR}/ts_second.nii.gz )
+add_test(ANTS_SYN_WARP_TIMESERIES_SEPARATE ${TEST_BINARY_DIR}/WarpTimeSeriesImageMultiTransform 2 ${R16_IMAGE} ${CMAKE_BINARY_DIR}/ts_separate.nii.gz -R ${R16_IMAGE} ${WARP} )
+add_test(ANTS_SYN_WARP_TIMESERIES_EXTRA_VS_SEPARATE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CMAKE_BINARY_DIR}/ts_separate.nii.gz ${CMAKE_BINARY_DIR}/ts_second.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.05)
 add_test(ANTS_SYN_INVERSEWARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R16_IMAGE} ${INVERSEWARP_IMAGE} ${INVERSEWARP}  -R ${R16_IMAGE}  )
 add_test(ANTS_SYN_JPGINV  ${TEST_BINARY_DIR}/ConvertToJpg ${INVERSEWARP_IMAGE} ANTSSYNINV.jpg)
 add_test(ANTS_SYN_INVERSEWARP_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 12.5104 0.05)
 add_test(ANTS_SYN_INVERSEWARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.6 0.05)
 add_test(ANTS_SYN_INVERSEWARP_METRIC_2 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 2 ${R64_IMAGE} ${INVERSEWARP_IMAGE} ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.000444279 0.05)
+set(MULTIMETRIC_PREFIX ${CMAKE_BINARY_DIR}/MULTIMETRIC)
+add_test(ANTS_MULTIMETRIC ${TEST_BINARY_DIR}/ANTS 2 -m CC[${R16_IMAGE},${R64_IMAGE},1,2] -m MI[${R16_IMAGE},${R64_IMAGE},1,32] -t SyN[0.5] -i 50x50x30 -r Gauss[3,0] -o ${MULTIMETRIC_PREFIX}.nii.gz)
+add_test(ANTS_MULTIMETRIC_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${MULTIMETRIC_PREFIX}warped.nii.gz ${MULTIMETRIC_PREFIX}Warp.nii.gz ${MULTIMETRIC_PREFIX}Affine.txt -R ${R16_IMAGE}  )
+add_test(ANTS_MULTIMETRIC_UNFUSED ${TEST_BINARY_DIR}/ANTS 2 -m CC[${R16_IMAGE},${R64_IMAGE},1,2] -m MI[${R16_IMAGE},${R64_IMAGE},1,32] -t SyN[0.5] -i 50x50x30 -r Gauss[3,0] -o ${MULTIMETRIC_PREFIX}Unfused.nii.gz --fused-update-field false)
+add_test(ANTS_MULTIMETRIC_UNFUSED_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${R64_IMAGE} ${MULTIMETRIC_PREFIX}Unfusedwarped.nii.gz ${MULTIMETRIC_PREFIX}UnfusedWarp.nii.gz ${MULTIMETRIC_PREFIX}UnfusedAffine.txt -R ${R16_IMAGE}  )
+add_test(ANTS_MULTIMETRIC_FUSED_VS_UNFUSED ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${MULTIMETRIC_PREFIX}warped.nii.gz ${MULTIMETRIC_PREFIX}Unfusedwarped.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.05)
 ###
 # PSE sub-tests:  Check to see if .txt files and .vtk files also run correctly
 ###
@@ -151,6 +220,95 @@ add_test(ANTS_PSE_MSQ_VTK ${TEST_BINARY_DIR}/ANTS 2 -i 91x70x55x40x30  -r Gauss[
                                  -m PSE[${DEVIL_IMAGE},${ANGEL_IMAGE},${DEVIL_IMAGE_VTK},${ANGEL_IMAGE_VTK},1,0.33,11,1,25]
                                  --continue-affine 0 --number-of-affine-iterations 0
                                  -o ${OUTPUT_PREFIX}.nii.gz)
+set(ANGEL_IMAGE_SUBSET_TXT ${DATA_DIR}/SmileSubset.txt)
+set(DEVIL_IMAGE_SUBSET_TXT ${DATA_DIR}/FrownSubset.txt)
+set(PSE_PREFIX ${CMAKE_BINARY_DIR}/PSE)
+add_test(ANTS_PSE_SPARSE ${TEST_BINARY_DIR}/ANTS 2 -i 20x10  -r Gauss[3,0] -t SyN[0.2]
+                                 -m MSQ[${DEVIL_IMAGE},${ANGEL_IMAGE},1,0]
+                                 -m PSE[${DEVIL_IMAGE},${ANGEL_IMAGE},${DEVIL_IMAGE_SUBSET_TXT},${ANGEL_IMAGE_SUBSET_TXT},1,1,11,0,1000,100000,1]
+                                 --continue-affine 0 --number-of-affine-iterations 0
+                                 -o ${PSE_PREFIX}Sparse.nii.gz)
+add_test(ANTS_PSE_SPARSE_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${ANGEL_IMAGE} ${PSE_PREFIX}Sparsewarped.nii.gz ${PSE_PREFIX}SparseWarp.nii.gz ${PSE_PREFIX}SparseAffine.txt -R ${DEVIL_IMAGE} )
+add_test(ANTS_PSE_DENSE ${TEST_BINARY_DIR}/ANTS 2 -i 20x10  -r Gauss[3,0] -t SyN[0.2]
+                                 -m MSQ[${DEVIL_IMAGE},${ANGEL_IMAGE},1,0]
+                                 -m PSE[${DEVIL_IMAGE},${ANGEL_IMAGE},${DEVIL_IMAGE_SUBSET_TXT},${ANGEL_IMAGE_SUBSET_TXT},1,1,11,0,1000,100000,2]
+                                 --continue-affine 0 --number-of-affine-iterations 0
+                                 -o ${PSE_PREFIX}Dense.nii.gz)
+add_test(ANTS_PSE_DENSE_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${ANGEL_IMAGE} ${PSE_PREFIX}Densewarped.nii.gz ${PSE_PREFIX}DenseWarp.nii.gz ${PSE_PREFIX}DenseAffine.txt -R ${DEVIL_IMAGE} )
+add_test(ANTS_PSE_SPARSE_VS_DENSE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${PSE_PREFIX}Sparsewarped.nii.gz ${PSE_PREFIX}Densewarped.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.001)
+# a distance threshold of five point set sigmas drops only negligible matches
+add_test(ANTS_PSE_SPARSE_THRESHOLD ${TEST_BINARY_DIR}/ANTS 2 -i 20x10  -r Gauss[3,0] -t SyN[0.2]
+                                 -m MSQ[${DEVIL_IMAGE},${ANGEL_IMAGE},1,0]
+                                 -m PSE[${DEVIL_IMAGE},${ANGEL_IMAGE},${DEVIL_IMAGE_SUBSET_TXT},${ANGEL_IMAGE_SUBSET_TXT},1,1,11,0,1000,100000,1,55]
+                                 --continue-affine 0 --number-of-affine-iterations 0
+                                 -o ${PSE_PREFIX}Threshold.nii.gz)
+add_test(ANTS_PSE_SPARSE_THRESHOLD_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${ANGEL_IMAGE} ${PSE_PREFIX}Thresholdwarped.nii.gz ${PSE_PREFIX}ThresholdWarp.nii.gz ${PSE_PREFIX}ThresholdAffine.txt -R ${DEVIL_IMAGE} )
+add_test(ANTS_PSE_SPARSE_THRESHOLD_VS_DENSE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${PSE_PREFIX}Thresholdwarped.nii.gz ${PSE_PREFIX}Densewarped.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.01)
+add_test(ANTS_JTB_KDTREE_TOLERANCE ${TEST_BINARY_DIR}/ANTS 2 -i 20x10  -r Gauss[3,0] -t SyN[0.2]
+                                 -m MSQ[${DEVIL_IMAGE},${ANGEL_IMAGE},1,0]
+                                 -m JTB[${DEVIL_IMAGE},${ANGEL_IMAGE},${DEVIL_IMAGE_SUBSET_TXT},${ANGEL_IMAGE_SUBSET_TXT},1,1,11,0,20,1.0,4x4,3,1,0,0.5]
+                                 --continue-affine 0 --number-of-affine-iterations 0
+                                 -o ${PSE_PREFIX}JTB.nii.gz)
+add_test(JTB_METRIC_THREADED_VS_SERIAL_AND_KDTREE_TOLERANCE ${TEST_BINARY_DIR}/JensenTsallisPointSetMetricTest 2 40 4 0.5 1.e-6)
+###
+#  ImageSetStatistics one slice per slab (slabmemoryMB 0) against a single slab
+###
+set(IMAGESET_PREFIX ${CMAKE_BINARY_DIR}/IMAGESET)
+file(WRITE ${IMAGESET_PREFIX}list.txt "${R16_IMAGE}\n${R64_IMAGE}\n${R16_IMAGE}\n")
+add_test(IMAGESET_MEDIAN_WHOLE ${TEST_BINARY_DIR}/ImageSetStatistics 2 ${IMAGESET_PREFIX}list.txt ${IMAGESET_PREFIX}MedianWhole.nii.gz 0 0 0 1024)
+add_test(IMAGESET_MEDIAN_SLABS ${TEST_BINARY_DIR}/ImageSetStatistics 2 ${IMAGESET_PREFIX}list.txt ${IMAGESET_PREFIX}MedianSlabs.nii 0 0 0 0)
+add_test(IMAGESET_MEDIAN_SLABS_VS_WHOLE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${IMAGESET_PREFIX}MedianWhole.nii.gz ${IMAGESET_PREFIX}MedianSlabs.nii ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+add_test(IMAGESET_VARIANCE_WHOLE ${TEST_BINARY_DIR}/ImageSetStatistics 2 ${IMAGESET_PREFIX}list.txt ${IMAGESET_PREFIX}VarianceWhole.nii.gz 9 0 0 1024)
+add_test(IMAGESET_VARIANCE_SLABS ${TEST_BINARY_DIR}/ImageSetStatistics 2 ${IMAGESET_PREFIX}list.txt ${IMAGESET_PREFIX}VarianceSlabs.nii 9 0 0 0)
+add_test(IMAGESET_VARIANCE_SLABS_VS_WHOLE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${IMAGESET_PREFIX}VarianceWhole.nii.gz ${IMAGESET_PREFIX}VarianceSlabs.nii ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+###
+#  Manifold Parzen density from the lookup grid against the kd-tree, for one and two components
+###
+add_test(MANIFOLD_PARZEN_LOOKUP_GRID_1 ${TEST_BINARY_DIR}/ManifoldParzenLookupGridTest 2 1.0 50 0.05 ${R16_IMAGE})
+add_test(MANIFOLD_PARZEN_LOOKUP_GRID_2 ${TEST_BINARY_DIR}/ManifoldParzenLookupGridTest 2 8.0 50 0.05 ${R16_IMAGE} ${R64_IMAGE})
+###
+#  Histogram Parzen density from the linear lookup tables against the B-spline interpolants, for one and two components
+###
+add_test(HISTOGRAM_PARZEN_LOOKUP_TABLE_1 ${TEST_BINARY_DIR}/HistogramParzenLookupTableTest 2 1.0 32 8 0.01 ${R16_IMAGE})
+add_test(HISTOGRAM_PARZEN_LOOKUP_TABLE_2 ${TEST_BINARY_DIR}/HistogramParzenLookupTableTest 2 1.0 32 8 0.01 ${R16_IMAGE} ${R64_IMAGE})
+add_test(HISTOGRAM_PARZEN_LOOKUP_TABLE_COARSE ${TEST_BINARY_DIR}/HistogramParzenLookupTableTest 2 1.0 32 2 0.05 ${R16_IMAGE} ${R64_IMAGE})
+###
+#  EvaluateBlock against Evaluate of the (log-Euclidean) Gaussian, for one and three components
+###
+add_test(LIST_SAMPLE_FUNCTION_BLOCK_1 ${TEST_BINARY_DIR}/ListSampleFunctionBlockTest 2 1000 1.e-5 ${R16_IMAGE})
+add_test(LIST_SAMPLE_FUNCTION_BLOCK_3 ${TEST_BINARY_DIR}/ListSampleFunctionBlockTest 2 1000 1.e-5 ${R16_IMAGE} ${R64_IMAGE} ${DATA_DIR}/r27slice.nii.gz)
+add_test(LIST_SAMPLE_FUNCTION_BLOCK_3_ODD ${TEST_BINARY_DIR}/ListSampleFunctionBlockTest 2 77 1.e-5 ${R16_IMAGE} ${R64_IMAGE} ${DATA_DIR}/r27slice.nii.gz)
+###
+#  LaplacianThickness of thresholded r16 wm and gm, red-black SOR against the previous smoothing solver
+###
+set(LAPLACIAN_PREFIX ${CMAKE_BINARY_DIR}/LAPLACIAN)
+add_test(LAPLACIAN_THICKNESS_WM ${TEST_BINARY_DIR}/ThresholdImage 2 ${R16_IMAGE} ${LAPLACIAN_PREFIX}wm.nii.gz 150 255)
+add_test(LAPLACIAN_THICKNESS_GM ${TEST_BINARY_DIR}/ThresholdImage 2 ${R16_IMAGE} ${LAPLACIAN_PREFIX}gm.nii.gz 90 255)
+add_test(LAPLACIAN_THICKNESS_SOR ${TEST_BINARY_DIR}/LaplacianThickness ${LAPLACIAN_PREFIX}wm.nii.gz ${LAPLACIAN_PREFIX}gm.nii.gz ${LAPLACIAN_PREFIX}SOR.nii.gz 1 5 0.01 0 0.001 0)
+add_test(LAPLACIAN_THICKNESS_SMOOTHING ${TEST_BINARY_DIR}/LaplacianThickness ${LAPLACIAN_PREFIX}wm.nii.gz ${LAPLACIAN_PREFIX}gm.nii.gz ${LAPLACIAN_PREFIX}Smoothing.nii.gz 1 5 0.01 0 0.001 1)
+add_test(LAPLACIAN_THICKNESS_SOR_VS_SMOOTHING_METRIC_0 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${LAPLACIAN_PREFIX}Smoothing.nii.gz ${LAPLACIAN_PREFIX}SOR.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.25)
+add_test(LAPLACIAN_THICKNESS_SOR_VS_SMOOTHING_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${LAPLACIAN_PREFIX}Smoothing.nii.gz ${LAPLACIAN_PREFIX}SOR.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.95 0.05)
+###
+#  LaplacianThickness with the smoothing solver against the serial code it replaced, on r16 and r64
+###
+add_test(LAPLACIAN_THICKNESS_REFERENCE ${TEST_BINARY_DIR}/LaplacianThicknessReference ${LAPLACIAN_PREFIX}wm.nii.gz ${LAPLACIAN_PREFIX}gm.nii.gz ${LAPLACIAN_PREFIX}Reference.nii.gz 1 5 0.01 0 0.001)
+add_test(LAPLACIAN_THICKNESS_VS_REFERENCE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${LAPLACIAN_PREFIX}Reference.nii.gz ${LAPLACIAN_PREFIX}Smoothing.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.01)
+add_test(LAPLACIAN_THICKNESS_R64_WM ${TEST_BINARY_DIR}/ThresholdImage 2 ${R64_IMAGE} ${LAPLACIAN_PREFIX}r64wm.nii.gz 150 255)
+add_test(LAPLACIAN_THICKNESS_R64_GM ${TEST_BINARY_DIR}/ThresholdImage 2 ${R64_IMAGE} ${LAPLACIAN_PREFIX}r64gm.nii.gz 90 255)
+add_test(LAPLACIAN_THICKNESS_R64_SMOOTHING ${TEST_BINARY_DIR}/LaplacianThickness ${LAPLACIAN_PREFIX}r64wm.nii.gz ${LAPLACIAN_PREFIX}r64gm.nii.gz ${LAPLACIAN_PREFIX}r64Smoothing.nii.gz 1 5 0.01 0 0.001 1)
+add_test(LAPLACIAN_THICKNESS_R64_REFERENCE ${TEST_BINARY_DIR}/LaplacianThicknessReference ${LAPLACIAN_PREFIX}r64wm.nii.gz ${LAPLACIAN_PREFIX}r64gm.nii.gz ${LAPLACIAN_PREFIX}r64Reference.nii.gz 1 5 0.01 0 0.001)
+add_test(LAPLACIAN_THICKNESS_R64_VS_REFERENCE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${LAPLACIAN_PREFIX}r64Reference.nii.gz ${LAPLACIAN_PREFIX}r64Smoothing.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.01)
+###
+#  StudentsTestOnImages permutation p-values with a fixed seed, on one thread and on the default threads
+###
+set(STUDENTS_PREFIX ${CMAKE_BINARY_DIR}/STUDENTS)
+set(STUDENTS_IMAGES ${DATA_DIR}/r16slice.nii.gz ${DATA_DIR}/r27slice.nii.gz ${DATA_DIR}/r30slice.nii.gz
+                    ${DATA_DIR}/r62slice.nii.gz ${DATA_DIR}/r64slice.nii.gz ${DATA_DIR}/r85slice.nii.gz)
+add_test(STUDENTS_PERMUTATION_SEED_1_THREAD ${TEST_BINARY_DIR}/StudentsTestOnImages 2 ${STUDENTS_PREFIX}Serial.nii.gz 3 3 ${STUDENTS_IMAGES} 50 7)
+set_tests_properties(STUDENTS_PERMUTATION_SEED_1_THREAD PROPERTIES ENVIRONMENT ITK_GLOBAL_DEFAULT_NUMBER_OF_THREADS=1)
+add_test(STUDENTS_PERMUTATION_SEED ${TEST_BINARY_DIR}/StudentsTestOnImages 2 ${STUDENTS_PREFIX}Threaded.nii.gz 3 3 ${STUDENTS_IMAGES} 50 7)
+add_test(STUDENTS_PERMUTATION_SEED_PVAL ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CMAKE_BINARY_DIR}/PVALSTUDENTSSerial.nii.gz ${CMAKE_BINARY_DIR}/PVALSTUDENTSThreaded.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+add_test(STUDENTS_PERMUTATION_SEED_FWEPVAL ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CMAKE_BINARY_DIR}/FWEPVALSTUDENTSSerial.nii.gz ${CMAKE_BINARY_DIR}/FWEPVALSTUDENTSThreaded.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
 ###
 #  ANTS labeled data testing
 ###
@@ -207,6 +365,18 @@ add_test(ANTS_ROT_EXP_INVERSEWARP2 ${TEST_BINARY_DIR}/WarpImageMultiTransform 3
 add_test(ANTS_ROT_EXP_INVERSEWARP2_METRIC_0_2 ${TEST_BINARY_DIR}/MeasureImageSimilarity 3 0 ${ROT_MOV_IMAGE} ${ROT_INVERSEWARP_IMAGE} ${ROT_OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz  34.8184 0.5)
 #add_test(ANTS_ROT_EXP_CLEAN rm ${ROT_WARP_FILES})
 ###
+#  Affine multi-start on a copy of r16 rotated by 90 degrees, where the single start gets stuck
+###
+set(AFFINE_MULTISTART_PREFIX ${CMAKE_BINARY_DIR}/AFFINEMULTISTART)
+add_test(ANTS_AFFINE_ROTATE_90 ${TEST_BINARY_DIR}/PermuteFlipImageOrientationAxes 2 ${R16_IMAGE} ${AFFINE_MULTISTART_PREFIX}r16rot90.nii.gz 1 0 1 0)
+add_test(ANTS_AFFINE_SINGLE_START ${TEST_BINARY_DIR}/ANTS 2 -m MI[${R16_IMAGE},${AFFINE_MULTISTART_PREFIX}r16rot90.nii.gz,1,32] -i 0 --number-of-affine-iterations 10000x10000x10000 -o ${AFFINE_MULTISTART_PREFIX}Single.nii.gz)
+add_test(ANTS_AFFINE_SINGLE_START_ROTATION ${TEST_BINARY_DIR}/AffineRotationAngleTest ${AFFINE_MULTISTART_PREFIX}SingleAffine.txt 90 10)
+set_tests_properties(ANTS_AFFINE_SINGLE_START_ROTATION PROPERTIES WILL_FAIL TRUE)
+add_test(ANTS_AFFINE_MULTI_START ${TEST_BINARY_DIR}/ANTS 2 -m MI[${R16_IMAGE},${AFFINE_MULTISTART_PREFIX}r16rot90.nii.gz,1,32] -i 0 --number-of-affine-iterations 10000x10000x10000 --affine-multi-start 4x180x2 -o ${AFFINE_MULTISTART_PREFIX}Multi.nii.gz)
+add_test(ANTS_AFFINE_MULTI_START_ROTATION ${TEST_BINARY_DIR}/AffineRotationAngleTest ${AFFINE_MULTISTART_PREFIX}MultiAffine.txt 90 10)
+add_test(ANTS_AFFINE_MULTI_START_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${AFFINE_MULTISTART_PREFIX}r16rot90.nii.gz ${AFFINE_MULTISTART_PREFIX}Multiwarped.nii.gz ${AFFINE_MULTISTART_PREFIX}MultiAffine.txt -R ${R16_IMAGE} )
+add_test(ANTS_AFFINE_MULTI_START_WARP_METRIC_1 ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 1 ${R16_IMAGE} ${AFFINE_MULTISTART_PREFIX}Multiwarped.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz -0.85 0.05)
+###
 #  Test SyN with time
 ###
 set(CHALF_IMAGE ${DATA_DIR}/chalf.nii.gz)
@@ -214,6 +384,10 @@ set(C_IMAGE ${DATA_DIR}/c.nii.gz)
 add_test(ANTS_SYN_WITH_TIME ${TEST_BINARY_DIR}/ANTS 2 -m MSQ[${CHALF_IMAGE},${C_IMAGE},1,0.] -t SyN[1,10,0.05] -i 150x100x2x2 -r Gauss[0.5,0.1] -o ${OUTPUT_PREFIX} --geodesic 1 --number-of-affine-iterations 0)
 add_test(ANTS_SYN_WITH_TIME_WARP ${TEST_BINARY_DIR}/WarpImageMultiTransform 2 ${C_IMAGE} ${OUTPUT_PREFIX}.nii.gz ${OUTPUT_PREFIX}Warp.nii.gz  -R  ${CHALF_IMAGE} )
 add_test(ANTS_SYN_WITH_TIME_METRIC ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${CHALF_IMAGE} ${OUTPUT_PREFIX}.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz  0.0943736 0.1)
+add_test(ANTS_BUILD_TEMPLATE ${TEST_BINARY_DIR}/antsBuildTemplate 2 ${OUTPUT_PREFIX}BT 2 2 0.25 CC[1,2] "-i 30x20x0 -t SyN[0.5] -r Gauss[3,0] --number-of-affine-iterations 100x100x50" ${R16_IMAGE} ${R64_IMAGE})
+add_test(ANTS_BUILD_TEMPLATE_1_THREAD ${TEST_BINARY_DIR}/antsBuildTemplate 2 ${OUTPUT_PREFIX}BT1 2 1 0.25 CC[1,2] "-i 30x20x0 -t SyN[0.5] -r Gauss[3,0] --number-of-affine-iterations 100x100x50" ${R16_IMAGE} ${R64_IMAGE})
+set_tests_properties(ANTS_BUILD_TEMPLATE_1_THREAD PROPERTIES ENVIRONMENT ITK_GLOBAL_DEFAULT_NUMBER_OF_THREADS=1)
+add_test(ANTS_BUILD_TEMPLATE_VS_1_THREAD ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${OUTPUT_PREFIX}BT1template.nii.gz ${OUTPUT_PREFIX}BTtemplate.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.005)
 ##
 # Apocrita tests
 ##
@@ -223,6 +397,31 @@ set(R16_PRIORS ${DATA_DIR}/r16priors.nii.gz)
 #add_test(APOC_OTSU_INIT_RADIUS_2x2 ${TEST_BINARY_DIR}/Apocrita 2 -i otsu[${R16_IMAGE},3] -x ${R16_MASK} -n 10 -m [0.3,2,0.2,0.1] -o ${OUTPUT_PREFIX}.nii.gz )
 #add_test(APOC_KMEANS_INIT ${TEST_BINARY_DIR}/Apocrita 2 -i kmeans[${R16_IMAGE},3] -x ${R16_MASK} -n 10 -m [0.3,1x1,0.2,0.1] -o [${OUTPUT_PREFIX}.nii.gz,${OUTPUT_PREFIX}_posteriors%d.nii.gz])
 #add_test(APOC_PRIORLABELIMAGE_INIT ${TEST_BINARY_DIR}/Apocrita 2 -i priorlabelimage[${R16_IMAGE},5,${R16_PRIORS},0.5] -x ${R16_MASK} -n 10 -m [0.3,1x1,0.2,0.1] -o [${OUTPUT_PREFIX}.nii.gz,${OUTPUT_PREFIX}_posteriors%d.nii.gz] -l 1[1,0.75] -l 2[1,1.0] -l 3[0.5,0.5] -l 4[1,1])
+add_test(ATROPOS_KMEANS_INIT ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[6] -c [5,0] -m [0.1,1x1] -o [${OUTPUT_PREFIX}ATROPOS.nii.gz,${OUTPUT_PREFIX}ATROPOS_prior%d.nii.gz])
+add_test(ATROPOS_PRIORS_DENSE ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i PriorProbabilityImages[6,${OUTPUT_PREFIX}ATROPOS_prior%d.nii.gz,0.5] -c [5,0] -m [0.1,1x1] -u 0 -o ${OUTPUT_PREFIX}ATROPOS_dense.nii.gz)
+add_test(ATROPOS_PRIORS_SPARSE ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i PriorProbabilityImages[6,${OUTPUT_PREFIX}ATROPOS_prior%d.nii.gz,0.5] -c [5,0] -m [0.1,1x1] -u 1 -o ${OUTPUT_PREFIX}ATROPOS_sparse.nii.gz)
+add_test(ATROPOS_PRIORS_SPARSE_VS_DENSE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${OUTPUT_PREFIX}ATROPOS_dense.nii.gz ${OUTPUT_PREFIX}ATROPOS_sparse.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+add_test(ATROPOS_SPARSE_PRIOR_BENCHMARK ${TEST_BINARY_DIR}/SparsePriorBenchmark 2 ${OUTPUT_PREFIX}ATROPOS_prior1.nii.gz 0 256)
+add_test(ATROPOS_HISTOGRAM_PARZEN ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k HistogramParzenWindows[1.0,32] -c [5,0] -m [0.1,1x1] -o ${OUTPUT_PREFIX}ATROPOS_hpw.nii.gz)
+add_test(ATROPOS_MANIFOLD_PARZEN ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k ManifoldParzenWindows[1.0,50] -c [5,0] -m [0.1,1x1] -o ${OUTPUT_PREFIX}ATROPOS_mpw.nii.gz)
+add_test(ATROPOS_MANIFOLD_PARZEN_SEEDED ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k ManifoldParzenWindows[1.0,50] -c [5,0] -m [0.1,1x1] -r 1 -o ${OUTPUT_PREFIX}ATROPOS_mpw_seeded.nii.gz)
+add_test(ATROPOS_MANIFOLD_PARZEN_SEEDED_1_THREAD ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k ManifoldParzenWindows[1.0,50] -c [5,0] -m [0.1,1x1] -r 1 -o ${OUTPUT_PREFIX}ATROPOS_mpw_seeded1.nii.gz)
+set_tests_properties(ATROPOS_MANIFOLD_PARZEN_SEEDED_1_THREAD PROPERTIES ENVIRONMENT ITK_GLOBAL_DEFAULT_NUMBER_OF_THREADS=1)
+add_test(ATROPOS_MANIFOLD_PARZEN_VS_1_THREAD ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${OUTPUT_PREFIX}ATROPOS_mpw_seeded1.nii.gz ${OUTPUT_PREFIX}ATROPOS_mpw_seeded.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+add_test(ATROPOS_MANIFOLD_PARZEN_LOOKUP_GRID ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k ManifoldParzenWindows[1.0,50,0,1.0,1] -c [5,0] -m [0.1,1x1] -r 1 -o ${OUTPUT_PREFIX}ATROPOS_mpw_grid.nii.gz)
+add_test(ATROPOS_MANIFOLD_PARZEN_LOOKUP_GRID_VS_EXACT ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${OUTPUT_PREFIX}ATROPOS_mpw_seeded.nii.gz ${OUTPUT_PREFIX}ATROPOS_mpw_grid.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.02)
+add_test(ATROPOS_HISTOGRAM_PARZEN_SEEDED ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k HistogramParzenWindows[1.0,32] -c [5,0] -m [0.1,1x1] -r 1 -o ${OUTPUT_PREFIX}ATROPOS_hpw_seeded.nii.gz)
+add_test(ATROPOS_HISTOGRAM_PARZEN_LOOKUP_TABLE ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k HistogramParzenWindows[1.0,32,1] -c [5,0] -m [0.1,1x1] -r 1 -o ${OUTPUT_PREFIX}ATROPOS_hpw_table.nii.gz)
+add_test(ATROPOS_HISTOGRAM_PARZEN_LOOKUP_TABLE_VS_BSPLINE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${OUTPUT_PREFIX}ATROPOS_hpw_seeded.nii.gz ${OUTPUT_PREFIX}ATROPOS_hpw_table.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 0.02)
+add_test(ATROPOS_GAUSSIAN_SEEDED ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k Gaussian -c [5,0] -m [0.1,1x1] -r 1 -o ${OUTPUT_PREFIX}ATROPOS_gaussian_seeded.nii.gz)
+add_test(ATROPOS_GAUSSIAN_SEEDED_1_THREAD ${TEST_BINARY_DIR}/Atropos -d 2 -a ${R16_IMAGE} -x ${R16_MASK} -i kmeans[3] -k Gaussian -c [5,0] -m [0.1,1x1] -r 1 -o ${OUTPUT_PREFIX}ATROPOS_gaussian_seeded1.nii.gz)
+set_tests_properties(ATROPOS_GAUSSIAN_SEEDED_1_THREAD PROPERTIES ENVIRONMENT ITK_GLOBAL_DEFAULT_NUMBER_OF_THREADS=1)
+add_test(ATROPOS_GAUSSIAN_VS_1_THREAD ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${OUTPUT_PREFIX}ATROPOS_gaussian_seeded1.nii.gz ${OUTPUT_PREFIX}ATROPOS_gaussian_seeded.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+add_test(IMAGEMATH_FMM_SEGMENTATION ${TEST_BINARY_DIR}/ImageMath 2 ${OUTPUT_PREFIX}FMMSEG.nii.gz FastMarchingSegmentation ${R16_MASK} ${OUTPUT_PREFIX}ATROPOS.nii.gz 100 0)
+add_test(IMAGEMATH_FMM_SEGMENTATION_BUCKETS ${TEST_BINARY_DIR}/ImageMath 2 ${OUTPUT_PREFIX}FMMSEG_buckets.nii.gz FastMarchingSegmentation ${R16_MASK} ${OUTPUT_PREFIX}ATROPOS.nii.gz 100 0 0.1)
+add_test(IMAGEMATH_FMM_SEGMENTATION_PRIORITY_QUEUE ${TEST_BINARY_DIR}/ImageMath 2 ${OUTPUT_PREFIX}FMMSEG_pq.nii.gz FastMarchingSegmentation ${R16_MASK} ${OUTPUT_PREFIX}ATROPOS.nii.gz 100 0 -1)
+add_test(IMAGEMATH_FMM_SEGMENTATION_VS_PRIORITY_QUEUE ${TEST_BINARY_DIR}/MeasureImageSimilarity 2 0 ${OUTPUT_PREFIX}FMMSEG_pq.nii.gz ${OUTPUT_PREFIX}FMMSEG.nii.gz ${OUTPUT_PREFIX}log.txt ${OUTPUT_PREFIX}metric.nii.gz 0 1.e-6)
+add_test(FAST_MARCHING_QUEUES_VS_PRIORITY_QUEUE ${TEST_BINARY_DIR}/FastMarchingQueueTest 2 ${R16_MASK} ${OUTPUT_PREFIX}ATROPOS.nii.gz 100 0.1 1.e-5 0.5)
 endif(RUN_LONG_TESTS)
 
 
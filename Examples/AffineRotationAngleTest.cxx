@@ -0,0 +1,73 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: AffineRotationAngleTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include <iostream>
+#include <cmath>
+#include "itkMatrixOffsetTransformBase.h"
+#include "itkTransformFactory.h"
+#include "itkTransformFileReader.h"
+#include "vnl/vnl_math.h"
+
+/** Reads a 2D affine transform and compares the angle of its rotational
+ * part,  atan2( m10 - m01, m00 + m11 ),  with an expected angle. */
+int main(int argc, char *argv[])
+{
+  if ( argc < 4 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " Affine.txt ExpectedAngleInDegrees ToleranceInDegrees " << std::endl;
+    std::cout << "  Fails if the rotation of the 2D affine transform in Affine.txt differs from" << std::endl;
+    std::cout << "  the expected angle by more than the tolerance, modulo 360 degrees. " << std::endl;
+    return 1;
+    }
+
+  typedef itk::MatrixOffsetTransformBase<double, 2, 2> AffineTransformType;
+  itk::TransformFactory<AffineTransformType>::RegisterTransform();
+
+  typedef itk::TransformFileReader TranReaderType;
+  TranReaderType::Pointer tran_reader = TranReaderType::New();
+  tran_reader->SetFileName( argv[1] );
+  try
+    {
+    tran_reader->Update();
+    }
+  catch( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+  AffineTransformType::Pointer aff =
+    dynamic_cast<AffineTransformType*>( ( tran_reader->GetTransformList() )->front().GetPointer() );
+  if ( !aff )
+    {
+    std::cerr << argv[1] << " does not hold a 2D affine transform " << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const AffineTransformType::MatrixType & m = aff->GetMatrix();
+  const double angle = atan2( m[1][0] - m[0][1], m[0][0] + m[1][1] ) * 180.0 / vnl_math::pi;
+  const double expected = atof( argv[2] );
+  const double tolerance = atof( argv[3] );
+  double difference = fmod( fabs( angle - expected ), 360.0 );
+  if ( difference > 180.0 ) difference = 360.0 - difference;
+
+  std::cout << " rotation " << angle << " degrees  expected " << expected << "  difference " << difference << std::endl;
+  if ( difference > tolerance )
+    {
+    std::cerr << " The affine rotation is not the expected one " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -697,6 +697,17 @@ int AtroposSegmentation( itk::ants::CommandLineParser *parser )
       }
     }
 
+  /**
+   * random seed
+   */
+  typename itk::ants::CommandLineParser::OptionType::Pointer seedOption =
+    parser->GetOption( "random-seed" );
+  if( seedOption && seedOption->GetNumberOfValues() > 0 )
+    {
+    segmenter->SetRandomSeed( parser->Convert<unsigned int>(
+      seedOption->GetValue() ) );
+    }
+
   /**
    * euclidean distance
    */
@@ -760,6 +771,12 @@ int AtroposSegmentation( itk::ants::CommandLineParser *parser )
         covSigma = parser->Convert<float>(
           likelihoodOption->GetParameter( 3 ) );
         }
+      bool useLookupGrid = false;
+      if( likelihoodOption->GetNumberOfParameters() > 4 )
+        {
+        useLookupGrid = parser->Convert<bool>(
+          likelihoodOption->GetParameter( 4 ) );
+        }
 
       for( unsigned int n = 0; n < segmenter->GetNumberOfTissueClasses(); n++ )
         {
@@ -769,6 +786,7 @@ int AtroposSegmentation( itk::ants::CommandLineParser *parser )
         mpwLikelihood->SetEvaluationKNeighborhood( evalNeighborhood );
         mpwLikelihood->SetCovarianceKNeighborhood( covNeighborhood );
         mpwLikelihood->SetKernelSigma( covSigma );
+        mpwLikelihood->SetUseLookupGrid( useLookupGrid );
         segmenter->SetLikelihoodFunction( n, mpwLikelihood );
         }
       }
@@ -790,6 +808,12 @@ int AtroposSegmentation( itk::ants::CommandLineParser *parser )
         numberOfBins = parser->Convert<unsigned int>(
           likelihoodOption->GetParameter( 1 ) );
         }
+      bool useLookupTable = false;
+      if( likelihoodOption->GetNumberOfParameters() > 2 )
+        {
+        useLookupTable = parser->Convert<bool>(
+          likelihoodOption->GetParameter( 2 ) );
+        }
 
       for( unsigned int n = 0; n < segmenter->GetNumberOfTissueClasses(); n++ )
         {
@@ -797,6 +821,7 @@ int AtroposSegmentation( itk::ants::CommandLineParser *parser )
           LikelihoodType::New();
         hpwLikelihood->SetSigma( sigma );
         hpwLikelihood->SetNumberOfHistogramBins( numberOfBins );
+        hpwLikelihood->SetUseLookupTable( useLookupTable );
         segmenter->SetLikelihoodFunction( n, hpwLikelihood );
         }
       }
@@ -1380,14 +1405,18 @@ void InitializeCommandLineOptions( itk::ants::CommandLineParser *parser )
     std::string( "iteration.  Other groups use non-parametric approaches " ) +
     std::string( "exemplified by option 2.  We recommend using options 1 " ) +
     std::string( "or 2 as they are fairly standard and the " ) +
-    std::string( "default parameters work adequately." );
+    std::string( "default parameters work adequately.  For the Parzen " ) +
+    std::string( "windows the densities can be tabulated once per " ) +
+    std::string( "iteration (useLookupTable, useLookupGrid), which " ) +
+    std::string( "speeds up the evaluation but changes the likelihoods " ) +
+    std::string( "slightly;  by default they are evaluated exactly." );
 
   OptionType::Pointer option = OptionType::New();
   option->SetLongName( "likelihood-model" );
   option->SetShortName( 'k' );
   option->SetUsageOption( 0, "Gaussian" );
-  option->SetUsageOption( 1, "HistogramParzenWindows[<sigma=1.0>,<numberOfBins=32>]" );
-  option->SetUsageOption( 2, "ManifoldParzenWindows[<pointSetSigma=1.0>,<evaluationKNeighborhood=50>,<CovarianceKNeighborhood=0>,<kernelSigma=0>]" );
+  option->SetUsageOption( 1, "HistogramParzenWindows[<sigma=1.0>,<numberOfBins=32>,<useLookupTable=0>]" );
+  option->SetUsageOption( 2, "ManifoldParzenWindows[<pointSetSigma=1.0>,<evaluationKNeighborhood=50>,<CovarianceKNeighborhood=0>,<kernelSigma=0>,<useLookupGrid=0>]" );
   option->SetUsageOption( 3, "JointShapeAndOrientationProbability[<sigma=1.0>,<numberOfBins=32>]" );
   option->SetUsageOption( 4, "LogEuclideanGaussian" );
   option->SetDescription( description );
@@ -1526,6 +1555,22 @@ void InitializeCommandLineOptions( itk::ants::CommandLineParser *parser )
   parser->AddOption( option );
   }
 
+  {
+  std::string description =
+    std::string( "The random number generator used for the random " ) +
+    std::string( "initialization and for the order in which the ICM " ) +
+    std::string( "codes are visited is seeded from the clock by default. " ) +
+    std::string( "Specifying a seed makes repeated runs, also on different " ) +
+    std::string( "numbers of threads, give the same segmentation." );
+
+  OptionType::Pointer option = OptionType::New();
+  option->SetLongName( "random-seed" );
+  option->SetShortName( 'r' );
+  option->SetUsageOption( 0, "seed" );
+  option->SetDescription( description );
+  parser->AddOption( option );
+  }
+
   {
   std::string description = std::string( "Print the help menu (short version)." );
 
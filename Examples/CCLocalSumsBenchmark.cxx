@@ -0,0 +1,172 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: CCLocalSumsBenchmark.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkTimeProbe.h"
+#include "itkCrossCorrelationRegistrationFunction.h"
+
+/** CC metric over windows clipped to the image, summed voxel by voxel. */
+template <unsigned int ImageDimension>
+double BruteForceCrossCorrelation( itk::Image<float,ImageDimension> *fixed,
+  itk::Image<float,ImageDimension> *moving, unsigned int radius )
+{
+  typedef itk::Image<float,ImageDimension> ImageType;
+  typedef itk::ImageRegionConstIteratorWithIndex<ImageType> Iterator;
+  typedef typename ImageType::RegionType RegionType;
+
+  const RegionType whole = fixed->GetLargestPossibleRegion();
+  double totalcc = 0;
+  unsigned long ct = 0;
+  Iterator it( fixed, whole );
+  for( it.GoToBegin(); !it.IsAtEnd(); ++it )
+    {
+    typename ImageType::IndexType start = it.GetIndex();
+    typename ImageType::SizeType size;
+    for( unsigned int d = 0; d < ImageDimension; d++ )
+      {
+      start[d] -= radius;
+      size[d] = 2*radius + 1;
+      }
+    RegionType window( start, size );
+    window.Crop( whole );
+
+    double count = 0, suma = 0, sumb = 0, sumab = 0, suma2 = 0, sumb2 = 0;
+    Iterator wit( fixed, window );
+    for( wit.GoToBegin(); !wit.IsAtEnd(); ++wit )
+      {
+      const double a = wit.Get();
+      const double b = moving->GetPixel( wit.GetIndex() );
+      suma += a;
+      sumb += b;
+      sumab += a*b;
+      suma2 += a*a;
+      sumb2 += b*b;
+      count += 1;
+      }
+    const double fixedMean = suma / count;
+    const double movingMean = sumb / count;
+    const double sff = suma2 - 2*fixedMean*suma + count*fixedMean*fixedMean;
+    const double smm = sumb2 - 2*movingMean*sumb + count*movingMean*movingMean;
+    const double sfm = sumab - movingMean*suma - fixedMean*sumb + count*movingMean*fixedMean;
+    if ( fabs( sff*smm ) > 0 )
+      {
+      totalcc += sfm*sfm/(sff*smm);
+      ct++;
+      }
+    }
+  return totalcc/(float)ct*(-1.0);
+}
+
+
+/** Times the local sums of the CC metric (InitializeIteration) for a range
+ * of radii and checks the metric against the brute-force window sum. */
+template <unsigned int ImageDimension>
+int CCLocalSumsBenchmark(unsigned int argc, char *argv[])
+{
+  typedef float  PixelType;
+  typedef itk::Vector<float,ImageDimension>         VectorType;
+  typedef itk::Image<VectorType,ImageDimension>     FieldType;
+  typedef itk::Image<PixelType,ImageDimension>      ImageType;
+  typedef itk::CrossCorrelationRegistrationFunction<ImageType,ImageType,FieldType> CCMetricType;
+
+  unsigned int argct=2;
+  std::string fn1 = std::string(argv[argct]); argct++;
+  std::string fn2 = std::string(argv[argct]); argct++;
+  unsigned int maxradius = 8;
+  if (argc > argct) { maxradius=atoi(argv[argct]); } argct++;
+  unsigned int repeats = 5;
+  if (argc > argct) { repeats=atoi(argv[argct]); } argct++;
+  unsigned int maxcheckradius = 4;
+  if (argc > argct) { maxcheckradius=atoi(argv[argct]); } argct++;
+
+  typename ImageType::Pointer image1 = NULL;
+  ReadImage<ImageType>(image1, fn1.c_str());
+  typename ImageType::Pointer image2 = NULL;
+  ReadImage<ImageType>(image2, fn2.c_str());
+
+  typename CCMetricType::Pointer ccmet=CCMetricType::New();
+  ccmet->SetFixedImage(image1);
+  ccmet->SetMovingImage(image2);
+  ccmet->SetGradientStep(1.e2);
+  ccmet->SetNormalizeGradient(false);
+
+  std::cout << " radius  seconds-per-iteration  CC  brute-force-CC " << std::endl;
+  bool passed = true;
+  for (unsigned int radius=1; radius <= maxradius; radius*=2)
+    {
+    typename CCMetricType::RadiusType ccradius;
+    ccradius.Fill(radius);
+    ccmet->SetRadius(ccradius);
+
+    // the first call allocates the sum images, so it is not timed
+    ccmet->InitializeIteration();
+    itk::TimeProbe timer;
+    for (unsigned int i=0; i < repeats; i++)
+      {
+      timer.Start();
+      ccmet->InitializeIteration();
+      timer.Stop();
+      }
+    double metricvalue=ccmet->ComputeCrossCorrelation();
+
+    std::cout << " " << radius << "  " << timer.GetMeanTime() << "  " << metricvalue;
+    if ( radius <= maxcheckradius )
+      {
+      double reference=BruteForceCrossCorrelation<ImageDimension>(image1,image2,radius);
+      std::cout << "  " << reference;
+      if ( fabs(metricvalue-reference) > 1.e-3*fabs(reference) + 1.e-6 )
+        {
+        std::cout << "  MISMATCH";
+        passed = false;
+        }
+      }
+    std::cout << std::endl;
+    }
+
+  if ( !passed )
+    {
+    std::cerr << " The local sums differ from the brute-force window sums " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 4 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension image1.ext image2.ext MaxRadius Repeats MaxCheckedRadius " << std::endl;
+    std::cout << "  Times the CC metric local sums for radii 1, 2, 4 .. MaxRadius (default 8)," << std::endl;
+    std::cout << "  averaged over Repeats (default 5) iterations, and checks the metric against" << std::endl;
+    std::cout << "  a brute-force window sum up to MaxCheckedRadius (default 4). " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return CCLocalSumsBenchmark<2>(argc,argv);
+    case 3:
+      return CCLocalSumsBenchmark<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -0,0 +1,173 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: ExponentiateVelocityFieldTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkVectorLinearInterpolateImageFunction.h"
+#include "itkScalingAndSquaringDisplacementFieldImageFilter.h"
+
+/** One forward Euler step,  phi( x ) <- phi( x ) + h v( x + phi( x ) ),  as
+ * in ANTSImageRegistrationOptimizer::ComposeDiffs. */
+template <class TField>
+void EulerStep( TField *diffmap, TField *velocity, double timestep )
+{
+  typedef itk::VectorLinearInterpolateImageFunction<TField,double> InterpolatorType;
+  typename InterpolatorType::Pointer vinterp = InterpolatorType::New();
+  vinterp->SetInputImage( velocity );
+
+  itk::ImageRegionIteratorWithIndex<TField> It( diffmap, diffmap->GetLargestPossibleRegion() );
+  for ( It.GoToBegin(); !It.IsAtEnd(); ++It )
+    {
+    typename TField::PointType point;
+    diffmap->TransformIndexToPhysicalPoint( It.GetIndex(), point );
+    typename TField::PixelType disp = It.Get();
+    for (unsigned int d=0; d < TField::ImageDimension; d++) point[d] += disp[d];
+    if ( vinterp->IsInsideBuffer( point ) )
+      {
+      typename InterpolatorType::OutputType v = vinterp->Evaluate( point );
+      for (unsigned int d=0; d < TField::ImageDimension; d++) disp[d] += v[d] * timestep;
+      }
+    It.Set( disp );
+    }
+}
+
+template <class TField>
+double MaximumDifference( TField *a, TField *b )
+{
+  double maxdiff = 0;
+  itk::ImageRegionConstIterator<TField> Ia( a, a->GetLargestPossibleRegion() );
+  itk::ImageRegionConstIterator<TField> Ib( b, a->GetLargestPossibleRegion() );
+  for ( Ia.GoToBegin(), Ib.GoToBegin(); !Ia.IsAtEnd(); ++Ia, ++Ib )
+    {
+    maxdiff = vnl_math_max( maxdiff, (double)( Ia.Get() - Ib.Get() ).GetNorm() );
+    }
+  return maxdiff;
+}
+
+/** Builds a smooth velocity field on the lattice of a reference image,
+ * exponentiates it by scaling and squaring and by small forward Euler steps,
+ * and compares the forward and inverse results. */
+template <unsigned int ImageDimension>
+int ExponentiateVelocityFieldTest(unsigned int argc, char *argv[])
+{
+  typedef float                                       PixelType;
+  typedef itk::Image<PixelType,ImageDimension>        ImageType;
+  typedef itk::Vector<float,ImageDimension>           VectorType;
+  typedef itk::Image<VectorType,ImageDimension>       FieldType;
+
+  unsigned int argct=2;
+  typename ImageType::Pointer reference = NULL;
+  ReadImage<ImageType>(reference, argv[argct]); argct++;
+  double amplitude = atof(argv[argct]); argct++;
+  unsigned int eulersteps = atoi(argv[argct]); argct++;
+  double tolerance = atof(argv[argct]); argct++;
+
+  typename FieldType::Pointer velocity = FieldType::New();
+  velocity->CopyInformation( reference );
+  velocity->SetRegions( reference->GetLargestPossibleRegion() );
+  velocity->Allocate();
+
+  /** One period of a sine per axis, in voxels, vanishing at the border. */
+  typename FieldType::SizeType size = reference->GetLargestPossibleRegion().GetSize();
+  typename FieldType::SpacingType spacing = reference->GetSpacing();
+  itk::ImageRegionIteratorWithIndex<FieldType> Iv( velocity, velocity->GetLargestPossibleRegion() );
+  for ( Iv.GoToBegin(); !Iv.IsAtEnd(); ++Iv )
+    {
+    typename FieldType::IndexType index = Iv.GetIndex();
+    VectorType v;
+    for (unsigned int d=0; d < ImageDimension; d++)
+      {
+      const unsigned int e = ( d + 1 ) % ImageDimension;
+      const double u = (double)( index[d] - reference->GetLargestPossibleRegion().GetIndex()[d] ) / (double)( size[d] - 1 );
+      const double w = (double)( index[e] - reference->GetLargestPossibleRegion().GetIndex()[e] ) / (double)( size[e] - 1 );
+      v[d] = amplitude * spacing[d] * sin( vnl_math::pi * u ) * sin( 2.0 * vnl_math::pi * w );
+      }
+    Iv.Set( v );
+    }
+
+  typedef itk::ScalingAndSquaringDisplacementFieldImageFilter<FieldType, FieldType, double> ExponentiatorType;
+  typename ExponentiatorType::Pointer exponentiator = ExponentiatorType::New();
+  exponentiator->SetVelocityField( velocity );
+  exponentiator->SetScale( 1.0 );
+  exponentiator->ComputeInverseOn();
+  exponentiator->Update();
+
+  VectorType zero;  zero.Fill( 0 );
+  typename FieldType::Pointer euler = FieldType::New();
+  euler->CopyInformation( velocity );
+  euler->SetRegions( velocity->GetLargestPossibleRegion() );
+  euler->Allocate();
+  euler->FillBuffer( zero );
+  typename FieldType::Pointer inverseeuler = FieldType::New();
+  inverseeuler->CopyInformation( velocity );
+  inverseeuler->SetRegions( velocity->GetLargestPossibleRegion() );
+  inverseeuler->Allocate();
+  inverseeuler->FillBuffer( zero );
+  for (unsigned int n=0; n < eulersteps; n++)
+    {
+    EulerStep<FieldType>( euler, velocity, 1.0 / (double)eulersteps );
+    EulerStep<FieldType>( inverseeuler, velocity, -1.0 / (double)eulersteps );
+    }
+
+  double minspacing = spacing[0];
+  for (unsigned int d=1; d < ImageDimension; d++) minspacing = vnl_math_min( minspacing, (double)spacing[d] );
+  const double forward = MaximumDifference<FieldType>( exponentiator->GetOutput(), euler ) / minspacing;
+  const double inverse = MaximumDifference<FieldType>( exponentiator->GetInverseOutput(), inverseeuler ) / minspacing;
+  std::cout << " squaring steps " << exponentiator->GetNumberOfSquaringStepsUsed()
+            << "  max forward difference " << forward
+            << "  max inverse difference " << inverse << " voxels " << std::endl;
+  if ( forward > tolerance || inverse > tolerance )
+    {
+    std::cerr << " Scaling and squaring differs from the Euler integration " << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  /** Without ComputeInverse the second output is left empty. */
+  exponentiator->ComputeInverseOff();
+  exponentiator->Update();
+  if ( exponentiator->GetInverseOutput()->GetBufferPointer() != NULL )
+    {
+    std::cerr << " The inverse output was allocated without ComputeInverse " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 6 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension reference.ext AmplitudeInVoxels NumberOfEulerSteps Tolerance " << std::endl;
+    std::cout << "  Exponentiates a smooth velocity field on the lattice of reference.ext by scaling and" << std::endl;
+    std::cout << "  squaring and by forward Euler steps.  Fails if the forward or inverse displacements" << std::endl;
+    std::cout << "  differ by more than Tolerance voxels anywhere. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return ExponentiateVelocityFieldTest<2>(argc,argv);
+    case 3:
+      return ExponentiateVelocityFieldTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: FastMarchingQueueTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "../Temporary/itkFastMarchingImageFilter.h"
+#include "itkLabelContourImageFilter.h"
+
+/** Arrival times from the labels, as ImageMath FastMarchingSegmentation
+ * computes them:  the label contour is trial, the rest of the labels alive. */
+template <class TFilter, class TImage>
+typename TImage::Pointer FastMarchingArrivalTimes( TImage *speed, typename TFilter::LabelImageType *labels,
+  float stoppingValue, typename TFilter::TrialQueueType queue, double bucketWidth )
+{
+  typedef typename TFilter::NodeContainer  NodeContainer;
+  typedef typename TFilter::NodeType       NodeType;
+  typedef typename TFilter::LabelImageType LabelImageType;
+
+  typedef itk::LabelContourImageFilter<LabelImageType, LabelImageType> ContourFilterType;
+  typename ContourFilterType::Pointer contour = ContourFilterType::New();
+  contour->SetInput( labels );
+  contour->FullyConnectedOff();
+  contour->SetBackgroundValue( itk::NumericTraits<typename LabelImageType::PixelType>::Zero );
+  contour->Update();
+
+  typename NodeContainer::Pointer alivePoints = NodeContainer::New();
+  alivePoints->Initialize();
+  typename NodeContainer::Pointer trialPoints = NodeContainer::New();
+  trialPoints->Initialize();
+  unsigned long aliveCount = 0, trialCount = 0;
+  itk::ImageRegionIteratorWithIndex<LabelImageType> ItL( labels, labels->GetLargestPossibleRegion() );
+  itk::ImageRegionIteratorWithIndex<LabelImageType> ItC( contour->GetOutput(), labels->GetLargestPossibleRegion() );
+  for ( ItL.GoToBegin(), ItC.GoToBegin(); !ItL.IsAtEnd(); ++ItL, ++ItC )
+    {
+    NodeType node;
+    node.SetValue( 0.0 );
+    node.SetIndex( ItL.GetIndex() );
+    if ( ItC.Get() != itk::NumericTraits<typename LabelImageType::PixelType>::Zero )
+      {
+      trialPoints->InsertElement( trialCount++, node );
+      }
+    else if ( ItL.Get() != itk::NumericTraits<typename LabelImageType::PixelType>::Zero )
+      {
+      alivePoints->InsertElement( aliveCount++, node );
+      }
+    }
+
+  typename TFilter::Pointer filter = TFilter::New();
+  filter->SetInput( speed );
+  filter->SetTrialPoints( trialPoints );
+  filter->SetAlivePoints( alivePoints );
+  filter->SetStoppingValue( stoppingValue );
+  filter->SetTopologyCheck( TFilter::None );
+  filter->SetTrialQueue( queue );
+  filter->SetBucketWidth( bucketWidth );
+  filter->Update();
+  return filter->GetOutput();
+}
+
+/** The largest and the mean difference of two arrival time images, both
+ * clamped at the stopping value so that voxels the front did not reach
+ * compare equal. */
+template <class TImage>
+void ArrivalTimeDifference( TImage *a, TImage *b, float stoppingValue, double & maxdifference, double & meandifference )
+{
+  maxdifference = 0;
+  meandifference = 0;
+  unsigned long count = 0;
+  itk::ImageRegionConstIterator<TImage> ItA( a, a->GetLargestPossibleRegion() );
+  itk::ImageRegionConstIterator<TImage> ItB( b, b->GetLargestPossibleRegion() );
+  for ( ItA.GoToBegin(), ItB.GoToBegin(); !ItA.IsAtEnd(); ++ItA, ++ItB, count++ )
+    {
+    const double difference = fabs( vnl_math_min( ItA.Get(), stoppingValue ) - vnl_math_min( ItB.Get(), stoppingValue ) );
+    maxdifference = vnl_math_max( maxdifference, difference );
+    meandifference += difference;
+    }
+  if ( count > 0 ) meandifference /= (double)count;
+}
+
+/** Propagates the labels of a label image through a speed image with the
+ * indexed heap, the bucket queue and the std::priority_queue of earlier
+ * versions, and compares the arrival times of the first two with those
+ * of the priority queue. */
+template <unsigned int ImageDimension>
+int FastMarchingQueueTest(unsigned int argc, char *argv[])
+{
+  typedef float                                       PixelType;
+  typedef itk::Image<PixelType,ImageDimension>        ImageType;
+  typedef itk::FastMarchingImageFilter<ImageType>     FilterType;
+  typedef typename FilterType::LabelImageType         LabelImageType;
+
+  unsigned int argct=2;
+  typename ImageType::Pointer speed = NULL;
+  ReadImage<ImageType>(speed, argv[argct]); argct++;
+  typename LabelImageType::Pointer labels = NULL;
+  ReadImage<LabelImageType>(labels, argv[argct]); argct++;
+  float stoppingValue = atof(argv[argct]); argct++;
+  double bucketWidth = atof(argv[argct]); argct++;
+  double heaptolerance = atof(argv[argct]); argct++;
+  double buckettolerance = atof(argv[argct]); argct++;
+
+  typename ImageType::Pointer reference = NULL, heap = NULL, buckets = NULL;
+  try
+    {
+    reference = FastMarchingArrivalTimes<FilterType, ImageType>( speed, labels, stoppingValue, FilterType::PriorityQueue, 0 );
+    heap = FastMarchingArrivalTimes<FilterType, ImageType>( speed, labels, stoppingValue, FilterType::IndexedHeap, 0 );
+    buckets = FastMarchingArrivalTimes<FilterType, ImageType>( speed, labels, stoppingValue, FilterType::BucketQueue, bucketWidth );
+    }
+  catch( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  double heapmax = 0, heapmean = 0, bucketmax = 0, bucketmean = 0;
+  ArrivalTimeDifference<ImageType>( heap, reference, stoppingValue, heapmax, heapmean );
+  ArrivalTimeDifference<ImageType>( buckets, reference, stoppingValue, bucketmax, bucketmean );
+  std::cout << " indexed heap  max difference " << heapmax << "  mean " << heapmean << std::endl;
+  std::cout << " bucket queue  max difference " << bucketmax << "  mean " << bucketmean
+            << "  (bucket width " << bucketWidth << ") " << std::endl;
+  if ( heapmax > heaptolerance )
+    {
+    std::cerr << " The indexed heap differs from the priority queue " << std::endl;
+    return EXIT_FAILURE;
+    }
+  if ( bucketmax > buckettolerance )
+    {
+    std::cerr << " The bucket queue differs from the priority queue by more than the bound " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 8 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension speed.ext labels.ext StoppingValue BucketWidth HeapTolerance BucketTolerance " << std::endl;
+    std::cout << "  Propagates labels.ext through speed.ext as ImageMath FastMarchingSegmentation does, with" << std::endl;
+    std::cout << "  the indexed heap, the bucket queue and the std::priority_queue of earlier versions as the" << std::endl;
+    std::cout << "  reference.  Fails if the arrival times, clamped at StoppingValue, of the heap or of the" << std::endl;
+    std::cout << "  bucket queue differ from the reference by more than HeapTolerance or BucketTolerance. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return FastMarchingQueueTest<2>(argc,argv);
+    case 3:
+      return FastMarchingQueueTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: HistogramParzenLookupTableTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkListSample.h"
+#include "antsHistogramParzenWindowsListSampleFunction.h"
+
+/** Builds a histogram Parzen density from the voxel intensities of one or
+ * more images, one component per image, with and without the linear lookup
+ * tables, and compares the two at every voxel and at points beyond the
+ * intensity range. */
+template <unsigned int ImageDimension>
+int HistogramParzenLookupTableTest(unsigned int argc, char *argv[])
+{
+  typedef float  PixelType;
+  typedef itk::Image<PixelType,ImageDimension>      ImageType;
+  typedef itk::Array<float>                         MeasurementVectorType;
+  typedef itk::Statistics::ListSample<MeasurementVectorType> SampleType;
+  typedef itk::ants::Statistics::HistogramParzenWindowsListSampleFunction
+    <SampleType, float, float> FunctionType;
+
+  unsigned int argct=2;
+  float sigma = atof(argv[argct]); argct++;
+  unsigned int bins = atoi(argv[argct]); argct++;
+  unsigned int samplesperbin = atoi(argv[argct]); argct++;
+  double tolerance = atof(argv[argct]); argct++;
+  std::vector<typename ImageType::Pointer> images;
+  for ( ; argct < argc; argct++)
+    {
+    typename ImageType::Pointer image = NULL;
+    ReadImage<ImageType>(image, argv[argct]);
+    images.push_back(image);
+    }
+  const unsigned int components = images.size();
+
+  typename SampleType::Pointer sample = SampleType::New();
+  sample->SetMeasurementVectorSize( components );
+  std::vector<itk::ImageRegionConstIterator<ImageType> > iterators;
+  for (unsigned int c=0; c < components; c++)
+    {
+    iterators.push_back( itk::ImageRegionConstIterator<ImageType>(
+      images[c], images[0]->GetLargestPossibleRegion() ) );
+    iterators[c].GoToBegin();
+    }
+  MeasurementVectorType minima( components ), maxima( components );
+  minima.Fill( itk::NumericTraits<float>::max() );
+  maxima.Fill( itk::NumericTraits<float>::NonpositiveMin() );
+  while ( !iterators[0].IsAtEnd() )
+    {
+    MeasurementVectorType measurement( components );
+    for (unsigned int c=0; c < components; c++)
+      {
+      measurement[c] = iterators[c].Get();
+      minima[c] = vnl_math_min( minima[c], measurement[c] );
+      maxima[c] = vnl_math_max( maxima[c], measurement[c] );
+      ++iterators[c];
+      }
+    sample->PushBack( measurement );
+    }
+
+  typename FunctionType::ListSampleWeightArrayType weights( sample->Size() );
+  weights.Fill( 1.0 );
+
+  typename FunctionType::Pointer tabulated = FunctionType::New();
+  tabulated->SetSigma( sigma );
+  tabulated->SetNumberOfHistogramBins( bins );
+  tabulated->SetNumberOfLookupTableSamplesPerBin( samplesperbin );
+  tabulated->UseLookupTableOn();
+  tabulated->SetListSampleWeights( &weights );
+  tabulated->SetInputListSample( sample );
+
+  typename FunctionType::Pointer interpolated = FunctionType::New();
+  interpolated->SetSigma( sigma );
+  interpolated->SetNumberOfHistogramBins( bins );
+  interpolated->SetListSampleWeights( &weights );
+  interpolated->SetInputListSample( sample );
+
+  double sumdifference = 0, suminterpolated = 0, maxrelative = 0;
+  for (unsigned long i=0; i < sample->Size(); i++)
+    {
+    const MeasurementVectorType & measurement = sample->GetMeasurementVector( i );
+    const double t = tabulated->Evaluate( measurement );
+    const double b = interpolated->Evaluate( measurement );
+    sumdifference += fabs( t - b );
+    suminterpolated += fabs( b );
+    if ( b > 0 ) maxrelative = vnl_math_max( maxrelative, fabs( t - b ) / b );
+    }
+  const double relative = sumdifference / vnl_math_max( suminterpolated, 1.e-12 );
+
+  /** Beyond the histogram buffers both must vanish;  between the last bin
+   * center and the buffer edge the table is clamped to the last center. */
+  unsigned long outsidemismatches = 0;
+  for (unsigned int c=0; c < components; c++)
+    {
+    const float range = vnl_math_max( maxima[c] - minima[c], 1.0f );
+    MeasurementVectorType below = sample->GetMeasurementVector( 0 );
+    MeasurementVectorType above = sample->GetMeasurementVector( 0 );
+    below[c] = minima[c] - range;
+    above[c] = maxima[c] + range;
+    if ( tabulated->Evaluate( below ) != 0 || interpolated->Evaluate( below ) != 0 ) outsidemismatches++;
+    if ( tabulated->Evaluate( above ) != 0 || interpolated->Evaluate( above ) != 0 ) outsidemismatches++;
+    }
+
+  std::cout << " lookup table bytes " << tabulated->GetLookupTableSizeInBytes()
+            << "  mean relative difference " << relative
+            << "  max relative difference " << maxrelative << std::endl;
+  if ( relative > tolerance )
+    {
+    std::cerr << " The lookup tables differ from the B-spline interpolation " << std::endl;
+    return EXIT_FAILURE;
+    }
+  if ( outsidemismatches > 0 )
+    {
+    std::cerr << outsidemismatches << " evaluations beyond the histograms are not 0 " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 7 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension Sigma NumberOfHistogramBins LookupTableSamplesPerBin Tolerance image1.ext {image2.ext ...} " << std::endl;
+    std::cout << "  Compares the histogram Parzen density of the voxel intensities, one component per" << std::endl;
+    std::cout << "  image, evaluated from the linear lookup tables and from the B-spline interpolants at" << std::endl;
+    std::cout << "  every voxel.  Fails if the mean relative difference exceeds Tolerance or if either" << std::endl;
+    std::cout << "  is not 0 beyond the intensity range. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return HistogramParzenLookupTableTest<2>(argc,argv);
+    case 3:
+      return HistogramParzenLookupTableTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -5060,6 +5060,8 @@ int FastMarchingSegmentation( unsigned int argc, char *argv[] )
   if (  argc > argct) { stoppingValue=atof(argv[argct]);   argct++; }
   int topocheck=0;
   if (  argc > argct) { topocheck=atoi(argv[argct]);   argct++; }
+  float bucketWidth=0;
+  if (  argc > argct) { bucketWidth=atof(argv[argct]);   argct++; }
 
 
   typedef itk::ImageFileReader<ImageType> ReaderType;
@@ -5143,6 +5145,15 @@ int FastMarchingSegmentation( unsigned int argc, char *argv[] )
       std::cout << " no handles " << std::endl;
     filter->SetTopologyCheck( FilterType::NoHandles );
     }
+  if( bucketWidth > 0 )  // approximate ordering
+    {
+    filter->SetTrialQueue( FilterType::BucketQueue );
+    filter->SetBucketWidth( bucketWidth );
+    }
+  else if( bucketWidth < 0 )  // priority queue of earlier versions, for reference
+    {
+    filter->SetTrialQueue( FilterType::PriorityQueue );
+    }
 
   try
     {
@@ -8121,7 +8132,9 @@ int main(int argc, char *argv[])
     std::cout << "      Usage        : ExtractSlice volume.nii.gz slicetoextract" << std::endl;
 
     std::cout << "\n  FastMarchingSegmentation: final output is the propagated label image. Optional stopping value: higher values allow more distant propagation "  << std::endl;
-    std::cout << "      Usage        : FastMarchingSegmentation speed/binaryimagemask.ext initiallabelimage.ext Optional-Stopping-Value" << std::endl;
+    std::cout << "      Usage        : FastMarchingSegmentation speed/binaryimagemask.ext initiallabelimage.ext Optional-Stopping-Value Optional-Topology-Check Optional-Bucket-Width" << std::endl;
+    std::cout << "      A bucket width > 0 accepts trial points within that arrival time of each other in any order, which is faster but approximate; " << std::endl;
+    std::cout << "      a bucket width < 0 uses the std::priority_queue of earlier versions as a reference " << std::endl;
 
     std::cout << "\n  FillHoles        : Parameter = ratio of edge at object to edge at background;  --  " << std::endl;
     std::cout << "                Parameter = 1 is a definite hole bounded by object only, 0.99 is close" << std::endl;
@@ -17,6 +17,7 @@
 =========================================================================*/
 
 
+#include <algorithm>
 #include <vector>
 #include <cstdlib>
 #include <ctime>
@@ -32,6 +33,10 @@
 #include "itkBinaryThresholdImageFilter.h"
 #include "itkLabelStatisticsImageFilter.h"
 #include "itkNeighborhoodIterator.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkMultiThreader.h"
+#include "itkImageIOFactory.h"
+#include <itksys/SystemTools.hxx>
 
 //  RecursiveAverageImages img1  img2  weight
 
@@ -406,13 +411,12 @@ GetClusterStat(typename TImage::Pointer image, float Tthreshold, unsigned int mi
         if (size == 0) return 0;
           //            throw domain_error("median of an empty vector");
 
-        sort(vec.begin(),vec.end());
-
         vec_sz mid = size/2;
-
-        return size % 2 == 0
-            ? (vec[mid] + vec[mid-1]) / 2
-            : vec[mid];
+        std::nth_element(vec.begin(), vec.begin()+mid, vec.end());
+        if ( size % 2 != 0 ) return vec[mid];
+        // the lower middle value is the largest of the lower half
+        float lower = *std::max_element(vec.begin(), vec.begin()+mid);
+        return (vec[mid] + lower) / 2;
      }
 
 float npdf(std::vector<float> vec, bool opt,  float www) {
@@ -551,6 +555,105 @@ float myantssimilaritymaxlabel(std::vector<float> labelvec, std::vector<float> s
 
 
 
+// The inputs are read slab by slab along the last axis, so that only the
+// values of one slab of all subjects are held in memory.  Each slab is stored
+// voxel by voxel and its statistics are computed on all threads.
+
+typedef struct
+{
+  unsigned int whichstat;
+  unsigned int numImages;
+  unsigned int numSimilarities;
+  unsigned long slabVoxels;
+  const float *values;        // slabVoxels x numImages
+  const float *similarities;  // slabVoxels x numSimilarities
+  const float *roi;           // per slab voxel, NULL without an ROI
+  float www;
+  float *output;
+} SlabStatisticsStruct;
+
+ITK_THREAD_RETURN_TYPE SlabStatisticsThreaderCallback( void *arg )
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  const SlabStatisticsStruct *str = static_cast<const SlabStatisticsStruct *>( info->UserData );
+  itk::ThreadIdType threadId = info->ThreadID;
+  itk::ThreadIdType threadCount = info->NumberOfThreads;
+
+  const unsigned long valuesPerThread = ( str->slabVoxels + threadCount - 1 ) / threadCount;
+  const unsigned long first = threadId * valuesPerThread;
+  const unsigned long last = std::min( first + valuesPerThread, str->slabVoxels );
+
+  std::vector<float> voxels(str->numImages);
+  std::vector<float> similarities(str->numSimilarities);
+  for (unsigned long k = first; k < last; k++)
+    {
+      unsigned int maxval=0;
+      if ( str->roi )
+        {
+          if ( str->roi[k] < 0.5 ) { str->output[k] = 0; continue; }
+          maxval=(unsigned int)(str->roi[k]-1);
+        }
+      const float *v = str->values + k * str->numImages;
+      voxels.assign( v, v + str->numImages );
+      if ( str->numSimilarities > 0 )
+        {
+          const float *s = str->similarities + k * str->numSimilarities;
+          similarities.assign( s, s + str->numSimilarities );
+        }
+      float stat = 0;
+      switch( str->whichstat )
+        {
+           case 1: stat=npdf(voxels,true,str->www); break;
+           case 2: stat=npdf(voxels,false,str->www); break;
+           case 3: stat=trimmean(voxels); break;
+           case 4: stat=myantsmax(voxels); break;
+           case 5: stat=myantssimilaritymaxlabel(voxels,similarities,true); break;
+           case 6: stat=myantssimilaritymaxlabel(voxels,similarities,false); break;
+           case 7: stat=voxels[maxval]; break;
+           default: stat=median(voxels); break;
+        }
+      str->output[k] = stat;
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+bool IsCompressedImageFile(const std::string & filename)
+// gzipped files are inflated from the start for every region read or written
+{
+  return itksys::SystemTools::GetFilenameLastExtension(filename) == ".gz";
+}
+
+bool CanStreamReadImage(const std::string & filename)
+{
+  itk::ImageIOBase::Pointer io =
+    itk::ImageIOFactory::CreateImageIO(filename.c_str(), itk::ImageIOFactory::ReadMode);
+  return io && io->CanStreamRead() && !IsCompressedImageFile(filename);
+}
+
+bool CanStreamWriteImage(const std::string & filename)
+{
+  itk::ImageIOBase::Pointer io =
+    itk::ImageIOFactory::CreateImageIO(filename.c_str(), itk::ImageIOFactory::WriteMode);
+  return io && io->CanStreamWrite() && !IsCompressedImageFile(filename);
+}
+
+template <class TImageType>
+void ReadSlab(const std::string & filename, const typename TImageType::RegionType & slab,
+              float *values, unsigned int stride)
+// values[k * stride] = k-th voxel of the slab, read through the streaming reader
+{
+  typedef itk::ImageFileReader<TImageType> readertype;
+  typename readertype::Pointer reader = readertype::New();
+  reader->SetFileName(filename.c_str());
+  reader->UpdateOutputInformation();
+  reader->GetOutput()->SetRequestedRegion(slab);
+  reader->Update();
+  itk::ImageRegionConstIterator<TImageType> it( reader->GetOutput(), slab );
+  unsigned long k = 0;
+  for( it.GoToBegin(); !it.IsAtEnd(); ++it, ++k ) values[k * stride] = it.Get();
+}
+
+
 template <unsigned int ImageDimension>
 int ImageSetStatistics(int argc, char *argv[])
 {
@@ -567,7 +670,6 @@ int ImageSetStatistics(int argc, char *argv[])
   typedef itk::LinearInterpolateImageFunction<ImageType,double>  InterpolatorType1;
   typedef itk::NearestNeighborInterpolateImageFunction<ImageType,double>  InterpolatorType2;
   typedef itk::ImageRegionIteratorWithIndex<ImageType> Iterator;
-  unsigned int mch=0;
   int argct=2;
   std::string fn1 = std::string(argv[argct]); argct++;
   std::string outfn = std::string(argv[argct]);argct++;
@@ -576,11 +678,12 @@ int ImageSetStatistics(int argc, char *argv[])
   if (argc > argct){ roifn=std::string(argv[argct]); argct++; }
   std::string simimagelist=std::string("");
   if (argc > argct){ simimagelist=std::string(argv[argct]); argct++; }
+  unsigned long slabmegabytes=1024;
+  if (argc > argct){ slabmegabytes=atoi(argv[argct]); argct++; }
   float www = 0;
   // if (argc > argct) { www=atof(argv[argct]);argct++;}
   //  unsigned int mchmax= 0;
   // if (argc > argct) { mchmax=atoi(argv[argct]); argct++;}
-  unsigned int localmeanrad= 0;
   // if (argc > argct) { localmeanrad=atoi(argv[argct]);argct++;}
 
   //  std::cout <<" roifn " << roifn << " fn1 " << fn1 << " whichstat " << whichstat << std::endl;
@@ -675,10 +778,6 @@ int ImageSetStatistics(int argc, char *argv[])
   } // fi simimagelist
   std::cout << " NFiles2 " << filecount2 << std::endl;
 
-  typename ImageType::Pointer meanimage;
-  std::vector<typename ImageType::Pointer>  imagestack;
-  imagestack.resize(filecount1);
-  //  imagestack.fill(NULL);
   std::vector<std::string> filenames(filecount1);
   typename ImageType::Pointer StatImage;
     unsigned int ct = 0;
@@ -702,18 +801,12 @@ int ImageSetStatistics(int argc, char *argv[])
       else
     {
       filenames[ct]=std::string(filenm);
-      ReadImage<ImageType>(imagestack[ct] , filenm ,false);
-      if (ct ==0)   meanimage=MakeNewImage<ImageType>(imagestack[ct],0);
-      if (localmeanrad > 0) LocalMean<ImageType>(imagestack[ct],localmeanrad,meanimage);
-      std::cout << " done reading " << (float) ct / (float ) filecount1 << std::endl;
       ct++;
     }
     }
   inputStreamA.close();
 
-  // read similarity images, if needed
-  std::vector<typename ImageType::Pointer>  simimagestack;
-  simimagestack.resize(filecount2);
+  // list similarity images, if needed
   std::vector<std::string> simfilenames(filecount2);
   ct = 0;
   if ( simimagelist.length() > 2 && ( whichstat == 5 || whichstat == 6 ) )
@@ -734,7 +827,6 @@ int ImageSetStatistics(int argc, char *argv[])
       else
     {
       simfilenames[ct]=std::string(filenm);
-      ReadImage<ImageType>(simimagestack[ct] , filenm ,false);
       ct++;
     }
     }
@@ -742,84 +834,172 @@ int ImageSetStatistics(int argc, char *argv[])
   } // fi read similarity images
 
 
-  ReadImage<ImageType>( StatImage , filenames[0].c_str() , false);
-  Iterator vfIter(StatImage , StatImage->GetLargestPossibleRegion() );
-  std::vector<float> voxels(filecount1);
-  std::vector<float> similarities(filecount2);
-  unsigned long nvox=1;
-  for (unsigned int i=0; i<ImageDimension; i++) nvox*=StatImage->GetLargestPossibleRegion().GetSize()[i];
+  // the output has the geometry of the first image
+  {
+  typename readertype::Pointer reader = readertype::New();
+  reader->SetFileName(filenames[0].c_str());
+  reader->UpdateOutputInformation();
+  StatImage=ImageType::New();
+  StatImage->CopyInformation(reader->GetOutput());
+  StatImage->SetRegions(reader->GetOutput()->GetLargestPossibleRegion());
+  }
+  const typename ImageType::RegionType region=StatImage->GetLargestPossibleRegion();
+  const unsigned int slabaxis=ImageDimension-1;
+  unsigned long slicevox=1;
+  for (unsigned int i=0; i<slabaxis; i++) slicevox*=region.GetSize()[i];
+  const unsigned int numslices=region.GetSize()[slabaxis];
+  unsigned int slabslices=(unsigned int) std::min<unsigned long>( numslices,
+    ( slabmegabytes << 20 ) / ( slicevox * sizeof(float) * ( filecount1 + filecount2 ) ) );
+  if (slabslices < 1) slabslices=1;
+
+  // with several slabs, each slab of the statistic is pasted into the output
+  // file, unless its format cannot take a region (e.g. .nii.gz), in which case
+  // the whole statistic image is kept and written at the end
+  bool streamoutput=false;
+  if ( slabslices < numslices )
+    {
+      streamoutput=CanStreamWriteImage(outfn);
+      if ( !streamoutput )
+        std::cout << " warning: " << outfn << " cannot be written slab by slab, the whole output image is kept in memory " << std::endl;
+      unsigned int unstreamable=0;
+      for (unsigned int j=0; j<filecount1; j++) if ( !CanStreamReadImage(filenames[j]) ) unstreamable++;
+      for (unsigned int j=0; j<filecount2; j++) if ( !CanStreamReadImage(simfilenames[j]) ) unstreamable++;
+      if ( unstreamable > 0 )
+        std::cout << " warning: " << unstreamable << " input images are compressed or cannot be read by region, each is read whole once per slab ( "
+                  << ( numslices + slabslices - 1 ) / slabslices << " slabs ) --- uncompress them or raise slabmemoryMB " << std::endl;
+    }
+  if ( streamoutput )
+    {
+      // a stale file of another geometry would be pasted into
+      itksys::SystemTools::RemoveFile(outfn.c_str());
+    }
+  else
+    {
+      StatImage->Allocate();
+      StatImage->FillBuffer(0);
+    }
 
-  ct=0;
-      unsigned long  prog = nvox/15;
-      for(  vfIter.GoToBegin(); !vfIter.IsAtEnd(); ++vfIter )
+  switch( whichstat )
     {
-      if (ct % prog == 0) std::cout << " % " << (float) ct / (float) nvox << std::endl;
-      ct++;
-      IndexType ind=vfIter.GetIndex();
-      unsigned int maxval=0;
-      bool takesample=true;
-      if ( ROIimg )
+    case 1: std::cout << "the max prob appearance \n"; break;
+    case 2: std::cout << "the probabilistically weighted appearance " << www << " \n"; break;
+    case 3: std::cout << "the trimmed mean appearance \n"; break;
+    case 4: std::cout << "the maximum appearance \n"; break;
+    case 5: std::cout << "the maximum similarity-based label \n"; break;
+    case 6: std::cout << "which image provides the maximum similarity-based label \n"; break;
+    case 7: std::cout << "which image provides the maximum similarity-based label \n"; break;
+    case 8: std::cout << "the mean appearance \n"; break;
+    case 9: std::cout << "the variance of the appearance \n"; break;
+    default: std::cout << "the median appearance \n"; break;
+    }
+  std::cout << " slabs of " << slabslices << " of " << numslices << " slices " << std::endl;
+
+  // mean and variance are accumulated image by image (Welford), the other
+  // statistics need all values of a voxel
+  const bool online = ( whichstat == 8 || whichstat == 9 );
+  std::vector<float> values;
+  std::vector<float> simvalues;
+  std::vector<float> roivalues;
+  std::vector<float> current;
+  std::vector<double> runningmean;
+  std::vector<double> runningm2;
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads( itk::MultiThreader::GetGlobalDefaultNumberOfThreads() );
+
+  for (unsigned int firstslice=0; firstslice<numslices; firstslice+=slabslices)
+    {
+      std::cout << " % " << (float) firstslice / (float) numslices << std::endl;
+      typename ImageType::RegionType slab=region;
+      slab.SetIndex(slabaxis, region.GetIndex()[slabaxis]+firstslice);
+      slab.SetSize(slabaxis, std::min(slabslices, numslices-firstslice));
+      const unsigned long slabvox=slab.GetNumberOfPixels();
+      float *output=NULL;
+      if ( streamoutput )
         {
-           if ( ROIimg->GetPixel(ind) < 0.5 )  takesample=false;
-          else maxval=(unsigned int)(ROIimg->GetPixel(ind)-1);
+          StatImage->SetBufferedRegion(slab);
+          StatImage->SetRequestedRegion(slab);
+          StatImage->Allocate();
+          output=StatImage->GetBufferPointer();
         }
-      if ( takesample ) {
-      if (mch == 0) meanimage->SetPixel(ind, meanimage->GetPixel(ind)/filecount1 );
-      for (unsigned int j=0; j<filecount1; j++)
+      else output=StatImage->GetBufferPointer()+(unsigned long)firstslice*slicevox;
+
+      if ( online )
         {
-          voxels[j]=imagestack[j]->GetPixel(ind);
+          current.resize(slabvox);
+          runningmean.assign(slabvox, 0.0);
+          runningm2.assign(slabvox, 0.0);
+          for (unsigned int j=0; j<filecount1; j++)
+            {
+              ReadSlab<ImageType>(filenames[j], slab, &current[0], 1);
+              const double n = j+1;
+              for (unsigned long k=0; k<slabvox; k++)
+                {
+                  double delta = current[k] - runningmean[k];
+                  runningmean[k] += delta / n;
+                  runningm2[k] += delta * ( current[k] - runningmean[k] );
+                }
+            }
+          for (unsigned long k=0; k<slabvox; k++)
+            {
+              if ( whichstat == 8 ) output[k] = runningmean[k];
+              else output[k] = ( filecount1 > 1 ) ? runningm2[k] / ( filecount1 - 1 ) : 0;
+            }
         }
-      for (unsigned int j=0; j<filecount2; j++)
+      else
         {
-          similarities[j]=simimagestack[j]->GetPixel(ind);
+          values.resize(slabvox*filecount1);
+          for (unsigned int j=0; j<filecount1; j++)
+            ReadSlab<ImageType>(filenames[j], slab, &values[j], filecount1);
+          simvalues.resize(slabvox*filecount2);
+          for (unsigned int j=0; j<filecount2; j++)
+            ReadSlab<ImageType>(simfilenames[j], slab, &simvalues[j], filecount2);
+
+          SlabStatisticsStruct str;
+          str.whichstat=whichstat;
+          str.numImages=filecount1;
+          str.numSimilarities=filecount2;
+          str.slabVoxels=slabvox;
+          str.values=values.empty() ? NULL : &values[0];
+          str.similarities=simvalues.empty() ? NULL : &simvalues[0];
+          str.roi=NULL;
+          str.www=www;
+          str.output=output;
+          if ( ROIimg )
+            {
+              roivalues.resize(slabvox);
+              itk::ImageRegionConstIterator<ImageType> roiIter(ROIimg, slab);
+              unsigned long k=0;
+              for( roiIter.GoToBegin(); !roiIter.IsAtEnd(); ++roiIter, ++k ) roivalues[k]=roiIter.Get();
+              str.roi=&roivalues[0];
+            }
+          threader->SetSingleMethod( SlabStatisticsThreaderCallback, &str );
+          threader->SingleMethodExecute();
         }
-      float stat = 0;
-      switch( whichstat )
+
+      if ( ROIimg && online )
+        {
+          itk::ImageRegionConstIterator<ImageType> roiIter(ROIimg, slab);
+          unsigned long k=0;
+          for( roiIter.GoToBegin(); !roiIter.IsAtEnd(); ++roiIter, ++k ) if ( roiIter.Get() < 0.5 ) output[k]=0;
+        }
+
+      if ( streamoutput )
         {
-           case 1:
-         stat=npdf(voxels,true,www);
-          if (ct == 1)    std::cout << "the max prob appearance \n";
-            break;
-           case 2:
-         stat=npdf(voxels,false,www);
-         if (ct == 1)    std::cout << "the probabilistically weighted appearance " << www << " \n";
-
-            break;
-
-           case 3:
-          stat=trimmean(voxels);
-          if (ct == 1)    std::cout << "the trimmed mean appearance \n";
-            break;
-
-           case 4:
-          stat=myantsmax(voxels);
-          if (ct == 1)    std::cout << "the maximum appearance \n";
-            break;
-           case 5:
-         stat=myantssimilaritymaxlabel(voxels,similarities,true);
-          if (ct == 1)    std::cout << "the maximum similarity-based label \n";
-            break;
-           case 6:
-         stat=myantssimilaritymaxlabel(voxels,similarities,false);
-          if (ct == 1)    std::cout << "which image provides the maximum similarity-based label \n";
-            break;
-           case 7:
-         stat=voxels[maxval];
-          if (ct == 1)    std::cout << "which image provides the maximum similarity-based label \n";
-            break;
-
-           default:
-          stat=median(voxels);
-          if (ct == 1)    std::cout << "the median appearance \n";
-            break;
+          itk::ImageIORegion ioregion(ImageDimension);
+          for (unsigned int d=0; d<ImageDimension; d++)
+            {
+              ioregion.SetIndex(d, slab.GetIndex()[d]-region.GetIndex()[d]);
+              ioregion.SetSize(d, slab.GetSize()[d]);
+            }
+          typename writertype::Pointer writer = writertype::New();
+          writer->SetFileName(outfn.c_str());
+          writer->SetInput(StatImage);
+          writer->SetIORegion(ioregion);
+          writer->Update();
         }
-      float sval=stat;
-      if ( localmeanrad > 0 ) sval+= meanimage->GetPixel(ind);
-      StatImage->SetPixel(ind, sval);
-      }
-      else StatImage->SetPixel(ind, 0);
     }
-      WriteImage<ImageType>(StatImage, outfn.c_str() );
+  if ( !streamoutput ) WriteImage<ImageType>(StatImage, outfn.c_str() );
 
       std::cout << " Done " << std::endl;
       return 0;
@@ -835,8 +1015,10 @@ int main( int argc, char * argv[] )
   if ( argc < 4 )
   {
     std::cout << "Usage:  "<< std::endl;
-    std::cout << argv[0] << " ImageDimension controlslist.txt outimage.nii whichstat {roi.nii} {imagelist2forsimilarityweightedstats.txt}" << std::endl;
-    std::cout << " whichstat = 0:  median,  1:  max prob appearance  , 2: weighted mean appearance ,  3: trimmed mean , 4 : max value , option 5 : similarity-weighted (must pass imagelist2 as well) else median , option 6 : same as similarity-weighted option 5 but the label corresponds to the image that provides the best local match ... useful if you want to MRF smooth these indices  , option 7 : similar to 5 but expects the max-value to be stored in the ROI image and uses it to get the intensity ... "  << std::endl;
+    std::cout << argv[0] << " ImageDimension controlslist.txt outimage.nii whichstat {roi.nii} {imagelist2forsimilarityweightedstats.txt} {slabmemoryMB}" << std::endl;
+    std::cout << " whichstat = 0:  median,  1:  max prob appearance  , 2: weighted mean appearance ,  3: trimmed mean , 4 : max value , option 5 : similarity-weighted (must pass imagelist2 as well) else median , option 6 : same as similarity-weighted option 5 but the label corresponds to the image that provides the best local match ... useful if you want to MRF smooth these indices  , option 7 : similar to 5 but expects the max-value to be stored in the ROI image and uses it to get the intensity ... , 8 : mean , 9 : variance "  << std::endl;
+    std::cout << " the images are read in slabs holding at most slabmemoryMB (default 1024) of voxel values; pass 0 for the roi and list to skip them . " << std::endl;
+    std::cout << " with several slabs, uncompressed inputs and output (e.g. .nii rather than .nii.gz) are read and written slab by slab " << std::endl;
     std::cout << " example:   ImageSetStatistics  3   imagelist.txt  maxvalueimage.nii.gz 4 " << std::endl;
     std::cout << " similarity weighted --- pass in a list of similarity images here which will be used to select the best label --- thus, number of similarity images must match the number of label images . " << std::endl;
     return 1;
@@ -0,0 +1,190 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: InvertFieldTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkANTSImageRegistrationOptimizer.h"
+
+/** The largest |u(x) + phi(x + u(x))| over the lattice, in voxels, for the
+ * inverse u of phi. */
+template <class TOptimizer>
+double MaximumInverseResidual( TOptimizer *optimizer, typename TOptimizer::DisplacementFieldPointer field,
+                               typename TOptimizer::DisplacementFieldPointer inverse )
+{
+  typedef typename TOptimizer::DisplacementFieldType FieldType;
+  typename FieldType::Pointer composed = FieldType::New();
+  composed->CopyInformation( field );
+  composed->SetRegions( field->GetLargestPossibleRegion() );
+  composed->Allocate();
+  optimizer->ComposeDiffs( inverse, field, composed, 1 );
+
+  double maxresidual = 0;
+  itk::ImageRegionConstIterator<FieldType> It( composed, composed->GetLargestPossibleRegion() );
+  for ( It.GoToBegin(); !It.IsAtEnd(); ++It )
+    {
+    double mag = 0;
+    for (unsigned int d=0; d < FieldType::ImageDimension; d++)
+      {
+      const double r = It.Get()[d] / field->GetSpacing()[d];
+      mag += r * r;
+      }
+    maxresidual = vnl_math_max( maxresidual, sqrt( mag ) );
+    }
+  return maxresidual;
+}
+
+/** The serial fixed point inversion the optimizer used before its voxels
+ * were threaded and frozen:  every voxel is updated in every iteration. */
+template <class TOptimizer>
+void ReferenceInvertField( TOptimizer *optimizer, typename TOptimizer::DisplacementFieldPointer field,
+                           typename TOptimizer::DisplacementFieldPointer inverse, double toler, unsigned int maxiter )
+{
+  typedef typename TOptimizer::DisplacementFieldType FieldType;
+  typedef typename FieldType::PixelType              VectorType;
+  typename FieldType::Pointer eulerian = FieldType::New();
+  eulerian->CopyInformation( field );
+  eulerian->SetRegions( field->GetLargestPossibleRegion() );
+  eulerian->Allocate();
+
+  const unsigned long npix = field->GetLargestPossibleRegion().GetNumberOfPixels();
+  std::vector<double> magnitudes( npix );
+  double difmag = 10.0, meandif = 1.e8;
+  unsigned int ct = 0;
+  while ( difmag > toler && ct < maxiter && meandif > 0.001 )
+    {
+    optimizer->ComposeDiffs( inverse, field, eulerian, 1 );
+    VectorType *update = eulerian->GetBufferPointer();
+    difmag = 0;
+    meandif = 0;
+    for (unsigned long i=0; i < npix; i++)
+      {
+      double mag = 0;
+      for (unsigned int d=0; d < FieldType::ImageDimension; d++)
+        {
+        update[i][d] *= -1.0;
+        mag += ( update[i][d] / field->GetSpacing()[d] ) * ( update[i][d] / field->GetSpacing()[d] );
+        }
+      magnitudes[i] = sqrt( mag );
+      meandif += magnitudes[i];
+      difmag = vnl_math_max( difmag, magnitudes[i] );
+      }
+    meandif /= (double)npix;
+    const double epsilon = ( ct == 0 ) ? 0.75 : 0.5;
+    const double stepl = difmag * epsilon;
+    VectorType *inv = inverse->GetBufferPointer();
+    for (unsigned long i=0; i < npix; i++)
+      {
+      VectorType u = update[i];
+      if ( magnitudes[i] > stepl ) u = u * ( stepl / magnitudes[i] );
+      inv[i] += u * epsilon;
+      }
+    ct++;
+    }
+}
+
+/** Builds a smooth displacement field on the lattice of a reference image,
+ * inverts it with InvertField and with the serial reference inversion, and
+ * compares the inverse residuals. */
+template <unsigned int ImageDimension>
+int InvertFieldTest(unsigned int argc, char *argv[])
+{
+  typedef double                                                       RealType;
+  typedef itk::ANTSImageRegistrationOptimizer<ImageDimension,RealType> OptimizerType;
+  typedef typename OptimizerType::ImageType                            ImageType;
+  typedef typename OptimizerType::VectorType                           VectorType;
+  typedef typename OptimizerType::DisplacementFieldType                FieldType;
+
+  unsigned int argct=2;
+  typename ImageType::Pointer reference = NULL;
+  ReadImage<ImageType>(reference, argv[argct]); argct++;
+  double amplitude = atof(argv[argct]); argct++;
+  double tolerance = atof(argv[argct]); argct++;
+  const double toler = 0.1;
+  const unsigned int maxiter = 20;
+
+  typename FieldType::Pointer field = FieldType::New();
+  field->CopyInformation( reference );
+  field->SetRegions( reference->GetLargestPossibleRegion() );
+  field->Allocate();
+  typename FieldType::RegionType region = field->GetLargestPossibleRegion();
+  itk::ImageRegionIteratorWithIndex<FieldType> It( field, region );
+  for ( It.GoToBegin(); !It.IsAtEnd(); ++It )
+    {
+    typename FieldType::IndexType index = It.GetIndex();
+    VectorType v;
+    for (unsigned int d=0; d < ImageDimension; d++)
+      {
+      const unsigned int e = ( d + 1 ) % ImageDimension;
+      const double u = (double)( index[d] - region.GetIndex()[d] ) / (double)( region.GetSize()[d] - 1 );
+      const double w = (double)( index[e] - region.GetIndex()[e] ) / (double)( region.GetSize()[e] - 1 );
+      v[d] = amplitude * field->GetSpacing()[d] * sin( vnl_math::pi * u ) * sin( 2.0 * vnl_math::pi * w );
+      }
+    It.Set( v );
+    }
+
+  VectorType zero;  zero.Fill( 0 );
+  typename FieldType::Pointer inverse = FieldType::New();
+  inverse->CopyInformation( field );
+  inverse->SetRegions( region );
+  inverse->Allocate();
+  inverse->FillBuffer( zero );
+  typename FieldType::Pointer referenceinverse = FieldType::New();
+  referenceinverse->CopyInformation( field );
+  referenceinverse->SetRegions( region );
+  referenceinverse->Allocate();
+  referenceinverse->FillBuffer( zero );
+
+  typename OptimizerType::Pointer optimizer = OptimizerType::New();
+  optimizer->InvertField( field, inverse, 1.0, toler, maxiter, true );
+  ReferenceInvertField<OptimizerType>( optimizer, field, referenceinverse, toler, maxiter );
+
+  const double residual = MaximumInverseResidual<OptimizerType>( optimizer, field, inverse );
+  const double referenceresidual = MaximumInverseResidual<OptimizerType>( optimizer, field, referenceinverse );
+  std::cout << " max |phi o phi^-1 - id|  InvertField " << residual
+            << "  reference " << referenceresidual << " voxels " << std::endl;
+  if ( residual > referenceresidual + tolerance )
+    {
+    std::cerr << " InvertField leaves a larger residual than the reference inversion " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 5 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension reference.ext AmplitudeInVoxels Tolerance " << std::endl;
+    std::cout << "  Inverts a smooth displacement field on the lattice of reference.ext with the optimizer's" << std::endl;
+    std::cout << "  InvertField and with the serial reference inversion.  Fails if the largest residual" << std::endl;
+    std::cout << "  |phi o phi^-1 - id| of InvertField exceeds that of the reference by more than Tolerance voxels. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return InvertFieldTest<2>(argc,argv);
+    case 3:
+      return InvertFieldTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
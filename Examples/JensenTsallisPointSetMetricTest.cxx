@@ -0,0 +1,179 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: JensenTsallisPointSetMetricTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "itkPointSet.h"
+#include "itkMultiThreader.h"
+#include "itkJensenHavrdaCharvatTsallisLabeledPointSetMetric.h"
+
+/** Two labels of points on wavy closed curves;  offset shifts the moving
+ * curves by a smooth displacement of that many units. */
+template <class TPointSet>
+typename TPointSet::Pointer MakeCurvePointSet( unsigned int numberOfPoints, double offset, double phase )
+{
+  typename TPointSet::Pointer points = TPointSet::New();
+  points->Initialize();
+  for (unsigned int i=0; i < numberOfPoints; i++)
+    {
+    const long label = 1 + ( i % 2 );
+    const double theta = 2.0 * vnl_math::pi * (double)i / (double)numberOfPoints;
+    const double radius = 10.0 * label + 2.0 * sin( 5.0 * theta + phase );
+    typename TPointSet::PointType point;
+    point.Fill( 0 );
+    point[0] = 32 + radius * cos( theta ) + offset * sin( theta );
+    point[1] = 32 + radius * sin( theta ) + offset * cos( 2.0 * theta );
+    for (unsigned int d=2; d < TPointSet::PointDimension; d++) point[d] = 32 + offset * sin( 3.0 * theta );
+    points->SetPoint( i, point );
+    points->SetPointData( i, label );
+    }
+  return points;
+}
+
+template <class TMetric>
+void EvaluateMetric( TMetric *metric, double & value, typename TMetric::DerivativeType & derivative )
+{
+  typename TMetric::DefaultTransformType::ParametersType parameters;
+  parameters.Fill( 0.0 );
+  typename TMetric::MeasureType measure;
+  metric->Initialize();
+  metric->SetUseWithRespectToTheMovingPointSet( true );
+  metric->GetValueAndDerivative( parameters, measure, derivative );
+  value = measure[0];
+}
+
+template <class TMetric>
+typename TMetric::Pointer MakeMetric( typename TMetric::PointSetType *fixed, typename TMetric::PointSetType *moving,
+                                      double tolerance )
+{
+  typename TMetric::Pointer metric = TMetric::New();
+  metric->SetFixedPointSet( fixed );
+  metric->SetMovingPointSet( moving );
+  metric->SetFixedPointSetSigma( 1.0 );
+  metric->SetMovingPointSetSigma( 1.0 );
+  metric->SetFixedKernelSigma( 2.0 );
+  metric->SetMovingKernelSigma( 2.0 );
+  metric->SetFixedEvaluationKNeighborhood( 20 );
+  metric->SetMovingEvaluationKNeighborhood( 20 );
+  metric->SetUseInputAsSamples( true );
+  metric->SetAlpha( 1.0 );
+  metric->SetKdTreeRebuildTolerance( tolerance );
+  return metric;
+}
+
+template <class TDerivative>
+double MaximumRelativeDifference( double a, double b, const TDerivative & da, const TDerivative & db )
+{
+  double difference = fabs( a - b ) / vnl_math_max( fabs( b ), 1.e-12 );
+  double maxderivative = 0, maxdifference = 0;
+  for (unsigned int i=0; i < db.rows(); i++)
+    {
+    for (unsigned int j=0; j < db.cols(); j++)
+      {
+      maxderivative = vnl_math_max( maxderivative, fabs( db( i, j ) ) );
+      maxdifference = vnl_math_max( maxdifference, fabs( da( i, j ) - db( i, j ) ) );
+      }
+    }
+  return vnl_math_max( difference, maxdifference / vnl_math_max( maxderivative, 1.e-12 ) );
+}
+
+/** Evaluates the labeled Jensen-Havrda-Charvat-Tsallis metric of two point
+ * sets on one thread and on several, and with the kd-trees rebuilt after a
+ * small move of the moving points (tolerance 0) and kept (tolerance above
+ * the move), and compares the values and derivatives. */
+template <unsigned int ImageDimension>
+int JensenTsallisPointSetMetricTest(unsigned int argc, char *argv[])
+{
+  typedef itk::PointSet<long,ImageDimension>                            PointSetType;
+  typedef itk::JensenHavrdaCharvatTsallisLabeledPointSetMetric<PointSetType> MetricType;
+  typedef typename MetricType::DerivativeType                           DerivativeType;
+
+  unsigned int argct=2;
+  unsigned int numberOfPoints = atoi(argv[argct]); argct++;
+  unsigned int numberOfThreads = atoi(argv[argct]); argct++;
+  double kdtreetolerance = atof(argv[argct]); argct++;
+  double tolerance = atof(argv[argct]); argct++;
+
+  typename PointSetType::Pointer fixed = MakeCurvePointSet<PointSetType>( numberOfPoints, 0, 0 );
+  typename PointSetType::Pointer moving = MakeCurvePointSet<PointSetType>( numberOfPoints, 1.5, 0.3 );
+
+  double serialvalue = 0, threadedvalue = 0;
+  DerivativeType serialderivative, threadedderivative;
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads( 1 );
+  typename MetricType::Pointer serial = MakeMetric<MetricType>( fixed, moving, 0 );
+  EvaluateMetric<MetricType>( serial, serialvalue, serialderivative );
+  itk::MultiThreader::SetGlobalDefaultNumberOfThreads( numberOfThreads );
+  typename MetricType::Pointer threaded = MakeMetric<MetricType>( fixed, moving, 0 );
+  EvaluateMetric<MetricType>( threaded, threadedvalue, threadedderivative );
+  const double threadeddifference = MaximumRelativeDifference( threadedvalue, serialvalue, threadedderivative, serialderivative );
+
+  /** Move the moving points by less than the rebuild tolerance:  the
+   * rebuilt and the kept kd-trees must give the same metric. */
+  typename MetricType::Pointer rebuilt = MakeMetric<MetricType>( fixed, moving, 0 );
+  typename MetricType::Pointer kept = MakeMetric<MetricType>( fixed, moving, kdtreetolerance );
+  double rebuiltvalue = 0, keptvalue = 0;
+  DerivativeType rebuiltderivative, keptderivative;
+  EvaluateMetric<MetricType>( rebuilt, rebuiltvalue, rebuiltderivative );
+  EvaluateMetric<MetricType>( kept, keptvalue, keptderivative );
+  typename PointSetType::Pointer moved = MakeCurvePointSet<PointSetType>( numberOfPoints, 1.5 + 0.5 * kdtreetolerance, 0.3 );
+  rebuilt->SetMovingPointSet( moved );
+  kept->SetMovingPointSet( moved );
+  EvaluateMetric<MetricType>( rebuilt, rebuiltvalue, rebuiltderivative );
+  EvaluateMetric<MetricType>( kept, keptvalue, keptderivative );
+  const double keptdifference = MaximumRelativeDifference( keptvalue, rebuiltvalue, keptderivative, rebuiltderivative );
+
+  std::cout << " JHCT serial " << serialvalue << "  " << numberOfThreads << " threads " << threadedvalue
+            << "  max relative difference " << threadeddifference << std::endl;
+  std::cout << " JHCT rebuilt kd-trees " << rebuiltvalue << "  kept kd-trees " << keptvalue
+            << "  max relative difference " << keptdifference << std::endl;
+  if ( threadeddifference > tolerance )
+    {
+    std::cerr << " The threaded metric differs from the serial one " << std::endl;
+    return EXIT_FAILURE;
+    }
+  if ( keptdifference > tolerance )
+    {
+    std::cerr << " The metric with kept kd-trees differs from the one with rebuilt kd-trees " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 6 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension NumberOfPoints NumberOfThreads KdTreeRebuildTolerance Tolerance " << std::endl;
+    std::cout << "  Evaluates the labeled Jensen-Havrda-Charvat-Tsallis metric of two synthetic point sets" << std::endl;
+    std::cout << "  on 1 and on NumberOfThreads threads, and after moving the points by half the rebuild" << std::endl;
+    std::cout << "  tolerance with the kd-trees rebuilt and kept.  Fails if the values or derivatives differ" << std::endl;
+    std::cout << "  by more than Tolerance, relative to the largest derivative. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return JensenTsallisPointSetMetricTest<2>(argc,argv);
+    case 3:
+      return JensenTsallisPointSetMetricTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -20,6 +20,8 @@
 #include "itkBinaryDilateImageFilter.h"
 #include "itkBinaryBallStructuringElement.h"
 #include "itkLaplacianRecursiveGaussianImageFilter.h"
+#include "itkMultiThreader.h"
+#include "itkDisplacementFieldLinearSampler.h"
 #include "ReadWriteImage.h"
 
 #include "itkGradientRecursiveGaussianImageFilter.h"
@@ -344,9 +346,108 @@ FMMGrad(typename TImage::Pointer wm,typename TImage::Pointer gm )
  return sfield;
 }
 
+template <class TImage>
+struct LaplaceSORStruct
+{
+  typename TImage::PixelType *Buffer;
+  std::vector<itk::OffsetValueType> Band[2];
+  std::vector<unsigned char> Neighbors[2];
+  itk::OffsetValueType Stride[TImage::ImageDimension];
+  double Weight[TImage::ImageDimension];
+  double Omega;
+  unsigned int Color;
+  std::vector<double> MaxResidual;
+};
+
+template <class TImage>
+ITK_THREAD_RETURN_TYPE LaplaceSORThreaderCallback( void *arg )
+// one half sweep of red-black SOR:  voxels of one color only read the
+// other color, so the threads update their share of the list in place
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  LaplaceSORStruct<TImage> *str = static_cast<LaplaceSORStruct<TImage> *>( info->UserData );
+  const unsigned int threadId = info->ThreadID;
+  const unsigned int threadCount = info->NumberOfThreads;
+
+  const std::vector<itk::OffsetValueType> & band = str->Band[str->Color];
+  const std::vector<unsigned char> & neighbors = str->Neighbors[str->Color];
+  const unsigned long valuesPerThread = ( band.size() + threadCount - 1 ) / threadCount;
+  const unsigned long first = vnl_math_min( (unsigned long) band.size(), threadId * valuesPerThread );
+  const unsigned long last = vnl_math_min( (unsigned long) band.size(), first + valuesPerThread );
+
+  typename TImage::PixelType *buffer = str->Buffer;
+  double maxResidual = 0;
+  for ( unsigned long i = first; i < last; i++ )
+    {
+    const itk::OffsetValueType offset = band[i];
+    double sum = 0, weight = 0;
+    for ( unsigned int d = 0; d < TImage::ImageDimension; d++ )
+      {
+      if ( neighbors[i] & ( 1 << ( 2 * d ) ) )
+        {
+        sum += str->Weight[d] * buffer[offset - str->Stride[d]];
+        weight += str->Weight[d];
+        }
+      if ( neighbors[i] & ( 1 << ( 2 * d + 1 ) ) )
+        {
+        sum += str->Weight[d] * buffer[offset + str->Stride[d]];
+        weight += str->Weight[d];
+        }
+      }
+    if ( weight > 0 )
+      {
+      const double residual = sum / weight - buffer[offset];
+      buffer[offset] += str->Omega * residual;
+      maxResidual = vnl_math_max( maxResidual, vnl_math_abs( residual ) );
+      }
+    }
+  str->MaxResidual[threadId] = maxResidual;
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <class TImage>
+typename TImage::Pointer
+LaplacianBySmoothing(typename TImage::Pointer wm,typename TImage::Pointer gm, float sig , unsigned int numits, float tolerance)
+// the solver used before red-black SOR:  smooth the whole image and reset
+// L(wm)=1 and L=2 outside the gm, until the mean of the band changes by
+// less than tolerance
+{
+  typename TImage::Pointer laplacian=SmoothImage<TImage>(wm,1);
+  laplacian->FillBuffer(0);
+  typedef itk::ImageRegionIteratorWithIndex<TImage> IteratorType;
+  IteratorType Iterator( wm, wm->GetLargestPossibleRegion().GetSize() );
+  typename TImage::IndexType ind;
+  for( Iterator.GoToBegin(); !Iterator.IsAtEnd(); ++Iterator )
+    {
+    ind=Iterator.GetIndex();
+    if (wm->GetPixel(ind) >= 0.5 ) laplacian->SetPixel(ind,1);
+    else laplacian->SetPixel(ind,2.);
+    }
+
+  float meanvalue=0,lastmean=1;
+  unsigned int iterations=0;
+  while ( fabs(meanvalue-lastmean) > tolerance  && iterations < numits)
+    {
+    iterations++;
+    std::cout << "  % " << (float) iterations/(float)(numits+1) << " delta-mean " << fabs(meanvalue-lastmean) <<  std::endl;
+    laplacian=SmoothImage<TImage>(laplacian,sqrt(sig));
+    unsigned int ct=0;
+    lastmean=meanvalue;
+    for( Iterator.GoToBegin(); !Iterator.IsAtEnd(); ++Iterator )
+      {
+      ind=Iterator.GetIndex();
+      if (wm->GetPixel(ind) >= 0.5 ) laplacian->SetPixel(ind,1);
+      else if (gm->GetPixel(ind) < 0.5 ) laplacian->SetPixel(ind,2.);
+      else {     meanvalue+=laplacian->GetPixel(ind);  ct++;}
+      }
+    meanvalue/=(float)ct;
+    }
+  return laplacian;
+}
+
 template <class TImage,class TField>
 typename TField::Pointer
-LaplacianGrad(typename TImage::Pointer wm,typename TImage::Pointer gm, float sig , unsigned int numits, float tolerance)
+LaplacianGrad(typename TImage::Pointer wm,typename TImage::Pointer gm, float sig , unsigned int numits, float tolerance, bool smoothingSolver)
 {
   typedef  typename TImage::IndexType IndexType;
   IndexType ind;
@@ -365,43 +466,84 @@ LaplacianGrad(typename TImage::Pointer wm,typename TImage::Pointer gm, float sig
   sfield->SetBufferedRegion( wm->GetBufferedRegion() );
   sfield->Allocate();
 
-  typename TImage::Pointer laplacian=SmoothImage<TImage>(wm,1);
-  laplacian->FillBuffer(0);
+  if ( smoothingSolver )
+    {
+    GradientImageFilterPointer filter=GradientImageFilterType::New();
+    filter->SetInput( LaplacianBySmoothing<TImage>(wm,gm,sig,numits,tolerance) );
+    filter->SetSigma(sig*0.5);
+    filter->Update();
+    return filter->GetOutput();
+    }
+
+  typename TImage::Pointer laplacian=TImage::New();
+  laplacian->CopyInformation( wm );
+  laplacian->SetRegions( wm->GetLargestPossibleRegion() );
+  laplacian->Allocate();
   typedef itk::ImageRegionIteratorWithIndex<TImage> IteratorType;
   IteratorType Iterator( wm, wm->GetLargestPossibleRegion().GetSize() );
-  Iterator.GoToBegin();
 
-  //initialize L(wm)=1, L(gm)=0.5, else 0
-  while(  !Iterator.IsAtEnd()  )
+  // L(wm)=1 and L=2 outside the gm are fixed;  the band, gm but not wm, is
+  // solved for.  Band voxels are listed by color for red-black SOR, each with
+  // the mask of its face neighbours inside the image (the image edge is
+  // insulated).
+  LaplaceSORStruct<TImage> str;
+  typename TImage::SizeType size=wm->GetLargestPossibleRegion().GetSize();
+  itk::OffsetValueType stride=1;
+  for (unsigned int d=0; d<TImage::ImageDimension; d++)
+    {
+    str.Stride[d]=stride;
+    stride*=size[d];
+    str.Weight[d]=1.0/(wm->GetSpacing()[d]*wm->GetSpacing()[d]);
+    }
+  itk::OffsetValueType offset=0;
+  for( Iterator.GoToBegin(); !Iterator.IsAtEnd(); ++Iterator, ++offset )
     {
     ind=Iterator.GetIndex();
     if (wm->GetPixel(ind) >= 0.5 ) laplacian->SetPixel(ind,1);
-    else if (gm->GetPixel(ind) >= 0.5  && wm->GetPixel(ind) < 0.5 ) laplacian->SetPixel(ind,2.);
-    else laplacian->SetPixel(ind,2.);
-    ++Iterator;
+    else if (gm->GetPixel(ind) < 0.5 ) laplacian->SetPixel(ind,2.);
+    else
+      {
+      laplacian->SetPixel(ind,1.5);
+      unsigned int color=0;
+      unsigned char neighbors=0;
+      for (unsigned int d=0; d<TImage::ImageDimension; d++)
+        {
+        color+=ind[d]-wm->GetLargestPossibleRegion().GetIndex()[d];
+        if ( ind[d] > wm->GetLargestPossibleRegion().GetIndex()[d] ) neighbors |= 1 << (2*d);
+        if ( ind[d]-wm->GetLargestPossibleRegion().GetIndex()[d]+1 < (long)size[d] ) neighbors |= 1 << (2*d+1);
+        }
+      str.Band[color%2].push_back(offset);
+      str.Neighbors[color%2].push_back(neighbors);
+      }
     }
-
-  //smooth and then reset the values
-  float meanvalue=0,lastmean=1;
+  std::cout << " solving on " << str.Band[0].size()+str.Band[1].size() << " band voxels " << std::endl;
+
+  str.Buffer=laplacian->GetBufferPointer();
+  str.Omega=1.5;
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads( itk::MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  threader->SetSingleMethod( LaplaceSORThreaderCallback<TImage>, &str );
+  str.MaxResidual.resize( threader->GetNumberOfThreads() );
+
+  // sweep until no band voxel is farther than tolerance from the weighted
+  // mean of its neighbours
+  float residual=tolerance+1;
   unsigned int iterations=0;
-  while ( fabs(meanvalue-lastmean) > tolerance  && iterations < numits)
+  while ( residual > tolerance && iterations < numits)
     {
     iterations++;
-    std::cout << "  % " << (float) iterations/(float)(numits+1) << " delta-mean " << fabs(meanvalue-lastmean) <<  std::endl;
-    laplacian=SmoothImage<TImage>(laplacian,sqrt(sig));
-    Iterator.GoToBegin();
-    unsigned int ct=0;
-    lastmean=meanvalue;
-    while(  !Iterator.IsAtEnd()  )
+    residual=0;
+    for (str.Color=0; str.Color<2; str.Color++)
       {
-      ind=Iterator.GetIndex();
-      if (wm->GetPixel(ind) >= 0.5 ) laplacian->SetPixel(ind,1);
-      else if (gm->GetPixel(ind) < 0.5  && wm->GetPixel(ind) < 0.5 ) laplacian->SetPixel(ind,2.);
-      else {     meanvalue+=laplacian->GetPixel(ind);  ct++;}
-      ++Iterator;
+      std::fill( str.MaxResidual.begin(), str.MaxResidual.end(), 0.0 );
+      threader->SingleMethodExecute();
+      for (unsigned int t=0; t<str.MaxResidual.size(); t++)
+        residual=vnl_math_max(residual,(float)str.MaxResidual[t]);
       }
-    meanvalue/=(float)ct;
+    if ( iterations % 10 == 1 ) std::cout << "  % " << (float) iterations/(float)(numits+1) << " residual " << residual <<  std::endl;
     }
+  std::cout << " SOR converged to " << residual << " after " << iterations << " sweeps " << std::endl;
+  laplacian->Modified();
 
   ///  WriteImage<ImageType>(laplacian, "laplacian.hdr");
 
@@ -415,140 +557,157 @@ LaplacianGrad(typename TImage::Pointer wm,typename TImage::Pointer gm, float sig
 }
 
 
-template <class TImage,class TField, class TInterp, class TInterp2>
-float IntegrateLength( typename TImage::Pointer gmsurf,  typename TImage::Pointer thickimage, typename TImage::IndexType velind,  typename TField::Pointer lapgrad,  float itime, float starttime, float finishtime, bool timedone, float deltaTime, typename TInterp::Pointer vinterp, typename TInterp2::Pointer sinterp, unsigned int task, bool propagate,bool domeasure,   unsigned int m_NumberOfTimePoints, typename TImage::SpacingType spacing, float vecsign, float timesign, float gradsign, unsigned int ct, typename TImage::Pointer wm, typename TImage::Pointer gm, float priorthickval ,  typename TImage::Pointer smooththick  , bool printprobability,  typename TImage::Pointer sulci )
+template <class TImage,class TField>
+struct StreamlineThicknessStruct
+{
+  typedef itk::DisplacementFieldLinearSampler<TField> SamplerType;
+
+  const TImage *WM;
+  const TImage *GM;
+  const TImage *SmoothThick;
+  TImage *ThickImage;
+  SamplerType Samplers[2];
+  unsigned int NumberOfFields;
+  typename TImage::SpacingType Spacing;
+  typename TImage::SizeType Size;
+  float DeltaTime;
+  float PriorThickness;
+  bool FirstPass;
+};
+
+template <class TImage,class TField>
+float IntegrateLength( const StreamlineThicknessStruct<TImage,TField> *str,
+  const typename StreamlineThicknessStruct<TImage,TField>::SamplerType & sampler,
+  const typename TImage::IndexType & velind, std::vector<float> & totals )
+// RK4 from velind along the normalized laplacian gradient.  The trace stops
+// on leaving the gm or the image, when the step stalls, after 2/dT steps,
+// beyond the prior thickness or 1 beyond the smoothed thickness;  totals
+// gets the length after every step.
 {
-  typedef   TField TimeVaryingVelocityFieldType;
-  typedef typename TField::PixelType VectorType;
-  typedef itk::ImageRegionIteratorWithIndex<TField>         FieldIterator;
-  typedef typename TField::IndexType DIndexType;
-  typedef typename TField::PointType DPointType;
-  typedef itk::VectorLinearInterpolateImageFunction<TField,float> DefaultInterpolatorType;
-
-  VectorType zero;
-  zero.Fill(0);
-  VectorType disp;
-  disp.Fill(0);
-  ct=0;
-  DPointType pointIn1;
-  DPointType pointIn2;
-  typename DefaultInterpolatorType::ContinuousIndexType  vcontind;
-  DPointType pointIn3;
   enum { ImageDimension = TImage::ImageDimension };
+  typedef typename StreamlineThicknessStruct<TImage,TField>::SamplerType SamplerType;
+  typedef typename SamplerType::OutputType OutputType;
+  typedef itk::ContinuousIndex<float,ImageDimension> ContinuousIndexType;
   typedef typename TImage::IndexType IndexType;
+  const float deltaTime=str->DeltaTime;
 
-  float startprob=gm->GetPixel(velind);
-  if (sulci) startprob=sulci->GetPixel(velind);
-      bool printout=false;
-      if ( gmsurf->GetPixel(velind) > 0) printout=true;
-     IndexType index;
-     for (unsigned int jj=0; jj<ImageDimension; jj++)
-       {
-       index[jj]= velind[jj];
-       pointIn1[jj]=velind[jj]*lapgrad->GetSpacing()[jj];
-       }
-     if (task ==0)
-       {
-       propagate=false;
-       }
-     else propagate=true;
-     itime=starttime;
-     timedone=false;
-       float totalmag=0;
-     if ( domeasure ) {
-     while ( !timedone )
-       {
-       float scale = 1;//*m_DT[timeind]/m_DS[timeind];
-       //     std::cout << " scale " << scale << std::endl;
-       double itimetn1 = itime - timesign*deltaTime*scale;
-       double itimetn1h = itime - timesign*deltaTime*0.5*scale;
-       if (itimetn1h < 0 ) itimetn1h=0;
-       if (itimetn1h > m_NumberOfTimePoints-1 ) itimetn1h=m_NumberOfTimePoints-1;
-       if (itimetn1 < 0 ) itimetn1=0;
-       if (itimetn1 > m_NumberOfTimePoints-1 ) itimetn1=m_NumberOfTimePoints-1;
-
-       // first get current position of particle
-       IndexType index;
-       for (unsigned int jj=0; jj<ImageDimension; jj++)
-     {
-     index[jj]= velind[jj];
-     pointIn1[jj]=velind[jj]*lapgrad->GetSpacing()[jj];
-     }
-       //      std::cout << " ind " << index  << std::endl;
-       // now index the time varying field at that position.
-       typename DefaultInterpolatorType::OutputType f1;  f1.Fill(0);
-       typename DefaultInterpolatorType::OutputType f2;  f2.Fill(0);
-       typename DefaultInterpolatorType::OutputType f3;  f3.Fill(0);
-       typename DefaultInterpolatorType::OutputType f4;  f4.Fill(0);
-       typename DefaultInterpolatorType::ContinuousIndexType  Y1;
-       typename DefaultInterpolatorType::ContinuousIndexType  Y2;
-       typename DefaultInterpolatorType::ContinuousIndexType  Y3;
-       typename DefaultInterpolatorType::ContinuousIndexType  Y4;
-       for (unsigned int jj=0; jj<ImageDimension; jj++)
-     {
-     pointIn2[jj]=disp[jj]+pointIn1[jj];
-     vcontind[jj]=pointIn2[jj]/lapgrad->GetSpacing()[jj];
-     Y1[jj]=vcontind[jj];
-     Y2[jj]=vcontind[jj];
-     Y3[jj]=vcontind[jj];
-     Y4[jj]=vcontind[jj];
-     }
-       //Y1[ImageDimension]=itimetn1;
-       //Y2[ImageDimension]=itimetn1h;
-       //Y3[ImageDimension]=itimetn1h;
-       //      Y4[ImageDimension]=itime;
-
-       f1 = vinterp->EvaluateAtContinuousIndex( Y1 );
-       for (unsigned int jj=0; jj<ImageDimension; jj++) Y2[jj]+=f1[jj]*deltaTime*0.5;
-       bool isinside=true;
-       for (unsigned int jj=0; jj<ImageDimension; jj++) if (Y2[jj] < 1 || Y2[jj] > lapgrad->GetLargestPossibleRegion().GetSize()[jj] -2 ) isinside=false;
-       if (isinside) f2 = vinterp->EvaluateAtContinuousIndex( Y2 );
-       for (unsigned int jj=0; jj<ImageDimension; jj++) Y3[jj]+=f2[jj]*deltaTime*0.5;
-       isinside=true;
-       for (unsigned int jj=0; jj<ImageDimension; jj++) if (Y3[jj] < 1 || Y3[jj] > lapgrad->GetLargestPossibleRegion().GetSize()[jj] -2 ) isinside=false;
-       if (isinside) f3 = vinterp->EvaluateAtContinuousIndex( Y3 );
-       for (unsigned int jj=0; jj<ImageDimension; jj++) Y4[jj]+=f3[jj]*deltaTime;
-       isinside=true;
-       for (unsigned int jj=0; jj<ImageDimension; jj++) if (Y4[jj] < 1 || Y4[jj] > lapgrad->GetLargestPossibleRegion().GetSize()[jj] -2 ) isinside=false;
-       if (isinside)      f4 = vinterp->EvaluateAtContinuousIndex( Y4 );
-
-       for (unsigned int jj=0; jj<ImageDimension; jj++)
-     pointIn3[jj] = pointIn2[jj] + gradsign*vecsign*deltaTime/6.0 * ( f1[jj] + 2.0*f2[jj] + 2.0*f3[jj] + f4[jj] );
-
-
-       VectorType out;
-       float mag=0, dmag=0;
-       for (unsigned int jj=0; jj<ImageDimension; jj++)
-     {
-     out[jj]=pointIn3[jj]-pointIn1[jj];
-     mag+=(pointIn3[jj] - pointIn2[jj])*(pointIn3[jj] - pointIn2[jj]);
-     dmag+=(pointIn3[jj] - pointIn1[jj])*(pointIn3[jj] - pointIn1[jj]);
-     disp[jj]=out[jj];
-     }
-       dmag=sqrt(dmag);
-       totalmag+=sqrt(mag);
-
-       ct++;
-       //      if (!propagate) //thislength=dmag;//
-//         thislength += totalmag;
-       itime = itime + deltaTime*timesign;
-       IndexType myind;
-       for (unsigned int qq=0; qq<  ImageDimension; qq++) myind[qq]=(unsigned long)(pointIn3[qq]/spacing[qq]+0.5);
-
-
-       if ( gm->GetPixel(myind) < 0.5 && wm->GetPixel(myind) < 0.5 ||  wm->GetPixel(myind) >= 0.5 && gm->GetPixel(myind) < 0.5 || mag < 1.e-1*deltaTime)  { timedone=true; }
-       if ( gm->GetPixel(myind) < 0.5 )  { timedone=true; }
-       if ( ct >  2.0/deltaTime ) {  timedone=true;}
-       if ( totalmag >  priorthickval ) timedone=true;
-       if (smooththick) if ( (totalmag - smooththick->GetPixel(velind)) > 1 ) timedone=true;
-
-       if (printprobability) std::cout << " ind " << Y1 << " prob " << sinterp->EvaluateAtContinuousIndex(Y1) << " t " << itime << std::endl;
-
-       }
-     }
-
-     return totalmag;
+  typename TField::PixelType disp;
+  disp.Fill(0);
+  double pointIn1[ImageDimension], pointIn2[ImageDimension], pointIn3[ImageDimension];
+  for (unsigned int jj=0; jj<ImageDimension; jj++) pointIn1[jj]=velind[jj]*str->Spacing[jj];
+
+  totals.clear();
+  float totalmag=0;
+  unsigned long ct=0;
+  bool timedone=false;
+  while ( !timedone )
+    {
+    ContinuousIndexType Y1, Y2, Y3, Y4;
+    for (unsigned int jj=0; jj<ImageDimension; jj++)
+      {
+      pointIn2[jj]=disp[jj]+pointIn1[jj];
+      Y1[jj]=pointIn2[jj]/str->Spacing[jj];
+      }
+    Y2=Y1; Y3=Y1; Y4=Y1;
+
+    // the midpoints sample the field only a voxel away from the image edge
+    OutputType f1, f2, f3, f4;
+    f2.Fill(0); f3.Fill(0); f4.Fill(0);
+    sampler.EvaluateAtContinuousIndex( Y1, f1 );
+    bool isinside=true;
+    for (unsigned int jj=0; jj<ImageDimension; jj++)
+      {
+      Y2[jj]+=f1[jj]*deltaTime*0.5;
+      if (Y2[jj] < 1 || Y2[jj] > str->Size[jj]-2 ) isinside=false;
+      }
+    if (isinside) sampler.EvaluateAtContinuousIndex( Y2, f2 );
+    isinside=true;
+    for (unsigned int jj=0; jj<ImageDimension; jj++)
+      {
+      Y3[jj]+=f2[jj]*deltaTime*0.5;
+      if (Y3[jj] < 1 || Y3[jj] > str->Size[jj]-2 ) isinside=false;
+      }
+    if (isinside) sampler.EvaluateAtContinuousIndex( Y3, f3 );
+    isinside=true;
+    for (unsigned int jj=0; jj<ImageDimension; jj++)
+      {
+      Y4[jj]+=f3[jj]*deltaTime;
+      if (Y4[jj] < 1 || Y4[jj] > str->Size[jj]-2 ) isinside=false;
+      }
+    if (isinside) sampler.EvaluateAtContinuousIndex( Y4, f4 );
 
+    float mag=0;
+    for (unsigned int jj=0; jj<ImageDimension; jj++)
+      {
+      pointIn3[jj] = pointIn2[jj] + deltaTime/6.0 * ( f1[jj] + 2.0*f2[jj] + 2.0*f3[jj] + f4[jj] );
+      mag+=(pointIn3[jj] - pointIn2[jj])*(pointIn3[jj] - pointIn2[jj]);
+      disp[jj]=pointIn3[jj]-pointIn1[jj];
+      }
+    totalmag+=sqrt(mag);
+    totals.push_back(totalmag);
+    ct++;
+
+    IndexType myind;
+    for (unsigned int qq=0; qq<ImageDimension; qq++)
+      {
+      double x=pointIn3[qq]/str->Spacing[qq]+0.5;
+      if ( x < 0 || x >= str->Size[qq] ) timedone=true;
+      else myind[qq]=(long)x;
+      }
+    if ( timedone || str->GM->GetPixel(myind) < 0.5 || mag < 1.e-1*deltaTime ) timedone=true;
+    if ( ct > 2.0/deltaTime ) timedone=true;
+    if ( totalmag > str->PriorThickness ) timedone=true;
+    if ( str->SmoothThick && ( totalmag - str->SmoothThick->GetPixel(velind) ) > 1 ) timedone=true;
+    }
+  return totalmag;
+}
+
+template <class TImage,class TField>
+ITK_THREAD_RETURN_TYPE StreamlineThicknessThreaderCallback( void *arg )
+// each thread traces the seeds of a block of voxels and updates their
+// thickness;  voxels are independent, so nothing is shared but read-only data
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  StreamlineThicknessStruct<TImage,TField> *str = static_cast<StreamlineThicknessStruct<TImage,TField> *>( info->UserData );
+  const unsigned int threadId = info->ThreadID;
+  const unsigned int threadCount = info->NumberOfThreads;
+
+  const unsigned long numberOfVoxels = str->GM->GetLargestPossibleRegion().GetNumberOfPixels();
+  const unsigned long valuesPerThread = ( numberOfVoxels + threadCount - 1 ) / threadCount;
+  const unsigned long first = vnl_math_min( numberOfVoxels, threadId * valuesPerThread );
+  const unsigned long last = vnl_math_min( numberOfVoxels, first + valuesPerThread );
+
+  std::vector<float> totals;
+  for ( unsigned long v = first; v < last; v++ )
+    {
+    typename TImage::IndexType velind = str->GM->ComputeIndex( v );
+    float totalength=0;
+    if ( str->GM->GetPixel(velind) > 0.25 )
+      {
+      // the second trace follows the same path as the first with the prior
+      // reduced by the first length, so it stops at the first step beyond it
+      totalength=1.e9;
+      for (unsigned int field=0; field<str->NumberOfFields; field++)
+        {
+        float len1=IntegrateLength<TImage,TField>( str, str->Samplers[field], velind, totals );
+        float len2=totals.back();
+        for (unsigned int k=0; k<totals.size(); k++)
+          if ( totals[k] > str->PriorThickness-len1 ) { len2=totals[k]; break; }
+        if ( field == 0 || len1+len2 < totalength ) totalength=len1+len2;
+        }
+      }
+
+    if ( str->FirstPass )
+      {
+      if ( str->ThickImage->GetPixel(velind) == 0 || ( totalength > 0 && str->ThickImage->GetPixel(velind) < totalength ) )
+        str->ThickImage->SetPixel(velind,totalength);
+      }
+    else if ( str->SmoothThick )
+      {
+      str->ThickImage->SetPixel(velind, totalength*0.5 + str->SmoothThick->GetPixel(velind)*0.5 );
+      }
+    }
+  return ITK_THREAD_RETURN_VALUE;
 }
 
 
@@ -573,6 +732,8 @@ int LaplacianThickness(int argc, char *argv[])
   float tolerance=0.001;
   if (argc >  argct ) tolerance=atof(argv[argct]); argct++;
   std::cout << " using tolerance " << tolerance << std::endl;
+  bool smoothingSolver=false;
+  if (argc >  argct ) smoothingSolver=(atoi(argv[argct]) == 1); argct++;
   typedef float  PixelType;
   typedef itk::Vector<float,ImageDimension>         VectorType;
   typedef itk::Image<VectorType,ImageDimension>     DisplacementFieldType;
@@ -664,7 +825,7 @@ int LaplacianThickness(int argc, char *argv[])
   }
 
 
-  lapgrad=LaplacianGrad<ImageType,DisplacementFieldType>(wmb,gmb,smoothparam,500,tolerance);
+  lapgrad=LaplacianGrad<ImageType,DisplacementFieldType>(wmb,gmb,smoothparam,500,tolerance,smoothingSolver);
   //  lapgrad=FMMGrad<ImageType,DisplacementFieldType>(wmb,gmb);
 
 
@@ -679,41 +840,7 @@ int LaplacianThickness(int argc, char *argv[])
   //
 
 
-  double timezero=0; //1
-  typename ImageType::SizeType s= wm->GetLargestPossibleRegion().GetSize();
-  double timeone=1;//(s[ImageDimension]-1-timezero);
-
-  //  unsigned int m_NumberOfTimePoints = s[ImageDimension];
-
-  float starttime=timezero;//timezero;
-  float finishtime=timeone;//s[ImageDimension]-1;//timeone;
-  //std::cout << " MUCKING WITH START FINISH TIME " <<  finishtime <<  std::endl;
-
-  typename DisplacementFieldType::IndexType velind;
   typename ImageType::Pointer smooththick=NULL;
-    float timesign=1.0;
-    if (starttime  >  finishtime ) timesign= -1.0;
-    unsigned int m_NumberOfTimePoints=2;
-    typedef   DisplacementFieldType TimeVaryingVelocityFieldType;
-    typedef itk::ImageRegionIteratorWithIndex<DisplacementFieldType>         FieldIterator;
-    typedef typename DisplacementFieldType::IndexType DIndexType;
-    typedef typename DisplacementFieldType::PointType DPointType;
-    typedef typename TimeVaryingVelocityFieldType::IndexType VIndexType;
-    typedef typename TimeVaryingVelocityFieldType::PointType VPointType;
-    typedef itk::VectorLinearInterpolateImageFunction<TimeVaryingVelocityFieldType,float> DefaultInterpolatorType;
-    typedef itk::VectorLinearInterpolateImageFunction<DisplacementFieldType,float> DefaultInterpolatorType2;
-    typename DefaultInterpolatorType::Pointer vinterp =  DefaultInterpolatorType::New();
-    typedef itk::LinearInterpolateImageFunction<ImageType,float> ScalarInterpolatorType;
-    typename ScalarInterpolatorType::Pointer sinterp =  ScalarInterpolatorType::New();
-    sinterp->SetInputImage(gm);
-    if (sulci)  sinterp->SetInputImage(sulci);
-    VectorType zero;
-    zero.Fill(0);
-
-  DPointType pointIn1;
-  DPointType pointIn2;
-  typename DefaultInterpolatorType::ContinuousIndexType  vcontind;
-  DPointType pointIn3;
 
   typedef itk::ImageRegionIteratorWithIndex<DisplacementFieldType> VIteratorType;
   VIteratorType VIterator( lapgrad, lapgrad->GetLargestPossibleRegion().GetSize() );
@@ -737,87 +864,33 @@ int LaplacianThickness(int argc, char *argv[])
     }
       ++VIterator;
     }
-  bool propagate=false;
-  for (unsigned int smoothit=0; smoothit<nsmooth; smoothit++)
-    {
-    std::cout << " smoothit " << smoothit << std::endl;
-    Iterator.GoToBegin();
-    unsigned int  cter=0;
-    while(  !Iterator.IsAtEnd()  )
-      {
-      velind=Iterator.GetIndex();
-      //      float thislength=0;
 
-      for (unsigned int task=0; task<1; task++)
+  typedef StreamlineThicknessStruct<ImageType,DisplacementFieldType> StreamlineStructType;
+  StreamlineStructType str;
+  str.WM=wm;
+  str.GM=gm;
+  str.ThickImage=thickimage2;
+  str.Samplers[0].Initialize( lapgrad );
+  str.NumberOfFields=1;
+  if (lapgrad2)
     {
-    float itime = starttime;
-    float inverr=0;
-
-    unsigned long ct = 0;
-    bool timedone = false;
-
-    inverr=1110;
-
-    VectorType disp;
-    disp.Fill(0.0);
-    double deltaTime=dT,vecsign=1.0;
-    bool domeasure=false;
-    float gradsign=1.0;
-    bool printprobability=false;
-//    std::cout << " wmb " << wmb->GetPixel(velind) << " gm " << gm->GetPixel(velind) << std::endl;
-//    if (surf->GetPixel(velind) != 0) printprobability=true;
-    if ( gm->GetPixel(velind) > 0.25 )//&& wmb->GetPixel(velind) < 1 )
-      {
-      cter++;
-      domeasure=true;
-      }
-    vinterp->SetInputImage(lapgrad);
-    gradsign=-1.0; vecsign=-1.0;
-    float len1=IntegrateLength<ImageType,DisplacementFieldType,DefaultInterpolatorType,ScalarInterpolatorType>
-      (gmsurf, thickimage, velind, lapgrad,  itime, starttime, finishtime,  timedone,  deltaTime,  vinterp, sinterp,task,propagate,domeasure,m_NumberOfTimePoints,spacing,vecsign, gradsign, timesign, ct, wm,gm, priorthickval , smooththick , printprobability , sulci );
-
-    gradsign=1.0;  vecsign=1;
-    float len2=IntegrateLength<ImageType,DisplacementFieldType,DefaultInterpolatorType,ScalarInterpolatorType>
-      (gmsurf, thickimage, velind, lapgrad,  itime, starttime, finishtime,  timedone,  deltaTime,  vinterp, sinterp,task,propagate,domeasure,m_NumberOfTimePoints,spacing,vecsign, gradsign, timesign, ct,wm,gm , priorthickval-len1 , smooththick , printprobability , sulci );
-
-    float len3=1.e9,len4=1.e9;
-    if (lapgrad2)
-      {
-      vinterp->SetInputImage(lapgrad2);
-      gradsign=-1.0; vecsign=-1.0;
-      len3=IntegrateLength<ImageType,DisplacementFieldType,DefaultInterpolatorType,ScalarInterpolatorType>
-        (gmsurf, thickimage, velind, lapgrad2,  itime, starttime, finishtime,  timedone,  deltaTime,  vinterp, sinterp,task,propagate,domeasure,m_NumberOfTimePoints,spacing,vecsign, gradsign, timesign, ct, wm,gm, priorthickval , smooththick , printprobability , sulci );
-
-    gradsign=1.0;  vecsign=1;
-      len4=IntegrateLength<ImageType,DisplacementFieldType,DefaultInterpolatorType,ScalarInterpolatorType>
-      (gmsurf, thickimage, velind, lapgrad2,  itime, starttime, finishtime,  timedone,  deltaTime,  vinterp, sinterp,task,propagate,domeasure,m_NumberOfTimePoints,spacing,vecsign, gradsign, timesign, ct,wm,gm , priorthickval-len3, smooththick , printprobability , sulci );
-      }
-    float totalength=len1+len2;
-//    if (totalength > 5 && totalength <  8) std::cout<< " t1 " << len3+len4 << " t2 " << len1+len2 << std::endl;
-    if (len3+len4 < totalength) totalength=len3+len4;
-
-    if (smoothit==0)
-      {
-    if ( thickimage2->GetPixel(velind) == 0  )
-      {
-      thickimage2->SetPixel(velind,totalength);
-      }
-    else if ( (totalength) > 0 &&  thickimage2->GetPixel(velind) < (totalength) )
-      {
-      thickimage2->SetPixel(velind,totalength);
-      }
-      }
-    if ( smoothit > 0 && smooththick )
-      {
-      thickimage2->SetPixel(velind, (totalength)*0.5 + smooththick->GetPixel(velind)*0.5 );
-      }
-
-
-    if (domeasure && (totalength)> 0 && cter % 10000 == 0) std::cout << " len1 " << len1 << " len2 " << len2 << " ind " << velind << std::endl;
-
+    str.Samplers[1].Initialize( lapgrad2 );
+    str.NumberOfFields=2;
     }
-      ++Iterator;
-      }
+  str.Spacing=spacing;
+  str.Size=wm->GetLargestPossibleRegion().GetSize();
+  str.DeltaTime=dT;
+  str.PriorThickness=priorthickval;
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads( itk::MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  threader->SetSingleMethod( StreamlineThicknessThreaderCallback<ImageType,DisplacementFieldType>, &str );
+  for (unsigned int smoothit=0; smoothit<nsmooth; smoothit++)
+    {
+    std::cout << " smoothit " << smoothit << std::endl;
+    str.SmoothThick=smooththick;
+    str.FirstPass=(smoothit==0);
+    threader->SingleMethodExecute();
 
     smooththick=SmoothImage<ImageType>(thickimage2,1.0);
 
@@ -846,7 +919,10 @@ int main(int argc, char *argv[])
 
   if ( argc < 4)
   {
-    std::cout << "Usage:   " << argv[0] << " WM.nii GM.nii   Out.nii  {smoothparam=3} {priorthickval=5}  {dT=0.01}  use-sulcus-prior optional-laplacian-tolerance=0.001" << std::endl;
+    std::cout << "Usage:   " << argv[0] << " WM.nii GM.nii   Out.nii  {smoothparam=3} {priorthickval=5}  {dT=0.01}  use-sulcus-prior optional-laplacian-tolerance=0.001 optional-laplacian-solver=0" << std::endl;
+    std::cout << " the laplacian is solved on the gm band by red-black SOR (solver 0) until the largest residual, the distance of a band voxel " << std::endl;
+    std::cout << " from the spacing-weighted mean of its neighbours, is below the tolerance;  L is 1 in the wm and 2 outside the gm. " << std::endl;
+    std::cout << " solver 1 is the previous iterated Gaussian smoothing, where the tolerance bounds the change in the mean of the band. " << std::endl;
     std::cout << " a good value for use sulcus prior is 0.15 -- in a function :  1/(1.+exp(-0.1*(laplacian-img-value-sulcprob)/0.01)) " << std::endl;
     return 1;
   }
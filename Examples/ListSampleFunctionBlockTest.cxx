@@ -0,0 +1,179 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: ListSampleFunctionBlockTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkListSample.h"
+#include "antsGaussianListSampleFunction.h"
+#include "antsLogEuclideanGaussianListSampleFunction.h"
+
+/** Evaluates a list sample function at every measurement of its sample, one
+ * point at a time and in blocks of blocksize measurements (the last block
+ * may be shorter), and returns the largest difference relative to the
+ * largest value. */
+template <class TFunction, class TSample>
+double MaximumBlockDifference( const TFunction *function, const TSample *sample, unsigned long blocksize )
+{
+  typename TFunction::InputMeasurementVectorBlockType block;
+  std::vector<float> values( blocksize );
+  double maxdifference = 0, maxvalue = 0;
+  for (unsigned long start=0; start < sample->Size(); start += blocksize)
+    {
+    block.clear();
+    for (unsigned long i=start; i < sample->Size() && i < start + blocksize; i++)
+      {
+      block.push_back( sample->GetMeasurementVector( i ) );
+      }
+    function->EvaluateBlock( block, &values[0], 0 );
+    for (unsigned long n=0; n < block.size(); n++)
+      {
+      const double point = function->Evaluate( block[n] );
+      maxdifference = vnl_math_max( maxdifference, fabs( values[n] - point ) );
+      maxvalue = vnl_math_max( maxvalue, fabs( point ) );
+      }
+    }
+  return maxdifference / vnl_math_max( maxvalue, 1.e-30 );
+}
+
+/** Builds list samples from the voxel intensities of one or more images:
+ * one component per image for the Gaussian, and the three components of a
+ * 2x2 positive definite tensor made from the images, taken cyclically, for
+ * the log-Euclidean Gaussian.  Compares EvaluateBlock() of both functions
+ * with Evaluate() at every voxel. */
+template <unsigned int ImageDimension>
+int ListSampleFunctionBlockTest(unsigned int argc, char *argv[])
+{
+  typedef float  PixelType;
+  typedef itk::Image<PixelType,ImageDimension>      ImageType;
+  typedef itk::Array<float>                         MeasurementVectorType;
+  typedef itk::Statistics::ListSample<MeasurementVectorType> SampleType;
+  typedef itk::ants::Statistics::GaussianListSampleFunction
+    <SampleType, float, float> GaussianType;
+  typedef itk::ants::Statistics::LogEuclideanGaussianListSampleFunction
+    <SampleType, float, float> LogEuclideanType;
+
+  unsigned int argct=2;
+  unsigned long blocksize = atol(argv[argct]); argct++;
+  double tolerance = atof(argv[argct]); argct++;
+  if ( blocksize < 1 ) blocksize = 1;
+  std::vector<typename ImageType::Pointer> images;
+  std::vector<float> maxima;
+  for ( ; argct < argc; argct++)
+    {
+    typename ImageType::Pointer image = NULL;
+    ReadImage<ImageType>(image, argv[argct]);
+    images.push_back(image);
+    float maximum = 0;
+    itk::ImageRegionConstIterator<ImageType> It( image, image->GetLargestPossibleRegion() );
+    for ( It.GoToBegin(); !It.IsAtEnd(); ++It ) maximum = vnl_math_max( maximum, It.Get() );
+    maxima.push_back( vnl_math_max( maximum, 1.0f ) );
+    }
+  const unsigned int components = images.size();
+
+  typename SampleType::Pointer sample = SampleType::New();
+  sample->SetMeasurementVectorSize( components );
+  typename SampleType::Pointer tensors = SampleType::New();
+  tensors->SetMeasurementVectorSize( 3 );
+  std::vector<itk::ImageRegionConstIterator<ImageType> > iterators;
+  for (unsigned int c=0; c < components; c++)
+    {
+    iterators.push_back( itk::ImageRegionConstIterator<ImageType>(
+      images[c], images[0]->GetLargestPossibleRegion() ) );
+    iterators[c].GoToBegin();
+    }
+  while ( !iterators[0].IsAtEnd() )
+    {
+    MeasurementVectorType measurement( components );
+    for (unsigned int c=0; c < components; c++)
+      {
+      measurement[c] = iterators[c].Get();
+      ++iterators[c];
+      }
+    sample->PushBack( measurement );
+
+    // eigenvalues exp( u0 ) and exp( u1 ), off-diagonal below their mean
+    const float u0 = measurement[0] / maxima[0];
+    const float u1 = measurement[1 % components] / maxima[1 % components];
+    const float u2 = measurement[2 % components] / maxima[2 % components];
+    MeasurementVectorType tensor( 3 );
+    tensor[0] = exp( u0 );
+    tensor[2] = exp( u1 );
+    tensor[1] = 0.5 * sqrt( tensor[0] * tensor[2] ) * ( 2.0 * u2 - 1.0 );
+    tensors->PushBack( tensor );
+    }
+
+  typename GaussianType::ListSampleWeightArrayType weights( sample->Size() );
+  weights.Fill( 1.0 );
+
+  typename GaussianType::Pointer gaussian = GaussianType::New();
+  gaussian->SetListSampleWeights( &weights );
+  typename LogEuclideanType::Pointer logeuclidean = LogEuclideanType::New();
+  logeuclidean->SetListSampleWeights( &weights );
+  try
+    {
+    gaussian->SetInputListSample( sample );
+    logeuclidean->SetInputListSample( tensors );
+    }
+  catch( itk::ExceptionObject & e )
+    {
+    std::cerr << e << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  const double gaussiandifference = MaximumBlockDifference<GaussianType, SampleType>( gaussian, sample, blocksize );
+  const double logeuclideandifference = MaximumBlockDifference<LogEuclideanType, SampleType>( logeuclidean, tensors, blocksize );
+  std::cout << " " << sample->Size() << " samples of " << components << " components, blocks of " << blocksize << std::endl;
+  std::cout << " Gaussian              max block difference " << gaussiandifference << " of the largest value " << std::endl;
+  std::cout << " log-Euclidean Gaussian max block difference " << logeuclideandifference << " of the largest value " << std::endl;
+  if ( gaussiandifference > tolerance )
+    {
+    std::cerr << " EvaluateBlock of the Gaussian differs from Evaluate " << std::endl;
+    return EXIT_FAILURE;
+    }
+  if ( logeuclideandifference > tolerance )
+    {
+    std::cerr << " EvaluateBlock of the log-Euclidean Gaussian differs from Evaluate " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 5 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension BlockSize Tolerance image1.ext {image2.ext ...} " << std::endl;
+    std::cout << "  Evaluates the Gaussian of the voxel intensities, one component per image, and the" << std::endl;
+    std::cout << "  log-Euclidean Gaussian of 2x2 tensors made from them, one voxel at a time and in" << std::endl;
+    std::cout << "  blocks of BlockSize voxels.  Fails if the largest difference, relative to the largest" << std::endl;
+    std::cout << "  value, exceeds Tolerance. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return ListSampleFunctionBlockTest<2>(argc,argv);
+    case 3:
+      return ListSampleFunctionBlockTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -0,0 +1,137 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: ManifoldParzenLookupGridTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkListSample.h"
+#include "antsManifoldParzenWindowsListSampleFunction.h"
+
+/** Builds a manifold Parzen density from the voxel intensities of one or
+ * more images, one component per image, with and without the lookup grid,
+ * and compares the two at every voxel. */
+template <unsigned int ImageDimension>
+int ManifoldParzenLookupGridTest(unsigned int argc, char *argv[])
+{
+  typedef float  PixelType;
+  typedef itk::Image<PixelType,ImageDimension>      ImageType;
+  typedef itk::Array<float>                         MeasurementVectorType;
+  typedef itk::Statistics::ListSample<MeasurementVectorType> SampleType;
+  typedef itk::ants::Statistics::ManifoldParzenWindowsListSampleFunction
+    <SampleType, float, float> FunctionType;
+
+  unsigned int argct=2;
+  float sigma = atof(argv[argct]); argct++;
+  unsigned int kneighborhood = atoi(argv[argct]); argct++;
+  double tolerance = atof(argv[argct]); argct++;
+  std::vector<typename ImageType::Pointer> images;
+  for ( ; argct < argc; argct++)
+    {
+    typename ImageType::Pointer image = NULL;
+    ReadImage<ImageType>(image, argv[argct]);
+    images.push_back(image);
+    }
+  const unsigned int components = images.size();
+
+  typename SampleType::Pointer sample = SampleType::New();
+  sample->SetMeasurementVectorSize( components );
+  std::vector<itk::ImageRegionConstIterator<ImageType> > iterators;
+  for (unsigned int c=0; c < components; c++)
+    {
+    iterators.push_back( itk::ImageRegionConstIterator<ImageType>(
+      images[c], images[0]->GetLargestPossibleRegion() ) );
+    iterators[c].GoToBegin();
+    }
+  while ( !iterators[0].IsAtEnd() )
+    {
+    MeasurementVectorType measurement( components );
+    for (unsigned int c=0; c < components; c++)
+      {
+      measurement[c] = iterators[c].Get();
+      ++iterators[c];
+      }
+    sample->PushBack( measurement );
+    }
+
+  typename FunctionType::ListSampleWeightArrayType weights( sample->Size() );
+  weights.Fill( 1.0 );
+
+  typename FunctionType::Pointer gridded = FunctionType::New();
+  gridded->SetRegularizationSigma( sigma );
+  gridded->SetEvaluationKNeighborhood( kneighborhood );
+  gridded->UseLookupGridOn();
+  gridded->SetListSampleWeights( &weights );
+  gridded->SetInputListSample( sample );
+
+  typename FunctionType::Pointer exact = FunctionType::New();
+  exact->SetRegularizationSigma( sigma );
+  exact->SetEvaluationKNeighborhood( kneighborhood );
+  exact->UseLookupGridOff();
+  exact->SetListSampleWeights( &weights );
+  exact->SetInputListSample( sample );
+
+  if ( gridded->GetLookupGridSizeInBytes() == 0 )
+    {
+    std::cerr << " No lookup grid was built for " << sample->Size() << " samples " << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  double sumdifference = 0, sumexact = 0, maxrelative = 0;
+  for (unsigned long i=0; i < sample->Size(); i++)
+    {
+    const MeasurementVectorType & measurement = sample->GetMeasurementVector( i );
+    const double g = gridded->Evaluate( measurement );
+    const double e = exact->Evaluate( measurement );
+    sumdifference += fabs( g - e );
+    sumexact += fabs( e );
+    if ( e > 0 ) maxrelative = vnl_math_max( maxrelative, fabs( g - e ) / e );
+    }
+  const double relative = sumdifference / vnl_math_max( sumexact, 1.e-12 );
+  std::cout << " lookup grid bytes " << gridded->GetLookupGridSizeInBytes()
+            << "  mean relative difference " << relative
+            << "  max relative difference " << maxrelative << std::endl;
+  if ( relative > tolerance )
+    {
+    std::cerr << " The lookup grid differs from the kd-tree evaluation " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 6 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension RegularizationSigma EvaluationKNeighborhood Tolerance image1.ext {image2.ext ...} " << std::endl;
+    std::cout << "  Compares the manifold Parzen density of the voxel intensities, one component" << std::endl;
+    std::cout << "  per image, evaluated from the lookup grid and from the kd-tree at every voxel." << std::endl;
+    std::cout << "  Fails if the mean relative difference exceeds Tolerance. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return ManifoldParzenLookupGridTest<2>(argc,argv);
+    case 3:
+      return ManifoldParzenLookupGridTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
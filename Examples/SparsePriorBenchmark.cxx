@@ -0,0 +1,190 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: SparsePriorBenchmark.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkPointSet.h"
+#include "itkTimeProbe.h"
+#include "antsSparseProbabilityImage.h"
+
+/** The sparse prior of Atropos before the row-indexed store:  the linear
+ * index of every voxel above the threshold is kept as a float coordinate of
+ * a point set, and every lookup scatters the whole set into a new image, as
+ * GetPriorProbabilityImage() did for each voxel. */
+template <class TImage>
+class OldSparsePriorImage
+{
+public:
+  typedef itk::PointSet<typename TImage::PixelType, 1> SparseImageType;
+
+  void SetImage( const TImage *image, typename TImage::PixelType threshold )
+    {
+    this->m_Region = image->GetRequestedRegion();
+    this->m_Reference = image;
+    this->m_Points = SparseImageType::New();
+    this->m_Points->Initialize();
+    unsigned long count = 0;
+    itk::ImageRegionConstIteratorWithIndex<TImage> It( image, this->m_Region );
+    for ( It.GoToBegin(); !It.IsAtEnd(); ++It )
+      {
+      if ( It.Get() > threshold )
+        {
+        typename SparseImageType::PointType number;
+        number[0] = this->IndexToNumber( It.GetIndex() );
+        this->m_Points->SetPoint( count, number );
+        this->m_Points->SetPointData( count, It.Get() );
+        count++;
+        }
+      }
+    }
+
+  typename TImage::PixelType GetValue( const typename TImage::IndexType & index ) const
+    {
+    typename TImage::Pointer image = TImage::New();
+    image->CopyInformation( this->m_Reference );
+    image->SetRegions( this->m_Region );
+    image->Allocate();
+    image->FillBuffer( 0 );
+    typename SparseImageType::PointsContainer::ConstIterator It = this->m_Points->GetPoints()->Begin();
+    typename SparseImageType::PointDataContainer::ConstIterator ItD = this->m_Points->GetPointData()->Begin();
+    for ( ; It != this->m_Points->GetPoints()->End(); ++It, ++ItD )
+      {
+      image->SetPixel( this->NumberToIndex( static_cast<unsigned long>( It.Value()[0] ) ), ItD.Value() );
+      }
+    return image->GetPixel( index );
+    }
+
+private:
+  unsigned long IndexToNumber( const typename TImage::IndexType & index ) const
+    {
+    unsigned long number = 0, stride = 1;
+    for ( unsigned int d = 0; d < TImage::ImageDimension; d++ )
+      {
+      number += stride * ( index[d] - this->m_Region.GetIndex()[d] );
+      stride *= this->m_Region.GetSize()[d];
+      }
+    return number;
+    }
+
+  typename TImage::IndexType NumberToIndex( unsigned long number ) const
+    {
+    typename TImage::IndexType index;
+    for ( unsigned int d = 0; d < TImage::ImageDimension; d++ )
+      {
+      index[d] = this->m_Region.GetIndex()[d] + number % this->m_Region.GetSize()[d];
+      number /= this->m_Region.GetSize()[d];
+      }
+    return index;
+    }
+
+  typename TImage::RegionType          m_Region;
+  typename TImage::ConstPointer        m_Reference;
+  typename SparseImageType::Pointer    m_Points;
+};
+
+/** Times voxel lookups of a prior probability image stored densely, in the
+ * row-indexed sparse store and in the old point set sparse store, and checks
+ * that the three give the same values.  The old store is looked up at every
+ * Stride-th voxel only. */
+template <unsigned int ImageDimension>
+int SparsePriorBenchmark(unsigned int argc, char *argv[])
+{
+  typedef float                                      PixelType;
+  typedef itk::Image<PixelType,ImageDimension>       ImageType;
+  typedef itk::ants::SparseProbabilityImage<ImageType> SparseImageType;
+
+  unsigned int argct=2;
+  typename ImageType::Pointer prior = NULL;
+  ReadImage<ImageType>(prior, argv[argct]); argct++;
+  PixelType threshold = atof(argv[argct]); argct++;
+  unsigned long stride = atol(argv[argct]); argct++;
+  if ( stride < 1 ) stride = 1;
+
+  // the stores index from a zero start, as GetPriorProbability() does
+  typename ImageType::RegionType region = prior->GetLargestPossibleRegion();
+  typename ImageType::IndexType zero;
+  zero.Fill( 0 );
+  region.SetIndex( zero );
+  prior->SetRegions( region );
+
+  SparseImageType sparse;
+  sparse.SetImage( prior, threshold );
+  OldSparsePriorImage<ImageType> oldsparse;
+  oldsparse.SetImage( prior, threshold );
+
+  std::vector<typename ImageType::IndexType> indices;
+  itk::ImageRegionConstIteratorWithIndex<ImageType> It( prior, region );
+  for ( It.GoToBegin(); !It.IsAtEnd(); ++It ) indices.push_back( It.GetIndex() );
+
+  double densesum = 0, sparsesum = 0, oldsum = 0;
+  unsigned long mismatches = 0, oldlookups = 0;
+  itk::TimeProbe denseclock, sparseclock, oldclock;
+  denseclock.Start();
+  for ( unsigned long i=0; i < indices.size(); i++ ) densesum += prior->GetPixel( indices[i] );
+  denseclock.Stop();
+  sparseclock.Start();
+  for ( unsigned long i=0; i < indices.size(); i++ ) sparsesum += sparse.GetValue( indices[i] );
+  sparseclock.Stop();
+  oldclock.Start();
+  for ( unsigned long i=0; i < indices.size(); i += stride, oldlookups++ ) oldsum += oldsparse.GetValue( indices[i] );
+  oldclock.Stop();
+
+  for ( unsigned long i=0; i < indices.size(); i++ )
+    {
+    const PixelType dense = ( prior->GetPixel( indices[i] ) > threshold ) ? prior->GetPixel( indices[i] ) : 0;
+    if ( sparse.GetValue( indices[i] ) != dense ) mismatches++;
+    if ( i % stride == 0 && oldsparse.GetValue( indices[i] ) != dense ) mismatches++;
+    }
+
+  std::cout << " " << indices.size() << " voxels, " << sparse.GetNumberOfValues() << " above " << threshold << std::endl;
+  std::cout << " dense          " << 1.e6 * denseclock.GetTotal() / indices.size() << " us per lookup " << std::endl;
+  std::cout << " sparse rows    " << 1.e6 * sparseclock.GetTotal() / indices.size() << " us per lookup " << std::endl;
+  std::cout << " old sparse     " << 1.e6 * oldclock.GetTotal() / oldlookups << " us per lookup ("
+            << oldlookups << " lookups) " << std::endl;
+  std::cout << " sums " << densesum << " " << sparsesum << " " << oldsum << std::endl;
+  if ( mismatches > 0 )
+    {
+    std::cerr << mismatches << " lookups differ from the thresholded dense prior " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 5 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension prior.ext ProbabilityThreshold Stride " << std::endl;
+    std::cout << "  Times voxel lookups of the prior stored densely, in the row-indexed sparse store of Atropos" << std::endl;
+    std::cout << "  and in the point set sparse store it replaced, looked up at every Stride-th voxel.  Fails if" << std::endl;
+    std::cout << "  a sparse lookup differs from the dense prior thresholded at ProbabilityThreshold. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return SparsePriorBenchmark<2>(argc,argv);
+    case 3:
+      return SparsePriorBenchmark<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -0,0 +1,120 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: SpatialMutualInformationTableTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkSpatialMutualInformationRegistrationFunction.h"
+
+/** Evaluates the spatial mutual information of two images and its update
+ * at every voxel with the tabulated derivative term and with the direct
+ * B-spline evaluation, and compares the two. */
+template <unsigned int ImageDimension>
+int SpatialMutualInformationTableTest(unsigned int argc, char *argv[])
+{
+  typedef float                                     PixelType;
+  typedef itk::Image<PixelType,ImageDimension>      ImageType;
+  typedef itk::Vector<float,ImageDimension>         VectorType;
+  typedef itk::Image<VectorType,ImageDimension>     FieldType;
+  typedef itk::SpatialMutualInformationRegistrationFunction<ImageType,ImageType,FieldType> MetricType;
+
+  unsigned int argct=2;
+  typename ImageType::Pointer fixed = NULL;
+  ReadImage<ImageType>(fixed, argv[argct]); argct++;
+  typename ImageType::Pointer moving = NULL;
+  ReadImage<ImageType>(moving, argv[argct]); argct++;
+  unsigned int bins = atoi(argv[argct]); argct++;
+  unsigned int oversampling = atoi(argv[argct]); argct++;
+  double tolerance = atof(argv[argct]); argct++;
+
+  VectorType zero;  zero.Fill( 0 );
+  typename FieldType::Pointer field = FieldType::New();
+  field->CopyInformation( fixed );
+  field->SetRegions( fixed->GetLargestPossibleRegion() );
+  field->Allocate();
+  field->FillBuffer( zero );
+
+  typename MetricType::RadiusType radius;
+  radius.Fill( 0 );
+  typename MetricType::Pointer metric[2];
+  for (unsigned int m=0; m < 2; m++)
+    {
+    metric[m] = MetricType::New();
+    metric[m]->SetFixedImage( fixed );
+    metric[m]->SetMovingImage( moving );
+    metric[m]->SetDisplacementField( field );
+    metric[m]->SetRadius( radius );
+    metric[m]->SetNormalizeGradient( false );
+    metric[m]->SetNumberOfHistogramBins( bins );
+    metric[m]->SetDerivativeTableOversampling( ( m == 0 ) ? oversampling : 0 );
+    metric[m]->InitializeIteration();
+    }
+
+  const double tabulatedvalue = metric[0]->ComputeSpatialMutualInformation();
+  const double directvalue = metric[1]->ComputeSpatialMutualInformation();
+
+  void *globaldata[2] = { metric[0]->GetGlobalDataPointer(), metric[1]->GetGlobalDataPointer() };
+  typename MetricType::NeighborhoodType neighborhood( radius, field, field->GetLargestPossibleRegion() );
+  double maxdifference = 0, maxupdate = 0;
+  itk::ImageRegionIteratorWithIndex<FieldType> It( field, field->GetLargestPossibleRegion() );
+  for ( It.GoToBegin(); !It.IsAtEnd(); ++It )
+    {
+    neighborhood.SetLocation( It.GetIndex() );
+    VectorType tabulated = metric[0]->ComputeUpdate( neighborhood, globaldata[0] );
+    VectorType direct = metric[1]->ComputeUpdate( neighborhood, globaldata[1] );
+    maxdifference = vnl_math_max( maxdifference, (double)( tabulated - direct ).GetNorm() );
+    maxupdate = vnl_math_max( maxupdate, (double)direct.GetNorm() );
+    }
+  metric[0]->ReleaseGlobalDataPointer( globaldata[0] );
+  metric[1]->ReleaseGlobalDataPointer( globaldata[1] );
+
+  const double relativevalue = fabs( tabulatedvalue - directvalue ) / vnl_math_max( fabs( directvalue ), 1.e-12 );
+  const double relativeupdate = maxdifference / vnl_math_max( maxupdate, 1.e-12 );
+  std::cout << " SMI tabulated " << tabulatedvalue << "  direct " << directvalue
+            << "  max update difference " << relativeupdate << " of the largest update " << std::endl;
+  if ( relativevalue > tolerance || relativeupdate > tolerance )
+    {
+    std::cerr << " The tabulated derivative term differs from the direct evaluation " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 7 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension fixed.ext moving.ext NumberOfHistogramBins DerivativeTableOversampling Tolerance " << std::endl;
+    std::cout << "  Computes the spatial mutual information of fixed.ext and moving.ext and its update at every" << std::endl;
+    std::cout << "  voxel with the derivative term tabulated at the given oversampling and evaluated directly" << std::endl;
+    std::cout << "  (oversampling 0).  Fails if the values or the largest update difference, relative to the" << std::endl;
+    std::cout << "  largest update, exceed Tolerance. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return SpatialMutualInformationTableTest<2>(argc,argv);
+    case 3:
+      return SpatialMutualInformationTableTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -19,6 +19,7 @@
 #include <itkImageRegionIteratorWithIndex.h>
 
 #include "itkTDistribution.h"
+#include "itkMultiThreader.h"
 #include "vnl/vnl_math.h"
 #include "vnl/vnl_erf.h"
 
@@ -81,16 +82,26 @@ void generatePermGroup(int * groupID, int lengthGroupA, int lengthGroupB,
 int smallerPermElem(PermElement * elem1, PermElement * elem2);
 
 static int first = 0;
+static bool permutationSeedGiven = false;
+static unsigned int permutationSeed = 0;
+
+void seedPermutations()
+// seeds rand() once, with the seed given on the command line or the time,
+// so that a given seed reproduces the permutations and the p-values
+{
+  if (!first) {
+    first = 1;
+    if (permutationSeedGiven) srand(permutationSeed);
+    else srand(time(NULL));
+  }
+}
 
 void generatePermGroup(int * groupID, int lengthGroupA, int lengthGroupB,
                  int * genGroupID)
 // generate a permutation of group assignments
 {
   int numSubjects = lengthGroupA + lengthGroupB;
-  if (!first) {
-    first = 1; srand(time(NULL));
-    //cout << "generatePermGroup called" << endl;
-  }
+  seedPermutations();
   int * newPerm = new int [numSubjects];
   generatePerm(numSubjects, newPerm);
   for (int i=0; i<numSubjects; i++) {
@@ -104,10 +115,7 @@ void generatePermGroup(int * groupID, int lengthGroupA, int lengthGroupB,
 
 void generatePerm(int length, int * genPerm)
 {
-    if (!first) {
-     first = 1;srand(time(NULL));
-     //cout << "generatePerm called" << endl;
-    }
+    seedPermutations();
     PermElement * newPerm = new PermElement[length];
     int cnt;
     for (cnt = 0; cnt < length; cnt++) {
@@ -139,11 +147,7 @@ double computeQuantile(int numObs, double * stat, double quantile)
 // numObs = Number of Observations
 // stat = double array[numObs ] contains the test statisticss
 {
-  static int first = 0;
-    if (!first) {
-     first = 1;
-     srand(time(NULL));
-    }
+    seedPermutations();
 
     StatElement * sortStat= new StatElement[numObs];
 
@@ -178,11 +182,7 @@ void computePermStatPval(int numFeatures, int numPerms,
 // permStat = double array[numPerms * numFeatures] contains the test statistics
 // permStatPval = double array [numPerms * numFeatures] returns the p-val of the statistics
 {
-    static int first = 0;
-    if (!first) {
-     first = 1;
-     srand(time(NULL));
-    }
+    seedPermutations();
 
     int feat;
     int perm;
@@ -371,6 +371,181 @@ double TTest(int numSubjects,   int* groupLabel, double * featureValue )
 
 }
 
+// Permutation engine.  The subjects of one block of voxels are copied to a
+// subject-by-voxel buffer, centred per voxel, and the group sums of every
+// permutation are accumulated over the smaller group, which is the product of
+// the permutation indicator matrix with the block.  Each thread works through
+// its own range of blocks and keeps, per voxel, how many permutations reach
+// the observed |t| and, per permutation, the maximum |t| over its voxels, so
+// nothing of size numPerms * numVoxels is stored.
+
+#define PERMBLOCKSIZE 256
+
+typedef struct
+{
+  unsigned int numSubjects;
+  unsigned int numSubjectsA;
+  unsigned int numSubjectsB;
+  unsigned int numPerms;
+  unsigned long numVoxels;
+  bool sumGroupA;                     // which group the permutations list
+  std::vector<unsigned int> permGroup; // numPerms rows of the summed group's subjects
+  std::vector<const float *> subjectBuffers;
+  std::vector<double> absStat;        // observed |t| per voxel
+  std::vector<unsigned int> exceedCount; // permutations with |t| >= observed, per voxel
+  std::vector<std::vector<double> > threadMaxStat; // max |t| per permutation, per thread
+} PermTestStruct;
+
+inline double PermTTest(double sumSmall, double sumSqSmall, double sum, double sumSq, const PermTestStruct *str)
+// the statistic of TTest from the group sums
+{
+  double sumA = str->sumGroupA ? sumSmall : sum - sumSmall;
+  double sumSqA = str->sumGroupA ? sumSqSmall : sumSq - sumSqSmall;
+  double sumB = sum - sumA;
+  double sumSqB = sumSq - sumSqA;
+  float n1 = (float) str->numSubjectsA;
+  float n2 = (float) str->numSubjectsB;
+  double meanA = sumA / n1;
+  double meanB = sumB / n2;
+  double varA = sumSqA / n1 - meanA * meanA;
+  double varB = sumSqB / n2 - meanB * meanB;
+  if (varA < 0) varA = 0;
+  if (varB < 0) varB = 0;
+  float denom = varA/n1 + varB/n2;
+  if ( denom > 0) return (meanA - meanB)/sqrt(denom);
+  return 0;
+}
+
+ITK_THREAD_RETURN_TYPE PermTestThreaderCallback( void *arg )
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  PermTestStruct *str = static_cast<PermTestStruct *>( info->UserData );
+  itk::ThreadIdType threadId = info->ThreadID;
+  itk::ThreadIdType threadCount = info->NumberOfThreads;
+
+  const unsigned int numSubjects = str->numSubjects;
+  const unsigned int numSmall = str->sumGroupA ? str->numSubjectsA : str->numSubjectsB;
+  const unsigned long numBlocks = ( str->numVoxels + PERMBLOCKSIZE - 1 ) / PERMBLOCKSIZE;
+  const unsigned long blocksPerThread = ( numBlocks + threadCount - 1 ) / threadCount;
+  const unsigned long firstBlock = threadId * blocksPerThread;
+  const unsigned long lastBlock = std::min( firstBlock + blocksPerThread, numBlocks );
+
+  std::vector<double> & maxStat = str->threadMaxStat[threadId];
+  maxStat.assign( str->numPerms, 0.0 );
+
+  std::vector<double> values( numSubjects * PERMBLOCKSIZE );
+  std::vector<double> squares( numSubjects * PERMBLOCKSIZE );
+  double sum[PERMBLOCKSIZE], sumSq[PERMBLOCKSIZE], sumSmall[PERMBLOCKSIZE], sumSqSmall[PERMBLOCKSIZE];
+
+  for (unsigned long block = firstBlock; block < lastBlock; block++) {
+    const unsigned long firstVoxel = block * PERMBLOCKSIZE;
+    const unsigned int n = (unsigned int) std::min<unsigned long>( PERMBLOCKSIZE, str->numVoxels - firstVoxel );
+
+    // load and centre the block, the t statistic does not depend on the offset
+    for (unsigned int b = 0; b < n; b++) sum[b] = 0;
+    for (unsigned int subj = 0; subj < numSubjects; subj++) {
+      const float *source = str->subjectBuffers[subj] + firstVoxel;
+      double *row = &values[subj * PERMBLOCKSIZE];
+      for (unsigned int b = 0; b < n; b++) {
+        row[b] = source[b];
+        sum[b] += row[b];
+      }
+    }
+    for (unsigned int b = 0; b < n; b++) sum[b] /= numSubjects;
+    for (unsigned int subj = 0; subj < numSubjects; subj++) {
+      double *row = &values[subj * PERMBLOCKSIZE];
+      double *rowSq = &squares[subj * PERMBLOCKSIZE];
+      for (unsigned int b = 0; b < n; b++) {
+        row[b] -= sum[b];
+        rowSq[b] = row[b] * row[b];
+      }
+    }
+    for (unsigned int b = 0; b < n; b++) { sum[b] = 0; sumSq[b] = 0; }
+    for (unsigned int subj = 0; subj < numSubjects; subj++) {
+      const double *row = &values[subj * PERMBLOCKSIZE];
+      const double *rowSq = &squares[subj * PERMBLOCKSIZE];
+      for (unsigned int b = 0; b < n; b++) { sum[b] += row[b]; sumSq[b] += rowSq[b]; }
+    }
+
+    // permutation 0 is the observed labelling
+    for (unsigned int perm = 0; perm < str->numPerms; perm++) {
+      const unsigned int *group = &str->permGroup[perm * numSmall];
+      for (unsigned int b = 0; b < n; b++) { sumSmall[b] = 0; sumSqSmall[b] = 0; }
+      for (unsigned int i = 0; i < numSmall; i++) {
+        const double *row = &values[group[i] * PERMBLOCKSIZE];
+        const double *rowSq = &squares[group[i] * PERMBLOCKSIZE];
+        for (unsigned int b = 0; b < n; b++) { sumSmall[b] += row[b]; sumSqSmall[b] += rowSq[b]; }
+      }
+      double blockMax = 0;
+      for (unsigned int b = 0; b < n; b++) {
+        double stat = fabs( PermTTest( sumSmall[b], sumSqSmall[b], sum[b], sumSq[b], str ) );
+        if (perm == 0) {
+          str->absStat[firstVoxel + b] = stat;
+          str->exceedCount[firstVoxel + b] = 0;
+        }
+        if (stat >= str->absStat[firstVoxel + b]) str->exceedCount[firstVoxel + b]++;
+        if (stat > blockMax) blockMax = stat;
+      }
+      if (blockMax > maxStat[perm]) maxStat[perm] = blockMax;
+    }
+  }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <class TImageType>
+void PermutationTest(std::vector<typename TImageType::Pointer> & imagestack, int* groupLabel,
+                     unsigned int numSubjectsA, unsigned int numSubjectsB, unsigned int numPerms,
+                     typename TImageType::Pointer PImage, typename TImageType::Pointer FWEImage)
+// two-sided permutation p-values of the t statistic, uncorrected in PImage and
+// family-wise corrected by the maximum statistic in FWEImage;  the observed
+// labelling counts as one of the numPerms permutations
+{
+  PermTestStruct str;
+  str.numSubjects = numSubjectsA + numSubjectsB;
+  str.numSubjectsA = numSubjectsA;
+  str.numSubjectsB = numSubjectsB;
+  str.numPerms = numPerms;
+  str.numVoxels = PImage->GetLargestPossibleRegion().GetNumberOfPixels();
+  str.sumGroupA = ( numSubjectsA <= numSubjectsB );
+  const int smallLabel = str.sumGroupA ? GROUPALABEL : GROUPBLABEL;
+
+  int * permLabel = new int [str.numSubjects];
+  for (unsigned int perm = 0; perm < numPerms; perm++) {
+    if (perm == 0) for (unsigned int subj = 0; subj < str.numSubjects; subj++) permLabel[subj] = groupLabel[subj];
+    else generatePermGroup(groupLabel, numSubjectsA, numSubjectsB, permLabel);
+    for (unsigned int subj = 0; subj < str.numSubjects; subj++)
+      if (permLabel[subj] == smallLabel) str.permGroup.push_back(subj);
+  }
+  delete [] permLabel;
+
+  for (unsigned int subj = 0; subj < str.numSubjects; subj++)
+    str.subjectBuffers.push_back( imagestack[subj]->GetBufferPointer() );
+  str.absStat.resize( str.numVoxels );
+  str.exceedCount.resize( str.numVoxels );
+
+  itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads( itk::MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  str.threadMaxStat.resize( threader->GetNumberOfThreads() );
+  std::cout << " permutations " << numPerms << " on " << threader->GetNumberOfThreads() << " threads " << std::endl;
+  threader->SetSingleMethod( PermTestThreaderCallback, &str );
+  threader->SingleMethodExecute();
+
+  // distribution of the maximum statistic over the image
+  std::vector<double> maxStat( numPerms, 0.0 );
+  for (unsigned int t = 0; t < str.threadMaxStat.size(); t++)
+    for (unsigned int perm = 0; perm < str.threadMaxStat[t].size(); perm++)
+      maxStat[perm] = std::max( maxStat[perm], str.threadMaxStat[t][perm] );
+  std::sort( maxStat.begin(), maxStat.end() );
+
+  float *pval = PImage->GetBufferPointer();
+  float *fwepval = FWEImage->GetBufferPointer();
+  for (unsigned long v = 0; v < str.numVoxels; v++) {
+    pval[v] = (double) str.exceedCount[v] / (double) numPerms;
+    unsigned long below = std::lower_bound( maxStat.begin(), maxStat.end(), str.absStat[v] ) - maxStat.begin();
+    fwepval[v] = (double) ( numPerms - below ) / (double) numPerms;
+  }
+}
+
 template <unsigned int ImageDimension>
 int StudentsTestOnImages(int argc, char *argv[])
 {
@@ -389,6 +564,13 @@ int StudentsTestOnImages(int argc, char *argv[])
   int* groupLabel = new int [numSubjects];
   for (unsigned int i=0; i < numSubjectsA; i++) groupLabel[i]=0;
   for (unsigned int i=numSubjectsA; i < numSubjects; i++) groupLabel[i]=1;
+  unsigned int numPerms=0;
+  if ( argc > (int) ( 5 + numSubjects ) ) numPerms=atoi(argv[5+numSubjects]);
+  if ( argc > (int) ( 6 + numSubjects ) )
+    {
+    permutationSeed=atoi(argv[6+numSubjects]);
+    permutationSeedGiven=true;
+    }
   double* feature = new double [numvals];
   for (unsigned int i=0; i < numvals; i++) feature[i]=0;
 
@@ -447,6 +629,14 @@ int StudentsTestOnImages(int argc, char *argv[])
    PImage->SetBufferedRegion( region );
    PImage->Allocate();
    PImage->FillBuffer(0);
+   typename ImageType::Pointer FWEImage=ImageType::New();
+   FWEImage->SetSpacing( spacing );
+   FWEImage->SetOrigin( origin );
+   FWEImage->SetLargestPossibleRegion(region );
+   FWEImage->SetRequestedRegion( region );
+   FWEImage->SetBufferedRegion( region );
+   FWEImage->Allocate();
+   FWEImage->FillBuffer(0);
 
 //   unsigned int sizeofpixel=sizeof(PixelType);
 
@@ -493,8 +683,17 @@ int StudentsTestOnImages(int argc, char *argv[])
 
 
   WriteImage(StatImage,outname.c_str());
-  std::string soutname=std::string("PVAL")+outname;
-  //WriteImage(PImage,soutname.c_str());
+  if ( numPerms > 0 )
+    {
+    PermutationTest<ImageType>(imagestack, groupLabel, numSubjectsA, numSubjectsB, numPerms, PImage, FWEImage);
+    // prefix the file name, not the directory, of OutName
+    std::string::size_type namepos=outname.find_last_of("/\\");
+    namepos = ( namepos == std::string::npos ) ? 0 : namepos+1;
+    std::string soutname=outname.substr(0,namepos)+std::string("PVAL")+outname.substr(namepos);
+    WriteImage(PImage,soutname.c_str());
+    std::string foutname=outname.substr(0,namepos)+std::string("FWEPVAL")+outname.substr(namepos);
+    WriteImage(FWEImage,foutname.c_str());
+    }
 
 
   return 1;
@@ -523,9 +722,11 @@ std::cout << " 100    1.98     2.63     3.39  " << std::endl;
 
 if ( argc < 6 )
   {
-  std::cout << "Usage: " << argv[0] <<  " ImageDimension  OutName NGroup1 NGroup2 ControlV1*   SubjectV1*   " << std::endl;
+  std::cout << "Usage: " << argv[0] <<  " ImageDimension  OutName NGroup1 NGroup2 ControlV1*   SubjectV1*  [NPermutations] [Seed] " << std::endl;
   std::cout << " Assume all images the same size " << std::endl;
   std::cout <<" Writes out an F-Statistic image " << std::endl;
+  std::cout <<" With NPermutations, also writes the two-sided permutation p-values to PVAL<OutName> and the family-wise corrected (max statistic) p-values to FWEPVAL<OutName> " << std::endl;
+  std::cout <<" Seed fixes the random permutations, so that the p-values are reproducible;  without it the time seeds them " << std::endl;
   std::cout <<  " \n example call \n  \n ";
   std::cout << argv[0] << "  2  TEST.nii.gz 4 8 FawtJandADCcon/*SUB.nii  FawtJandADCsub/*SUB.nii  \n ";
   return 1;
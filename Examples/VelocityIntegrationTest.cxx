@@ -0,0 +1,153 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: VelocityIntegrationTest.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#include "ReadWriteImage.h"
+#include "itkANTSImageRegistrationOptimizer.h"
+
+/** Builds a smooth time-varying velocity field on the lattice of a reference
+ * image, integrates it forward and backward with the batched, threaded
+ * integrator and voxel by voxel with IntegratePointVelocity, and compares
+ * the end points. */
+template <unsigned int ImageDimension>
+int VelocityIntegrationTest(unsigned int argc, char *argv[])
+{
+  typedef double                                                   RealType;
+  typedef itk::ANTSImageRegistrationOptimizer<ImageDimension,RealType> OptimizerType;
+  typedef typename OptimizerType::ImageType                        ImageType;
+  typedef typename OptimizerType::VectorType                       VectorType;
+  typedef typename OptimizerType::DisplacementFieldType            FieldType;
+  typedef typename OptimizerType::TimeVaryingVelocityFieldType     TimeVaryingFieldType;
+
+  unsigned int argct=2;
+  typename ImageType::Pointer reference = NULL;
+  ReadImage<ImageType>(reference, argv[argct]); argct++;
+  double amplitude = atof(argv[argct]); argct++;
+  unsigned int timepoints = atoi(argv[argct]); argct++;
+  double deltatime = atof(argv[argct]); argct++;
+  double tolerance = atof(argv[argct]); argct++;
+
+  /** The velocity lattice is the reference lattice with a time axis. */
+  typename TimeVaryingFieldType::RegionType tregion;
+  typename TimeVaryingFieldType::SpacingType tspacing;
+  typename TimeVaryingFieldType::PointType torigin;
+  typename TimeVaryingFieldType::DirectionType tdirection;
+  tdirection.SetIdentity();
+  for (unsigned int d=0; d < ImageDimension; d++)
+    {
+    tregion.SetIndex( d, reference->GetLargestPossibleRegion().GetIndex()[d] );
+    tregion.SetSize( d, reference->GetLargestPossibleRegion().GetSize()[d] );
+    tspacing[d] = reference->GetSpacing()[d];
+    torigin[d] = reference->GetOrigin()[d];
+    for (unsigned int e=0; e < ImageDimension; e++) tdirection[d][e] = reference->GetDirection()[d][e];
+    }
+  tregion.SetIndex( ImageDimension, 0 );
+  tregion.SetSize( ImageDimension, timepoints );
+  tspacing[ImageDimension] = 1;
+  torigin[ImageDimension] = 0;
+
+  typename TimeVaryingFieldType::Pointer velocity = TimeVaryingFieldType::New();
+  velocity->SetRegions( tregion );
+  velocity->SetSpacing( tspacing );
+  velocity->SetOrigin( torigin );
+  velocity->SetDirection( tdirection );
+  velocity->Allocate();
+
+  itk::ImageRegionIteratorWithIndex<TimeVaryingFieldType> Iv( velocity, tregion );
+  for ( Iv.GoToBegin(); !Iv.IsAtEnd(); ++Iv )
+    {
+    typename TimeVaryingFieldType::IndexType index = Iv.GetIndex();
+    const double t = (double)index[ImageDimension] / (double)vnl_math_max( timepoints - 1, 1u );
+    VectorType v;
+    for (unsigned int d=0; d < ImageDimension; d++)
+      {
+      const unsigned int e = ( d + 1 ) % ImageDimension;
+      const double u = (double)( index[d] - tregion.GetIndex()[d] ) / (double)( tregion.GetSize()[d] - 1 );
+      const double w = (double)( index[e] - tregion.GetIndex()[e] ) / (double)( tregion.GetSize()[e] - 1 );
+      v[d] = amplitude * tspacing[d] * sin( vnl_math::pi * u ) * cos( 2.0 * vnl_math::pi * ( w + 0.25 * t ) );
+      }
+    Iv.Set( v );
+    }
+
+  VectorType zero;  zero.Fill( 0 );
+  typename FieldType::Pointer field = FieldType::New();
+  field->CopyInformation( reference );
+  field->SetRegions( reference->GetLargestPossibleRegion() );
+  field->Allocate();
+  field->FillBuffer( zero );
+
+  typename OptimizerType::Pointer optimizer = OptimizerType::New();
+  optimizer->SetDisplacementField( field );
+  optimizer->SetTimeVaryingVelocityField( velocity );
+  optimizer->SetDeltaTime( deltatime );
+
+  double minspacing = reference->GetSpacing()[0];
+  for (unsigned int d=1; d < ImageDimension; d++) minspacing = vnl_math_min( minspacing, (double)reference->GetSpacing()[d] );
+
+  double maxdifference = 0;
+  for (unsigned int direction=0; direction < 2; direction++)
+    {
+    const RealType start = ( direction == 0 ) ? 0 : 1;
+    const RealType finish = 1 - start;
+    typename FieldType::Pointer batched = FieldType::New();
+    batched->CopyInformation( field );
+    batched->SetRegions( field->GetLargestPossibleRegion() );
+    batched->Allocate();
+    batched->FillBuffer( zero );
+    optimizer->IntegrateVelocityBatched( start, finish, batched, NULL );
+
+    itk::ImageRegionConstIteratorWithIndex<FieldType> It( batched, batched->GetLargestPossibleRegion() );
+    for ( It.GoToBegin(); !It.IsAtEnd(); ++It )
+      {
+      VectorType disp = optimizer->IntegratePointVelocity( start, finish, It.GetIndex() );
+      maxdifference = vnl_math_max( maxdifference, (double)( disp - It.Get() ).GetNorm() / minspacing );
+      }
+    }
+
+  std::cout << " max difference between batched and per-point integration " << maxdifference << " voxels " << std::endl;
+  if ( maxdifference > tolerance )
+    {
+    std::cerr << " The batched integration differs from the per-point integration " << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if ( argc < 7 )
+    {
+    std::cout << "Basic useage ex: " << std::endl;
+    std::cout << argv[0] << " ImageDimension reference.ext AmplitudeInVoxels NumberOfTimePoints DeltaTime Tolerance " << std::endl;
+    std::cout << "  Integrates a smooth time-varying velocity field on the lattice of reference.ext from 0 to 1" << std::endl;
+    std::cout << "  and from 1 to 0, batched over all voxels and one point at a time.  Fails if any end point" << std::endl;
+    std::cout << "  differs by more than Tolerance voxels. " << std::endl;
+    return 1;
+    }
+
+  // Get the image dimension
+  switch( atoi(argv[1]))
+    {
+    case 2:
+      return VelocityIntegrationTest<2>(argc,argv);
+    case 3:
+      return VelocityIntegrationTest<3>(argc,argv);
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      exit( EXIT_FAILURE );
+    }
+
+  return 0;
+}
@@ -1,12 +1,16 @@
 #include <vector>
 #include <string>
+#include <algorithm>
 #include "itkImageFileReader.h"
 #include "itkVector.h"
 //#include "itkVectorImageFileReader.h"
 #include "itkImageFileWriter.h"
+#include "itkImageIOFactory.h"
+#include "itkStreamingImageFilter.h"
 #include "itkMatrixOffsetTransformBase.h"
 #include "itkTransformFactory.h"
 #include "itkWarpImageMultiTransformFilter.h"
+#include "itkDisplacementFieldFromMultiTransformFilter.h"
 #include "itkTransformFileReader.h"
 #include "itkNearestNeighborInterpolateImageFunction.h"
 #include "itkBSplineInterpolateImageFunction.h"
@@ -62,6 +66,10 @@ typedef struct{
     bool use_TightestBoundingBox;
     char * reference_image_filename;
     bool use_RotationHeader;
+    double memory_budget_mb;
+    std::vector<std::string> extra_moving_image_filenames;
+    std::vector<std::string> extra_output_image_filenames;
+    char * composed_warp_filename;
 
     MLINTERP_OPT opt_ML;
 } MISC_OPT;
@@ -163,6 +171,10 @@ bool ParseInput(int argc, char **argv, char *&moving_image_filename,
     misc_opt.use_BSpline_interpolator = false;
     misc_opt.use_TightestBoundingBox = false;
     misc_opt.use_RotationHeader = false;
+    misc_opt.memory_budget_mb = 0;
+    misc_opt.extra_moving_image_filenames.clear();
+    misc_opt.extra_output_image_filenames.clear();
+    misc_opt.composed_warp_filename = NULL;
 
     misc_opt.use_NN_interpolator=false;
     misc_opt.use_MultiLabel_interpolator=false;
@@ -230,6 +242,23 @@ bool ParseInput(int argc, char **argv, char *&moving_image_filename,
               }
         }
 
+        else if (strcmp(argv[ind], "--memory-budget")==0) {
+            ind++; if(ind >= argc) return false;
+            misc_opt.memory_budget_mb = atof(argv[ind]);
+            if (misc_opt.memory_budget_mb <= 0){
+                std::cerr << "--memory-budget expects a positive size in MB" << std::endl;
+                return false;
+            }
+        }
+        else if (strcmp(argv[ind], "--extra-image")==0) {
+            ind+=2; if(ind >= argc) return false;
+            misc_opt.extra_moving_image_filenames.push_back(argv[ind-1]);
+            misc_opt.extra_output_image_filenames.push_back(argv[ind]);
+        }
+        else if (strcmp(argv[ind], "--write-composed-warp")==0) {
+            ind++; if(ind >= argc) return false;
+            misc_opt.composed_warp_filename = argv[ind];
+        }
         else if (strcmp(argv[ind], "-R")==0) {
             ind++; if(ind >= argc) return false;
             misc_opt.reference_image_filename = argv[ind];
@@ -381,6 +410,21 @@ bool ParseInput(int argc, char **argv, char *&moving_image_filename,
 
     }
 
+    if (misc_opt.extra_moving_image_filenames.size() > 0){
+        // every image shares one chain on one grid, so the grid must not
+        // come from the first moving image
+        if (misc_opt.reference_image_filename == NULL){
+            std::cout << "--extra-image needs -R: all images are warped onto the reference image grid" << std::endl;
+            return false;
+        }
+        for (unsigned int i = 0; i < opt_queue.size(); i++){
+            if (opt_queue[i].file_type == IMAGE_AFFINE_HEADER && opt_queue[i].filename == moving_image_filename){
+                std::cout << "--extra-image cannot be used with --moving-image-header, which differs between images" << std::endl;
+                return false;
+            }
+        }
+    }
+
     return true;
 }
 
@@ -559,6 +603,71 @@ void GetLaregstSizeAfterWarp(WarperPointerType &warper, ImagePointerType &img, S
 }
 
 
+template<class ImageType>
+typename ImageType::PixelType ReadFirstPixel(const char *filename){
+    // a one-voxel streamed read, for when the image itself is not resident
+    typedef itk::ImageFileReader<ImageType> ImageFileReaderType;
+    typename ImageFileReaderType::Pointer reader = ImageFileReaderType::New();
+    reader->SetFileName(filename);
+    reader->UpdateOutputInformation();
+    typename ImageType::RegionType corner = reader->GetOutput()->GetLargestPossibleRegion();
+    typename ImageType::SizeType one; one.Fill(1);
+    corner.SetSize(one);
+    reader->GetOutput()->SetRequestedRegion(corner);
+    reader->Update();
+    return reader->GetOutput()->GetPixel(corner.GetIndex());
+}
+
+template<class WarperType>
+void WriteWarpedImage(WarperType *warper, const char *output_image_filename,
+        double memory_budget_mb, unsigned int fieldcount){
+    typedef typename WarperType::OutputImageType ImageType;
+    typedef typename WarperType::DisplacementFieldType::PixelType VectorType;
+    const unsigned int ImageDimension = WarperType::ImageDimension;
+
+    typedef itk::ImageFileWriter<ImageType> ImageFileWriterType;
+    typename ImageFileWriterType::Pointer writer_img = ImageFileWriterType::New();
+    writer_img->SetFileName(output_image_filename);
+
+    if (memory_budget_mb <= 0){
+        writer_img->SetInput(warper->GetOutput());
+        writer_img->Update();
+        return;
+    }
+
+    // per output voxel a slab holds the output, about as much of the moving
+    // image, a piece of every displacement field and the mapped point
+    double voxels = 1;
+    for (unsigned int d = 0; d < ImageDimension; d++) voxels *= warper->GetOutputSize()[d];
+    const double bytes = voxels * ( 2.0*sizeof(typename ImageType::PixelType) + fieldcount*sizeof(VectorType)
+                                    + sizeof(typename WarperType::PointType) + 1 );
+    unsigned int ndivisions = static_cast<unsigned int>( ceil( bytes / (memory_budget_mb*1024.0*1024.0) ) );
+    ndivisions = std::max( ndivisions, 1u );
+    ndivisions = std::min( ndivisions, static_cast<unsigned int>( warper->GetOutputSize()[ImageDimension-1] ) );
+
+    itk::ImageIOBase::Pointer io = itk::ImageIOFactory::CreateImageIO( output_image_filename, itk::ImageIOFactory::WriteMode );
+    if (io.IsNotNull() && io->CanStreamWrite()){
+        std::cout << "streaming the output in " << ndivisions << " slabs" << std::endl;
+        writer_img->SetImageIO(io);
+        writer_img->SetNumberOfStreamDivisions(ndivisions);
+        writer_img->SetInput(warper->GetOutput());
+        writer_img->Update();
+    }
+    else {
+        // the output format cannot be written piecewise:  the output is
+        // assembled in memory but the inputs are still read in slabs
+        std::cout << "streaming the inputs in " << ndivisions << " slabs (output format cannot stream)" << std::endl;
+        typedef itk::StreamingImageFilter<ImageType, ImageType> StreamerType;
+        typename StreamerType::Pointer streamer = StreamerType::New();
+        streamer->SetInput(warper->GetOutput());
+        streamer->SetNumberOfStreamDivisions(ndivisions);
+        streamer->Update();
+        writer_img->SetInput(streamer->GetOutput());
+        writer_img->Update();
+    }
+}
+
+
 template<int ImageDimension, unsigned int NVectorComponents>
 void WarpImageMultiTransform(char *moving_image_filename, char *output_image_filename,
         TRAN_OPT_QUEUE &opt_queue, MISC_OPT &misc_opt){
@@ -576,9 +685,14 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
 
     typedef itk::ImageFileReader<ImageType> ImageFileReaderType;
     typedef itk::ImageFileReader<RefImageType> VectorImageFileReaderType;
+    // with a memory budget only the headers are read here;  the warper
+    // pulls the sub-regions it needs slab by slab from the readers
+    const bool use_streaming = (misc_opt.memory_budget_mb > 0);
+
     typename ImageFileReaderType::Pointer reader_img = ImageFileReaderType::New();
     reader_img->SetFileName(moving_image_filename);
-    reader_img->Update();
+    if (use_streaming) reader_img->UpdateOutputInformation();
+    else reader_img->Update();
     typename ImageType::Pointer img_mov = ImageType::New();
 
     img_mov = reader_img->GetOutput();
@@ -588,7 +702,8 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
     typename VectorImageFileReaderType::Pointer reader_img_ref = VectorImageFileReaderType::New();
     if (misc_opt.reference_image_filename){
         reader_img_ref->SetFileName(misc_opt.reference_image_filename);
-        reader_img_ref->Update();
+        if (use_streaming) reader_img_ref->UpdateOutputInformation();
+        else reader_img_ref->Update();
         img_ref = reader_img_ref->GetOutput();
     }
     // else
@@ -599,6 +714,13 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
     PixelType zero; zero.Fill(0);
     warper->SetEdgePaddingValue( zero );
 
+    if (use_streaming){
+        // the warper pads with the first voxel of the moving image, which
+        // may not be in the slab being read, so fetch it up front
+        warper->SetEdgePaddingValue( ReadFirstPixel<ImageType>(moving_image_filename) );
+        warper->UseStreamingOn();
+    }
+
 
 
     if (misc_opt.use_NN_interpolator){
@@ -653,8 +775,10 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
 
     typedef itk::TransformFileReader TranReaderType;
     typedef itk::ImageFileReader<DisplacementFieldType> FieldReaderType;
+    std::vector<typename FieldReaderType::Pointer> field_readers;
     bool takeaffinv=false;
     unsigned int   transcount=0;
+    unsigned int   fieldcount=0;
     const int kOptQueueSize = opt_queue.size();
     for(int i=0; i<kOptQueueSize; i++){
         const TRAN_OPT &opt = opt_queue[i];
@@ -728,7 +852,11 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
         case DEFORMATION_FILE:{
             typename FieldReaderType::Pointer field_reader = FieldReaderType::New();
             field_reader->SetFileName( opt.filename );
-            field_reader->Update();
+            // when streaming the warper reads the part of the field each
+            // slab maps through, so the reader must outlive this loop
+            if (use_streaming) field_reader->UpdateOutputInformation();
+            else field_reader->Update();
+            field_readers.push_back(field_reader);
             typename DisplacementFieldType::Pointer field = field_reader->GetOutput();
 
             warper->PushBackDisplacementFieldTransform(field);
@@ -738,6 +866,7 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
             warper->SetOutputDirection(field->GetDirection());
 
             transcount++;
+            fieldcount++;
             break;
         }
         default:
@@ -810,7 +939,47 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
 
     // warper->PrintTransformList();
     warper->DetermineFirstDeformNoInterp();
-    warper->Update();
+
+    // With several moving images, or when asked to keep it, the chain is
+    // composed once into a displacement field on the output grid.  Every
+    // image is then warped through that single field, looked up without
+    // interpolation, instead of through the whole chain.
+    if (misc_opt.extra_moving_image_filenames.size() > 0 || misc_opt.composed_warp_filename){
+        if (use_streaming){
+            std::cout << "the transform chain is not precomposed with --memory-budget" << std::endl;
+        }
+        else {
+            typedef itk::DisplacementFieldFromMultiTransformFilter<DisplacementFieldType,
+                DisplacementFieldType, AffineTransformType> ComposerType;
+            typename ComposerType::Pointer composer = ComposerType::New();
+            composer->PushBackTransformList(warper.GetPointer());
+            composer->SetOutputSize(warper->GetOutputSize());
+            composer->SetOutputSpacing(warper->GetOutputSpacing());
+            composer->SetOutputOrigin(warper->GetOutputOrigin());
+            composer->SetOutputDirection(warper->GetOutputDirection());
+            composer->DetermineFirstDeformNoInterp();
+            composer->Update();
+            typename DisplacementFieldType::Pointer composed = composer->GetOutput();
+
+            if (misc_opt.composed_warp_filename){
+                typedef itk::ImageFileWriter<DisplacementFieldType> FieldWriterType;
+                typename FieldWriterType::Pointer field_writer = FieldWriterType::New();
+                field_writer->SetFileName(misc_opt.composed_warp_filename);
+                field_writer->SetInput(composed);
+                field_writer->Update();
+                std::cout << "composed warp written to " << misc_opt.composed_warp_filename << std::endl;
+            }
+
+            warper->GetTransformList().clear();
+            warper->PushBackDisplacementFieldTransform(composed);
+            warper->DetermineFirstDeformNoInterp();
+            fieldcount = 1;
+        }
+    }
+
+    // the output takes the orientation of the reference in both modes
+    if (img_ref) warper->SetOutputDirection(img_ref->GetDirection());
+    if (!use_streaming) warper->Update();
 
     //    {
     //        typename ImageType::IndexType ind_orig, ind_warped;
@@ -837,12 +1006,26 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
     typename ImageType::Pointer img_output = ImageType::New();
     img_output=warper->GetOutput();
 
-    typedef itk::ImageFileWriter<ImageType> ImageFileWriterType;
-    typename ImageFileWriterType::Pointer writer_img = ImageFileWriterType::New();
-    if (img_ref) img_output->SetDirection(img_ref->GetDirection());
-    writer_img->SetFileName(output_image_filename);
-    writer_img->SetInput(img_output);
-    writer_img->Update();
+    WriteWarpedImage(warper.GetPointer(), output_image_filename, misc_opt.memory_budget_mb, fieldcount);
+
+    // further moving images reuse the warper and its (composed) chain
+    for (unsigned int k = 0; k < misc_opt.extra_moving_image_filenames.size(); k++){
+        const char *extra_moving = misc_opt.extra_moving_image_filenames[k].c_str();
+        const char *extra_output = misc_opt.extra_output_image_filenames[k].c_str();
+        std::cout << "warping " << extra_moving << " -> " << extra_output << std::endl;
+
+        typename ImageFileReaderType::Pointer reader_extra = ImageFileReaderType::New();
+        reader_extra->SetFileName(extra_moving);
+        if (use_streaming){
+            reader_extra->UpdateOutputInformation();
+            warper->SetEdgePaddingValue( ReadFirstPixel<ImageType>(extra_moving) );
+        }
+        else reader_extra->Update();
+
+        warper->SetInput(reader_extra->GetOutput());
+        if (!use_streaming) warper->Update();
+        WriteWarpedImage(warper.GetPointer(), extra_output, misc_opt.memory_budget_mb, fieldcount);
+    }
 }
 
 
@@ -888,6 +1071,12 @@ int main(int argc, char **argv){
     std::cout << "       It can be used together with -R. This is typically not used together with any other transforms.\n " << std::endl;
 
     std::cout << " --use-NN: Use Nearest Neighbor Interpolation. \n " << std::endl;
+    std::cout << " --extra-image moving_image output_image: Also warp moving_image into output_image with the same transforms; may be repeated. Requires -R. " << std::endl;
+    std::cout << "       The transforms are then composed once into a single warp on the output grid, which all images are resampled through. \n " << std::endl;
+    std::cout << " --write-composed-warp filename: Save the composed warp, which can be passed as the only transform in later calls. \n " << std::endl;
+    std::cout << " --memory-budget MB: Warp the output in slabs, reading only the parts of the moving image and of the warps each slab needs, so roughly MB megabytes are in use at a time. " << std::endl;
+    std::cout << "       The moving image is read in parts with the default linear and with nearest neighbor interpolation only, and compressed files (e.g. .nii.gz) are read whole. " << std::endl;
+    std::cout << "       The output is written slab by slab when its format supports streamed writing (e.g. .nrrd, .mha, .nii). \n " << std::endl;
     std::cout << " --use-BSpline: Use 3rd order B-Spline Interpolation. \n " << std::endl;
     std::cout << " --use-ML sigma: Use anti-aliasing interpolation for multi-label images, with Gaussian smoothing with standard deviation sigma. \n " << std::endl;
   std::cout << "                 Sigma can be specified in physical or voxel units, as in Convert3D. It can be a scalar or a vector. \n " << std::endl;
@@ -11,6 +11,7 @@
 #include "itkVectorNearestNeighborInterpolateImageFunction.h"
 #include "ReadWriteImage.h"
 #include "itkWarpImageMultiTransformFilter.h"
+#include "itkDisplacementFieldFromMultiTransformFilter.h"
 #include "itkExtractImageFilter.h"
 
 typedef enum{INVALID_FILE=1, AFFINE_FILE, DEFORMATION_FILE, IMAGE_AFFINE_HEADER, IDENTITY_TRANSFORM} TRAN_FILE_TYPE;
@@ -35,6 +36,8 @@ typedef struct{
     bool use_TightestBoundingBox;
     char * reference_image_filename;
     bool use_RotationHeader;
+    std::vector<std::string> extra_moving_image_filenames;
+    std::vector<std::string> extra_output_image_filenames;
 } MISC_OPT;
 
 void DisplayOptQueue(const TRAN_OPT_QUEUE &opt_queue);
@@ -126,6 +129,8 @@ bool ParseInput(int argc, char **argv, char *&moving_image_filename,
     misc_opt.use_NN_interpolator = false;
     misc_opt.use_TightestBoundingBox = false;
     misc_opt.use_RotationHeader = false;
+    misc_opt.extra_moving_image_filenames.clear();
+    misc_opt.extra_output_image_filenames.clear();
 
     moving_image_filename = argv[0];
     output_image_filename = argv[1];
@@ -140,6 +145,11 @@ bool ParseInput(int argc, char **argv, char *&moving_image_filename,
         if (strcmp(argv[ind], "--use-NN")==0) {
             misc_opt.use_NN_interpolator = true;
         }
+        else if (strcmp(argv[ind], "--extra-image")==0) {
+            ind+=2; if(ind >= argc) return false;
+            misc_opt.extra_moving_image_filenames.push_back(argv[ind-1]);
+            misc_opt.extra_output_image_filenames.push_back(argv[ind]);
+        }
         else if (strcmp(argv[ind], "-R")==0) {
             ind++; if(ind >= argc) return false;
             misc_opt.reference_image_filename = argv[ind];
@@ -291,6 +301,21 @@ bool ParseInput(int argc, char **argv, char *&moving_image_filename,
 
     }
 
+    if (misc_opt.extra_moving_image_filenames.size() > 0){
+        // every image shares one chain on one grid, so the grid must not
+        // come from the first moving image
+        if (misc_opt.reference_image_filename == NULL){
+            std::cout << "--extra-image needs -R: all images are warped onto the reference image grid" << std::endl;
+            return false;
+        }
+        for (unsigned int i = 0; i < opt_queue.size(); i++){
+            if (opt_queue[i].file_type == IMAGE_AFFINE_HEADER && opt_queue[i].filename == moving_image_filename){
+                std::cout << "--extra-image cannot be used with --moving-image-header, which differs between images" << std::endl;
+                return false;
+            }
+        }
+    }
+
     return true;
 }
 
@@ -469,9 +494,38 @@ void GetLaregstSizeAfterWarp(WarperPointerType &warper, ImagePointerType &img, S
 }
 
 
+// Compose the transform chain of a warper into one displacement field on its
+// output grid.  Points that leave the chain get the maximal displacement, so
+// a warper using the field pads them as the full chain would.
+template<class WarperType>
+typename WarperType::DisplacementFieldType::Pointer ComposeTransformChain(WarperType *chain){
+    typedef typename WarperType::DisplacementFieldType DisplacementFieldType;
+    typedef itk::DisplacementFieldFromMultiTransformFilter<DisplacementFieldType,
+        DisplacementFieldType, typename WarperType::TransformType> ComposerType;
+    typename ComposerType::Pointer composer = ComposerType::New();
+    composer->PushBackTransformList(chain);
+    composer->SetOutputSize(chain->GetOutputSize());
+    composer->SetOutputSpacing(chain->GetOutputSpacing());
+    composer->SetOutputOrigin(chain->GetOutputOrigin());
+    composer->SetOutputDirection(chain->GetOutputDirection());
+    composer->DetermineFirstDeformNoInterp();
+    composer->Update();
+    return composer->GetOutput();
+}
+
+template<class WarperType>
+void UseComposedField(WarperType *warper, typename WarperType::DisplacementFieldType *field){
+    warper->PushBackDisplacementFieldTransform(field);
+    warper->SetOutputSize(field->GetLargestPossibleRegion().GetSize());
+    warper->SetOutputOrigin(field->GetOrigin());
+    warper->SetOutputSpacing(field->GetSpacing());
+    warper->SetOutputDirection(field->GetDirection());
+}
+
 template<int ImageDimension>
 void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_image_filename,
-        TRAN_OPT_QUEUE &opt_queue, MISC_OPT &misc_opt)
+        TRAN_OPT_QUEUE &opt_queue, MISC_OPT &misc_opt,
+        typename itk::Image<itk::Vector<float, ImageDimension-1>, ImageDimension-1>::Pointer &composed_field)
 {
 
   typedef itk::Image<float, ImageDimension> VectorImageType;  // 4D contains functional image
@@ -543,18 +597,10 @@ void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_imag
   std::cout << " 4D-Out-Size " <<  transformedvecimage->GetLargestPossibleRegion().GetSize() << std::endl;
   std::cout << " 4D-Out-Dir " << transformedvecimage->GetDirection() << std::endl;
 
-  unsigned int timedims=img_mov->GetLargestPossibleRegion().GetSize()[ImageDimension-1];
-  for (unsigned int timedim=0;  timedim < timedims ;  timedim++ ) {
-
-    typename WarperType::Pointer  warper = WarperType::New();
-    warper->SetEdgePaddingValue(0);
-
-    if (misc_opt.use_NN_interpolator){
-        typedef typename itk::NearestNeighborInterpolateImageFunction<ImageType, typename WarperType::CoordRepType> NNInterpolateType;
-        typename NNInterpolateType::Pointer interpolator_NN = NNInterpolateType::New();
-        std::cout <<  " Use Nearest Neighbor interpolation " << std::endl;
-        warper->SetInterpolator(interpolator_NN);
-    }
+  // read the transforms once and compose them into a single field on the
+  // reference grid;  every volume is then warped through that field
+  if (composed_field.IsNull()) {
+    typename WarperType::Pointer  chain = WarperType::New();
 
     typedef itk::TransformFileReader TranReaderType;
     typedef itk::ImageFileReader<DisplacementFieldType> FieldReaderType;
@@ -577,12 +623,12 @@ void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_imag
                 aff = aff_inv;
             }
             // std::cout <<" aff " << transcount <<  std::endl;
-            warper->PushBackAffineTransform(aff);
+            chain->PushBackAffineTransform(aff);
             if (transcount==0){
-                warper->SetOutputSize(img_ref->GetLargestPossibleRegion().GetSize());
-                warper->SetOutputSpacing(img_ref->GetSpacing());
-                warper->SetOutputOrigin(img_ref->GetOrigin());
-                warper->SetOutputDirection(img_ref->GetDirection());
+                chain->SetOutputSize(img_ref->GetLargestPossibleRegion().GetSize());
+                chain->SetOutputSpacing(img_ref->GetSpacing());
+                chain->SetOutputOrigin(img_ref->GetOrigin());
+                chain->SetOutputDirection(img_ref->GetDirection());
             }
             transcount++;
             break;
@@ -592,7 +638,7 @@ void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_imag
             typename AffineTransformType::Pointer aff;
             GetIdentityTransform(aff);
             // std::cout << " aff id" << transcount << std::endl;
-            warper->PushBackAffineTransform(aff);
+            chain->PushBackAffineTransform(aff);
             transcount++;
             break;
         }
@@ -615,13 +661,13 @@ void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_imag
             }
 
             // std::cout <<" aff from image header " << transcount <<  std::endl;
-            warper->PushBackAffineTransform(aff);
+            chain->PushBackAffineTransform(aff);
 
             //            if (transcount==0){
-            //                warper->SetOutputSize(img_mov->GetLargestPossibleRegion().GetSize());
-            //                warper->SetOutputSpacing(img_mov->GetSpacing());
-            //                warper->SetOutputOrigin(img_mov->GetOrigin());
-            //                warper->SetOutputDirection(img_mov->GetDirection());
+            //                chain->SetOutputSize(img_mov->GetLargestPossibleRegion().GetSize());
+            //                chain->SetOutputSpacing(img_mov->GetSpacing());
+            //                chain->SetOutputOrigin(img_mov->GetOrigin());
+            //                chain->SetOutputDirection(img_mov->GetDirection());
             //            }
 
             transcount++;
@@ -634,11 +680,11 @@ void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_imag
             field_reader->Update();
             typename DisplacementFieldType::Pointer field = field_reader->GetOutput();
 
-            warper->PushBackDisplacementFieldTransform(field);
-            warper->SetOutputSize(field->GetLargestPossibleRegion().GetSize());
-            warper->SetOutputOrigin(field->GetOrigin());
-            warper->SetOutputSpacing(field->GetSpacing());
-            warper->SetOutputDirection(field->GetDirection());
+            chain->PushBackDisplacementFieldTransform(field);
+            chain->SetOutputSize(field->GetLargestPossibleRegion().GetSize());
+            chain->SetOutputOrigin(field->GetOrigin());
+            chain->SetOutputSpacing(field->GetSpacing());
+            chain->SetOutputDirection(field->GetDirection());
 
             transcount++;
             break;
@@ -648,15 +694,15 @@ void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_imag
         }
     }
 
-    // warper->PrintTransformList();
+    // chain->PrintTransformList();
 
 
 
     if (img_ref.IsNotNull()){
-        warper->SetOutputSize(img_ref->GetLargestPossibleRegion().GetSize());
-        warper->SetOutputSpacing(img_ref->GetSpacing());
-        warper->SetOutputOrigin(img_ref->GetOrigin());
-        warper->SetOutputDirection(img_ref->GetDirection());
+        chain->SetOutputSize(img_ref->GetLargestPossibleRegion().GetSize());
+        chain->SetOutputSpacing(img_ref->GetSpacing());
+        chain->SetOutputOrigin(img_ref->GetOrigin());
+        chain->SetOutputDirection(img_ref->GetDirection());
     }
     else {
         if (misc_opt.use_TightestBoundingBox == true){
@@ -665,20 +711,36 @@ void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_imag
           /*
             typename ImageType::SizeType largest_size;
             typename ImageType::PointType origin_warped;
-            GetLaregstSizeAfterWarp(warper, warpthisimage , largest_size, origin_warped);
-            warper->SetOutputSize(largest_size);
-            warper->SetOutputSpacing(warpthisimage->GetSpacing());
-            warper->SetOutputOrigin(origin_warped);
+            GetLaregstSizeAfterWarp(chain, warpthisimage , largest_size, origin_warped);
+            chain->SetOutputSize(largest_size);
+            chain->SetOutputSpacing(warpthisimage->GetSpacing());
+            chain->SetOutputOrigin(origin_warped);
 
             typename ImageType::DirectionType d;
             d.SetIdentity();
-            warper->SetOutputDirection(d);*/
+            chain->SetOutputDirection(d);*/
         }
 
     }
 
+    chain->DetermineFirstDeformNoInterp();
+    composed_field = ComposeTransformChain(chain.GetPointer());
+  }
+
+  unsigned int timedims=img_mov->GetLargestPossibleRegion().GetSize()[ImageDimension-1];
+  for (unsigned int timedim=0;  timedim < timedims ;  timedim++ ) {
+
+    typename WarperType::Pointer  warper = WarperType::New();
+    warper->SetEdgePaddingValue(0);
 
+    if (misc_opt.use_NN_interpolator){
+        typedef typename itk::NearestNeighborInterpolateImageFunction<ImageType, typename WarperType::CoordRepType> NNInterpolateType;
+        typename NNInterpolateType::Pointer interpolator_NN = NNInterpolateType::New();
+        std::cout <<  " Use Nearest Neighbor interpolation " << std::endl;
+        warper->SetInterpolator(interpolator_NN);
+    }
 
+    UseComposedField(warper.GetPointer(), composed_field.GetPointer());
 
     if ( timedim % vnl_math_max(timedims / 10, static_cast<unsigned int>(1)) == 0 ) std::cout << (float) timedim/(float)timedims*100 << " % done ... " << std::flush; // << std::endl;
     typename VectorImageType::RegionType extractRegion = img_mov->GetLargestPossibleRegion();
@@ -735,7 +797,8 @@ void WarpImageMultiTransformFourD(char *moving_image_filename, char *output_imag
 
 template<int ImageDimension>
 void WarpImageMultiTransform(char *moving_image_filename, char *output_image_filename,
-        TRAN_OPT_QUEUE &opt_queue, MISC_OPT &misc_opt){
+        TRAN_OPT_QUEUE &opt_queue, MISC_OPT &misc_opt,
+        typename itk::Image<itk::Vector<float, ImageDimension>, ImageDimension>::Pointer &composed_field){
 
     typedef itk::VectorImage<float, ImageDimension> VectorImageType;
     typedef itk::Image<float, ImageDimension> ImageType;
@@ -786,155 +849,166 @@ void WarpImageMultiTransform(char *moving_image_filename, char *output_image_fil
     vec.Fill(0);
     img_output->FillBuffer( vec );
 
-    for (unsigned int tensdim=0;  tensdim < veclength;  tensdim++) {
+    // read the transforms once and compose them into a single field on the
+    // output grid;  every component is then warped through that field
+    if (composed_field.IsNull()) {
+        typename WarperType::Pointer  chain = WarperType::New();
+
+        typedef itk::TransformFileReader TranReaderType;
+        typedef itk::ImageFileReader<DisplacementFieldType> FieldReaderType;
+
+
+
+        unsigned int   transcount=0;
+        const int kOptQueueSize = opt_queue.size();
+        for(int i=0; i<kOptQueueSize; i++){
+            const TRAN_OPT &opt = opt_queue[i];
+
+            switch(opt.file_type){
+            case AFFINE_FILE:{
+                typename TranReaderType::Pointer tran_reader = TranReaderType::New();
+                tran_reader->SetFileName(opt.filename);
+                tran_reader->Update();
+                typename AffineTransformType::Pointer aff = dynamic_cast< AffineTransformType* >
+                ((tran_reader->GetTransformList())->front().GetPointer());
+                if (opt.do_affine_inv) {
+                    typename AffineTransformType::Pointer aff_inv = AffineTransformType::New();
+                    aff->GetInverse(aff_inv);
+                    aff = aff_inv;
+                }
+                // std::cout <<" aff " << transcount <<  std::endl;
+                chain->PushBackAffineTransform(aff);
+                if (transcount==0){
+                    chain->SetOutputSize(img_mov->GetLargestPossibleRegion().GetSize());
+                    chain->SetOutputSpacing(img_mov->GetSpacing());
+                    chain->SetOutputOrigin(img_mov->GetOrigin());
+                    chain->SetOutputDirection(img_mov->GetDirection());
+                }
+                transcount++;
+                break;
+            }
 
-      typedef itk::VectorIndexSelectionCastImageFilter<VectorImageType,ImageType> IndexSelectCasterType;
-      typename IndexSelectCasterType::Pointer fieldCaster = IndexSelectCasterType::New();
-      fieldCaster->SetInput( img_mov );
-      fieldCaster->SetIndex( tensdim );
-      fieldCaster->Update();
-      typename ImageType::Pointer tenscomponent=fieldCaster->GetOutput();
-      tenscomponent->SetSpacing(img_mov->GetSpacing());
-      tenscomponent->SetOrigin(img_mov->GetOrigin());
-      tenscomponent->SetDirection(img_mov->GetDirection());
+            case IDENTITY_TRANSFORM:{
+                typename AffineTransformType::Pointer aff;
+                GetIdentityTransform(aff);
+                // std::cout << " aff id" << transcount << std::endl;
+                chain->PushBackAffineTransform(aff);
+                transcount++;
+                break;
+            }
 
-      typename WarperType::Pointer  warper = WarperType::New();
-      warper->SetInput(tenscomponent);
-      //      PixelType nullPix;
-      // nullPix.Fill(0);
-      warper->SetEdgePaddingValue(0);
+            case IMAGE_AFFINE_HEADER:{
 
+                typename AffineTransformType::Pointer aff = AffineTransformType::New();
+                typename ImageType::Pointer img_affine = ImageType::New();
+                typename ImageFileReaderType::Pointer reader_image_affine = ImageFileReaderType::New();
+                reader_image_affine->SetFileName(opt.filename);
+                reader_image_affine->Update();
+                img_affine = reader_image_affine->GetOutput();
 
+                GetAffineTransformFromImage(img_affine, aff);
 
-    if (misc_opt.use_NN_interpolator){
-        typedef typename itk::NearestNeighborInterpolateImageFunction<ImageType, typename WarperType::CoordRepType> NNInterpolateType;
-        typename NNInterpolateType::Pointer interpolator_NN = NNInterpolateType::New();
-        std::cout << "Haha" << std::endl;
-        warper->SetInterpolator(interpolator_NN);
-    }
+                if (opt.do_affine_inv) {
+                    typename AffineTransformType::Pointer aff_inv = AffineTransformType::New();
+                    aff->GetInverse(aff_inv);
+                    aff = aff_inv;
+                }
 
-    typedef itk::TransformFileReader TranReaderType;
-    typedef itk::ImageFileReader<DisplacementFieldType> FieldReaderType;
+                // std::cout <<" aff from image header " << transcount <<  std::endl;
+                chain->PushBackAffineTransform(aff);
 
+                //            if (transcount==0){
+                //                chain->SetOutputSize(img_mov->GetLargestPossibleRegion().GetSize());
+                //                chain->SetOutputSpacing(img_mov->GetSpacing());
+                //                chain->SetOutputOrigin(img_mov->GetOrigin());
+                //                chain->SetOutputDirection(img_mov->GetDirection());
+                //            }
 
+                transcount++;
+                break;
+            }
 
-    unsigned int   transcount=0;
-    const int kOptQueueSize = opt_queue.size();
-    for(int i=0; i<kOptQueueSize; i++){
-        const TRAN_OPT &opt = opt_queue[i];
+            case DEFORMATION_FILE:{
+                typename FieldReaderType::Pointer field_reader = FieldReaderType::New();
+                field_reader->SetFileName( opt.filename );
+                field_reader->Update();
+                typename DisplacementFieldType::Pointer field = field_reader->GetOutput();
 
-        switch(opt.file_type){
-        case AFFINE_FILE:{
-            typename TranReaderType::Pointer tran_reader = TranReaderType::New();
-            tran_reader->SetFileName(opt.filename);
-            tran_reader->Update();
-            typename AffineTransformType::Pointer aff = dynamic_cast< AffineTransformType* >
-            ((tran_reader->GetTransformList())->front().GetPointer());
-            if (opt.do_affine_inv) {
-                typename AffineTransformType::Pointer aff_inv = AffineTransformType::New();
-                aff->GetInverse(aff_inv);
-                aff = aff_inv;
+                chain->PushBackDisplacementFieldTransform(field);
+                chain->SetOutputSize(field->GetLargestPossibleRegion().GetSize());
+                chain->SetOutputOrigin(field->GetOrigin());
+                chain->SetOutputSpacing(field->GetSpacing());
+                chain->SetOutputDirection(field->GetDirection());
+
+                transcount++;
+                break;
             }
-            // std::cout <<" aff " << transcount <<  std::endl;
-            warper->PushBackAffineTransform(aff);
-            if (transcount==0){
-                warper->SetOutputSize(img_mov->GetLargestPossibleRegion().GetSize());
-                warper->SetOutputSpacing(img_mov->GetSpacing());
-                warper->SetOutputOrigin(img_mov->GetOrigin());
-                warper->SetOutputDirection(img_mov->GetDirection());
+            default:
+                std::cout << "Unknown file type!" << std::endl;
             }
-            transcount++;
-            break;
-        }
-
-        case IDENTITY_TRANSFORM:{
-            typename AffineTransformType::Pointer aff;
-            GetIdentityTransform(aff);
-            // std::cout << " aff id" << transcount << std::endl;
-            warper->PushBackAffineTransform(aff);
-            transcount++;
-            break;
         }
 
-        case IMAGE_AFFINE_HEADER:{
+        // chain->PrintTransformList();
 
-            typename AffineTransformType::Pointer aff = AffineTransformType::New();
-            typename ImageType::Pointer img_affine = ImageType::New();
-            typename ImageFileReaderType::Pointer reader_image_affine = ImageFileReaderType::New();
-            reader_image_affine->SetFileName(opt.filename);
-            reader_image_affine->Update();
-            img_affine = reader_image_affine->GetOutput();
 
-            GetAffineTransformFromImage(img_affine, aff);
 
-            if (opt.do_affine_inv) {
-                typename AffineTransformType::Pointer aff_inv = AffineTransformType::New();
-                aff->GetInverse(aff_inv);
-                aff = aff_inv;
+        if (img_ref.IsNotNull()){
+            chain->SetOutputSize(img_ref->GetLargestPossibleRegion().GetSize());
+            chain->SetOutputSpacing(img_ref->GetSpacing());
+            chain->SetOutputOrigin(img_ref->GetOrigin());
+            chain->SetOutputDirection(img_ref->GetDirection());
+        }
+        else {
+            if (misc_opt.use_TightestBoundingBox == true){
+                // compute the desired spacking after inputting all the transform files using the
+
+                typename ImageType::SizeType largest_size;
+                typename ImageType::PointType origin_warped;
+                GetLaregstSizeAfterWarp(chain, img_mov, largest_size, origin_warped);
+                chain->SetOutputSize(largest_size);
+                chain->SetOutputSpacing(img_mov->GetSpacing());
+                chain->SetOutputOrigin(origin_warped);
+
+                typename ImageType::DirectionType d;
+                d.SetIdentity();
+                chain->SetOutputDirection(d);
             }
 
-            // std::cout <<" aff from image header " << transcount <<  std::endl;
-            warper->PushBackAffineTransform(aff);
-
-            //            if (transcount==0){
-            //                warper->SetOutputSize(img_mov->GetLargestPossibleRegion().GetSize());
-            //                warper->SetOutputSpacing(img_mov->GetSpacing());
-            //                warper->SetOutputOrigin(img_mov->GetOrigin());
-            //                warper->SetOutputDirection(img_mov->GetDirection());
-            //            }
-
-            transcount++;
-            break;
         }
 
-        case DEFORMATION_FILE:{
-            typename FieldReaderType::Pointer field_reader = FieldReaderType::New();
-            field_reader->SetFileName( opt.filename );
-            field_reader->Update();
-            typename DisplacementFieldType::Pointer field = field_reader->GetOutput();
-
-            warper->PushBackDisplacementFieldTransform(field);
-            warper->SetOutputSize(field->GetLargestPossibleRegion().GetSize());
-            warper->SetOutputOrigin(field->GetOrigin());
-            warper->SetOutputSpacing(field->GetSpacing());
-            warper->SetOutputDirection(field->GetDirection());
-
-            transcount++;
-            break;
-        }
-        default:
-            std::cout << "Unknown file type!" << std::endl;
-        }
+        chain->DetermineFirstDeformNoInterp();
+        composed_field = ComposeTransformChain(chain.GetPointer());
     }
 
-    // warper->PrintTransformList();
-
+    for (unsigned int tensdim=0;  tensdim < veclength;  tensdim++) {
 
+      typedef itk::VectorIndexSelectionCastImageFilter<VectorImageType,ImageType> IndexSelectCasterType;
+      typename IndexSelectCasterType::Pointer fieldCaster = IndexSelectCasterType::New();
+      fieldCaster->SetInput( img_mov );
+      fieldCaster->SetIndex( tensdim );
+      fieldCaster->Update();
+      typename ImageType::Pointer tenscomponent=fieldCaster->GetOutput();
+      tenscomponent->SetSpacing(img_mov->GetSpacing());
+      tenscomponent->SetOrigin(img_mov->GetOrigin());
+      tenscomponent->SetDirection(img_mov->GetDirection());
 
-    if (img_ref.IsNotNull()){
-        warper->SetOutputSize(img_ref->GetLargestPossibleRegion().GetSize());
-        warper->SetOutputSpacing(img_ref->GetSpacing());
-        warper->SetOutputOrigin(img_ref->GetOrigin());
-        warper->SetOutputDirection(img_ref->GetDirection());
-    }
-    else {
-        if (misc_opt.use_TightestBoundingBox == true){
-            // compute the desired spacking after inputting all the transform files using the
+      typename WarperType::Pointer  warper = WarperType::New();
+      warper->SetInput(tenscomponent);
+      //      PixelType nullPix;
+      // nullPix.Fill(0);
+      warper->SetEdgePaddingValue(0);
 
-            typename ImageType::SizeType largest_size;
-            typename ImageType::PointType origin_warped;
-            GetLaregstSizeAfterWarp(warper, img_mov, largest_size, origin_warped);
-            warper->SetOutputSize(largest_size);
-            warper->SetOutputSpacing(img_mov->GetSpacing());
-            warper->SetOutputOrigin(origin_warped);
 
-            typename ImageType::DirectionType d;
-            d.SetIdentity();
-            warper->SetOutputDirection(d);
-        }
 
+    if (misc_opt.use_NN_interpolator){
+        typedef typename itk::NearestNeighborInterpolateImageFunction<ImageType, typename WarperType::CoordRepType> NNInterpolateType;
+        typename NNInterpolateType::Pointer interpolator_NN = NNInterpolateType::New();
+        std::cout << "Haha" << std::endl;
+        warper->SetInterpolator(interpolator_NN);
     }
 
+    UseComposedField(warper.GetPointer(), composed_field.GetPointer());
+
     warper->DetermineFirstDeformNoInterp();
     warper->Update();
 
@@ -978,6 +1052,8 @@ int main(int argc, char **argv){
       std::cout << " --reslice-by-header        : Equivalient to -i -mh, or -fh -i -mh if used together with -R. It uses the orientation matrix and origin encoded in the image file header. " << std::endl;
       std::cout << " --tightest-bounding-box    : Computes the tightest bounding box using all the affine transformations. It will be overrided by -R <reference_image.ext> if given." << std::endl;
       std::cout << " These options can be used together with -R and are typically not used together with any other transforms." << std::endl;
+      std::cout << " --extra-image <moving_image.ext> <output_image.ext> : Also warp another image with the same transforms; may be repeated." << std::endl;
+      std::cout << "                     Requires -R.  The transforms are read and composed once on the reference grid and reused for every volume of every image." << std::endl;
 
       std::cout << "\nInterpolation:" << std::endl;
       std::cout << " --use-NN            : Use Nearest Neighbor Interpolator" << std::endl;
@@ -1009,17 +1085,32 @@ int main(int argc, char **argv){
         else std::cout << "NULL" << std::endl;
         DisplayOptQueue(opt_queue);
 
+        // the first image is followed by any --extra-image pairs, all of
+        // which share the transform chain composed for the first one
+        std::vector<char *> moving_image_filenames(1, moving_image_filename);
+        std::vector<char *> output_image_filenames(1, output_image_filename);
+        for (unsigned int k = 0; k < misc_opt.extra_moving_image_filenames.size(); k++){
+            moving_image_filenames.push_back(const_cast<char *>(misc_opt.extra_moving_image_filenames[k].c_str()));
+            output_image_filenames.push_back(const_cast<char *>(misc_opt.extra_output_image_filenames[k].c_str()));
+        }
+
         switch (kImageDim){
         case 2:{
-            WarpImageMultiTransform<2>(moving_image_filename, output_image_filename, opt_queue, misc_opt);
+            itk::Image<itk::Vector<float, 2>, 2>::Pointer composed_field;
+            for (unsigned int k = 0; k < moving_image_filenames.size(); k++)
+                WarpImageMultiTransform<2>(moving_image_filenames[k], output_image_filenames[k], opt_queue, misc_opt, composed_field);
             break;
         }
         case 3:{
-            WarpImageMultiTransform<3>(moving_image_filename, output_image_filename, opt_queue, misc_opt);
+            itk::Image<itk::Vector<float, 3>, 3>::Pointer composed_field;
+            for (unsigned int k = 0; k < moving_image_filenames.size(); k++)
+                WarpImageMultiTransform<3>(moving_image_filenames[k], output_image_filenames[k], opt_queue, misc_opt, composed_field);
             break;
         }
         case 4:{
-            WarpImageMultiTransformFourD<4>(moving_image_filename, output_image_filename, opt_queue, misc_opt);
+            itk::Image<itk::Vector<float, 3>, 3>::Pointer composed_field;
+            for (unsigned int k = 0; k < moving_image_filenames.size(); k++)
+                WarpImageMultiTransformFourD<4>(moving_image_filenames[k], output_image_filenames[k], opt_queue, misc_opt, composed_field);
             break;
         }
         }
@@ -0,0 +1,443 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: antsBuildTemplate.cxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+
+// Unbiased template construction in one process, following
+// buildtemplateparallel.sh:  every iteration registers each subject to the
+// current template with ANTS, averages the warped subjects, and moves the
+// template by the inverse of the average affine and a fraction of the
+// average warp, as shapeupdatetotemplate.sh does.  The template, the
+// subjects, the warped images and the transforms stay in memory;  the
+// registrations run concurrently on a pool of threads, each with a share of
+// the cores.  Only the final template, warped subjects and transforms are
+// written.
+
+#include "itkPICSLAdvancedNormalizationToolKit.h"
+#include "itkANTSImageTransformation.h"
+#include "itkANTSImageRegistrationOptimizer.h"
+#include "itkWarpImageMultiTransformFilter.h"
+#include "itkAverageAffineTransformFunction.h"
+#include "itkLaplacianSharpeningImageFilter.h"
+#include "itkImageFileReader.h"
+#include "itkImageFileWriter.h"
+#include "itkImageRegionIterator.h"
+#include "itkImageRegionConstIterator.h"
+#include "itkMultiThreader.h"
+#include "itkSimpleFastMutexLock.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+std::string SubjectBaseName( const std::string & filename )
+{
+  std::string name = filename.substr( filename.find_last_of( "/\\" ) + 1 );
+  if ( name.size() > 3 && name.substr( name.size() - 3 ) == ".gz" )
+    {
+    name = name.substr( 0, name.size() - 3 );
+    }
+  return name.substr( 0, name.find_last_of( '.' ) );
+}
+
+template <class TImage, class TWarper>
+void SetWarperOutputToImage( TWarper *warper, const TImage *reference )
+{
+  warper->SetOutputSize( reference->GetLargestPossibleRegion().GetSize() );
+  warper->SetOutputSpacing( reference->GetSpacing() );
+  warper->SetOutputOrigin( reference->GetOrigin() );
+  warper->SetOutputDirection( reference->GetDirection() );
+}
+
+template <class TImage>
+typename TImage::Pointer
+AverageNormalizedImages( const std::vector<typename TImage::Pointer> & images )
+// AverageImages with normalization:  each image divided by its mean, then
+// the average is sharpened
+{
+  typename TImage::Pointer average = TImage::New();
+  average->CopyInformation( images[0] );
+  average->SetRegions( images[0]->GetLargestPossibleRegion() );
+  average->Allocate();
+  average->FillBuffer( 0 );
+
+  const float numberofimages = images.size();
+  for ( unsigned int j = 0; j < images.size(); j++ )
+    {
+    itk::ImageRegionConstIterator<TImage> It( images[j], images[j]->GetLargestPossibleRegion() );
+    double meanval = 0;
+    unsigned long ct = 0;
+    for ( It.GoToBegin(); !It.IsAtEnd(); ++It, ++ct )
+      {
+      meanval += It.Get();
+      }
+    if ( ct > 0 ) meanval /= ct;
+    if ( meanval <= 0 ) meanval = 1;
+
+    itk::ImageRegionIterator<TImage> Avg( average, average->GetLargestPossibleRegion() );
+    for ( It.GoToBegin(), Avg.GoToBegin(); !It.IsAtEnd(); ++It, ++Avg )
+      {
+      Avg.Set( Avg.Get() + It.Get() / meanval / numberofimages );
+      }
+    }
+
+  typedef itk::LaplacianSharpeningImageFilter<TImage, TImage> SharpeningFilterType;
+  typename SharpeningFilterType::Pointer sharpener = SharpeningFilterType::New();
+  sharpener->SetInput( average );
+  sharpener->Update();
+  return sharpener->GetOutput();
+}
+
+template <unsigned int ImageDimension>
+struct TemplateBuildStruct
+{
+  typedef itk::PICSLAdvancedNormalizationToolKit<ImageDimension> RegistrationType;
+  typedef typename RegistrationType::ImageType                   ImageType;
+  typedef typename RegistrationType::TransformationModelType     TransformationModelType;
+
+  typename ImageType::Pointer                          Template;
+  std::vector<typename ImageType::Pointer>             Subjects;
+  std::vector<std::string>                             SubjectNames;
+  std::vector<std::string>                             Arguments;   // ANTS options, without -m and -o
+  std::string                                          Metric;      // e.g. CC
+  std::string                                          MetricParameters; // e.g. 1,4
+  std::string                                          OutputPrefix;
+
+  itk::SimpleFastMutexLock                             Lock;
+  unsigned int                                         NextSubject;
+
+  std::vector<typename TransformationModelType::Pointer> Models;
+  std::vector<typename ImageType::Pointer>             Warped;
+  std::vector<char>                                    Failed;      // not vector<bool>, written from several threads
+  std::vector<std::string>                             Errors;
+};
+
+template <unsigned int ImageDimension>
+void RegisterSubjectToTemplate( TemplateBuildStruct<ImageDimension> *str, unsigned int k )
+{
+  typedef TemplateBuildStruct<ImageDimension>                      StructType;
+  typedef typename StructType::RegistrationType                    RegistrationType;
+  typedef typename StructType::ImageType                           ImageType;
+  typedef typename RegistrationType::DisplacementFieldType         DisplacementFieldType;
+  typedef typename RegistrationType::AffineTransformType           AffineTransformType;
+
+  // nothing may escape the worker thread:  any error is reported back to
+  // the caller through Failed and Errors
+  try
+    {
+    // the metric names the in-memory images, not files
+    const std::string templateName = "template";
+    const std::string subjectName = "subject:" + str->SubjectNames[k];
+    std::ostringstream dimension;
+    dimension << ImageDimension;
+
+    std::vector<std::string> args;
+    args.push_back( "ANTS" );
+    args.push_back( dimension.str() );
+    args.push_back( "-m" );
+    args.push_back( str->Metric + "[" + templateName + "," + subjectName + "," + str->MetricParameters + "]" );
+    args.insert( args.end(), str->Arguments.begin(), str->Arguments.end() );
+    args.push_back( "-o" );
+    args.push_back( str->OutputPrefix + str->SubjectNames[k] + ".nii.gz" );
+    std::vector<char *> argv;
+    for ( unsigned int i = 0; i < args.size(); i++ )
+      {
+      argv.push_back( &args[i][0] );
+      }
+
+    typename RegistrationType::Pointer registration = RegistrationType::New();
+    registration->SetInputImage( templateName, str->Template );
+    registration->SetInputImage( subjectName, str->Subjects[k] );
+    // a seed of its own per subject, so that the random samples do not
+    // depend on the order in which the concurrent registrations draw them
+    registration->SetAffineSamplingSeed( 19650218 + k );
+    registration->ParseCommandLine( argv.size(), &argv[0] );
+    registration->RunRegistration();
+    str->Models[k] = registration->GetTransformationModel();
+
+    // as WarpImageMultiTransform subject -R template Warp Affine
+    typedef itk::WarpImageMultiTransformFilter<ImageType, ImageType, DisplacementFieldType, AffineTransformType> WarperType;
+    typename WarperType::Pointer warper = WarperType::New();
+    warper->SetInput( str->Subjects[k] );
+    warper->SetEdgePaddingValue( 0 );
+    if ( str->Models[k]->GetDisplacementField() )
+      {
+      warper->PushBackDisplacementFieldTransform( str->Models[k]->GetDisplacementField() );
+      }
+    if ( str->Models[k]->GetAffineTransform() )
+      {
+      warper->PushBackAffineTransform( str->Models[k]->GetAffineTransform() );
+      }
+    SetWarperOutputToImage( warper.GetPointer(), str->Template.GetPointer() );
+    warper->Update();
+    str->Warped[k] = warper->GetOutput();
+    }
+  catch( itk::ExceptionObject & e )
+    {
+    str->Failed[k] = true;
+    str->Errors[k] = e.GetDescription();
+    }
+  catch( std::exception & e )
+    {
+    str->Failed[k] = true;
+    str->Errors[k] = e.what();
+    }
+  catch( ... )
+    {
+    str->Failed[k] = true;
+    str->Errors[k] = "unknown exception";
+    }
+}
+
+template <unsigned int ImageDimension>
+ITK_THREAD_RETURN_TYPE TemplateBuildThreaderCallback( void *arg )
+{
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  TemplateBuildStruct<ImageDimension> *str = static_cast<TemplateBuildStruct<ImageDimension> *>( info->UserData );
+
+  // subjects are handed out one at a time, registrations differ in length
+  for ( ;; )
+    {
+    str->Lock.Lock();
+    unsigned int k = str->NextSubject++;
+    str->Lock.Unlock();
+    if ( k >= str->Subjects.size() )
+      {
+      break;
+      }
+    RegisterSubjectToTemplate<ImageDimension>( str, k );
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <unsigned int ImageDimension>
+int antsBuildTemplate( int argc, char *argv[] )
+{
+  typedef TemplateBuildStruct<ImageDimension>                      StructType;
+  typedef typename StructType::RegistrationType                    RegistrationType;
+  typedef typename StructType::ImageType                           ImageType;
+  typedef typename RegistrationType::DisplacementFieldType         DisplacementFieldType;
+  typedef typename RegistrationType::AffineTransformType           AffineTransformType;
+  typedef typename DisplacementFieldType::PixelType                VectorType;
+
+  StructType str;
+  str.OutputPrefix = argv[2];
+  const unsigned int numberOfIterations = atoi( argv[3] );
+  unsigned int numberOfJobs = atoi( argv[4] );
+  const double gradientStep = atof( argv[5] );
+
+  std::string metric = argv[6];
+  std::string::size_type bracket = metric.find( '[' );
+  str.Metric = metric.substr( 0, bracket );
+  if ( bracket != std::string::npos )
+    {
+    str.MetricParameters = metric.substr( bracket + 1, metric.find_last_of( ']' ) - bracket - 1 );
+    }
+  else
+    {
+    str.MetricParameters = "1,4";
+    }
+  std::istringstream options( argv[7] );
+  std::string token;
+  while ( options >> token )
+    {
+    str.Arguments.push_back( token );
+    }
+
+  typedef itk::ImageFileReader<ImageType> ReaderType;
+  for ( int i = 8; i < argc; i++ )
+    {
+    typename ReaderType::Pointer reader = ReaderType::New();
+    reader->SetFileName( argv[i] );
+    reader->Update();
+    typename ImageType::Pointer image = reader->GetOutput();
+    // non-finite voxels would spread through the template average;  the
+    // registrations rescale (and histogram match, if asked) their own copies, as ANTS
+    // does with the images it reads
+    itk::ImageRegionIterator<ImageType> It( image, image->GetLargestPossibleRegion() );
+    for ( It.GoToBegin(); !It.IsAtEnd(); ++It )
+      {
+      if ( vnl_math_isinf( It.Get() ) || vnl_math_isnan( It.Get() ) ) It.Set( 0 );
+      }
+    str.Subjects.push_back( image );
+    str.SubjectNames.push_back( SubjectBaseName( argv[i] ) );
+    }
+  const unsigned int numberOfSubjects = str.Subjects.size();
+  numberOfJobs = std::max( 1u, std::min( numberOfJobs, numberOfSubjects ) );
+  std::cout << " building a template from " << numberOfSubjects << " images, "
+            << numberOfJobs << " registrations at a time " << std::endl;
+
+  typedef itk::WarpImageMultiTransformFilter<ImageType, ImageType, DisplacementFieldType, AffineTransformType> WarperType;
+  typedef itk::WarpImageMultiTransformFilter<DisplacementFieldType, DisplacementFieldType,
+    DisplacementFieldType, AffineTransformType> FieldWarperType;
+
+  // initial template:  the normalized average in the space of the first image
+  {
+  std::vector<typename ImageType::Pointer> resampled( numberOfSubjects );
+  for ( unsigned int k = 0; k < numberOfSubjects; k++ )
+    {
+    typename WarperType::Pointer warper = WarperType::New();
+    warper->SetInput( str.Subjects[k] );
+    warper->SetEdgePaddingValue( 0 );
+    warper->PushBackAffineTransform( AffineTransformType::New() );
+    SetWarperOutputToImage( warper.GetPointer(), str.Subjects[0].GetPointer() );
+    warper->Update();
+    resampled[k] = warper->GetOutput();
+    }
+  str.Template = AverageNormalizedImages<ImageType>( resampled );
+  }
+
+  const itk::ThreadIdType numberOfThreads = itk::MultiThreader::GetGlobalDefaultNumberOfThreads();
+  for ( unsigned int iteration = 0; iteration < numberOfIterations; iteration++ )
+    {
+    std::cout << " template iteration " << iteration << std::endl;
+    str.NextSubject = 0;
+    str.Models.assign( numberOfSubjects, typename StructType::TransformationModelType::Pointer() );
+    str.Warped.assign( numberOfSubjects, typename ImageType::Pointer() );
+    str.Failed.assign( numberOfSubjects, false );
+    str.Errors.assign( numberOfSubjects, std::string() );
+
+    // each registration threads over its share of the cores
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads( std::max<itk::ThreadIdType>( 1, numberOfThreads / numberOfJobs ) );
+    itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+    threader->SetNumberOfThreads( numberOfJobs );
+    threader->SetSingleMethod( TemplateBuildThreaderCallback<ImageDimension>, &str );
+    threader->SingleMethodExecute();
+    itk::MultiThreader::SetGlobalDefaultNumberOfThreads( numberOfThreads );
+
+    for ( unsigned int k = 0; k < numberOfSubjects; k++ )
+      {
+      if ( str.Failed[k] )
+        {
+        std::cerr << " registration of " << str.SubjectNames[k] << " failed:  " << str.Errors[k] << std::endl;
+        return EXIT_FAILURE;
+        }
+      }
+
+    // shape update:  average the warped images, affines and warps
+    typename ImageType::Pointer average = AverageNormalizedImages<ImageType>( str.Warped );
+
+    typename DisplacementFieldType::Pointer warp;
+    VectorType zero;
+    zero.Fill( 0 );
+    for ( unsigned int k = 0; k < numberOfSubjects; k++ )
+      {
+      typename DisplacementFieldType::Pointer field = str.Models[k]->GetDisplacementField();
+      if ( !field )
+        {
+        continue;
+        }
+      if ( !warp )
+        {
+        warp = DisplacementFieldType::New();
+        warp->CopyInformation( field );
+        warp->SetRegions( field->GetLargestPossibleRegion() );
+        warp->Allocate();
+        warp->FillBuffer( zero );
+        }
+      itk::ImageRegionConstIterator<DisplacementFieldType> It( field, field->GetLargestPossibleRegion() );
+      itk::ImageRegionIterator<DisplacementFieldType> Wt( warp, warp->GetLargestPossibleRegion() );
+      for ( It.GoToBegin(), Wt.GoToBegin(); !It.IsAtEnd(); ++It, ++Wt )
+        {
+        Wt.Set( Wt.Get() + It.Get() * ( -gradientStep / numberOfSubjects ) );
+        }
+      }
+
+    typedef itk::AverageAffineTransformFunction<AffineTransformType> AverageAffineFunctionType;
+    AverageAffineFunctionType averageAffine;
+    for ( unsigned int k = 0; k < numberOfSubjects; k++ )
+      {
+      if ( str.Models[k]->GetAffineTransform() )
+        {
+        averageAffine.PushBackAffineTransform( str.Models[k]->GetAffineTransform(), 1.0 );
+        }
+      }
+    typename AffineTransformType::Pointer inverseAffine = AffineTransformType::New();
+    if ( !averageAffine.GetTransformList().empty() )
+      {
+      typename AffineTransformType::Pointer affine = AffineTransformType::New();
+      averageAffine.AverageMultipleAffineTransform(
+        averageAffine.GetTransformList().front().aff->GetCenter(), affine );
+      affine->GetInverse( inverseAffine );
+      }
+
+    // as WarpImageMultiTransform warp warp -i Affine -R template
+    if ( warp )
+      {
+      typename FieldWarperType::Pointer fieldWarper = FieldWarperType::New();
+      fieldWarper->SetInput( warp );
+      fieldWarper->SetEdgePaddingValue( zero );
+      fieldWarper->PushBackAffineTransform( inverseAffine );
+      SetWarperOutputToImage( fieldWarper.GetPointer(), str.Template.GetPointer() );
+      fieldWarper->Update();
+      warp = fieldWarper->GetOutput();
+      }
+
+    // as WarpImageMultiTransform template template -i Affine warp warp warp warp -R template
+    typename WarperType::Pointer warper = WarperType::New();
+    warper->SetInput( average );
+    warper->SetEdgePaddingValue( 0 );
+    warper->PushBackAffineTransform( inverseAffine );
+    for ( unsigned int i = 0; warp && i < 4; i++ )
+      {
+      warper->PushBackDisplacementFieldTransform( warp );
+      }
+    SetWarperOutputToImage( warper.GetPointer(), str.Template.GetPointer() );
+    warper->Update();
+    str.Template = warper->GetOutput();
+    }
+
+  typedef itk::ImageFileWriter<ImageType> WriterType;
+  typename WriterType::Pointer writer = WriterType::New();
+  writer->SetFileName( str.OutputPrefix + "template.nii.gz" );
+  writer->SetInput( str.Template );
+  writer->Update();
+  for ( unsigned int k = 0; numberOfIterations > 0 && k < numberOfSubjects; k++ )
+    {
+    str.Models[k]->SetWriteComponentImages( true );
+    str.Models[k]->Write();
+    typename WriterType::Pointer warpedWriter = WriterType::New();
+    warpedWriter->SetFileName( str.OutputPrefix + str.SubjectNames[k] + "deformed.nii.gz" );
+    warpedWriter->SetInput( str.Warped[k] );
+    warpedWriter->Update();
+    }
+
+  return EXIT_SUCCESS;
+}
+
+
+int main( int argc, char *argv[] )
+{
+  if ( argc < 10 )
+    {
+    std::cout << "Usage: " << argv[0] << " ImageDimension OutputPrefix NumberOfIterations NumberOfConcurrentRegistrations GradientStep Metric[weight,parameter] \"ANTS options\" image1 image2 ... " << std::endl;
+    std::cout << " Builds an unbiased template in one process, as buildtemplateparallel.sh does with ANTS, WarpImageMultiTransform, AverageImages and AverageAffineTransform. " << std::endl;
+    std::cout << " The metric is given without its images, e.g. CC[1,4] or MI[1,32];  the ANTS options exclude -m and -o, e.g. \"-i 30x90x20 -t SyN[0.25] -r Gauss[3,0] --number-of-affine-iterations 10000x10000x10000\". " << std::endl;
+    std::cout << " The cores are shared among NumberOfConcurrentRegistrations registrations;  GradientStep is the template update step, 0.25 in buildtemplateparallel.sh. " << std::endl;
+    std::cout << " Writes OutputPrefixtemplate.nii.gz and, for every image, the last affine, warps and warped image under OutputPrefix<image name>. " << std::endl;
+    std::cout << " example: " << argv[0] << " 3 T_ 4 4 0.25 CC[1,4] \"-i 30x90x20 -t SyN[0.25] -r Gauss[3,0]\" *.nii.gz " << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  switch ( atoi( argv[1] ) )
+    {
+    case 2:
+      return antsBuildTemplate<2>( argc, argv );
+    case 3:
+      return antsBuildTemplate<3>( argc, argv );
+    default:
+      std::cerr << "Unsupported dimension" << std::endl;
+      return EXIT_FAILURE;
+    }
+}
@@ -49,6 +49,7 @@
 #include "itkTransformFactory.h"
 #include "itkTransformFileReader.h"
 #include "itkTransformFileWriter.h"
+#include "itkANTSRegistrationCheckpoint.h"
 
 #include "itkBSplineTransformParametersAdaptor.h"
 #include "itkBSplineSmoothingOnUpdateDisplacementFieldTransformParametersAdaptor.h"
@@ -364,6 +365,58 @@ void PreprocessImages( ImageType *fixedImage, ImageType *movingImage,
   std::cout << outputPreprocessingString << std::flush;
 }
 
+// Read back the transform a finished stage wrote, with the inverse field
+// when there is one, so that a resumed run can skip the stage.
+template<unsigned int ImageDimension>
+typename itk::Transform<double, ImageDimension, ImageDimension>::Pointer
+ReadStageTransform( const std::string & filename, const std::string & inverseFilename )
+{
+  typedef itk::Transform<double, ImageDimension, ImageDimension> TransformType;
+  typename TransformType::Pointer transform = NULL;
+
+  try
+    {
+    if( filename.find( ".nii" ) != std::string::npos )
+      {
+      typedef itk::DisplacementFieldTransform<double, ImageDimension> DisplacementFieldTransformType;
+      typedef typename DisplacementFieldTransformType::DisplacementFieldType DisplacementFieldType;
+      typedef itk::ImageFileReader<DisplacementFieldType> DisplacementFieldReaderType;
+
+      typename DisplacementFieldReaderType::Pointer fieldReader = DisplacementFieldReaderType::New();
+      fieldReader->SetFileName( filename.c_str() );
+      fieldReader->Update();
+
+      typename DisplacementFieldTransformType::Pointer displacementFieldTransform =
+        DisplacementFieldTransformType::New();
+      displacementFieldTransform->SetDisplacementField( fieldReader->GetOutput() );
+      if( !inverseFilename.empty() )
+        {
+        typename DisplacementFieldReaderType::Pointer inverseFieldReader = DisplacementFieldReaderType::New();
+        inverseFieldReader->SetFileName( inverseFilename.c_str() );
+        inverseFieldReader->Update();
+        displacementFieldTransform->SetInverseDisplacementField( inverseFieldReader->GetOutput() );
+        }
+      transform = displacementFieldTransform.GetPointer();
+      }
+    else
+      {
+      typedef itk::TransformFileReader TransformReaderType;
+      TransformReaderType::Pointer transformReader = TransformReaderType::New();
+      transformReader->SetFileName( filename.c_str() );
+      transformReader->Update();
+      transform = dynamic_cast<TransformType *>(
+        ( ( transformReader->GetTransformList() )->front() ).GetPointer() );
+      }
+    }
+  catch( const itk::ExceptionObject & e )
+    {
+    std::cerr << "Could not read the stage transform " << filename << ":\n";
+    e.Print( std::cerr );
+    return NULL;
+    }
+  return transform;
+}
+
 template<unsigned int ImageDimension>
 int antsRegistration( itk::ants::CommandLineParser *parser )
 {
@@ -573,6 +626,45 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       }
     }
 
+  // A checkpoint lists the transform files of the stages done so far;  a
+  // resumed run reads them back into the composite transform instead of
+  // running those stages again.
+  std::string checkpointFileName;
+  typename OptionType::Pointer checkpointOption = parser->GetOption( "checkpoint" );
+  if( checkpointOption && checkpointOption->GetNumberOfValues() > 0 )
+    {
+    checkpointFileName = checkpointOption->GetValue( 0 );
+    }
+  itk::ANTSRegistrationCheckpoint checkpoint;
+  std::vector<std::string> stageFileNames;
+  std::vector<std::string> stageInverseFileNames;
+  std::vector<std::string> resumedFileNames;
+  std::vector<std::string> resumedInverseFileNames;
+
+  typename OptionType::Pointer resumeOption = parser->GetOption( "resume" );
+  if( resumeOption && resumeOption->GetNumberOfValues() > 0 )
+    {
+    unsigned int dimension = 0;
+    unsigned int numberOfCompletedStages = 0;
+    bool ok = checkpoint.Read( resumeOption->GetValue( 0 ) ) && checkpoint.Get( dimension ) &&
+      dimension == ImageDimension && checkpoint.Get( numberOfCompletedStages );
+    for( unsigned int n = 0; ok && n < numberOfCompletedStages; n++ )
+      {
+      std::string name;
+      std::string inverseName;
+      ok = checkpoint.GetString( name ) && checkpoint.GetString( inverseName );
+      resumedFileNames.push_back( name );
+      resumedInverseFileNames.push_back( inverseName );
+      }
+    if( !ok || numberOfCompletedStages > numberOfStages )
+      {
+      std::cerr << "Could not resume from " << resumeOption->GetValue( 0 ) << std::endl;
+      return EXIT_FAILURE;
+      }
+    std::cout << "Resuming after " << numberOfCompletedStages << " completed stage(s)." << std::endl;
+    checkpoint.Clear();
+    }
+
   // We iterate backwards because the command line options are stored as a stack (first in last out)
 
   for( int currentStage = numberOfStages - 1; currentStage >= 0; currentStage-- )
@@ -586,6 +678,25 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
     std::stringstream currentStageString;
     currentStageString << ( numberOfInitialTransforms + numberOfStages - currentStage - 1 );
 
+    const unsigned int stageNumber = numberOfStages - currentStage - 1;
+    std::string stageFileName;
+    std::string stageInverseFileName;
+    if( stageNumber < resumedFileNames.size() )
+      {
+      typedef itk::Transform<double, ImageDimension, ImageDimension> TransformType;
+      typename TransformType::Pointer stageTransform =
+        ReadStageTransform<ImageDimension>( resumedFileNames[stageNumber], resumedInverseFileNames[stageNumber] );
+      if( !stageTransform )
+        {
+        return EXIT_FAILURE;
+        }
+      compositeTransform->AddTransform( stageTransform );
+      stageFileNames.push_back( resumedFileNames[stageNumber] );
+      stageInverseFileNames.push_back( resumedInverseFileNames[stageNumber] );
+      std::cout << "  restored from " << resumedFileNames[stageNumber] << std::endl;
+      continue;
+      }
+
     // Get the fixed and moving images
 
     std::string fixedImageFileName = metricOption->GetParameter( currentStage, 0 );
@@ -849,6 +960,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the affine transform
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Affine.mat" );
+      stageFileName = filename;
 
       typedef itk::TransformFileWriter TransformWriterType;
       typename TransformWriterType::Pointer transformWriter = TransformWriterType::New();
@@ -897,6 +1009,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the affine transform
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Rigid.mat" );
+      stageFileName = filename;
 
       typedef itk::TransformFileWriter TransformWriterType;
       typename TransformWriterType::Pointer transformWriter = TransformWriterType::New();
@@ -944,6 +1057,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the affine transform
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Affine.mat" );
+      stageFileName = filename;
 
       typedef itk::TransformFileWriter TransformWriterType;
       typename TransformWriterType::Pointer transformWriter = TransformWriterType::New();
@@ -992,6 +1106,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the affine transform
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Similarity.mat" );
+      stageFileName = filename;
 
       typedef itk::TransformFileWriter TransformWriterType;
       typename TransformWriterType::Pointer transformWriter = TransformWriterType::New();
@@ -1040,6 +1155,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the affine transform
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Translation.mat" );
+      stageFileName = filename;
 
       typedef itk::TransformFileWriter TransformWriterType;
       typename TransformWriterType::Pointer transformWriter = TransformWriterType::New();
@@ -1145,6 +1261,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the displacement field
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Warp.nii.gz" );
+      stageFileName = filename;
 
       typedef itk::ImageFileWriter<DisplacementFieldType> WriterType;
       typename WriterType::Pointer writer = WriterType::New();
@@ -1277,6 +1394,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the displacement field
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Warp.nii.gz" );
+      stageFileName = filename;
 
       typedef itk::ImageFileWriter<DisplacementFieldType> WriterType;
       typename WriterType::Pointer writer = WriterType::New();
@@ -1374,6 +1492,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out B-spline transform
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "BSpline.txt" );
+      stageFileName = filename;
 
       typedef itk::TransformFileWriter TransformWriterType;
       typename TransformWriterType::Pointer transformWriter = TransformWriterType::New();
@@ -1543,6 +1662,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the displacement fields
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Warp.nii.gz" );
+      stageFileName = filename;
 
       typedef typename VelocityFieldRegistrationType::TransformType::DisplacementFieldType DisplacementFieldType;
 
@@ -1553,6 +1673,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       writer->Update();
 
       std::string inverseFilename = outputPrefix + currentStageString.str() + std::string( "InverseWarp.nii.gz" );
+      stageInverseFileName = inverseFilename;
 
       typedef itk::ImageFileWriter<DisplacementFieldType> InverseWriterType;
       typename InverseWriterType::Pointer inverseWriter = InverseWriterType::New();
@@ -1733,6 +1854,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the displacement fields
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Warp.nii.gz" );
+      stageFileName = filename;
 
       typedef typename VelocityFieldRegistrationType::TransformType::DisplacementFieldType DisplacementFieldType;
 
@@ -1743,6 +1865,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       writer->Update();
 
       std::string inverseFilename = outputPrefix + currentStageString.str() + std::string( "InverseWarp.nii.gz" );
+      stageInverseFileName = inverseFilename;
 
       typedef itk::ImageFileWriter<DisplacementFieldType> InverseWriterType;
       typename InverseWriterType::Pointer inverseWriter = InverseWriterType::New();
@@ -1859,6 +1982,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       // Write out the displacement field and its inverse
 
       std::string filename = outputPrefix + currentStageString.str() + std::string( "Warp.nii.gz" );
+      stageFileName = filename;
 
       typedef itk::ImageFileWriter<DisplacementFieldType> WriterType;
       typename WriterType::Pointer writer = WriterType::New();
@@ -1867,6 +1991,7 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       writer->Update();
 
       filename = outputPrefix + currentStageString.str() + std::string( "InverseWarp.nii.gz" );
+      stageInverseFileName = filename;
 
       typename WriterType::Pointer inverseWriter = WriterType::New();
       inverseWriter->SetInput( const_cast<typename DisplacementFieldRegistrationType::TransformType *>( displacementFieldRegistration->GetOutput()->Get() )->GetInverseDisplacementField() );
@@ -1878,6 +2003,21 @@ int antsRegistration( itk::ants::CommandLineParser *parser )
       std::cerr << "ERROR:  Unrecognized transform option - " << whichTransform << std::endl;
       return EXIT_FAILURE;
       }
+    stageFileNames.push_back( stageFileName );
+    stageInverseFileNames.push_back( stageInverseFileName );
+    if( !checkpointFileName.empty() )
+      {
+      checkpoint.Clear();
+      checkpoint.Put<unsigned int>( ImageDimension );
+      checkpoint.Put<unsigned int>( stageFileNames.size() );
+      for( unsigned int n = 0; n < stageFileNames.size(); n++ )
+        {
+        checkpoint.PutString( stageFileNames[n] );
+        checkpoint.PutString( stageInverseFileNames[n] );
+        }
+      checkpoint.WriteAsync( checkpointFileName );
+      }
+
     timer.Stop();
     std::cout << "  Elapsed time (stage " << ( numberOfStages - currentStage - 1 ) << "): " << timer.GetMeanTime() << std::endl << std::endl;
     }
@@ -2120,6 +2260,29 @@ void InitializeCommandLineOptions( itk::ants::CommandLineParser *parser )
   parser->AddOption( option );
   }
 
+  {
+  std::string description = std::string( "Write the list of finished stages and their transform files " ) +
+    std::string( "to this file after every stage.  The file is written in the background." );
+
+  OptionType::Pointer option = OptionType::New();
+  option->SetLongName( "checkpoint" );
+  option->SetUsageOption( 0, "checkpointFile" );
+  option->SetDescription( description );
+  parser->AddOption( option );
+  }
+
+  {
+  std::string description = std::string( "Continue an interrupted run from a --checkpoint file.  The stages " ) +
+    std::string( "it lists are read back from their transform files instead of being run again;  " ) +
+    std::string( "the other options must match those of the interrupted run." );
+
+  OptionType::Pointer option = OptionType::New();
+  option->SetLongName( "resume" );
+  option->SetUsageOption( 0, "checkpointFile" );
+  option->SetDescription( description );
+  parser->AddOption( option );
+  }
+
   {
   std::string description = std::string( "Print the help menu (short version)." );
 
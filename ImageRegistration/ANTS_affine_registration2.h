@@ -38,6 +38,9 @@
 #include "itkImageRegionIterator.h"
 #include "itkRandomImageSource.h"
 #include "itkAddImageFilter.h"
+#include "itkMultiThreader.h"
+#include "vnl/vnl_quaternion.h"
+#include <algorithm>
 
 
 typedef enum{AffineWithMutualInformation=1, AffineWithMeanSquareDifference , AffineWithHistogramCorrelation, AffineWithNormalizedCorrelation , AffineWithGradientDifference } AffineMetricType;
@@ -52,6 +55,7 @@ public:
   OptAffine(){
     MI_bins = 32;
     MI_samples = 6000;
+    MI_sampling_seed = 0;
     number_of_seeds = 0;
     time_seed = (unsigned int) time(NULL) ;
     number_of_levels = 3;
@@ -70,6 +74,13 @@ public:
 
     use_rotation_header = false;
     ignore_void_orgin = true;
+
+    number_of_rotation_starts = 0;
+    rotation_search_range = 90.0;
+    number_of_translation_starts = 1;
+    translation_search_range = 0.0;
+    number_of_best_starts = 3;
+    start_search_samples = 2000;
   };
 
   ~OptAffine(){
@@ -80,6 +91,7 @@ public:
 
   int MI_bins;
   int MI_samples;
+  unsigned int MI_sampling_seed; // 0: samples drawn from ITK's global generator
   int number_of_seeds;
   unsigned int time_seed;
   int number_of_levels;
@@ -96,6 +108,14 @@ public:
 
   bool use_rotation_header;
   bool ignore_void_orgin;
+
+  // multi-start search at the coarsest level, off unless more than one start
+  int number_of_rotation_starts; // angles per rotation axis
+  double rotation_search_range; // degrees, on either side of the initial rotation
+  int number_of_translation_starts; // offsets per axis
+  double translation_search_range; // physical units, on either side of the initial translation
+  int number_of_best_starts; // starts refined through all levels
+  int start_search_samples; // MI samples of the search
 };
 
 
@@ -136,6 +156,9 @@ std::ostream& operator<< (std::ostream& os, const OptAffine<TAffineTransformPoin
   os <<"relaxation_factor="<<p.relaxation_factor<<std::endl;
   os<<"minimum_step_length="<<p.minimum_step_length<<std::endl;
   os<<"translation_scales="<<p.translation_scales<<std::endl;
+  os<<"number_of_rotation_starts="<<p.number_of_rotation_starts<<" "<<"rotation_search_range="<<p.rotation_search_range<<std::endl;
+  os<<"number_of_translation_starts="<<p.number_of_translation_starts<<" "<<"translation_search_range="<<p.translation_search_range<<std::endl;
+  os<<"number_of_best_starts="<<p.number_of_best_starts<<" "<<"start_search_samples="<<p.start_search_samples<<std::endl;
 
 
 
@@ -375,6 +398,7 @@ inline void PreConversionInAffine(ImagePointerType &fixedImage, RunningImagePoin
 
   R_opt.MI_bins = opt.MI_bins;
   R_opt.MI_samples = opt.MI_samples;
+  R_opt.MI_sampling_seed = opt.MI_sampling_seed;
   R_opt.number_of_seeds = opt.number_of_seeds;
   R_opt.time_seed = opt.time_seed;
   R_opt.number_of_levels = opt.number_of_levels;
@@ -1313,6 +1337,213 @@ bool RegisterImageAffineMutualInformationMultiResolution(RunningAffineCacheType
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// multi-start initialization: a grid of rotations (and translations) around
+// the initial transform is scored at the coarsest level with a subsampled
+// Mattes MI, all cores sharing the grid, and only the best few starts go
+// through the full multi-resolution descent.
+
+/** n values 2*range/n apart that include zero, so a full turn has no
+ * duplicate;  a single value is zero. */
+inline std::vector<double> AffineStartOffsets(int n, double range){
+  std::vector<double> offsets;
+  if (n < 1) n = 1;
+  for(int k = 0; k < n; k++) offsets.push_back((k - n / 2) * 2.0 * range / n);
+  return offsets;
+}
+
+template<class OptAffine, class ParaType>
+void BuildAffineStartCandidates(OptAffine &opt, unsigned int kImageDim, std::vector<ParaType> &candidates){
+
+  const double deg2rad = vnl_math::pi / 180.0;
+  std::vector<double> angles = AffineStartOffsets(opt.number_of_rotation_starts, opt.rotation_search_range * deg2rad);
+  std::vector<double> offsets = AffineStartOffsets(opt.number_of_translation_starts, opt.translation_search_range);
+  if (opt.translation_search_range <= 0) offsets.assign(1, 0.0);
+
+  ParaType para0 = opt.transform_initial->GetParameters();
+  const unsigned int kParaDim = para0.Size();
+  const unsigned int na = angles.size();
+  const unsigned int nt = offsets.size();
+
+  candidates.clear();
+  switch(kImageDim){
+  case 2: // theta, s1, s2, k, c1, c2, t1, t2
+    for(unsigned int a = 0; a < na; a++)
+      for(unsigned int t = 0; t < nt * nt; t++){
+        ParaType para = para0;
+        para[0] += angles[a];
+        para[kParaDim-2] += offsets[t % nt];
+        para[kParaDim-1] += offsets[t / nt];
+        candidates.push_back(para);
+      }
+    break;
+  case 3: // q1,q2,q3,q4,s1,s2,s3,k1,k2,k3,t1,t2,t3
+  {
+    vnl_quaternion<double> q0(para0[0], para0[1], para0[2], para0[3]);
+    for(unsigned int a = 0; a < na * na * na; a++)
+      for(unsigned int t = 0; t < nt * nt * nt; t++){
+        ParaType para = para0;
+        vnl_quaternion<double> q = vnl_quaternion<double>(angles[a % na], angles[(a / na) % na], angles[a / (na * na)]) * q0;
+        for(int j = 0; j < 4; j++) para[j] = q[j];
+        para[kParaDim-3] += offsets[t % nt];
+        para[kParaDim-2] += offsets[(t / nt) % nt];
+        para[kParaDim-1] += offsets[t / (nt * nt)];
+        candidates.push_back(para);
+      }
+  }
+  break;
+  }
+}
+
+template<class MetricPointerType, class ParaType>
+struct AffineStartSearchThreadStruct{
+  std::vector<MetricPointerType> metrics; // one per thread
+  const std::vector<ParaType> *candidates;
+  std::vector<double> values;
+};
+
+template<class ThreadStructType>
+ITK_THREAD_RETURN_TYPE AffineStartSearchThreaderCallback(void *arg){
+  itk::MultiThreader::ThreadInfoStruct *info = static_cast<itk::MultiThreader::ThreadInfoStruct *>( arg );
+  ThreadStructType *str = static_cast<ThreadStructType *>( info->UserData );
+  itk::ThreadIdType threadId = info->ThreadID;
+  itk::ThreadIdType threadCount = info->NumberOfThreads;
+
+  const unsigned int numberOfCandidates = str->candidates->size();
+  const unsigned int valuesPerThread = ( numberOfCandidates + threadCount - 1 ) / threadCount;
+  const unsigned int first = threadId * valuesPerThread;
+  const unsigned int last = std::min( first + valuesPerThread, numberOfCandidates );
+  for(unsigned int i = first; i < last; i++){
+    try{
+      str->values[i] = str->metrics[threadId]->GetValue( (*str->candidates)[i] );
+    }
+    catch(itk::ExceptionObject &){
+      // too many samples outside the moving image, keep the worst value
+    }
+  }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+/** Score the start grid and return the best opt.number_of_best_starts,
+ * best first.  The grid is only the initial transform when it has a single
+ * point. */
+template<class RunningAffineCacheType, class OptAffine, class ParaType>
+void SearchAffineStarts(RunningAffineCacheType &running_cache, OptAffine &opt, std::vector<ParaType> &starts){
+
+  typedef typename RunningAffineCacheType::ImagePointerType ImagePointerType;
+  typedef typename ImagePointerType::ObjectType ImageType;
+  typedef typename OptAffine::AffineTransformType TransformType;
+  typedef itk::MattesMutualInformationImageToImageMetric<ImageType, ImageType> SearchMetricType;
+  typedef typename SearchMetricType::Pointer SearchMetricPointerType;
+  typedef itk::LinearInterpolateImageFunction<ImageType, double> SearchInterpolatorType;
+  typedef AffineStartSearchThreadStruct<SearchMetricPointerType, ParaType> ThreadStructType;
+
+  std::vector<ParaType> candidates;
+  BuildAffineStartCandidates(opt, ImageType::ImageDimension, candidates);
+  starts.assign(1, opt.transform_initial->GetParameters());
+  if (candidates.size() <= 1) return;
+
+  ImagePointerType fixed_image = running_cache.fixed_image_pyramid[0];
+  ImagePointerType moving_image = running_cache.moving_image_pyramid[0];
+
+  typename itk::MultiThreader::Pointer threader = itk::MultiThreader::New();
+  threader->SetNumberOfThreads( std::min<unsigned int>( itk::MultiThreader::GetGlobalDefaultNumberOfThreads(), candidates.size() ) );
+  const unsigned int threadCount = threader->GetNumberOfThreads();
+
+  ThreadStructType str;
+  str.candidates = &candidates;
+  str.values.assign(candidates.size(), itk::NumericTraits<double>::max());
+  try{
+    for(unsigned int t = 0; t < threadCount; t++){
+      typename TransformType::Pointer transform = TransformType::New();
+      transform->SetParameters(opt.transform_initial->GetParameters());
+      transform->SetCenter(opt.transform_initial->GetCenter());
+      typename SearchInterpolatorType::Pointer interpolator = SearchInterpolatorType::New();
+      interpolator->SetInputImage( moving_image );
+
+      SearchMetricPointerType metric = SearchMetricType::New();
+      metric->SetMovingImage( moving_image );
+      metric->SetFixedImage( fixed_image );
+      metric->SetTransform( transform );
+      metric->SetInterpolator( interpolator );
+      metric->SetFixedImageRegion( fixed_image->GetLargestPossibleRegion() );
+      if (running_cache.mask_fixed_object.IsNotNull()) metric->SetFixedImageMask( running_cache.mask_fixed_object );
+      metric->SetNumberOfHistogramBins( opt.MI_bins );
+      metric->SetNumberOfSpatialSamples( opt.start_search_samples );
+      metric->SetNumberOfThreads( 1 );
+      // same seed in every thread so that all candidates see the same samples
+      metric->ReinitializeSeed( 76926294 );
+      metric->Initialize();
+      str.metrics.push_back( metric );
+    }
+  }
+  catch(itk::ExceptionObject & err){
+    std::cerr << "ExceptionObject caught in the affine start search, using the initial transform" << std::endl;
+    std::cerr << err << std::endl;
+    return;
+  }
+
+  threader->SetSingleMethod( AffineStartSearchThreaderCallback<ThreadStructType>, &str );
+  threader->SingleMethodExecute();
+
+  // ties go to the earlier candidate, so the result does not depend on the thread count
+  std::vector<std::pair<double, unsigned int> > order(candidates.size());
+  for(unsigned int i = 0; i < candidates.size(); i++) order[i] = std::make_pair(str.values[i], i);
+  std::sort(order.begin(), order.end());
+
+  const unsigned int numberOfStarts = std::min<unsigned int>( std::max(opt.number_of_best_starts, 1), candidates.size() );
+  starts.clear();
+  std::cout << "searched " << candidates.size() << " affine starts on " << threadCount << " threads, best:" << std::endl;
+  for(unsigned int k = 0; k < numberOfStarts; k++){
+    starts.push_back(candidates[order[k].second]);
+    std::cout << "    start " << order[k].second << " value " << order[k].first << " para " << starts.back() << std::endl;
+  }
+}
+
+/** Multi-resolution descent from the best starts of the grid search, keeping
+ * the result of lowest full resolution MI;  the plain descent from the
+ * initial transform when the search is off. */
+template<class RunningAffineCacheType, class OptAffine, class ParaType>
+bool RegisterImageAffineMultiStart(RunningAffineCacheType &running_cache, OptAffine &opt, ParaType &para_final){
+
+  typedef typename RunningAffineCacheType::ImagePointerType ImagePointerType;
+  typedef typename OptAffine::AffineTransformType TransformType;
+
+  bool noaffine=true;
+  for(int i = 0; i<opt.number_of_levels; i++) if ( opt.number_of_iteration_list[i] > 0) noaffine=false;
+
+  std::vector<ParaType> starts;
+  if (!noaffine) SearchAffineStarts(running_cache, opt, starts);
+  if (starts.size() <= 1)
+    return RegisterImageAffineMutualInformationMultiResolution(running_cache, opt, para_final);
+
+  ImagePointerType fixed_image = running_cache.fixed_image_pyramid[opt.number_of_levels-1];
+  ImagePointerType moving_image = running_cache.moving_image_pyramid[opt.number_of_levels-1];
+  typename TransformType::InputPointType center = opt.transform_initial->GetCenter();
+
+  bool is_ok = false;
+  double best_value = itk::NumericTraits<double>::max();
+  for(unsigned int k = 0; k < starts.size(); k++){
+    OptAffine opt_start = opt;
+    opt_start.transform_initial = TransformType::New();
+    opt_start.transform_initial->SetParameters(starts[k]);
+    opt_start.transform_initial->SetCenter(center);
+
+    ParaType para(TransformType::ParametersDimension);
+    if (!RegisterImageAffineMutualInformationMultiResolution(running_cache, opt_start, para)) continue;
+
+    double value = TestCostValueMMI(fixed_image, moving_image, para, center, opt.transform_initial);
+    std::cout << "start " << k << ": measure value (MMI) = " << value << std::endl;
+    if (!is_ok || value < best_value){
+      best_value = value;
+      para_final = para;
+      is_ok = true;
+    }
+  }
+  return is_ok;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 template<class ImagePointerType, class TransformPointerType, class OptAffineType>
 void ComputeSingleAffineTransform2D3D(ImagePointerType fixed_image, ImagePointerType moving_image, OptAffineType &opt, TransformPointerType &transform){
@@ -1351,7 +1582,7 @@ void ComputeSingleAffineTransform2D3D(ImagePointerType fixed_image, ImagePointer
 
     RunningAffineCacheType running_cache;
     InitializeRunningAffineCache(fixed_image, moving_image, opt, running_cache);
-    RegisterImageAffineMutualInformationMultiResolution(running_cache, opt, para_final);
+    RegisterImageAffineMultiStart(running_cache, opt, para_final);
   }
   break;
   case AffineWithHistogramCorrelation:{
@@ -1368,7 +1599,7 @@ void ComputeSingleAffineTransform2D3D(ImagePointerType fixed_image, ImagePointer
     histSize[0] = nBins;
     histSize[1] = nBins;
     running_cache.metric->SetHistogramSize(histSize);
-    RegisterImageAffineMutualInformationMultiResolution(running_cache, opt, para_final);
+    RegisterImageAffineMultiStart(running_cache, opt, para_final);
   }
   break;
   case AffineWithNormalizedCorrelation:{
@@ -1379,7 +1610,7 @@ void ComputeSingleAffineTransform2D3D(ImagePointerType fixed_image, ImagePointer
 
     RunningAffineCacheType running_cache;
     InitializeRunningAffineCache(fixed_image, moving_image, opt, running_cache);
-    RegisterImageAffineMutualInformationMultiResolution(running_cache, opt, para_final);
+    RegisterImageAffineMultiStart(running_cache, opt, para_final);
   }
   break;
   case AffineWithGradientDifference:{
@@ -1390,7 +1621,7 @@ void ComputeSingleAffineTransform2D3D(ImagePointerType fixed_image, ImagePointer
 
     RunningAffineCacheType running_cache;
     InitializeRunningAffineCache(fixed_image, moving_image, opt, running_cache);
-    RegisterImageAffineMutualInformationMultiResolution(running_cache, opt, para_final);
+    RegisterImageAffineMultiStart(running_cache, opt, para_final);
   }
   break;
   case AffineWithMutualInformation: {
@@ -1404,8 +1635,9 @@ void ComputeSingleAffineTransform2D3D(ImagePointerType fixed_image, ImagePointer
 
     running_cache.metric->SetNumberOfHistogramBins( opt.MI_bins );
     running_cache.metric->SetNumberOfSpatialSamples( opt.MI_samples );
+    if ( opt.MI_sampling_seed > 0 ) running_cache.metric->ReinitializeSeed( opt.MI_sampling_seed );
 
-    RegisterImageAffineMutualInformationMultiResolution(running_cache, opt, para_final);
+    RegisterImageAffineMultiStart(running_cache, opt, para_final);
   }
   break;
   default:
@@ -31,6 +31,7 @@
 #include "itkResampleImageFilter.h"
 #include "itkVectorNeighborhoodOperatorImageFilter.h"
 #include "vnl/vnl_math.h"
+#include <algorithm>
 #include "ANTS_affine_registration2.h"
 #include "itkWarpImageMultiTransformFilter.h"
 //#include "itkVectorImageFileWriter.h"
@@ -79,6 +80,80 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
     this->m_HitImage=NULL;
     this->m_ThickImage=NULL;
     this->m_SyNFullTime=0;
+    this->m_UseFusedUpdateField=true;
+    this->m_UseScalingAndSquaring=false;
+    this->m_ScalingAndSquaringSteps=0;
+    this->m_ScalingAndSquaringInDouble=false;
+    this->m_MetricSamplingStrategy=0;
+    this->m_MetricSamplingPercentages.clear();
+    this->m_MetricSamplingSeed=19650218;
+    this->m_MetricSamplingRandomizer=NULL;
+    this->m_MetricSamplingCount=0;
+    this->m_MetricSamplingTaken=0;
+    this->m_MetricSamplingCounters.clear();
+    this->m_MetricSamplingStride=1;
+    this->m_MetricSamplingOffset=0;
+    this->m_MetricSamplingBlockOffset=0;
+    this->m_MetricSamplingFraction=1;
+    this->m_CheckpointInterval=10;
+    this->m_Resuming=false;
+    this->m_ResumeLevel=0;
+    this->m_ResumeIteration=0;
+    this->m_ResumeLevelConverged=false;
+    this->m_ResumeLevelAtIterationLimit=false;
+    this->m_ResumeGradstep=0;
+    this->m_ResumeAffineTransform=NULL;
+    this->m_ResumeFixedImageAffineTransform=NULL;
+}
+
+
+template<unsigned int TDimension, class TReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::InitializeMetricSampling( unsigned int metricCount, bool ispointsetmetric )
+{
+  this->m_MetricSamplingCount=0;
+  this->m_MetricSamplingTaken=0;
+  this->m_MetricSamplingStride=1;
+  this->m_MetricSamplingOffset=0;
+  this->m_MetricSamplingBlockOffset=0;
+  this->m_MetricSamplingFraction=1;
+  if ( this->m_MetricSamplingStrategy == 0 || this->m_MetricSamplingPercentages.empty() ) return;
+
+  // point-set metrics put their gradients at the points only, so dropping
+  // voxels would drop points
+  if ( ispointsetmetric ) return;
+
+  // the last percentage given applies to the remaining levels
+  unsigned int level=vnl_math_min( static_cast<unsigned int>( this->m_CurrentLevel ),
+    static_cast<unsigned int>( this->m_MetricSamplingPercentages.size() - 1 ) );
+  TReal percentage=this->m_MetricSamplingPercentages[level];
+  if ( percentage >= 1 || percentage <= 0 ) return;
+
+  // regular sampling shifts each metric's lattice by one voxel per sweep, so
+  // that every voxel is visited once over Stride iterations, and jitters it
+  // per block of Stride voxels (see IsMetricSample());  random
+  // sampling draws a new set each sweep.  The gradients are not reweighted:
+  // the smoothed update field is normalized by its maximum anyway.
+  if ( this->m_MetricSamplingStrategy == 1 )
+    {
+    if ( this->m_MetricSamplingCounters.size() <= metricCount )
+      this->m_MetricSamplingCounters.resize( metricCount + 1, 0 );
+    this->m_MetricSamplingStride=static_cast<unsigned long>( vnl_math_rnd( 1.0 / percentage ) );
+    if ( this->m_MetricSamplingStride < 1 ) this->m_MetricSamplingStride=1;
+    this->m_MetricSamplingOffset=this->m_MetricSamplingCounters[metricCount] % this->m_MetricSamplingStride;
+    this->m_MetricSamplingFraction=1.0/static_cast<TReal>( this->m_MetricSamplingStride );
+    this->m_MetricSamplingCounters[metricCount]++;
+    }
+  else
+    {
+    if ( !this->m_MetricSamplingRandomizer )
+      {
+      this->m_MetricSamplingRandomizer=RandomizerType::New();
+      this->m_MetricSamplingRandomizer->Initialize( this->m_MetricSamplingSeed );
+      }
+    this->m_MetricSamplingFraction=percentage;
+    }
 }
 
 
@@ -543,7 +618,17 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
 {
     VectorType zero;
     zero.Fill(0);
-    DisplacementFieldPointer diffmap=DisplacementFieldType::New();
+    DisplacementFieldPointer diffmap;
+    if ( this->m_UseScalingAndSquaring )
+    {
+        if ( this->m_ScalingAndSquaringInDouble )
+            this->template ExponentiateVelocityField<double>(totalField, timestep*(TReal)ntimesteps, diffmap, NULL);
+        else
+            this->template ExponentiateVelocityField<float>(totalField, timestep*(TReal)ntimesteps, diffmap, NULL);
+        return diffmap;
+    }
+
+    diffmap=DisplacementFieldType::New();
     diffmap->SetSpacing( totalField->GetSpacing() );
     diffmap->SetOrigin( totalField->GetOrigin() );
     diffmap->SetDirection( totalField->GetDirection() );
@@ -562,11 +647,79 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
 }
 
 
+template<unsigned int TDimension, class TReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::IntegrateConstantVelocityWithInverse(DisplacementFieldPointer totalField, unsigned int ntimesteps, TReal timestep,
+                                       DisplacementFieldPointer & diffmap, DisplacementFieldPointer & invdiffmap)
+{
+    if ( !this->m_UseScalingAndSquaring )
+    {
+        diffmap = this->IntegrateConstantVelocity(totalField, ntimesteps, timestep);
+        invdiffmap = this->IntegrateConstantVelocity(totalField, ntimesteps, timestep*(-1.));
+        return;
+    }
+    if ( this->m_ScalingAndSquaringInDouble )
+        this->template ExponentiateVelocityField<double>(totalField, timestep*(TReal)ntimesteps, diffmap, &invdiffmap);
+    else
+        this->template ExponentiateVelocityField<float>(totalField, timestep*(TReal)ntimesteps, diffmap, &invdiffmap);
+}
+
+
+template<unsigned int TDimension, class TReal>
+template<class TComputeReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::ExponentiateVelocityField(DisplacementFieldPointer velocity, TReal scale,
+                            DisplacementFieldPointer & diffmap, DisplacementFieldPointer * invdiffmap)
+{
+    typedef itk::ScalingAndSquaringDisplacementFieldImageFilter<DisplacementFieldType, DisplacementFieldType, TComputeReal> ExponentiatorType;
+    typename ExponentiatorType::Pointer exponentiator = ExponentiatorType::New();
+    exponentiator->SetVelocityField( velocity );
+    exponentiator->SetScale( scale );
+    exponentiator->SetNumberOfSquaringSteps( this->m_ScalingAndSquaringSteps );
+    exponentiator->SetComputeInverse( invdiffmap != NULL );
+    exponentiator->Update();
+    if (this->m_Debug) std::cout << " squaring steps used " << exponentiator->GetNumberOfSquaringStepsUsed() << std::endl;
+
+    diffmap = exponentiator->GetOutput();
+    diffmap->DisconnectPipeline();
+    if ( invdiffmap )
+    {
+        *invdiffmap = exponentiator->GetInverseOutput();
+        (*invdiffmap)->DisconnectPipeline();
+    }
+}
+
+
+template<unsigned int TDimension, class TReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::AllocateUpdateFieldBuffer( DisplacementFieldPointer & buffer, DisplacementFieldPointer reference )
+{
+  VectorType zero;
+  zero.Fill(0);
+  if ( !buffer || buffer->GetLargestPossibleRegion() != reference->GetLargestPossibleRegion()
+       || buffer->GetSpacing() != reference->GetSpacing() )
+    {
+    buffer=DisplacementFieldType::New();
+    buffer->SetSpacing( reference->GetSpacing() );
+    buffer->SetLargestPossibleRegion( reference->GetLargestPossibleRegion() );
+    buffer->SetRequestedRegion( reference->GetLargestPossibleRegion() );
+    buffer->SetBufferedRegion( reference->GetLargestPossibleRegion() );
+    buffer->Allocate();
+    }
+  buffer->SetOrigin( reference->GetOrigin() );
+  buffer->SetDirection( reference->GetDirection() );
+  buffer->FillBuffer(zero);
+}
+
 template<unsigned int TDimension, class TReal>
 typename ANTSImageRegistrationOptimizer<TDimension, TReal>::DisplacementFieldPointer
 ANTSImageRegistrationOptimizer<TDimension, TReal>
 ::ComputeUpdateField(DisplacementFieldPointer fixedwarp, DisplacementFieldPointer movingwarp ,   PointSetPointer fpoints, PointSetPointer wpoints, DisplacementFieldPointer totalUpdateInvField, bool updateenergy)
 {
+  this->m_UpdateFieldTimer.Start();
 
   ImagePointer mask=NULL;
   if ( movingwarp && this->m_MaskImage && !this->m_ComputeThickness )
@@ -599,6 +752,28 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
       }
     sumWeights=1;
 
+    /** With several metrics, warp all metric images in one shared pass,
+        reuse the per-metric update buffers and sum the contributions in a
+        single threaded sweep after the metric loop. */
+    unsigned int numberOfMetrics=this->m_SimilarityMetrics.size();
+    bool fuse = ( this->m_UseFusedUpdateField && numberOfMetrics > 1 );
+    std::vector<ImagePointer> warpedMovingImages;
+    std::vector<ImagePointer> warpedFixedImages;
+    typedef Functor::ANTSUpdateFieldAccumulator<VectorType,TReal> AccumulatorFunctorType;
+    AccumulatorFunctorType accumulate;
+    AccumulatorFunctorType accumulateInv;
+    if ( fuse )
+      {
+      this->m_UpdateFieldBuffers.resize( numberOfMetrics, NULL );
+      this->m_UpdateFieldInvBuffers.resize( numberOfMetrics, NULL );
+      warpedMovingImages = this->WarpMultiTransformList( this->m_ReferenceSpaceImage, this->m_SmoothMovingImages, this->m_AffineTransform, fixedwarp, false, NULL );
+      warpedFixedImages = this->WarpMultiTransformList( this->m_ReferenceSpaceImage, this->m_SmoothFixedImages, NULL, movingwarp, false, this->m_FixedImageAffineTransform );
+      VectorType spacingvec;
+      for (unsigned int jj=0; jj<ImageDimension; jj++) spacingvec[jj]=spacing[jj];
+      accumulate.SetSpacing( spacingvec );
+      accumulateInv.SetSpacing( spacingvec );
+      }
+
     for ( unsigned int metricCount = 0; metricCount < this->m_SimilarityMetrics.size(); metricCount++ )
     {
          bool ispointsetmetric=false;
@@ -609,6 +784,16 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
           updateField=totalUpdateField;
           if (totalUpdateInvField) updateFieldInv=totalUpdateInvField;
         }
+       else if ( fuse )
+        {
+          this->AllocateUpdateFieldBuffer( this->m_UpdateFieldBuffers[metricCount], fixedwarp );
+          updateField=this->m_UpdateFieldBuffers[metricCount];
+          if (totalUpdateInvField)
+            {
+            this->AllocateUpdateFieldBuffer( this->m_UpdateFieldInvBuffers[metricCount], fixedwarp );
+            updateFieldInv=this->m_UpdateFieldInvBuffers[metricCount];
+            }
+        }
         else {
           updateField=DisplacementFieldType::New();
           updateField->SetSpacing( fixedwarp->GetSpacing() );
@@ -659,15 +844,22 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
          turn  then expand the update field to fit size of total
          deformation */
         ImagePointer wmimage=NULL;
+        ImagePointer wfimage=NULL;
+        if ( fuse )
+          {
+          wmimage=warpedMovingImages[metricCount];
+          wfimage=warpedFixedImages[metricCount];
+          }
+        else {
             if ( fixedwarp)
      wmimage= this->WarpMultiTransform(  this->m_ReferenceSpaceImage ,this->m_SmoothMovingImages[metricCount], this->m_AffineTransform, fixedwarp, false , NULL );
         else wmimage=this->SubsampleImage( this->m_SmoothMovingImages[metricCount] , this->m_ScaleFactor , this->m_SmoothMovingImages[metricCount]->GetOrigin() , this->m_SmoothMovingImages[metricCount]->GetDirection() ,  NULL);
 
 //    std::cout << " C " << std::endl;
-        ImagePointer wfimage=NULL;
         if ( movingwarp)
               wfimage= this->WarpMultiTransform( this->m_ReferenceSpaceImage , this->m_SmoothFixedImages[metricCount], NULL, movingwarp, false , this->m_FixedImageAffineTransform );
         else wfimage=this->SubsampleImage( this->m_SmoothFixedImages[metricCount] , this->m_ScaleFactor , this->m_SmoothFixedImages[metricCount]->GetOrigin() , this->m_SmoothFixedImages[metricCount]->GetDirection() ,  NULL);
+        }
     /*
     if (this->m_TimeVaryingVelocity && ! this->m_MaskImage ) {
       std::string outname=this->localANTSGetFilePrefix(this->m_OutputNamingConvention.c_str())+std::string("thick.nii.gz");
@@ -694,6 +886,7 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
         if (wpoints && ispointsetmetric ) df->SetMovingPointSet(wpoints); else if (ispointsetmetric ) std::cout << "NO POINTS!! " << std::endl;
         typename ImageType::SizeType  radius = df->GetRadius();
         df->InitializeIteration();
+        TReal initialenergy=df->GetEnergy();
         typename DisplacementFieldType::Pointer output = updateField;
         typedef NeighborhoodAlgorithm::ImageBoundaryFacesCalculator<DisplacementFieldType>
         FaceCalculatorType;
@@ -708,11 +901,12 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
         UpdateIteratorType       nU(updateField,  *fIt);
         nD.GoToBegin();
     nU.GoToBegin();
+        this->InitializeMetricSampling( metricCount, ispointsetmetric );
         while( !nD.IsAtEnd() )
         {
-            bool oktosample=true;
+            bool oktosample=this->IsMetricSample();
             TReal maskprob=1.0;
-            if (mask)
+            if (mask && oktosample)
              {
                 maskprob=mask->GetPixel( nD.GetIndex() );
                 if (maskprob > 1.0) maskprob=1.0;
@@ -770,7 +964,7 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
 
        if (updateenergy){
          this->m_LastEnergy[metricCount]=this->m_Energy[metricCount];
-         this->m_Energy[metricCount]=df->GetEnergy();// *this->m_SimilarityMetrics[metricCount]->GetWeightScalar()/sumWeights;
+         this->m_Energy[metricCount]=this->GetMetricSamplingEnergy( initialenergy, df->GetEnergy() );// *this->m_SimilarityMetrics[metricCount]->GetWeightScalar()/sumWeights;
         }
 
        // smooth the fields
@@ -864,6 +1058,11 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
        if (this->m_Debug) std::cout << "PRE MAX " << max << std::endl;
        TReal max2=0;
        if (max <= 0) max=1;
+       if ( fuse )
+         {
+         accumulate.AddTerm( max, this->m_SimilarityMetrics[metricCount]->GetWeightScalar() / sumWeights, ispointsetmetric );
+         }
+       else
        for( dIter.GoToBegin(); !dIter.IsAtEnd(); ++dIter )
         {
             typename ImageType::IndexType index=dIter.GetIndex();
@@ -919,6 +1118,11 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
        if (this->m_Debug) std::cout << "PRE MAX " << max << std::endl;
        TReal max2=0;
        if (max <= 0) max=1;
+       if ( fuse )
+         {
+         accumulateInv.AddTerm( max, this->m_SimilarityMetrics[metricCount]->GetWeightScalar() / sumWeights, ispointsetmetric );
+         }
+       else
        for( dIter.GoToBegin(); !dIter.IsAtEnd(); ++dIter )
         {
             typename ImageType::IndexType index=dIter.GetIndex();
@@ -957,9 +1161,30 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
 
     }
 
+    if ( fuse )
+      {
+      typedef NaryFunctorImageFilter<DisplacementFieldType, DisplacementFieldType, AccumulatorFunctorType> AccumulatorType;
+      typename AccumulatorType::Pointer accumulator = AccumulatorType::New();
+      for ( unsigned int metricCount = 0; metricCount < numberOfMetrics; metricCount++ )
+        accumulator->SetInput( metricCount, this->m_UpdateFieldBuffers[metricCount] );
+      accumulator->SetFunctor( accumulate );
+      accumulator->GraftOutput( totalUpdateField );
+      accumulator->Update();
+      if ( totalUpdateInvField )
+        {
+        typename AccumulatorType::Pointer accumulatorInv = AccumulatorType::New();
+        for ( unsigned int metricCount = 0; metricCount < numberOfMetrics; metricCount++ )
+          accumulatorInv->SetInput( metricCount, this->m_UpdateFieldInvBuffers[metricCount] );
+        accumulatorInv->SetFunctor( accumulateInv );
+        accumulatorInv->GraftOutput( totalUpdateInvField );
+        accumulatorInv->Update();
+        }
+      }
+
 //    this->SmoothDisplacementField( totalUpdateField,true);
 //    if (totalUpdateInvField) this->SmoothDisplacementField( totalUpdateInvField,true);
 
+    this->m_UpdateFieldTimer.Stop();
 
     return totalUpdateField;
 }
@@ -1086,6 +1311,7 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
         if (wpoints && ispointsetmetric ) df->SetMovingPointSet(wpoints); else if (ispointsetmetric ) std::cout << "NO POINTS!! " << std::endl;
         typename ImageType::SizeType  radius = df->GetRadius();
         df->InitializeIteration();
+        TReal initialenergy=df->GetEnergy();
         typename DisplacementFieldType::Pointer output = updateField;
         typedef NeighborhoodAlgorithm::ImageBoundaryFacesCalculator<DisplacementFieldType>
         FaceCalculatorType;
@@ -1100,11 +1326,12 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
         UpdateIteratorType       nU(updateField,  *fIt);
         nD.GoToBegin();
     nU.GoToBegin();
+        this->InitializeMetricSampling( metricCount, ispointsetmetric );
         while( !nD.IsAtEnd() )
         {
-            bool oktosample=true;
+            bool oktosample=this->IsMetricSample();
             TReal maskprob=1.0;
-            if (mask)
+            if (mask && oktosample)
              {
                 maskprob=mask->GetPixel( nD.GetIndex() );
                 if (maskprob > 1.0) maskprob=1.0;
@@ -1129,7 +1356,7 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
         }
        if (updateenergy){
          this->m_LastEnergy[metricCount]=this->m_Energy[metricCount];
-         this->m_Energy[metricCount]=df->GetEnergy();//*this->m_SimilarityMetrics[metricCount]->GetWeightScalar()/sumWeights;
+         this->m_Energy[metricCount]=this->GetMetricSamplingEnergy( initialenergy, df->GetEnergy() );//*this->m_SimilarityMetrics[metricCount]->GetWeightScalar()/sumWeights;
         }
 
        // smooth the fields
@@ -1600,10 +1827,9 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
 
     TReal timestep=1.0/(TReal)this->m_NTimeSteps;
     unsigned int nts=this->m_NTimeSteps;
-    DisplacementFieldPointer fdiffmap = this->IntegrateConstantVelocity(this->m_SyNF, nts, 1);
-    this->m_SyNFInv = this->IntegrateConstantVelocity(this->m_SyNF, nts, (-1.));
-    DisplacementFieldPointer mdiffmap = this->IntegrateConstantVelocity(this->m_SyNM, nts, 1);
-    this->m_SyNMInv = this->IntegrateConstantVelocity(this->m_SyNM, nts, (-1.));
+    DisplacementFieldPointer fdiffmap, mdiffmap;
+    this->IntegrateConstantVelocityWithInverse(this->m_SyNF, nts, 1, fdiffmap, this->m_SyNFInv);
+    this->IntegrateConstantVelocityWithInverse(this->m_SyNM, nts, 1, mdiffmap, this->m_SyNMInv);
 
 
     if (aff){
@@ -2218,7 +2444,30 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
   if (starttimein  >  finishtimein ) timesign= -1.0;
   FieldIterator m_FieldIter(this->GetDisplacementField(), this->GetDisplacementField()->GetLargestPossibleRegion());
 //  std::cout << " Start Int " << starttimein <<  std::endl;
-  if ( mask  && !this->m_ComputeThickness )
+  if ( !this->m_ThickImage )
+    {
+    // no thickness bookkeeping, so the voxels are independent
+    bool debug=this->m_Debug;
+    if ( mask  && !this->m_ComputeThickness ) this->IntegrateVelocityBatched(starttimein, finishtimein, intfield, mask);
+    else this->IntegrateVelocityBatched(starttimein, finishtimein, intfield, NULL);
+    if ( debug )
+      {
+      unsigned long nvox=intfield->GetLargestPossibleRegion().GetNumberOfPixels();
+      unsigned long every=nvox/100+1, ct=0;
+      TReal maxdiff=0;
+      for(  m_FieldIter.GoToBegin(); !m_FieldIter.IsAtEnd(); ++m_FieldIter, ++ct )
+        {
+        if ( ct % every ) continue;
+        IndexType velind=m_FieldIter.GetIndex();
+        if ( mask && !this->m_ComputeThickness ) continue;
+        VectorType disp=this->IntegratePointVelocity(starttimein, finishtimein , velind);
+        maxdiff=vnl_math_max(maxdiff,(TReal)(disp-intfield->GetPixel(velind)).GetNorm());
+        }
+      std::cout << " batched velocity integration, max difference to per-point integration " << maxdiff << std::endl;
+      this->m_Debug=debug;
+      }
+    }
+  else if ( mask  && !this->m_ComputeThickness )
     {
   for(  m_FieldIter.GoToBegin(); !m_FieldIter.IsAtEnd(); ++m_FieldIter )
     {
@@ -2248,6 +2497,195 @@ ANTSImageRegistrationOptimizer<TDimension, TReal>
 }
 
 
+template<unsigned int TDimension, class TReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::IntegrateVelocityBatched(TReal starttimein, TReal finishtimein, DisplacementFieldPointer intfield, ImagePointer mask)
+{
+  IntegrateVelocityThreadStruct str;
+  str.Optimizer=this;
+  str.Kernel.Initialize(this->m_TimeVaryingVelocity);
+  str.StartTime=starttimein;
+  str.FinishTime=finishtimein;
+  str.Field=intfield;
+  str.Mask=mask;
+
+  typename MultiThreader::Pointer threader=MultiThreader::New();
+  threader->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  threader->SetSingleMethod( Self::IntegrateVelocityThreaderCallback, &str );
+  threader->SingleMethodExecute();
+}
+
+
+template<unsigned int TDimension, class TReal>
+ITK_THREAD_RETURN_TYPE
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::IntegrateVelocityThreaderCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info=static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  const IntegrateVelocityThreadStruct *str=static_cast<const IntegrateVelocityThreadStruct *>( info->UserData );
+  ThreadIdType threadId=info->ThreadID;
+  ThreadIdType threadCount=info->NumberOfThreads;
+
+  // one slab along the slowest axis per thread
+  typename DisplacementFieldType::RegionType region=str->Field->GetLargestPossibleRegion();
+  const unsigned int splitAxis=ImageDimension-1;
+  unsigned long range=region.GetSize()[splitAxis];
+  unsigned long valuesPerThread=( range + threadCount - 1 ) / threadCount;
+  if ( valuesPerThread == 0 || threadId*valuesPerThread >= range ) return ITK_THREAD_RETURN_VALUE;
+  unsigned long extent=vnl_math_min( valuesPerThread, range - threadId*valuesPerThread );
+  typename DisplacementFieldType::IndexType sindex=region.GetIndex();
+  typename DisplacementFieldType::SizeType ssize=region.GetSize();
+  sindex[splitAxis]+=threadId*valuesPerThread;
+  ssize[splitAxis]=extent;
+  region.SetIndex(sindex);
+  region.SetSize(ssize);
+
+  str->Optimizer->IntegrateVelocityBlock( *str, region );
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template<unsigned int TDimension, class TReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::IntegrateVelocityBlock(const IntegrateVelocityThreadStruct & str, const typename DisplacementFieldType::RegionType & region) const
+{
+  typedef typename TimeVaryingVelocityFieldType::IndexType VIndexType;
+  typedef typename TimeVaryingVelocityFieldType::PointType VPointType;
+  const unsigned int blocksize=256;
+  const unsigned int D=ImageDimension;
+
+  TReal starttimein=str.StartTime;
+  TReal finishtimein=str.FinishTime;
+  TReal timesign=1.0, vecsign=1.0;
+  if (starttimein  >  finishtimein ) { timesign= -1.0; vecsign=-1.0; }
+  TReal deltaTime=this->m_DeltaTime;
+  TReal ntp=(TReal)(this->m_TimeVaryingVelocity->GetLargestPossibleRegion().GetSize()[TDimension]-1);
+
+  // particle block, one array per coordinate so each stage is a flat loop
+  std::vector<IndexType> index(blocksize);
+  std::vector<TReal> weight(blocksize);
+  std::vector<TReal> start(blocksize*D), disp(blocksize*D), length(blocksize);
+  std::vector<double> f(4*blocksize*D);
+  std::vector<char> active(blocksize);
+
+  typedef itk::ImageRegionConstIteratorWithIndex<DisplacementFieldType> FieldIterator;
+  FieldIterator fIter(str.Field, region);
+  fIter.GoToBegin();
+  VectorType zero;
+  zero.Fill(0);
+  while ( !fIter.IsAtEnd() )
+    {
+    unsigned int n=0;
+    for ( ; n < blocksize && !fIter.IsAtEnd(); ++fIter )
+      {
+      IndexType velind=fIter.GetIndex();
+      TReal w=1;
+      if ( str.Mask )
+        {
+        w=str.Mask->GetPixel(velind);
+        if ( w <= 0.05 ) { str.Field->SetPixel(velind,zero); continue; }
+        }
+      VIndexType vind;
+      vind.Fill(0);
+      for (unsigned int jj=0; jj<D; jj++) vind[jj]=velind[jj];
+      VPointType pointIn1;
+      this->m_TimeVaryingVelocity->TransformIndexToPhysicalPoint( vind, pointIn1);
+      for (unsigned int jj=0; jj<D; jj++)
+        {
+        start[jj*blocksize+n]=pointIn1[jj];
+        disp[jj*blocksize+n]=0;
+        }
+      index[n]=velind;
+      weight[n]=w;
+      length[n]=0;
+      active[n]=1;
+      n++;
+      }
+
+    TReal itime=starttimein;
+    bool timedone=(n == 0);
+    while ( !timedone )
+      {
+      TReal itimetn1 = itime - timesign*deltaTime;
+      TReal itimetn1h = itime - timesign*deltaTime*0.5;
+      if (itimetn1h < 0 ) itimetn1h=0;
+      if (itimetn1h > 1 ) itimetn1h=1;
+      if (itimetn1 < 0 ) itimetn1=0;
+      if (itimetn1 > 1 ) itimetn1=1;
+      const TReal stagetime[4]={ itimetn1*ntp, itimetn1h*ntp, itimetn1h*ntp, itime*ntp };
+      const TReal stagestep[4]={ 0, deltaTime*(TReal)0.5, deltaTime*(TReal)0.5, deltaTime };
+
+      // each Runge-Kutta stage is evaluated for the whole block before the next
+      for (unsigned int stage=0; stage<4; stage++)
+        {
+        double * fs=&f[stage*blocksize*D];
+        const double * fprev=&f[(stage > 0 ? stage-1 : 0)*blocksize*D];
+        for (unsigned int p=0; p<n; p++)
+          {
+          if ( !active[p] ) continue;
+          TReal y[TDimension+1];
+          for (unsigned int jj=0; jj<D; jj++)
+            {
+            y[jj]=start[jj*blocksize+p]+disp[jj*blocksize+p];
+            if ( stage > 0 ) y[jj]+=fprev[jj*blocksize+p]*stagestep[stage];
+            }
+          y[D]=stagetime[stage];
+          double v[TDimension];
+          if ( !str.Kernel.Evaluate( y, v ) ) for (unsigned int jj=0; jj<D; jj++) v[jj]=0;
+          for (unsigned int jj=0; jj<D; jj++) fs[jj*blocksize+p]=v[jj];
+          }
+        }
+
+      const double * f1=&f[0];
+      const double * f2=&f[blocksize*D];
+      const double * f3=&f[2*blocksize*D];
+      const double * f4=&f[3*blocksize*D];
+      for (unsigned int p=0; p<n; p++)
+        {
+        if ( !active[p] ) continue;
+        TReal mag=0;
+        for (unsigned int jj=0; jj<D; jj++)
+          {
+          unsigned int k=jj*blocksize+p;
+          TReal step=vecsign*deltaTime/6.0 * ( f1[k] + 2.0*f2[k] + 2.0*f3[k] + f4[k] );
+          TReal pointIn2=start[k]+disp[k];
+          TReal pointIn3=pointIn2+step;
+          mag+=step*step;
+          disp[k]=pointIn3-start[k];
+          }
+        length[p]+=sqrt(mag);
+        }
+
+      itime = itime + deltaTime*timesign;
+      if (starttimein > finishtimein)
+        {
+        if (itime <= finishtimein  ) timedone=true;
+        }
+      else
+        {
+        // a particle that has not moved after its first step is left there
+        bool anyactive=false;
+        for (unsigned int p=0; p<n; p++)
+          {
+          if ( active[p] && length[p] == 0 ) active[p]=0;
+          if ( active[p] ) anyactive=true;
+          }
+        if ( !anyactive || itime >= finishtimein ) timedone=true;
+        }
+      }
+
+    for (unsigned int p=0; p<n; p++)
+      {
+      VectorType out;
+      for (unsigned int jj=0; jj<D; jj++) out[jj]=disp[jj*blocksize+p]*weight[p];
+      str.Field->SetPixel(index[p],out);
+      }
+    }
+}
+
+
 template<unsigned int TDimension, class TReal>
 typename ANTSImageRegistrationOptimizer<TDimension, TReal>::DisplacementFieldPointer
 ANTSImageRegistrationOptimizer<TDimension, TReal>
@@ -2621,6 +3059,325 @@ if (this->m_Debug)       std::cout << " p2 " << pointIn2<< " y1 " <<  Y1x[TDimen
 
 
 
+template<unsigned int TDimension, class TReal>
+TReal
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::InvertField(DisplacementFieldPointer field, DisplacementFieldPointer inverseField, TReal weight,
+  TReal toler, int maxiter, bool print)
+{
+  TReal mytoler=toler;
+  unsigned int mymaxiter=maxiter;
+  typename ParserType::OptionType::Pointer thicknessOption = NULL;
+  if ( this->m_Parser ) thicknessOption = this->m_Parser->GetOption( "go-faster" );
+  if( thicknessOption && ( thicknessOption->GetValue() == "true" ||  thicknessOption->GetValue() == "1" ) )
+    { mytoler=0.5; maxiter=12; }
+
+  DisplacementFieldPointer lagrangianInitCond=DisplacementFieldType::New();
+  lagrangianInitCond->SetSpacing( field->GetSpacing() );
+  lagrangianInitCond->SetOrigin( field->GetOrigin() );
+  lagrangianInitCond->SetDirection( field->GetDirection() );
+  lagrangianInitCond->SetLargestPossibleRegion( field->GetLargestPossibleRegion() );
+  lagrangianInitCond->SetRequestedRegion(field->GetRequestedRegion() );
+  lagrangianInitCond->SetBufferedRegion( field->GetLargestPossibleRegion() );
+  lagrangianInitCond->Allocate();
+  {
+  const VectorType * in=field->GetBufferPointer();
+  VectorType * out=lagrangianInitCond->GetBufferPointer();
+  const unsigned long n=field->GetLargestPossibleRegion().GetNumberOfPixels();
+  for ( unsigned long i=0; i<n; i++ ) out[i]=in[i]*weight;
+  }
+
+  // the voxels still iterated on, as offsets into the inverse field buffer
+  const unsigned long npix=inverseField->GetLargestPossibleRegion().GetNumberOfPixels();
+  std::vector<FieldOffsetValueType> active( npix );
+  for ( unsigned long i=0; i<npix; i++ ) active[i]=i;
+
+  InvertFieldThreadStruct str;
+  str.Sampler.Initialize( lagrangianInitCond );
+  str.Inverse=inverseField;
+  str.Active=&active;
+  std::vector<VectorType> updates( npix );
+  std::vector<TReal> magnitudes( npix );
+  str.Updates=&updates;
+  str.Magnitudes=&magnitudes;
+  const ThreadIdType numberOfThreads=MultiThreader::GetGlobalDefaultNumberOfThreads();
+  str.ThreadMax.resize( numberOfThreads );
+  str.ThreadSum.resize( numberOfThreads );
+
+  typename MultiThreader::Pointer threader=MultiThreader::New();
+  threader->SetNumberOfThreads( numberOfThreads );
+  threader->SetSingleMethod( Self::InvertFieldThreaderCallback, &str );
+
+  // The residual of a voxel depends only on its own inverse vector.  A voxel
+  // whose residual, measured after the last update, is below a tenth of the
+  // tolerance is not updated again, and that residual keeps counting
+  // towards the maximum and mean that stop the iteration.
+  const TReal freezetoler=mytoler*0.1;
+  TReal frozenmax=0;
+  TReal frozensum=0;
+  TReal difmag=10.0;
+  TReal meandif=1.e8;
+  unsigned int ct=0;
+  while ( difmag > mytoler && ct < mymaxiter && meandif > 0.001 && !active.empty() )
+    {
+    str.Apply=false;
+    std::fill( str.ThreadMax.begin(), str.ThreadMax.end(), 0 );
+    std::fill( str.ThreadSum.begin(), str.ThreadSum.end(), 0 );
+    threader->SingleMethodExecute();
+
+    difmag=frozenmax;
+    meandif=frozensum;
+    for ( ThreadIdType t=0; t<numberOfThreads; t++ )
+      {
+      if ( str.ThreadMax[t] > difmag ) difmag=str.ThreadMax[t];
+      meandif+=str.ThreadSum[t];
+      }
+    meandif/=(TReal)npix;
+
+    unsigned long kept=0;
+    for ( unsigned long i=0; i<active.size(); i++ )
+      {
+      if ( magnitudes[i] < freezetoler )
+        {
+        frozensum+=magnitudes[i];
+        if ( magnitudes[i] > frozenmax ) frozenmax=magnitudes[i];
+        continue;
+        }
+      active[kept]=active[i];
+      updates[kept]=updates[i];
+      magnitudes[kept]=magnitudes[i];
+      kept++;
+      }
+    active.resize( kept );
+
+    str.Epsilon = ( ct == 0 ) ? 0.75 : 0.5;
+    str.StepLength=difmag*str.Epsilon;
+    str.Apply=true;
+    threader->SingleMethodExecute();
+    ct++;
+    }
+  if ( print ) std::cout << " difmag " << difmag << ": its " << ct << " active " << active.size() << std::endl;
+
+  return difmag;
+}
+
+
+template<unsigned int TDimension, class TReal>
+ITK_THREAD_RETURN_TYPE
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::InvertFieldThreaderCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info=static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  InvertFieldThreadStruct *str=static_cast<InvertFieldThreadStruct *>( info->UserData );
+  ThreadIdType threadId=info->ThreadID;
+  ThreadIdType threadCount=info->NumberOfThreads;
+
+  const std::vector<FieldOffsetValueType> & active=*str->Active;
+  unsigned long range=active.size();
+  unsigned long valuesPerThread=( range + threadCount - 1 ) / threadCount;
+  if ( valuesPerThread == 0 || threadId*valuesPerThread >= range ) return ITK_THREAD_RETURN_VALUE;
+  const unsigned long first=threadId*valuesPerThread;
+  const unsigned long last=vnl_math_min( range, first + valuesPerThread );
+
+  DisplacementFieldType * inverseField=str->Inverse;
+  VectorType * inverse=inverseField->GetBufferPointer();
+  std::vector<VectorType> & updates=*str->Updates;
+  std::vector<TReal> & magnitudes=*str->Magnitudes;
+  typename ImageType::SpacingType spacing=inverseField->GetSpacing();
+
+  if ( str->Apply )
+    {
+    for ( unsigned long i=first; i<last; i++ )
+      {
+      VectorType update=updates[i];
+      TReal val=magnitudes[i];
+      if (val > str->StepLength) update = update * (str->StepLength/val);
+      inverse[active[i]]+=update * (str->Epsilon);
+      }
+    return ITK_THREAD_RETURN_VALUE;
+    }
+
+  typedef typename DisplacementFieldSamplerType::PointType VPointType;
+  typename DisplacementFieldSamplerType::OutputType disp2;
+  TReal maxmag=0;
+  TReal summag=0;
+  for ( unsigned long i=first; i<last; i++ )
+    {
+    // the composition x + u(x) + v( x + u(x) ) should map back onto x
+    typename DisplacementFieldType::IndexType index=inverseField->ComputeIndex( active[i] );
+    VPointType pointIn1;
+    VPointType pointIn2;
+    inverseField->TransformIndexToPhysicalPoint( index, pointIn1 );
+    const VectorType & disp=inverse[active[i]];
+    for (unsigned int jj=0; jj<ImageDimension; jj++) pointIn2[jj]=disp[jj]+pointIn1[jj];
+    str->Sampler.Evaluate( pointIn2, disp2 );
+
+    VectorType update;
+    TReal mag=0;
+    for (unsigned int j=0; j<ImageDimension; j++)
+      {
+      update[j]=-( disp[j]+disp2[j] );
+      mag+=(update[j]/spacing[j])*(update[j]/spacing[j]);
+      }
+    mag=sqrt(mag);
+    updates[i]=update;
+    magnitudes[i]=mag;
+    summag+=mag;
+    if (mag > maxmag) maxmag=mag;
+    }
+  str->ThreadMax[threadId]=maxmag;
+  str->ThreadSum[threadId]=summag;
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template<unsigned int TDimension, class TReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::PutCheckpointAffine( AffineTransformPointer affine )
+{
+  std::vector<double> parameters;
+  std::vector<double> fixedParameters;
+  if ( affine )
+    {
+    for ( unsigned int i=0; i<affine->GetParameters().Size(); i++ ) parameters.push_back( affine->GetParameters()[i] );
+    for ( unsigned int i=0; i<affine->GetFixedParameters().Size(); i++ ) fixedParameters.push_back( affine->GetFixedParameters()[i] );
+    }
+  this->m_Checkpoint.template Put<char>( affine ? 1 : 0 );
+  this->m_Checkpoint.PutVector( parameters );
+  this->m_Checkpoint.PutVector( fixedParameters );
+}
+
+
+template<unsigned int TDimension, class TReal>
+bool
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::GetCheckpointAffine( AffineTransformPointer & affine )
+{
+  char present=0;
+  std::vector<double> parameters;
+  std::vector<double> fixedParameters;
+  if ( !this->m_Checkpoint.Get( present ) || !this->m_Checkpoint.GetVector( parameters )
+       || !this->m_Checkpoint.GetVector( fixedParameters ) ) return false;
+  affine=NULL;
+  if ( !present ) return true;
+  affine=AffineTransformType::New();
+  typename AffineTransformType::ParametersType p( affine->GetNumberOfParameters() );
+  typename AffineTransformType::ParametersType fp( affine->GetFixedParameters().Size() );
+  if ( parameters.size() != p.Size() || fixedParameters.size() != fp.Size() ) return false;
+  for ( unsigned int i=0; i<p.Size(); i++ ) p[i]=parameters[i];
+  for ( unsigned int i=0; i<fp.Size(); i++ ) fp[i]=fixedParameters[i];
+  affine->SetFixedParameters( fp );
+  affine->SetParameters( p );
+  return true;
+}
+
+
+template<unsigned int TDimension, class TReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::WriteCheckpoint( bool levelConverged, const std::vector<TReal> & profile )
+{
+  // the header is what ReadCheckpoint needs before the deformable
+  // optimization starts, the rest is restored at the level it was written
+  this->m_Checkpoint.Clear();
+  this->m_Checkpoint.template Put<unsigned int>( ImageDimension );
+  this->m_Checkpoint.PutString( this->GetTransformationModel() );
+  this->m_Checkpoint.template Put<unsigned int>( this->m_CurrentLevel );
+  this->m_Checkpoint.template Put<unsigned int>( this->m_CurrentIteration );
+  // 1 the energy test stopped the level, 2 it reached its iteration limit
+  char converged=0;
+  if ( levelConverged )
+    converged = ( this->m_CurrentIteration >= this->m_Iterations[this->m_CurrentLevel] ) ? 2 : 1;
+  this->m_Checkpoint.template Put<char>( converged );
+  this->m_Checkpoint.template Put<TReal>( this->m_GradstepAltered );
+  this->PutCheckpointAffine( this->m_AffineTransform );
+  this->PutCheckpointAffine( this->m_FixedImageAffineTransform );
+
+  this->m_Checkpoint.template Put<TReal>( this->m_ESlope );
+  this->m_Checkpoint.PutVector( this->m_MetricSamplingCounters );
+  this->m_Checkpoint.PutVector( this->m_Energy );
+  this->m_Checkpoint.PutVector( this->m_LastEnergy );
+  this->m_Checkpoint.PutVector( this->m_EnergyBad );
+  this->m_Checkpoint.PutVector( profile );
+  this->m_Checkpoint.PutImage( this->m_DisplacementField.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_InverseDisplacementField.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_SyNF.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_SyNFInv.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_SyNM.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_SyNMInv.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_TimeVaryingVelocity.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_LastTimeVaryingVelocity.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_LastTimeVaryingUpdate.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_HitImage.GetPointer() );
+  this->m_Checkpoint.PutImage( this->m_ThickImage.GetPointer() );
+  this->m_Checkpoint.WriteAsync( this->m_CheckpointFileName );
+}
+
+
+template<unsigned int TDimension, class TReal>
+bool
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::ReadCheckpoint( const std::string & filename )
+{
+  this->m_Resuming=false;
+  unsigned int dimension=0;
+  char converged=0;
+  if ( !this->m_Checkpoint.Read( filename )
+       || !this->m_Checkpoint.Get( dimension ) || dimension != ImageDimension
+       || !this->m_Checkpoint.GetString( this->m_ResumeTransformationModel )
+       || !this->m_Checkpoint.Get( this->m_ResumeLevel )
+       || !this->m_Checkpoint.Get( this->m_ResumeIteration )
+       || !this->m_Checkpoint.Get( converged )
+       || !this->m_Checkpoint.Get( this->m_ResumeGradstep )
+       || !this->GetCheckpointAffine( this->m_ResumeAffineTransform )
+       || !this->GetCheckpointAffine( this->m_ResumeFixedImageAffineTransform ) )
+    {
+    std::cout << " Could not read checkpoint " << filename << std::endl;
+    this->m_Checkpoint.Clear();
+    return false;
+    }
+  this->m_ResumeLevelConverged=( converged != 0 );
+  this->m_ResumeLevelAtIterationLimit=( converged == 2 );
+  this->m_Resuming=true;
+  std::cout << " Read checkpoint " << filename << " : " << this->m_ResumeTransformationModel
+            << " level " << this->m_ResumeLevel << " iteration " << this->m_ResumeIteration << std::endl;
+  return true;
+}
+
+
+template<unsigned int TDimension, class TReal>
+void
+ANTSImageRegistrationOptimizer<TDimension, TReal>
+::RestoreCheckpoint( std::vector<TReal> & profile )
+{
+  bool ok = this->m_Checkpoint.Get( this->m_ESlope )
+    && this->m_Checkpoint.GetVector( this->m_MetricSamplingCounters )
+    && this->m_Checkpoint.GetVector( this->m_Energy )
+    && this->m_Checkpoint.GetVector( this->m_LastEnergy )
+    && this->m_Checkpoint.GetVector( this->m_EnergyBad )
+    && this->m_Checkpoint.GetVector( profile )
+    && this->m_Checkpoint.template GetImage<DisplacementFieldType>( this->m_DisplacementField )
+    && this->m_Checkpoint.template GetImage<DisplacementFieldType>( this->m_InverseDisplacementField )
+    && this->m_Checkpoint.template GetImage<DisplacementFieldType>( this->m_SyNF )
+    && this->m_Checkpoint.template GetImage<DisplacementFieldType>( this->m_SyNFInv )
+    && this->m_Checkpoint.template GetImage<DisplacementFieldType>( this->m_SyNM )
+    && this->m_Checkpoint.template GetImage<DisplacementFieldType>( this->m_SyNMInv )
+    && this->m_Checkpoint.template GetImage<TimeVaryingVelocityFieldType>( this->m_TimeVaryingVelocity )
+    && this->m_Checkpoint.template GetImage<TimeVaryingVelocityFieldType>( this->m_LastTimeVaryingVelocity )
+    && this->m_Checkpoint.template GetImage<TimeVaryingVelocityFieldType>( this->m_LastTimeVaryingUpdate )
+    && this->m_Checkpoint.template GetImage<ImageType>( this->m_HitImage )
+    && this->m_Checkpoint.template GetImage<ImageType>( this->m_ThickImage );
+  if ( !ok || profile.size() < this->m_ResumeIteration*this->m_SimilarityMetrics.size() )
+    {
+    itkExceptionMacro( "The checkpoint is truncated." );
+    }
+  if ( this->m_TimeVaryingVelocity )
+    this->m_VelocityFieldInterpolator->SetInputImage( this->m_TimeVaryingVelocity );
+  this->m_Checkpoint.Clear();
+}
+
+
 /**
  * Standard "PrintSelf" method
  */
@@ -45,6 +45,7 @@
 #include "itkWarpImageMultiTransformFilter.h"
 #include "itkDisplacementFieldFromMultiTransformFilter.h"
 #include "itkWarpImageWAffineFilter.h"
+#include "itkDisplacementFieldLinearSampler.h"
 #include "itkPointSet.h"
 #include "itkVector.h"
 #include "itkBSplineScatteredDataPointSetToImageFilter.h"
@@ -53,11 +54,88 @@
 #include "ANTS_affine_registration2.h"
 #include "itkVectorFieldGradientImageFunction.h"
 #include "itkBSplineInterpolateImageFunction.h"
+#include "itkNaryFunctorImageFilter.h"
+#include "itkTimeProbe.h"
+#include "itkMultiThreader.h"
+#include "itkScalingAndSquaringDisplacementFieldImageFilter.h"
+#include "itkMersenneTwisterRandomVariateGenerator.h"
+#include "itkANTSRegistrationCheckpoint.h"
 
 
 
 namespace itk {
 
+namespace Functor {
+/** \class ANTSUpdateFieldAccumulator
+ * \brief Sums the per-metric update fields of ComputeUpdateField in one pass.
+ *
+ * Each input field is divided by its maximum magnitude and weighted by its
+ * metric weight.  A point-set metric damps everything accumulated before it
+ * by (1 - |landmark update|), exactly as the per-metric loop does.
+ */
+template<class TVector, class TReal>
+class ANTSUpdateFieldAccumulator
+{
+public:
+  ANTSUpdateFieldAccumulator() { this->m_Spacing.Fill( 1 ); }
+  ~ANTSUpdateFieldAccumulator() {}
+
+  void SetSpacing( const TVector & s ) { this->m_Spacing = s; }
+  void AddTerm( TReal maxMagnitude, TReal weight, bool isPointSetMetric )
+    {
+    this->m_MaxMagnitudes.push_back( maxMagnitude );
+    this->m_Weights.push_back( weight );
+    this->m_IsPointSetMetric.push_back( isPointSetMetric );
+    }
+
+  bool operator!=( const ANTSUpdateFieldAccumulator & other ) const
+    {
+    return this->m_Spacing != other.m_Spacing
+      || this->m_MaxMagnitudes != other.m_MaxMagnitudes
+      || this->m_Weights != other.m_Weights
+      || this->m_IsPointSetMetric != other.m_IsPointSetMetric;
+    }
+  bool operator==( const ANTSUpdateFieldAccumulator & other ) const
+    {
+    return !( *this != other );
+    }
+
+  inline TVector operator()( const std::vector<TVector> & B ) const
+    {
+    TVector total;
+    total.Fill( 0 );
+    for ( unsigned int k = 0; k < B.size(); k++ )
+      {
+      TVector vec = B[k] / this->m_MaxMagnitudes[k];
+      if ( this->m_IsPointSetMetric[k] )
+        {
+        TReal lmag = 0;
+        for ( unsigned int li = 0; li < TVector::Dimension; li++ )
+          {
+          lmag += ( vec[li] / this->m_Spacing[li] ) * ( vec[li] / this->m_Spacing[li] );
+          }
+        lmag = vcl_sqrt( lmag );
+        TReal modi = 1;
+        if ( lmag > 1 ) modi = 0;
+        else modi = 1.0 - lmag;
+        total = total * modi + vec * this->m_Weights[k];
+        }
+      else
+        {
+        total += vec * this->m_Weights[k];
+        }
+      }
+    return total;
+    }
+
+private:
+  TVector             m_Spacing;
+  std::vector<TReal>  m_MaxMagnitudes;
+  std::vector<TReal>  m_Weights;
+  std::vector<bool>   m_IsPointSetMetric;
+};
+}
+
 template<unsigned int TDimension = 3, class TReal = float>
 class ITK_EXPORT ANTSImageRegistrationOptimizer
 : public Object
@@ -157,6 +235,12 @@ public:
     void SetNumberOfLevels(unsigned int i) {this->m_NumberOfLevels=i;}
     void SetParser( typename ParserType::Pointer P ) {this->m_Parser=P;}
 
+    /** Load a checkpoint written with --checkpoint;  DeformableOptimization
+        then continues from the level and iteration it holds. */
+    bool ReadCheckpoint( const std::string & filename );
+    AffineTransformPointer GetCheckpointAffineTransform() {return this->m_ResumeAffineTransform;}
+    AffineTransformPointer GetCheckpointFixedImageAffineTransform() {return this->m_ResumeFixedImageAffineTransform;}
+
     /** Basic operations */
   DisplacementFieldPointer CopyDisplacementField( DisplacementFieldPointer input );
 
@@ -292,6 +376,60 @@ public:
 
   DisplacementFieldPointer ComputeUpdateField(DisplacementFieldPointer fixedwarp, DisplacementFieldPointer movingwarp,  PointSetPointer  fpoints=NULL,  PointSetPointer wpoints=NULL,DisplacementFieldPointer updateFieldInv=NULL, bool updateenergy=true);
 
+  /** Set up the metric sampling of the current level for one sweep of the
+   *  update field of a metric;  IsMetricSample() is then asked once per
+   *  voxel, in the order of the sweep, whether the metric gradient is
+   *  evaluated there.  Point-set metrics are always swept densely. */
+  void InitializeMetricSampling( unsigned int metricCount, bool ispointsetmetric );
+  inline bool IsMetricSample()
+  {
+    if ( this->m_MetricSamplingFraction >= 1 ) return true;
+    bool sample;
+    if ( this->m_MetricSamplingStrategy == 1 )
+      {
+      // one sample per block of Stride voxels, at a position jittered per
+      // block so that the samples do not line up with the image rows
+      unsigned long position=this->m_MetricSamplingCount % this->m_MetricSamplingStride;
+      if ( position == 0 )
+        this->m_MetricSamplingBlockOffset=( this->m_MetricSamplingOffset
+          + this->GetMetricSamplingJitter( this->m_MetricSamplingCount / this->m_MetricSamplingStride ) )
+          % this->m_MetricSamplingStride;
+      sample = ( position == this->m_MetricSamplingBlockOffset );
+      }
+    else
+      sample = this->m_MetricSamplingRandomizer->GetVariateWithOpenUpperRange() < this->m_MetricSamplingFraction;
+    this->m_MetricSamplingCount++;
+    if ( sample ) this->m_MetricSamplingTaken++;
+    return sample;
+  }
+
+  /** A fixed pseudo-random shift of a block of regular samples, the same in
+   *  every sweep, so the lattice offset still visits every voxel once over
+   *  Stride sweeps. */
+  unsigned long GetMetricSamplingJitter( unsigned long block ) const
+  {
+    unsigned long hash=( block + this->m_MetricSamplingSeed ) * 2654435761UL;
+    hash^=hash >> 15;
+    hash*=2246822519UL;
+    hash^=hash >> 13;
+    return hash;
+  }
+
+  /** The energy a metric accumulated over the sampled voxels of a sweep,
+   *  scaled to all voxels of the sweep, so that the convergence test does
+   *  not see the size of the sample.  initialenergy is the energy before
+   *  the sweep, e.g. from the metric's InitializeIteration. */
+  TReal GetMetricSamplingEnergy( TReal initialenergy, TReal energy ) const
+  {
+    if ( this->m_MetricSamplingFraction >= 1 || this->m_MetricSamplingTaken == 0 ) return energy;
+    return initialenergy + ( energy - initialenergy ) *
+      static_cast<TReal>( this->m_MetricSamplingCount ) / static_cast<TReal>( this->m_MetricSamplingTaken );
+  }
+
+  /** (Re)allocate a per-metric update buffer only when the domain changes,
+   *  i.e. once per level, and zero it otherwise. */
+  void AllocateUpdateFieldBuffer( DisplacementFieldPointer & buffer, DisplacementFieldPointer reference );
+
     TimeVaryingVelocityFieldPointer ExpandVelocity(  ) {
 
     TReal expandFactors[ImageDimension+1];
@@ -569,6 +707,101 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
 
   }
 
+  /** Warp a list of images through one transform chain.  Images that appear
+   *  more than once in the list are warped once.  When several distinct
+   *  images share the chain, it is composed into a single dense field first
+   *  so that the chain is only walked once per voxel. */
+  std::vector<ImagePointer> WarpMultiTransformList( ImagePointer referenceimage, const std::vector<ImagePointer> & movingImages, AffineTransformPointer aff, DisplacementFieldPointer totalField, bool doinverse, AffineTransformPointer fixedaff )
+  {
+    std::vector<ImagePointer> warpedImages( movingImages.size(), NULL );
+    std::vector<unsigned int> distinct;
+    for ( unsigned int i = 0; i < movingImages.size(); i++ )
+      {
+      bool seen = false;
+      for ( unsigned int j = 0; j < distinct.size(); j++ )
+        if ( movingImages[distinct[j]] == movingImages[i] ) seen = true;
+      if ( !seen ) distinct.push_back( i );
+      }
+
+    if ( !totalField || distinct.size() < 2 )
+      {
+      for ( unsigned int j = 0; j < distinct.size(); j++ )
+        {
+        ImagePointer image = movingImages[distinct[j]];
+        if ( totalField )
+          warpedImages[distinct[j]] = this->WarpMultiTransform( referenceimage, image, aff, totalField, doinverse, fixedaff );
+        else
+          warpedImages[distinct[j]] = this->SubsampleImage( image, this->m_ScaleFactor, image->GetOrigin(), image->GetDirection(), NULL );
+        }
+      }
+    else
+      {
+      AffineTransformPointer affinverse=NULL;
+      if (aff)
+        {
+        affinverse=AffineTransformType::New();
+        aff->GetInverse(affinverse);
+        }
+      AffineTransformPointer fixedaffinverse=NULL;
+      if (fixedaff)
+        {
+        fixedaffinverse=AffineTransformType::New();
+        fixedaff->GetInverse(fixedaffinverse);
+        }
+
+      typedef itk::DisplacementFieldFromMultiTransformFilter<DisplacementFieldType, DisplacementFieldType, TransformType> ComposerType;
+      typename ComposerType::Pointer composer = ComposerType::New();
+      if (!doinverse)
+        {
+        composer->PushBackDisplacementFieldTransform(totalField);
+        if (fixedaff) composer->PushBackAffineTransform(fixedaff);
+        else if (aff) composer->PushBackAffineTransform(aff);
+        }
+      else
+        {
+        if (aff) composer->PushBackAffineTransform( affinverse );
+        else if (fixedaff) composer->PushBackAffineTransform(fixedaffinverse);
+        composer->PushBackDisplacementFieldTransform(totalField);
+        }
+      totalField->SetOrigin(referenceimage->GetOrigin() );
+      totalField->SetDirection(referenceimage->GetDirection() );
+      composer->SetOutputOrigin(referenceimage->GetOrigin());
+      composer->SetOutputSize(totalField->GetLargestPossibleRegion().GetSize());
+      composer->SetOutputSpacing(totalField->GetSpacing());
+      composer->SetOutputDirection(referenceimage->GetDirection());
+      composer->Update();
+      DisplacementFieldPointer composedField = composer->GetOutput();
+
+      typedef itk::LinearInterpolateImageFunction<ImageType,TComp>  InterpolatorType1;
+      typedef itk::NearestNeighborInterpolateImageFunction<ImageType,TComp>  InterpolatorType2;
+      for ( unsigned int j = 0; j < distinct.size(); j++ )
+        {
+        ImagePointer image = movingImages[distinct[j]];
+        typedef WarpImageFilter<ImageType,ImageType, DisplacementFieldType> WarperType;
+        typename WarperType::Pointer warper = WarperType::New();
+        if (this->m_UseNN) warper->SetInterpolator( InterpolatorType2::New() );
+        else warper->SetInterpolator( InterpolatorType1::New() );
+        warper->SetInput( image );
+        warper->SetDisplacementField( composedField );
+        // match WarpImageMultiTransformFilter, which pads with the first voxel
+        typename ImageType::IndexType index;
+        index.Fill(0);
+        warper->SetEdgePaddingValue( image->GetPixel( index ) );
+        warper->SetOutputSpacing( composedField->GetSpacing() );
+        warper->SetOutputOrigin( composedField->GetOrigin() );
+        warper->SetOutputDirection( composedField->GetDirection() );
+        warper->Update();
+        warpedImages[distinct[j]] = warper->GetOutput();
+        }
+      }
+
+    for ( unsigned int i = 0; i < movingImages.size(); i++ )
+      for ( unsigned int j = 0; j < distinct.size(); j++ )
+        if ( movingImages[distinct[j]] == movingImages[i] ) warpedImages[i] = warpedImages[distinct[j]];
+
+    return warpedImages;
+  }
+
   ImagePointer  SmoothImageToScale(ImagePointer image ,  TReal scalingFactor )
   {
 
@@ -631,6 +864,16 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
     typename ANTSImageRegistrationOptimizer<TDimension, TReal>::DisplacementFieldPointer
     IntegrateConstantVelocity(DisplacementFieldPointer totalField, unsigned int ntimesteps, TReal timeweight);
 
+    /** Integrate totalField forward and backward in one pass;  with scaling
+     *  and squaring both exponentials share the same threaded sweeps. */
+    void IntegrateConstantVelocityWithInverse(DisplacementFieldPointer totalField, unsigned int ntimesteps, TReal timeweight,
+                                              DisplacementFieldPointer & diffmap, DisplacementFieldPointer & invdiffmap);
+
+    /** exp( scale * velocity ) by scaling and squaring in TComputeReal precision. */
+    template<class TComputeReal>
+    void ExponentiateVelocityField(DisplacementFieldPointer velocity, TReal scale,
+                                   DisplacementFieldPointer & diffmap, DisplacementFieldPointer * invdiffmap);
+
     /** Base optimization functions */
     // AffineTransformPointer AffineOptimization(AffineTransformPointer &aff_init, OptAffine &affine_opt); // {return NULL;}
     AffineTransformPointer AffineOptimization(OptAffineType &affine_opt); // {return NULL;}
@@ -694,6 +937,69 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
     if( thicknessOption->GetValue() == "true" ||  thicknessOption->GetValue() == "1" ) { this->m_ComputeThickness=1; this->m_SyNFullTime=2; }// asymm forces
     else if(  thicknessOption->GetValue() == "2" )  { this->m_ComputeThickness=1; this->m_SyNFullTime=1; } // symmetric forces
     else this->m_ComputeThickness=0; // not full time varying stuff
+
+    typename ParserType::OptionType::Pointer samplingOption
+      = this->m_Parser->GetOption( "metric-sampling" );
+    this->m_MetricSamplingStrategy=0;
+    this->m_MetricSamplingSeed=19650218;
+    if ( samplingOption && ( samplingOption->GetValue() == "Regular" || samplingOption->GetValue() == "Random" ) )
+      {
+      this->m_MetricSamplingStrategy = ( samplingOption->GetValue() == "Regular" ) ? 1 : 2;
+      this->m_MetricSamplingPercentages.clear();
+      this->m_MetricSamplingPercentages.push_back( 0.25 );
+      if ( samplingOption->GetNumberOfParameters() >= 1 )
+        {
+        std::string parameter = samplingOption->GetParameter( 0, 0 );
+        this->m_MetricSamplingPercentages = this->m_Parser->template ConvertVector<TReal>( parameter );
+        }
+      if ( samplingOption->GetNumberOfParameters() >= 2 )
+        {
+        std::string parameter = samplingOption->GetParameter( 0, 1 );
+        this->m_MetricSamplingSeed = this->m_Parser->template Convert<unsigned int>( parameter );
+        }
+      std::cout << " " << samplingOption->GetValue() << " metric sampling, percentage per level ";
+      for ( unsigned int jj=0; jj<this->m_MetricSamplingPercentages.size(); jj++ )
+        std::cout << this->m_MetricSamplingPercentages[jj] << " ";
+      std::cout << std::endl;
+      }
+
+    this->m_CheckpointFileName=std::string("");
+    this->m_CheckpointInterval=10;
+    if ( typename OptionType::Pointer option = this->m_Parser->GetOption( "checkpoint" ) )
+      {
+      this->m_CheckpointFileName=option->GetValue();
+      if ( option->GetNumberOfParameters() >= 1 )
+        this->m_CheckpointInterval = this->m_Parser->template Convert<unsigned int>( option->GetParameter( 0, 0 ) );
+      if ( this->m_CheckpointInterval < 1 ) this->m_CheckpointInterval=1;
+      if ( this->m_CheckpointFileName.length() > 0 )
+        std::cout << " Checkpoint " << this->m_CheckpointFileName << " every " << this->m_CheckpointInterval << " iterations " << std::endl;
+      }
+
+    std::string fused=this->m_Parser->GetOption( "fused-update-field" )->GetValue();
+    if ( fused == "false" || fused == "0" ) this->m_UseFusedUpdateField=false;
+    else this->m_UseFusedUpdateField=true;
+
+    typename ParserType::OptionType::Pointer expOption
+      = this->m_Parser->GetOption( "exponential-integration" );
+    this->m_UseScalingAndSquaring=false;
+    this->m_ScalingAndSquaringSteps=0;
+    this->m_ScalingAndSquaringInDouble=false;
+    if ( expOption && expOption->GetValue() == "ScalingAndSquaring" )
+      {
+      this->m_UseScalingAndSquaring=true;
+      if ( expOption->GetNumberOfParameters() >= 1 )
+        {
+        std::string parameter = expOption->GetParameter( 0, 0 );
+        this->m_ScalingAndSquaringSteps = this->m_Parser->template Convert<unsigned int>( parameter );
+        }
+      if ( expOption->GetNumberOfParameters() >= 2 )
+        {
+        std::string parameter = expOption->GetParameter( 0, 1 );
+        if ( parameter == "double" ) this->m_ScalingAndSquaringInDouble=true;
+        }
+      std::cout << " Scaling and squaring integration, steps " << this->m_ScalingAndSquaringSteps
+                << " (0=auto) precision " << ( this->m_ScalingAndSquaringInDouble ? "double" : "float" ) << std::endl;
+      }
     /**
      * Get transformation model and associated parameters
      */
@@ -1027,9 +1333,19 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
     this->m_SmoothFixedImages.resize(numberOfMetrics,NULL);
     this->m_SmoothMovingImages.resize(numberOfMetrics,NULL);
 
+    if ( this->m_Resuming && this->m_ResumeTransformationModel != this->GetTransformationModel() )
+      {
+      std::cout << " The checkpoint was written by a " << this->m_ResumeTransformationModel << " registration;  starting from scratch. " << std::endl;
+      this->m_Resuming=false;
+      }
+
     for ( unsigned int currentLevel = 0; currentLevel < this->m_NumberOfLevels; currentLevel++ )
       {
       this->m_CurrentLevel = currentLevel;
+      bool resumeLevel = ( this->m_Resuming && currentLevel == this->m_ResumeLevel );
+      if ( this->m_Resuming && currentLevel < this->m_ResumeLevel ) continue;
+      std::vector<TReal> resumeProfile;
+      if ( resumeLevel ) this->RestoreCheckpoint( resumeProfile );
       typedef Vector<TReal,1> ProfilePointDataType;
       typedef Image<ProfilePointDataType, 1> CurveType;
       typedef PointSet<ProfilePointDataType, 1> EnergyProfileType;
@@ -1070,22 +1386,37 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
       this->ComputeMultiResolutionParameters(this->m_ReferenceSpaceImage);
       std::cout << " Its at this level " << this->m_Iterations[currentLevel] << std::endl;
 
-      /*  generate smoothed images for all metrics */
+      /*  generate smoothed images for all metrics -- metrics that share an
+          input image also share its smoothed version */
       for ( unsigned int metricCount=0;  metricCount < numberOfMetrics;  metricCount++)
         {
+        bool sharedFixed=false, sharedMoving=false;
+        for ( unsigned int prior=0; prior < metricCount; prior++ )
+          {
+          if ( !sharedFixed && this->m_SimilarityMetrics[prior]->GetFixedImage() == this->m_SimilarityMetrics[metricCount]->GetFixedImage() )
+            {
+            this->m_SmoothFixedImages[metricCount] = this->m_SmoothFixedImages[prior];
+            sharedFixed=true;
+            }
+          if ( !sharedMoving && this->m_SimilarityMetrics[prior]->GetMovingImage() == this->m_SimilarityMetrics[metricCount]->GetMovingImage() )
+            {
+            this->m_SmoothMovingImages[metricCount] = this->m_SmoothMovingImages[prior];
+            sharedMoving=true;
+            }
+          }
         if( this->m_GaussianSmoothingSigmas.size() == 0 )
           {
-          this->m_SmoothFixedImages[metricCount] = this->SmoothImageToScale(
+          if ( !sharedFixed ) this->m_SmoothFixedImages[metricCount] = this->SmoothImageToScale(
             this->m_SimilarityMetrics[metricCount]->GetFixedImage(), this->m_ScaleFactor );
-          this->m_SmoothMovingImages[metricCount] = this->SmoothImageToScale(
+          if ( !sharedMoving ) this->m_SmoothMovingImages[metricCount] = this->SmoothImageToScale(
             this->m_SimilarityMetrics[metricCount]->GetMovingImage(), this->m_ScaleFactor );
           }
         else
           {
-          this->m_SmoothFixedImages[metricCount] = this->GaussianSmoothImage(
+          if ( !sharedFixed ) this->m_SmoothFixedImages[metricCount] = this->GaussianSmoothImage(
             this->m_SimilarityMetrics[metricCount]->GetFixedImage(),
             this->m_GaussianSmoothingSigmas[currentLevel] );
-          this->m_SmoothMovingImages[metricCount] = this->GaussianSmoothImage(
+          if ( !sharedMoving ) this->m_SmoothMovingImages[metricCount] = this->GaussianSmoothImage(
             this->m_SimilarityMetrics[metricCount]->GetMovingImage(),
             this->m_GaussianSmoothingSigmas[currentLevel] );
           }
@@ -1099,6 +1430,30 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
       this->m_EnergyBad.resize(nmet,0);
       bool converged=false;
       this->m_CurrentIteration=0;
+      this->m_UpdateFieldTimer=TimeProbe();
+      if ( resumeLevel )
+        {
+        // replay the energy profile so the convergence test sees the same window
+        this->m_CurrentIteration=this->m_ResumeIteration;
+        this->m_GradstepAltered=this->m_ResumeGradstep;
+        for( unsigned int it = 0; it < this->m_CurrentIteration; it++ )
+          for( unsigned int qq = 0; qq < numberOfMetrics; qq++ )
+            {
+            ProfilePointType point;
+            point[0] = it;
+            ProfilePointDataType energy;
+            energy[0] = resumeProfile[it*numberOfMetrics+qq];
+            energyProfiles[qq]->SetPoint( it, point );
+            energyProfiles[qq]->SetPointData( it, energy );
+            }
+        // a level that stopped at its iteration limit goes on if this run
+        // allows more iterations there
+        converged=this->m_ResumeLevelConverged;
+        if ( this->m_ResumeLevelAtIterationLimit && this->m_CurrentIteration < this->m_Iterations[currentLevel] )
+          converged=false;
+        this->m_Resuming=false;
+        std::cout << " Resuming level " << currentLevel << " at iteration " << this->m_CurrentIteration << std::endl;
+        }
 
       if (this->GetTransformationModel() != std::string("SyN"))  this->m_FixedImageAffineTransform=NULL;
       while (!converged)
@@ -1323,8 +1678,33 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
             std::cout<< " metric " << qq << " bad " << this->m_EnergyBad[qq] << "  " ;
           std::cout <<std::endl;
           }
+
+        if ( this->m_CheckpointFileName.length() > 0 &&
+             ( converged || this->m_CurrentIteration % this->m_CheckpointInterval == 0 ) )
+          {
+          std::vector<TReal> profile( this->m_CurrentIteration*numberOfMetrics, 0 );
+          for( unsigned int it = 0; it < this->m_CurrentIteration; it++ )
+            for( unsigned int qq = 0; qq < numberOfMetrics; qq++ )
+              {
+              ProfilePointDataType energy;
+              energy.Fill( 0 );
+              energyProfiles[qq]->GetPointData( it, &energy );
+              profile[it*numberOfMetrics+qq]=energy[0];
+              }
+          this->WriteCheckpoint( converged, profile );
+          }
+        }
+      if ( this->m_Debug && this->m_UpdateFieldTimer.GetNumberOfStops() > 0 )
+        {
+        std::cout << " update field time per iteration " << this->m_UpdateFieldTimer.GetMean()
+                  << " s over " << this->m_UpdateFieldTimer.GetNumberOfStops() << " calls ";
+        if ( this->m_UseFusedUpdateField && numberOfMetrics > 1 ) std::cout << "(fused)" << std::endl;
+        else std::cout << "(per-metric)" << std::endl;
         }
       }
+    this->m_UpdateFieldBuffers.clear();
+    this->m_UpdateFieldInvBuffers.clear();
+    this->m_Checkpoint.Wait();
 
 
     if ( this->GetTransformationModel() == std::string("SyN"))
@@ -1357,8 +1737,8 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
       }
     else if (this->GetTransformationModel() == std::string("Exp"))
       {
-    DisplacementFieldPointer diffmap =  this->IntegrateConstantVelocity( this->m_DisplacementField, (unsigned int)this->m_NTimeSteps , 1 ); // 1.0/ (TReal)this->m_NTimeSteps);
-    DisplacementFieldPointer invdiffmap = this->IntegrateConstantVelocity(this->m_DisplacementField,(unsigned int) this->m_NTimeSteps, -1 ); // -1.0/(TReal)this->m_NTimeSteps);
+    DisplacementFieldPointer diffmap, invdiffmap;
+    this->IntegrateConstantVelocityWithInverse( this->m_DisplacementField, (unsigned int)this->m_NTimeSteps , 1, diffmap, invdiffmap );
       this->m_InverseDisplacementField=invdiffmap;
       this->m_DisplacementField=diffmap;
       AffineTransformPointer invaff =NULL;
@@ -1480,161 +1860,147 @@ PointSetPointer  WarpMultiTransform(ImagePointer referenceimage, ImagePointer mo
 
   void SetDeltaTime( TReal t) {this->m_DeltaTime=t; }
 
+  /** Fixed point inversion of field into inverseField.  The voxels are
+   *  iterated on all threads and drop out of the iteration once their
+   *  residual is below a tenth of the tolerance. */
   TReal InvertField(DisplacementFieldPointer field,
             DisplacementFieldPointer inverseField, TReal weight=1.0,
-            TReal toler=0.1, int maxiter=20, bool print = false)
-{
+            TReal toler=0.1, int maxiter=20, bool print = false);
 
-  TReal mytoler=toler;
-  unsigned int mymaxiter=maxiter;
-  typename ParserType::OptionType::Pointer thicknessOption
-      = this->m_Parser->GetOption( "go-faster" );
-  if( thicknessOption->GetValue() == "true" ||  thicknessOption->GetValue() == "1" )
-    { mytoler=0.5; maxiter=12; }
-
-  VectorType zero; zero.Fill(0);
-  //  if (this->GetElapsedIterations() < 2 ) maxiter=10;
-
-  ImagePointer TRealImage = ImageType::New();
-  TRealImage->SetLargestPossibleRegion( field->GetLargestPossibleRegion() );
-  TRealImage->SetBufferedRegion( field->GetLargestPossibleRegion().GetSize() );
-  TRealImage->SetSpacing(field->GetSpacing());
-  TRealImage->SetOrigin(field->GetOrigin());
-  TRealImage->SetDirection(field->GetDirection());
-  TRealImage->Allocate();
-
-  typedef typename DisplacementFieldType::PixelType VectorType;
-  typedef typename DisplacementFieldType::IndexType IndexType;
-  typedef typename VectorType::ValueType           ScalarType;
-  typedef ImageRegionIteratorWithIndex<DisplacementFieldType> Iterator;
-
-  DisplacementFieldPointer lagrangianInitCond=DisplacementFieldType::New();
-  lagrangianInitCond->SetSpacing( field->GetSpacing() );
-  lagrangianInitCond->SetOrigin( field->GetOrigin() );
-  lagrangianInitCond->SetDirection( field->GetDirection() );
-  lagrangianInitCond->SetLargestPossibleRegion( field->GetLargestPossibleRegion() );
-  lagrangianInitCond->SetRequestedRegion(field->GetRequestedRegion() );
-  lagrangianInitCond->SetBufferedRegion( field->GetLargestPossibleRegion() );
-  lagrangianInitCond->Allocate();
-  DisplacementFieldPointer eulerianInitCond=DisplacementFieldType::New();
-  eulerianInitCond->SetSpacing( field->GetSpacing() );
-  eulerianInitCond->SetOrigin( field->GetOrigin() );
-  eulerianInitCond->SetDirection( field->GetDirection() );
-  eulerianInitCond->SetLargestPossibleRegion( field->GetLargestPossibleRegion() );
-  eulerianInitCond->SetRequestedRegion(field->GetRequestedRegion() );
-  eulerianInitCond->SetBufferedRegion( field->GetLargestPossibleRegion() );
-  eulerianInitCond->Allocate();
+  void SetUseNearestNeighborInterpolation( bool useNN) {  this->m_UseNN=useNN; }
+  void SetUseBSplineInterpolation( bool useNN) {  this->m_UseBSplineInterpolation=useNN; }
+  VectorType IntegratePointVelocity(TReal starttimein, TReal finishtimein , IndexType startPoint);
+  /** Integrates every voxel of intfield as IntegratePointVelocity does, but
+   *  advances blocks of particles one Runge-Kutta stage at a time and runs
+   *  the slabs of the domain on all threads.  A mask, if given, skips and
+   *  scales voxels like the serial masked loop. */
+  void IntegrateVelocityBatched(TReal starttimein, TReal finishtimein, DisplacementFieldPointer intfield, ImagePointer mask);
 
-  typedef typename DisplacementFieldType::SizeType SizeType;
-  SizeType size=field->GetLargestPossibleRegion().GetSize();
+protected:
 
+  DisplacementFieldPointer IntegrateVelocity(TReal,TReal);
+  DisplacementFieldPointer IntegrateLandmarkSetVelocity(TReal,TReal, PointSetPointer movingpoints, ImagePointer referenceimage );
 
-  typename ImageType::SpacingType spacing = field->GetSpacing();
-  TReal subpix=0.0;
-  unsigned long npix=1;
-  for (int j=0; j<ImageDimension; j++)  // only use in-plane spacing
+  /** (D+1)-linear interpolation straight from the buffer of the time varying
+   *  velocity field.  Same samples and border handling as the
+   *  VectorLinearInterpolateImageFunction, without the virtual calls and with
+   *  the point to index mapping precomputed, so threads can share it. */
+  class TimeVaryingVelocityKernel
   {
-    npix*=field->GetLargestPossibleRegion().GetSize()[j];
-  }
-  subpix=pow((TReal)ImageDimension,(TReal)ImageDimension)*0.5;
+  public:
+    itkStaticConstMacro( KernelDimension, unsigned int, TDimension+1 );
 
-  TReal max=0;
-    Iterator iter( field, field->GetLargestPossibleRegion() );
-    for(  iter.GoToBegin(); !iter.IsAtEnd(); ++iter )
+    void Initialize( const TimeVaryingVelocityFieldType * field )
     {
-      IndexType  index=iter.GetIndex();
-      VectorType vec1=iter.Get();
-      VectorType newvec=vec1*weight;
-      lagrangianInitCond->SetPixel(index,newvec);
-      TReal mag=0;
-      for (unsigned int jj=0; jj<ImageDimension; jj++) mag+=newvec[jj]*newvec[jj];
-      mag=sqrt(mag);
-      if (mag > max) max=mag;
-    }
-
-    eulerianInitCond->FillBuffer(zero);
-
-    TReal scale=(1.)/max;
-    if (scale > 1.) scale=1.0;
-//    TReal initscale=scale;
-    Iterator vfIter( inverseField, inverseField->GetLargestPossibleRegion() );
-
-//  int num=10;
-//  for (int its=0; its<num; its++)
-    TReal difmag=10.0;
-  unsigned int ct=0;
-    TReal denergy=10;
-    TReal denergy2=10;
-    TReal laste=1.e9;
-    TReal meandif=1.e8;
-//    int badct=0;
-//  while (difmag > subpix && meandif > subpix*0.1 && badct < 2 )//&& ct < 20 && denergy > 0)
-//    TReal length=0.0;
-    TReal stepl=2.;
-    TReal lastdifmag=0;
-
-    TReal epsilon = (TReal)size[0]/256;
-    if (epsilon > 1) epsilon = 1;
-
-    while ( difmag > mytoler && ct < mymaxiter && meandif > 0.001)
-  {
-    denergy=laste-difmag;//meandif;
-    denergy2=laste-meandif;
-    laste=difmag;//meandif;
-    meandif=0.0;
-
-    //this field says what position the eulerian field should contain in the E domain
-    this->ComposeDiffs(inverseField,lagrangianInitCond,    eulerianInitCond, 1);
-    difmag=0.0;
-    for(  vfIter.GoToBegin(); !vfIter.IsAtEnd(); ++vfIter )
-      {
-    IndexType  index=vfIter.GetIndex();
-    VectorType  update=eulerianInitCond->GetPixel(index);
-    TReal mag=0;
-    for (int j=0; j<ImageDimension;j++)
-      {
-        update[j]*=(-1.0);
-        mag+=(update[j]/spacing[j])*(update[j]/spacing[j]);
-                    }
-    mag=sqrt(mag);
-    meandif+=mag;
-    if (mag > difmag) {difmag=mag; }
-    //      if (mag < 1.e-2) update.Fill(0);
-
-    eulerianInitCond->SetPixel(index,update);
-    TRealImage->SetPixel(index,mag);
+      typedef typename TimeVaryingVelocityFieldType::RegionType TVRegionType;
+      const TVRegionType & region = field->GetBufferedRegion();
+      const typename TimeVaryingVelocityFieldType::OffsetValueType * offsets = field->GetOffsetTable();
+      this->m_Buffer = field->GetBufferPointer();
+      for ( unsigned int i = 0; i < KernelDimension; i++ )
+        {
+        this->m_Start[i] = region.GetIndex()[i];
+        this->m_End[i] = region.GetIndex()[i] + static_cast<long>( region.GetSize()[i] ) - 1;
+        this->m_Stride[i] = offsets[i];
+        this->m_Origin[i] = field->GetOrigin()[i];
+        for ( unsigned int j = 0; j < KernelDimension; j++ )
+          this->m_PointToIndex[i][j] = field->GetInverseDirection()[i][j] / field->GetSpacing()[i];
+        }
     }
-    meandif/=(TReal)npix;
-    if (ct == 0) epsilon = 0.75;
-    else epsilon=0.5;
-    stepl=difmag*epsilon;
 
-    for(  vfIter.GoToBegin(); !vfIter.IsAtEnd(); ++vfIter )
+    /** Returns false and leaves velocity alone outside the buffer. */
+    inline bool Evaluate( const TReal * point, double * velocity ) const
     {
-      TReal val = TRealImage->GetPixel(vfIter.GetIndex());
-      VectorType update=eulerianInitCond->GetPixel(vfIter.GetIndex());
-      if (val > stepl) update = update * (stepl/val);
-      VectorType upd=vfIter.Get()+update * (epsilon);
-      vfIter.Set(upd);
+      long   base[KernelDimension];
+      double distance[KernelDimension];
+      for ( unsigned int i = 0; i < KernelDimension; i++ )
+        {
+        double cindex = 0;
+        for ( unsigned int j = 0; j < KernelDimension; j++ )
+          cindex += this->m_PointToIndex[i][j] * ( point[j] - this->m_Origin[j] );
+        if ( cindex < this->m_Start[i] - 0.5 || cindex >= this->m_End[i] + 0.5 ) return false;
+        base[i] = static_cast<long>( vcl_floor( cindex ) );
+        distance[i] = cindex - base[i];
+        }
+      for ( unsigned int d = 0; d < TDimension; d++ ) velocity[d] = 0;
+      for ( unsigned int corner = 0; corner < ( 1u << KernelDimension ); corner++ )
+        {
+        double overlap = 1;
+        long offset = 0;
+        for ( unsigned int i = 0; i < KernelDimension; i++ )
+          {
+          long idx;
+          if ( corner & ( 1u << i ) )
+            {
+            idx = base[i] + 1;
+            if ( idx > this->m_End[i] ) idx = this->m_End[i];
+            overlap *= distance[i];
+            }
+          else
+            {
+            idx = base[i];
+            if ( idx < this->m_Start[i] ) idx = this->m_Start[i];
+            overlap *= 1.0 - distance[i];
+            }
+          offset += ( idx - this->m_Start[i] ) * this->m_Stride[i];
+          }
+        if ( overlap == 0 ) continue;
+        const VectorType & v = this->m_Buffer[offset];
+        for ( unsigned int d = 0; d < TDimension; d++ ) velocity[d] += overlap * v[d];
+        }
+      return true;
     }
-    ct++;
-    lastdifmag=difmag;
-
-  }
- // std::cout <<" difmag " << difmag << ": its " << ct <<  std::endl;
 
-  return difmag;
+  private:
+    const VectorType * m_Buffer;
+    long   m_Start[TDimension+1];
+    long   m_End[TDimension+1];
+    long   m_Stride[TDimension+1];
+    double m_Origin[TDimension+1];
+    double m_PointToIndex[TDimension+1][TDimension+1];
+  };
 
-}
+  struct IntegrateVelocityThreadStruct
+  {
+    const Self *                Optimizer;
+    TimeVaryingVelocityKernel   Kernel;
+    TReal                       StartTime;
+    TReal                       FinishTime;
+    DisplacementFieldType *     Field;
+    const ImageType *           Mask;
+  };
 
-  void SetUseNearestNeighborInterpolation( bool useNN) {  this->m_UseNN=useNN; }
-  void SetUseBSplineInterpolation( bool useNN) {  this->m_UseBSplineInterpolation=useNN; }
-  VectorType IntegratePointVelocity(TReal starttimein, TReal finishtimein , IndexType startPoint);
+  void IntegrateVelocityBlock(const IntegrateVelocityThreadStruct & str, const typename DisplacementFieldType::RegionType & region) const;
+  static ITK_THREAD_RETURN_TYPE IntegrateVelocityThreaderCallback( void *arg );
 
-protected:
+  typedef DisplacementFieldLinearSampler<DisplacementFieldType,TReal> DisplacementFieldSamplerType;
+  typedef typename DisplacementFieldType::OffsetValueType              FieldOffsetValueType;
 
-  DisplacementFieldPointer IntegrateVelocity(TReal,TReal);
-  DisplacementFieldPointer IntegrateLandmarkSetVelocity(TReal,TReal, PointSetPointer movingpoints, ImagePointer referenceimage );
+  struct InvertFieldThreadStruct
+  {
+    DisplacementFieldSamplerType              Sampler;
+    DisplacementFieldType *                   Inverse;
+    const std::vector<FieldOffsetValueType> * Active;
+    std::vector<VectorType> *                 Updates;
+    std::vector<TReal> *                      Magnitudes;
+    std::vector<TReal>                        ThreadMax;
+    std::vector<TReal>                        ThreadSum;
+    bool                                      Apply;
+    TReal                                     StepLength;
+    TReal                                     Epsilon;
+  };
+
+  /** One InvertField pass over a share of the active voxels:  the residual
+   *  of the composition, or the damped update of the inverse. */
+  static ITK_THREAD_RETURN_TYPE InvertFieldThreaderCallback( void *arg );
+
+  /** Put the optimizer state at the end of the current iteration into the
+   *  checkpoint buffer and hand it to the background writer. */
+  void WriteCheckpoint( bool levelConverged, const std::vector<TReal> & profile );
+  /** Restore the fields and energies of a checkpoint read by ReadCheckpoint;
+   *  profile receives the energies of the iterations already done. */
+  void RestoreCheckpoint( std::vector<TReal> & profile );
+  void PutCheckpointAffine( AffineTransformPointer affine );
+  bool GetCheckpointAffine( AffineTransformPointer & affine );
 
   ImagePointer  MakeSubImage( ImagePointer bigimage)
     {
@@ -1845,6 +2211,42 @@ private:
   Array<float> m_GaussianSmoothingSigmas;
   Array<float> m_SubsamplingFactors;
 
+/** per-metric update buffers, reused across iterations of a level */
+  bool m_UseFusedUpdateField;
+  bool m_UseScalingAndSquaring;
+  unsigned int m_ScalingAndSquaringSteps;
+  bool m_ScalingAndSquaringInDouble;
+
+/** metric sampling: 0 dense, 1 regular lattice, 2 random;  one percentage per level */
+  typedef Statistics::MersenneTwisterRandomVariateGenerator RandomizerType;
+  unsigned int m_MetricSamplingStrategy;
+  std::vector<TReal> m_MetricSamplingPercentages;
+  unsigned int m_MetricSamplingSeed;
+  typename RandomizerType::Pointer m_MetricSamplingRandomizer;
+  unsigned long m_MetricSamplingCount;
+  unsigned long m_MetricSamplingTaken;
+  std::vector<unsigned long> m_MetricSamplingCounters;
+  unsigned long m_MetricSamplingStride;
+  unsigned long m_MetricSamplingOffset;
+  unsigned long m_MetricSamplingBlockOffset;
+  TReal m_MetricSamplingFraction;
+/** checkpoint and resume of the deformable optimization */
+  std::string m_CheckpointFileName;
+  unsigned int m_CheckpointInterval;
+  ANTSRegistrationCheckpoint m_Checkpoint;
+  bool m_Resuming;
+  std::string m_ResumeTransformationModel;
+  unsigned int m_ResumeLevel;
+  unsigned int m_ResumeIteration;
+  bool m_ResumeLevelConverged;
+  bool m_ResumeLevelAtIterationLimit;
+  TReal m_ResumeGradstep;
+  AffineTransformPointer m_ResumeAffineTransform;
+  AffineTransformPointer m_ResumeFixedImageAffineTransform;
+  std::vector<DisplacementFieldPointer> m_UpdateFieldBuffers;
+  std::vector<DisplacementFieldPointer> m_UpdateFieldInvBuffers;
+  TimeProbe m_UpdateFieldTimer;
+
 };
 
 }
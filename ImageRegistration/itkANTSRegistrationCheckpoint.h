@@ -0,0 +1,321 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: itkANTSRegistrationCheckpoint.h,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __itkANTSRegistrationCheckpoint_h
+#define __itkANTSRegistrationCheckpoint_h
+
+#include "itkMultiThreader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined( _WIN32 )
+#include "itkWindows.h"
+#endif
+
+namespace itk
+{
+
+/** \class ANTSRegistrationCheckpoint
+ * \brief Binary snapshot of the state of a long registration.
+ *
+ * The state is put into an in-memory buffer value by value, images
+ * included, and read back with the Get methods in the same order.
+ * WriteAsync() hands the buffer to a background thread that writes it to
+ * a temporary file and renames it over the target, so the caller only
+ * pays for filling the buffer and an interrupted write leaves the last
+ * complete checkpoint in place.  Values are stored in the native byte
+ * order;  a checkpoint is meant to be resumed on the machine type that
+ * wrote it.
+ */
+class ANTSRegistrationCheckpoint
+{
+public:
+  ANTSRegistrationCheckpoint() : m_ReadPosition( 0 ), m_WriterThreadId( 0 ), m_Writing( false )
+    {
+    this->m_Threader = MultiThreader::New();
+    this->Clear();
+    }
+
+  ~ANTSRegistrationCheckpoint()
+    {
+    this->Wait();
+    }
+
+  /** Start a new checkpoint. */
+  void Clear()
+    {
+    this->m_Buffer.clear();
+    this->m_ReadPosition = 0;
+    this->PutBytes( Magic(), 8 );
+    }
+
+  template <class T>
+  void Put( const T & value )
+    {
+    this->PutBytes( &value, sizeof( T ) );
+    }
+
+  void PutString( const std::string & value )
+    {
+    this->Put<unsigned long>( value.size() );
+    this->PutBytes( value.data(), value.size() );
+    }
+
+  template <class T>
+  void PutVector( const std::vector<T> & values )
+    {
+    this->Put<unsigned long>( values.size() );
+    if( !values.empty() )
+      {
+      this->PutBytes( &values[0], values.size() * sizeof( T ) );
+      }
+    }
+
+  /** Geometry and pixels of an image, which may be NULL. */
+  template <class TImage>
+  void PutImage( const TImage *image )
+    {
+    this->Put<char>( image ? 1 : 0 );
+    if( !image )
+      {
+      return;
+      }
+    const typename TImage::RegionType & region = image->GetLargestPossibleRegion();
+    for( unsigned int d = 0; d < TImage::ImageDimension; d++ )
+      {
+      this->Put<long>( region.GetIndex()[d] );
+      this->Put<unsigned long>( region.GetSize()[d] );
+      this->Put<double>( image->GetSpacing()[d] );
+      this->Put<double>( image->GetOrigin()[d] );
+      for( unsigned int e = 0; e < TImage::ImageDimension; e++ )
+        {
+        this->Put<double>( image->GetDirection()[d][e] );
+        }
+      }
+    this->PutBytes( image->GetBufferPointer(),
+      region.GetNumberOfPixels() * sizeof( typename TImage::PixelType ) );
+    }
+
+  template <class T>
+  bool Get( T & value )
+    {
+    return this->GetBytes( &value, sizeof( T ) );
+    }
+
+  bool GetString( std::string & value )
+    {
+    unsigned long size = 0;
+    if( !this->Get( size ) || this->m_ReadPosition + size > this->m_Buffer.size() )
+      {
+      return false;
+      }
+    value.assign( &this->m_Buffer[0] + this->m_ReadPosition, size );
+    this->m_ReadPosition += size;
+    return true;
+    }
+
+  template <class T>
+  bool GetVector( std::vector<T> & values )
+    {
+    unsigned long size = 0;
+    if( !this->Get( size ) )
+      {
+      return false;
+      }
+    values.resize( size );
+    return size == 0 || this->GetBytes( &values[0], size * sizeof( T ) );
+    }
+
+  /** Returns false on a truncated buffer;  image is NULL if none was put. */
+  template <class TImage>
+  bool GetImage( typename TImage::Pointer & image )
+    {
+    image = NULL;
+    char present = 0;
+    if( !this->Get( present ) )
+      {
+      return false;
+      }
+    if( !present )
+      {
+      return true;
+      }
+    typename TImage::RegionType region;
+    typename TImage::SpacingType spacing;
+    typename TImage::PointType origin;
+    typename TImage::DirectionType direction;
+    for( unsigned int d = 0; d < TImage::ImageDimension; d++ )
+      {
+      long index = 0;
+      unsigned long size = 0;
+      double value = 0;
+      if( !this->Get( index ) || !this->Get( size ) )
+        {
+        return false;
+        }
+      region.SetIndex( d, index );
+      region.SetSize( d, size );
+      if( !this->Get( value ) )
+        {
+        return false;
+        }
+      spacing[d] = value;
+      if( !this->Get( value ) )
+        {
+        return false;
+        }
+      origin[d] = value;
+      for( unsigned int e = 0; e < TImage::ImageDimension; e++ )
+        {
+        if( !this->Get( value ) )
+          {
+          return false;
+          }
+        direction[d][e] = value;
+        }
+      }
+    image = TImage::New();
+    image->SetRegions( region );
+    image->SetSpacing( spacing );
+    image->SetOrigin( origin );
+    image->SetDirection( direction );
+    image->Allocate();
+    return this->GetBytes( image->GetBufferPointer(),
+      region.GetNumberOfPixels() * sizeof( typename TImage::PixelType ) );
+    }
+
+  /** Load a checkpoint file, false if it cannot be read or is not one. */
+  bool Read( const std::string & filename )
+    {
+    this->Wait();
+    std::ifstream file( filename.c_str(), std::ios::binary );
+    if( !file )
+      {
+      return false;
+      }
+    file.seekg( 0, std::ios::end );
+    std::streamoff length = file.tellg();
+    file.seekg( 0, std::ios::beg );
+    if( length < 8 )
+      {
+      return false;
+      }
+    this->m_Buffer.resize( static_cast<size_t>( length ) );
+    file.read( &this->m_Buffer[0], length );
+    this->m_ReadPosition = 8;
+    return file.good() && std::memcmp( &this->m_Buffer[0], Magic(), 8 ) == 0;
+    }
+
+  /** Write the current buffer in the background and start a new one;
+   * waits for the previous write to finish first. */
+  void WriteAsync( const std::string & filename )
+    {
+    this->Wait();
+    this->m_Pending.swap( this->m_Buffer );
+    this->m_PendingFileName = filename;
+    this->Clear();
+    this->m_WriterThreadId = this->m_Threader->SpawnThread( Self::WriterThreadCallback, this );
+    this->m_Writing = true;
+    }
+
+  /** Block until the background write, if any, is done. */
+  void Wait()
+    {
+    if( this->m_Writing )
+      {
+      this->m_Threader->TerminateThread( this->m_WriterThreadId );
+      this->m_Writing = false;
+      }
+    }
+
+private:
+  typedef ANTSRegistrationCheckpoint Self;
+
+  ANTSRegistrationCheckpoint( const Self & ); //purposely not implemented
+  void operator=( const Self & );             //purposely not implemented
+
+  static const char * Magic()
+    {
+    return "ANTSCKP1";
+    }
+
+  void PutBytes( const void *data, size_t size )
+    {
+    const char *bytes = static_cast<const char *>( data );
+    this->m_Buffer.insert( this->m_Buffer.end(), bytes, bytes + size );
+    }
+
+  bool GetBytes( void *data, size_t size )
+    {
+    if( this->m_ReadPosition + size > this->m_Buffer.size() )
+      {
+      return false;
+      }
+    if( size > 0 )
+      {
+      std::memcpy( data, &this->m_Buffer[0] + this->m_ReadPosition, size );
+      }
+    this->m_ReadPosition += size;
+    return true;
+    }
+
+  /** Move source over target in one step, so that target is either the old
+   * or the new checkpoint and never missing.  std::rename does that on
+   * POSIX systems but fails on Windows when the target exists. */
+  static bool ReplaceCheckpointFile( const std::string & source, const std::string & target )
+    {
+#if defined( _WIN32 )
+    return MoveFileExA( source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) != 0;
+#else
+    return std::rename( source.c_str(), target.c_str() ) == 0;
+#endif
+    }
+
+  static ITK_THREAD_RETURN_TYPE WriterThreadCallback( void *arg )
+    {
+    MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+    Self *self = static_cast<Self *>( info->UserData );
+
+    std::string temporary = self->m_PendingFileName + ".tmp";
+    std::ofstream file( temporary.c_str(), std::ios::binary | std::ios::trunc );
+    if( !self->m_Pending.empty() )
+      {
+      file.write( &self->m_Pending[0], self->m_Pending.size() );
+      }
+    file.close();
+    if( file.fail() || !ReplaceCheckpointFile( temporary, self->m_PendingFileName ) )
+      {
+      std::cerr << "Could not write checkpoint " << self->m_PendingFileName << std::endl;
+      }
+    return ITK_THREAD_RETURN_VALUE;
+    }
+
+  std::vector<char>      m_Buffer;
+  size_t                 m_ReadPosition;
+  std::vector<char>      m_Pending;
+  std::string            m_PendingFileName;
+  MultiThreader::Pointer m_Threader;
+  ThreadIdType           m_WriterThreadId;
+  bool                   m_Writing;
+};
+
+} // end namespace itk
+
+#endif
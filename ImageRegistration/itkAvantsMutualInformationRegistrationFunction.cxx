@@ -28,6 +28,7 @@
 #include "vnl/vnl_math.h"
 #include "itkDiscreteGaussianImageFilter.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkMultiThreader.h"
 
 namespace itk
 {
@@ -76,6 +77,8 @@ AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplaceme
   m_FixedImageGradientCalculator = GradientCalculatorType::New();
   m_MovingImageGradientCalculator = GradientCalculatorType::New();
   this->m_Padding=2;
+  this->m_DerivativeTableOversampling=4;
+  this->m_DerivativeTableSize=0;
 
 
   typename DefaultInterpolatorType::Pointer interp =  DefaultInterpolatorType::New();
@@ -126,6 +129,8 @@ AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplaceme
   os << m_MovingImageBinSize << std::endl;
   os << indent << "InterpolatorIsBSpline: ";
   os << m_InterpolatorIsBSpline << std::endl;
+  os << indent << "DerivativeTableOversampling: ";
+  os << m_DerivativeTableOversampling << std::endl;
 
 }
 
@@ -344,6 +349,48 @@ AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplaceme
   pdfinterpolator2->SetSplineOrder(3);
   pdfinterpolator3->SetSplineOrder(3);
   */
+
+  this->ComputeDerivativeTables();
+}
+
+
+/**
+ * Tabulate the metric terms on a grid aligned with the histogram bins
+ */
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+void
+AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::ComputeDerivativeTables()
+{
+  this->m_DerivativeTableSize = 0;
+  this->m_DerivativeTable[0].clear();
+  this->m_DerivativeTable[1].clear();
+  if ( this->m_DerivativeTableOversampling == 0 )
+    {
+    return;
+    }
+
+  // [0,1] spans NumberOfHistogramBins-2*Padding-1 bins;  the nodes fall on
+  // the bin centres and, for an even oversampling, on the half-bin offsets
+  // of the derivative stencils, where the linear interpolants have kinks.
+  const unsigned int intervals = static_cast<unsigned int>(
+    vnl_math_rnd( 1.0 / this->m_JointPDFSpacing[0] ) ) * this->m_DerivativeTableOversampling;
+  const unsigned int n = intervals + 1;
+  this->m_DerivativeTable[0].resize( n * n );
+  this->m_DerivativeTable[1].resize( n * n );
+
+  JointPDFPointType pdfind;
+  for ( unsigned int j = 0; j < n; j++ )
+    {
+    pdfind[1] = static_cast<double>( j ) / intervals;
+    for ( unsigned int i = 0; i < n; i++ )
+      {
+      pdfind[0] = static_cast<double>( i ) / intervals;
+      this->m_DerivativeTable[0][i + j * n] = this->ComputeDerivativeTerm( pdfind );
+      this->m_DerivativeTable[1][i + j * n] = this->ComputeDerivativeTermInv( pdfind );
+      }
+    }
+  this->m_DerivativeTableSize = n;
 }
 
 
@@ -356,53 +403,32 @@ void
 AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
 ::GetProbabilities()
 {
-  typedef ImageRegionConstIteratorWithIndex<FixedImageType> RandomIterator;
-  RandomIterator randIter( this->m_FixedImage, this->m_FixedImage->GetLargestPossibleRegion() );
   this->m_FixedImageMarginalPDF->FillBuffer(0);
   this->m_MovingImageMarginalPDF->FillBuffer(0);
 
-  // Reset the joint pdfs to zero
-  m_JointPDF->FillBuffer( 0.0 );
+  // Each thread fills its own histogram;  the counts are exact, so the sum
+  // does not depend on the number of threads.
+  JointHistogramThreadStruct str;
+  str.Function = this;
 
-  unsigned long nSamples=0;
-  RandomIterator iter( this->m_FixedImage, this->m_FixedImage->GetLargestPossibleRegion() );
+  typename MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  const unsigned long numberOfBins = m_NumberOfHistogramBins * m_NumberOfHistogramBins;
+  str.Histograms.assign( threader->GetNumberOfThreads(), std::vector<unsigned long>( numberOfBins, 0 ) );
+  threader->SetSingleMethod( Self::JointHistogramThreaderCallback, &str );
+  threader->SingleMethodExecute();
 
-  for( iter.GoToBegin(); !iter.IsAtEnd(); ++iter )
+  JointPDFValueType *pdfPtr = m_JointPDF->GetBufferPointer();
+  for ( unsigned long bin = 0; bin < numberOfBins; bin++ )
     {
-
-      bool takesample=true;
-      if (this->m_FixedImageMask) if (this->m_FixedImageMask->GetPixel( iter.GetIndex() ) < 1.e-6 ) takesample=false;
-
-      if (takesample)
+    unsigned long count = 0;
+    for ( unsigned int t = 0; t < str.Histograms.size(); t++ )
       {
-
-      // Get sampled index
-    FixedImageIndexType index = iter.GetIndex();
-    typename FixedImageType::SizeType imagesize=this->m_FixedImage->GetLargestPossibleRegion().GetSize();
-/*    bool inimage=true;
-    for (unsigned int dd=0; dd<ImageDimension; dd++)
-      {
-        if ( index[dd] < 1 ||    index[dd] >= static_cast<typename IndexType::IndexValueType>(imagesize[dd]-1) )
-          inimage=false;
-      }
-*/
-    double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( index )  );
-    double fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( index )  );
-
-      /** add the paired intensity points to the joint histogram */
-      JointPDFPointType jointPDFpoint;
-      this->ComputeJointPDFPoint(fixedImageValue,movingImageValue, jointPDFpoint);
-      JointPDFIndexType  jointPDFIndex;
-      jointPDFIndex.Fill(0);
-      this->m_JointPDF->TransformPhysicalPointToIndex(jointPDFpoint,jointPDFIndex);
-      this->m_JointPDF->SetPixel(jointPDFIndex,this->m_JointPDF->GetPixel(jointPDFIndex)+1);
-
-      ++nSamples;
+      count += str.Histograms[t][bin];
       }
+    pdfPtr[bin] = static_cast<PDFValueType>( count );
     }
 
-
-
   /**
    * Normalize the PDFs, compute moving image marginal PDF
    *
@@ -492,6 +518,69 @@ AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplaceme
 
 
 
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+ITK_THREAD_RETURN_TYPE
+AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::JointHistogramThreaderCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  JointHistogramThreadStruct *str = static_cast<JointHistogramThreadStruct *>( info->UserData );
+  ThreadIdType threadId = info->ThreadID;
+  ThreadIdType threadCount = info->NumberOfThreads;
+
+  // one slab of the fixed image per thread
+  typename FixedImageType::RegionType region =
+    str->Function->m_FixedImage->GetLargestPossibleRegion();
+  const unsigned int splitAxis = ImageDimension - 1;
+  unsigned long range = region.GetSize()[splitAxis];
+  unsigned long valuesPerThread = ( range + threadCount - 1 ) / threadCount;
+  if ( valuesPerThread == 0 || threadId*valuesPerThread >= range || threadId >= str->Histograms.size() )
+    {
+    return ITK_THREAD_RETURN_VALUE;
+    }
+  unsigned long extent = vnl_math_min( valuesPerThread, range - threadId*valuesPerThread );
+  IndexType sindex = region.GetIndex();
+  SizeType ssize = region.GetSize();
+  sindex[splitAxis] += threadId*valuesPerThread;
+  ssize[splitAxis] = extent;
+  region.SetIndex( sindex );
+  region.SetSize( ssize );
+
+  str->Function->ThreadedJointHistogram( region, str->Histograms[threadId] );
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+void
+AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::ThreadedJointHistogram( const typename FixedImageType::RegionType & region,
+                          std::vector<unsigned long> & histogram )
+{
+  typedef ImageRegionConstIteratorWithIndex<FixedImageType> IteratorType;
+  IteratorType iter( this->m_FixedImage, region );
+  const unsigned long nbins = m_NumberOfHistogramBins;
+
+  for( iter.GoToBegin(); !iter.IsAtEnd(); ++iter )
+    {
+    FixedImageIndexType index = iter.GetIndex();
+    if (this->m_FixedImageMask) if (this->m_FixedImageMask->GetPixel( index ) < 1.e-6 ) continue;
+
+    double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( index )  );
+    double fixedImageValue = this->GetFixedParzenTerm(  iter.Get()  );
+
+    /** add the paired intensity points to the joint histogram */
+    JointPDFPointType jointPDFpoint;
+    this->ComputeJointPDFPoint(fixedImageValue,movingImageValue, jointPDFpoint);
+    JointPDFIndexType  jointPDFIndex;
+    if ( this->m_JointPDF->TransformPhysicalPointToIndex(jointPDFpoint,jointPDFIndex) )
+      {
+      histogram[ jointPDFIndex[0] + jointPDFIndex[1] * nbins ]++;
+      }
+    }
+}
+
+
 /**
  * Get the both Value and Derivative Measure
  */
@@ -502,18 +591,18 @@ AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplaceme
             MeasureType& valuei,
             DerivativeType& derivative1,DerivativeType& derivative2)
 {
-  double value=0;
-  DerivativeType zero(ImageDimension);
-  zero.Fill(0);
-
+  return this->GetDerivativeTerm( oindex, false );
+}
 
-  double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( oindex )  );
-  double fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( oindex )  );
 
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+double
+AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::ComputeDerivativeTerm( const JointPDFPointType & pdfind )
+{
+  double value=0;
   double dJPDF=0,dFmPDF=0,jointPDFValue=0,fixedImagePDFValue=0;
 
-    JointPDFPointType pdfind;
-    this->ComputeJointPDFPoint(fixedImageValue,movingImageValue, pdfind);
     jointPDFValue=pdfinterpolator->Evaluate(pdfind);
     dJPDF = this->ComputeJointPDFDerivative( pdfind, 0 , 0 );
 
@@ -542,17 +631,18 @@ AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplaceme
             MeasureType& valuei,
             DerivativeType& derivative1,DerivativeType& derivative2)
 {
-  double value=0;
-  DerivativeType zero(ImageDimension);
-  zero.Fill(0);
+  return this->GetDerivativeTerm( oindex, true );
+}
 
-  double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( oindex )  );
-  double fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( oindex )  );
 
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+double
+AvantsMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::ComputeDerivativeTermInv( const JointPDFPointType & pdfind )
+{
+  double value=0;
   double dJPDF=0,dMmPDF=0,jointPDFValue=0,movingImagePDFValue=0;
 
-    JointPDFPointType pdfind;
-    this->ComputeJointPDFPoint(fixedImageValue,movingImageValue, pdfind);
     jointPDFValue=pdfinterpolator->Evaluate(pdfind);
     dJPDF = this->ComputeJointPDFDerivative( pdfind , 0 , 1 );
 
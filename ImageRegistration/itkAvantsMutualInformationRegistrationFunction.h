@@ -18,6 +18,7 @@
 #ifndef __itkAvantsMutualInformationRegistrationFunction_h
 #define __itkAvantsMutualInformationRegistrationFunction_h
 #include "vcl_cmath.h"
+#include "vnl/vnl_math.h"
 #include "itkImageFileWriter.h"
 #include "itkImageToImageMetric.h"
 #include "itkAvantsPDEDeformableRegistrationFunction.h"
@@ -39,6 +40,8 @@
 #include "itkGradientRecursiveGaussianImageFilter.h"
 #include "itkSpatialObject.h"
 #include "itkConstNeighborhoodIterator.h"
+#include "itkMultiThreader.h"
+#include <vector>
 
 namespace itk
 {
@@ -296,6 +299,40 @@ public:
 
   void GetProbabilities();
 
+  /** The per-voxel metric term depends only on the position of the
+   * intensity pair in the joint histogram.  After the PDFs are built it is
+   * tabulated on a grid with this many nodes per histogram bin and looked
+   * up bilinearly;  0 evaluates the PDF interpolators at every voxel. */
+  itkSetMacro( DerivativeTableOversampling, unsigned int );
+  itkGetConstMacro( DerivativeTableOversampling, unsigned int );
+
+  /** The metric term at one voxel, which scales the fixed image gradient
+   * in ComputeUpdate (inverse false) or the moving image gradient in
+   * ComputeUpdateInv (inverse true). */
+  inline double GetDerivativeTerm( const IndexType & oindex, bool inverse )
+  {
+    double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( oindex )  );
+    double fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( oindex )  );
+    JointPDFPointType pdfind;
+    this->ComputeJointPDFPoint(fixedImageValue,movingImageValue, pdfind);
+
+    const unsigned int which = inverse ? 1 : 0;
+    const unsigned int n = this->m_DerivativeTableSize;
+    if ( n > 1 && pdfind[0] >= 0 && pdfind[0] <= 1 && pdfind[1] >= 0 && pdfind[1] <= 1 )
+      {
+      const double x = pdfind[0] * ( n - 1 );
+      const double y = pdfind[1] * ( n - 1 );
+      const unsigned int i = vnl_math_min( static_cast<unsigned int>( x ), n - 2 );
+      const unsigned int j = vnl_math_min( static_cast<unsigned int>( y ), n - 2 );
+      const double fx = x - i;
+      const double fy = y - j;
+      const double *t = &this->m_DerivativeTable[which][i + j * n];
+      return ( 1.0 - fy ) * ( ( 1.0 - fx ) * t[0] + fx * t[1] ) +
+        fy * ( ( 1.0 - fx ) * t[n] + fx * t[n + 1] );
+      }
+    return inverse ? this->ComputeDerivativeTermInv( pdfind ) : this->ComputeDerivativeTerm( pdfind );
+  }
+
   void ComputeJointPDFPoint( double fixedImageValue,double movingImageValue , JointPDFPointType& jointPDFpoint ) {
     double a=(fixedImageValue-this->m_FixedImageTrueMin)/(this->m_FixedImageTrueMax-this->m_FixedImageTrueMin);
     double b=(movingImageValue-this->m_MovingImageTrueMin)/(this->m_MovingImageTrueMax-this->m_MovingImageTrueMin);
@@ -451,13 +488,8 @@ public:
 
     CovariantVectorType fixedGradient;
     double loce=0.0;
-    ParametersType fdvec1(ImageDimension);
-    ParametersType fdvec2(ImageDimension);
-    fdvec1.Fill(0);
-    fdvec2.Fill(0);
     fixedGradient = m_FixedImageGradientCalculator->EvaluateAtIndex( oindex );
-    double nccm1=0;
-    loce=this->GetValueAndDerivative(oindex,nccm1,fdvec1,fdvec2);
+    loce=this->GetDerivativeTerm(oindex,false);
     //    if ( loce > 1.5 ) std::cout << " loce " << loce << " ind " << oindex << std::endl;
     for (int imd=0; imd<ImageDimension; imd++) update[imd]=loce*fixedGradient[imd]*spacing[imd]*(1);
     //if (this->m_MetricImage) this->m_MetricImage->SetPixel(oindex,loce);
@@ -532,14 +564,9 @@ public:
 
     CovariantVectorType movingGradient;
     double loce=0.0;
-    ParametersType fdvec1(ImageDimension);
-    ParametersType fdvec2(ImageDimension);
-    fdvec1.Fill(0);
-    fdvec2.Fill(0);
     movingGradient = m_MovingImageGradientCalculator->EvaluateAtIndex( oindex );
 
-    double nccm1=0;
-    loce=this->GetValueAndDerivativeInv(oindex,nccm1,fdvec1,fdvec2);
+    loce=this->GetDerivativeTerm(oindex,true);
     for (int imd=0; imd<ImageDimension; imd++) update[imd]=loce*movingGradient[imd]*spacing[imd]*(1);
     //    if( oindex[1] == 250 && oindex[0] == 250  ) WriteImages();
     return update;
@@ -617,6 +644,30 @@ private:
   AvantsMutualInformationRegistrationFunction(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  /** Exact metric terms at a joint PDF point, from the PDF interpolators. */
+  double ComputeDerivativeTerm( const JointPDFPointType & pdfind );
+  double ComputeDerivativeTermInv( const JointPDFPointType & pdfind );
+
+  /** Tabulate both metric terms over the joint histogram domain. */
+  void ComputeDerivativeTables();
+
+  /** Each thread bins the intensity pairs of one slab of the fixed image
+   * into its own histogram;  GetProbabilities adds them up. */
+  struct JointHistogramThreadStruct
+    {
+    Self                                     *Function;
+    std::vector< std::vector<unsigned long> > Histograms;
+    };
+
+  static ITK_THREAD_RETURN_TYPE JointHistogramThreaderCallback( void *arg );
+
+  void ThreadedJointHistogram( const typename FixedImageType::RegionType & region,
+                               std::vector<unsigned long> & histogram );
+
+  unsigned int        m_DerivativeTableOversampling;
+  unsigned int        m_DerivativeTableSize;
+  std::vector<double> m_DerivativeTable[2];
+
 
   typename JointPDFDerivativesType::Pointer m_JointPDFDerivatives;
 
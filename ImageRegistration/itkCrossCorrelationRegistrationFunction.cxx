@@ -23,12 +23,14 @@
 #include "vnl/vnl_math.h"
 #include "itkImageFileWriter.h"
 #include "itkImageLinearConstIteratorWithIndex.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
 #include "itkDiscreteGaussianImageFilter.h"
 #include "itkMeanImageFilter.h"
 #include "itkMedianImageFilter.h"
 #include "itkImageFileWriter.h"
+#include "itkMultiThreader.h"
 
-#include <deque>
+#include <vector>
 
 namespace itk {
 
@@ -171,223 +173,246 @@ CrossCorrelationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField
       finitediffimages[4]=this->MakeImage();
     }
 
-  //float sig=15.;
-
-  RadiusType r;
-  for( int j = 0; j < ImageDimension; j++ )    r[j] = this->GetRadius()[j];
+  if ( this->m_FixedImageMask )
+    {
+    if ( !m_LocalCount || m_LocalCount->GetLargestPossibleRegion() !=
+         this->GetFixedImage()->GetLargestPossibleRegion() )
+      {
+      m_LocalCount = MetricImageType::New();
+      m_LocalCount->CopyInformation( this->GetFixedImage() );
+      m_LocalCount->SetRegions( this->GetFixedImage()->GetLargestPossibleRegion() );
+      m_LocalCount->Allocate();
+      }
+    }
+  else
+    {
+    m_LocalCount = NULL;
+    }
 
-  typedef itk::ImageRegionIteratorWithIndex<MetricImageType> Iterator;
-  Iterator tIter(this->GetFixedImage(),this->GetFixedImage()->GetLargestPossibleRegion() );
+  // The local sums of f, m, f^2, m^2 and fm over the box of the metric
+  // radius are separable, so they are built with one running-sum pass per
+  // axis, each threaded over slabs, instead of neighbourhood walks.
+  this->RunLocalSumsPass( LoadLocalSums );
+  for( unsigned int d = 0; d < ImageDimension; d++ )
+    {
+    this->RunLocalSumsPass( d );
+    }
+  this->RunLocalSumsPass( FinalizeLocalSums );
 
-  typename FixedImageType::SizeType imagesize=this->GetFixedImage()->GetLargestPossibleRegion().GetSize();
+  //m_FixedImageGradientCalculator->SetInputImage(finitediffimages[0]);
 
-  // compute local means
-  //  typedef itk::ImageRegionIteratorWithIndex<MetricImageType> Iterator;
+  m_MaxMag=0.0;
+  m_MinMag=9.e9;
+  m_AvgMag=0.0;
+  m_Iteration++;
 
+}
 
-  //
-  // The following change was made to speed up the correlation calculation.
-  //
 
-  typedef std::deque<float> SumQueueType;
+/*
+ * Run one pass of the local sum computation over slabs of the fixed image
+ */
+template <class TFixedImage, class TMovingImage, class TDisplacementField>
+void
+CrossCorrelationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::RunLocalSumsPass( unsigned int pass )
+{
+  LocalSumsThreadStruct str;
+  str.Function = this;
+  str.Pass = pass;
+
+  typename MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  threader->SetSingleMethod( Self::LocalSumsThreaderCallback, &str );
+  threader->SingleMethodExecute();
+}
 
-  SumQueueType Qsuma2;
-  SumQueueType Qsumb2;
-  SumQueueType Qsuma;
-  SumQueueType Qsumb;
-  SumQueueType Qsumab;
-  SumQueueType Qcount;
 
-  ImageLinearConstIteratorWithIndex<MetricImageType> outIter( this->finitediffimages[0],
-    this->finitediffimages[0]->GetLargestPossibleRegion() );
-  outIter.SetDirection( 0 );
-  outIter.GoToBegin();
-  while( !outIter.IsAtEnd() )
+template <class TFixedImage, class TMovingImage, class TDisplacementField>
+ITK_THREAD_RETURN_TYPE
+CrossCorrelationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::LocalSumsThreaderCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  LocalSumsThreadStruct *str = static_cast<LocalSumsThreadStruct *>( info->UserData );
+  ThreadIdType threadId = info->ThreadID;
+  ThreadIdType threadCount = info->NumberOfThreads;
+
+  // one slab per thread, cut across the axis being summed along
+  typename MetricImageType::RegionType region =
+    str->Function->GetFixedImage()->GetLargestPossibleRegion();
+  unsigned int splitAxis = ImageDimension - 1;
+  if ( str->Pass == ImageDimension - 1 && ImageDimension > 1 )
     {
-    // Push the zeros onto the stack that are outsized the image boundary at
-    // the beginning of the line.
-    Qsuma2 = SumQueueType( r[0], 0.0 );
-    Qsumb2 = SumQueueType( r[0], 0.0 );
-    Qsuma = SumQueueType( r[0], 0.0 );
-    Qsumb = SumQueueType( r[0], 0.0 );
-    Qsumab = SumQueueType( r[0], 0.0 );
-    Qcount = SumQueueType( r[0], 0.0 );
-
-    NeighborhoodIterator<MetricImageType> hoodIt( this->GetRadius(),
-      this->finitediffimages[0], this->finitediffimages[0]->GetLargestPossibleRegion() );
-    IndexType oindex = outIter.GetIndex();
-    hoodIt.SetLocation( oindex );
-    unsigned int hoodlen = hoodIt.Size();
-
-    // Now add the rest of the values from each hyperplane
-
-    for( unsigned int i = r[0]; i < ( 2*r[0] + 1 ); i++ )
-      {
-      float suma2 = 0.0;
-      float sumb2 = 0.0;
-      float suma = 0.0;
-      float sumb = 0.0;
-      float sumab = 0.0;
-      float count = 0.0;
-
-      for( unsigned int indct = i; indct < hoodlen; indct += ( 2*r[0] + 1 ) )
-        {
-        bool isInBounds = true;
-        hoodIt.GetPixel( indct, isInBounds );
-        IndexType index = hoodIt.GetIndex( indct );
+    splitAxis = ImageDimension - 2;
+    }
+  unsigned long range = region.GetSize()[splitAxis];
+  unsigned long valuesPerThread = ( range + threadCount - 1 ) / threadCount;
+  if ( valuesPerThread == 0 || threadId*valuesPerThread >= range )
+    {
+    return ITK_THREAD_RETURN_VALUE;
+    }
+  unsigned long extent = vnl_math_min( valuesPerThread, range - threadId*valuesPerThread );
+  IndexType sindex = region.GetIndex();
+  typename MetricImageType::SizeType ssize = region.GetSize();
+  sindex[splitAxis] += threadId*valuesPerThread;
+  ssize[splitAxis] = extent;
+  region.SetIndex( sindex );
+  region.SetSize( ssize );
+
+  str->Function->ThreadedLocalSums( str->Pass, region );
+  return ITK_THREAD_RETURN_VALUE;
+}
 
-        if ( !isInBounds || ( this->m_FixedImageMask &&
-          this->m_FixedImageMask->GetPixel( index ) < 0.25 ) )
-          {
-          continue;
-          }
 
-        float a = this->GetFixedImage()->GetPixel( index );
-        float b = this->GetMovingImage()->GetPixel( index );
+template <class TFixedImage, class TMovingImage, class TDisplacementField>
+void
+CrossCorrelationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::ThreadedLocalSums( unsigned int pass, const typename MetricImageType::RegionType & region )
+{
+  // finitediffimages hold the running sums of f, m, fm, f^2 and m^2 until
+  // the last pass turns them into the centred values and sfm, sff, smm
+  const unsigned int nsums = m_LocalCount ? 6 : 5;
+  float *buffers[6];
+  for( unsigned int k = 0; k < 5; k++ )
+    {
+    buffers[k] = this->finitediffimages[k]->GetBufferPointer();
+    }
+  if ( m_LocalCount )
+    {
+    buffers[5] = m_LocalCount->GetBufferPointer();
+    }
 
-        suma2 += a*a;
-        sumb2 += b*b;
-        suma += a;
-        sumb += b;
-        sumab += a*b;
-        count += 1.0;
-        }
+  const typename MetricImageType::RegionType & whole =
+    this->GetFixedImage()->GetLargestPossibleRegion();
+  const FixedImageType *fixed = this->GetFixedImage();
+  const MovingImageType *moving = this->GetMovingImage();
 
-      Qsuma2.push_back( suma2 );
-      Qsumb2.push_back( sumb2 );
-      Qsuma.push_back( suma );
-      Qsumb.push_back( sumb );
-      Qsumab.push_back( sumab );
-      Qcount.push_back( count );
+  if ( pass == LoadLocalSums )
+    {
+    ImageRegionConstIteratorWithIndex<FixedImageType> it( fixed, region );
+    for( it.GoToBegin(); !it.IsAtEnd(); ++it )
+      {
+      const IndexType index = it.GetIndex();
+      const OffsetValueType offset = this->finitediffimages[0]->ComputeOffset( index );
+      float a = it.Get();
+      float b = moving->GetPixel( index );
+      float w = 1;
+      if ( this->m_FixedImageMask && this->m_FixedImageMask->GetPixel( index ) < 0.25 )
+        {
+        a = 0;
+        b = 0;
+        w = 0;
+        }
+      buffers[0][offset] = a;
+      buffers[1][offset] = b;
+      buffers[2][offset] = a*b;
+      buffers[3][offset] = a*a;
+      buffers[4][offset] = b*b;
+      if ( m_LocalCount )
+        {
+        buffers[5][offset] = w;
+        }
       }
+    return;
+    }
 
-    while( !outIter.IsAtEndOfLine() )
+  if ( pass == FinalizeLocalSums )
+    {
+    ImageRegionConstIteratorWithIndex<FixedImageType> it( fixed, region );
+    for( it.GoToBegin(); !it.IsAtEnd(); ++it )
       {
-      // Test to see if there are any voxels we need to handle in the current
-      // window.
-
-      float suma2 = 0.0;
-      float sumb2 = 0.0;
-      float suma = 0.0;
-      float sumb = 0.0;
-      float sumab = 0.0;
-      float count = 0.0;
-
-      typename SumQueueType::iterator itcount = Qcount.begin();
-      while( itcount != Qcount.end() )
+      const IndexType index = it.GetIndex();
+      const OffsetValueType offset = this->finitediffimages[0]->ComputeOffset( index );
+
+      double count = 1;
+      if ( m_LocalCount )
         {
-        count += *itcount;
-        ++itcount;
+        count = buffers[5][offset];
         }
-
-      // If there are values, we need to calculate the different quantities
-      if( count > 0 )
+      else
         {
+        // without a mask every in-bounds voxel of the box counts
+        for( unsigned int d = 0; d < ImageDimension; d++ )
+          {
+          const long lo = vnl_math_max( static_cast<long>( index[d] ) - static_cast<long>( this->GetRadius()[d] ),
+            static_cast<long>( whole.GetIndex()[d] ) );
+          const long hi = vnl_math_min( static_cast<long>( index[d] ) + static_cast<long>( this->GetRadius()[d] ),
+            static_cast<long>( whole.GetIndex()[d] + whole.GetSize()[d] ) - 1 );
+          count *= static_cast<double>( hi - lo + 1 );
+          }
+        }
 
-        typename SumQueueType::iterator ita2 = Qsuma2.begin();
-        typename SumQueueType::iterator itb2 = Qsumb2.begin();
-        typename SumQueueType::iterator ita = Qsuma.begin();
-        typename SumQueueType::iterator itb = Qsumb.begin();
-        typename SumQueueType::iterator itab = Qsumab.begin();
-
-        while( ita2 != Qsuma2.end() )
+      if ( count < 0.5 )
+        {
+        for( unsigned int k = 0; k < 5; k++ )
           {
-          suma2 += *ita2;
-          sumb2 += *itb2;
-          suma += *ita;
-          sumb += *itb;
-          sumab += *itab;
-
-          ++ita2;
-          ++itb2;
-          ++ita;
-          ++itb;
-          ++itab;
+          buffers[k][offset] = 0;
           }
+        continue;
+        }
 
-        float fixedMean = suma / count;
-        float movingMean = sumb / count;
+      const double suma = buffers[0][offset];
+      const double sumb = buffers[1][offset];
+      const double sumab = buffers[2][offset];
+      const double suma2 = buffers[3][offset];
+      const double sumb2 = buffers[4][offset];
 
-        float sff = suma2 - fixedMean*suma - fixedMean*suma + count*fixedMean*fixedMean;
-        float smm = sumb2 - movingMean*sumb - movingMean*sumb + count*movingMean*movingMean;
-        float sfm = sumab - movingMean*suma - fixedMean*sumb + count*movingMean*fixedMean;
+      const double fixedMean = suma / count;
+      const double movingMean = sumb / count;
 
-        IndexType oindex = outIter.GetIndex();
+      const double sff = suma2 - fixedMean*suma - fixedMean*suma + count*fixedMean*fixedMean;
+      const double smm = sumb2 - movingMean*sumb - movingMean*sumb + count*movingMean*movingMean;
+      const double sfm = sumab - movingMean*suma - fixedMean*sumb + count*movingMean*fixedMean;
 
-        float val = this->GetFixedImage()->GetPixel( oindex ) - fixedMean;
-        this->finitediffimages[0]->SetPixel( oindex, val );
-        val = this->GetMovingImage()->GetPixel( oindex ) - movingMean;
-        this->finitediffimages[1]->SetPixel( oindex, val );
-        this->finitediffimages[2]->SetPixel( oindex, sfm );//A
-        this->finitediffimages[3]->SetPixel( oindex, sff );//B
-        this->finitediffimages[4]->SetPixel( oindex, smm );//C
-        }
+      buffers[0][offset] = it.Get() - fixedMean;
+      buffers[1][offset] = moving->GetPixel( index ) - movingMean;
+      buffers[2][offset] = sfm;//A
+      buffers[3][offset] = sff;//B
+      buffers[4][offset] = smm;//C
+      }
+    return;
+    }
 
-      // Increment the iterator and check to see if we're at the end of the
-      // line.  If so, go to the next line.  Otherwise, add the
-      // the values for the next hyperplane.
-      ++outIter;
+  // running box sum along one axis, accumulated in double per line
+  const unsigned int axis = pass;
+  const long radius = this->GetRadius()[axis];
+  const long length = region.GetSize()[axis];
+  const OffsetValueType stride = this->finitediffimages[0]->GetOffsetTable()[axis];
+  std::vector<double> line( length );
 
-      if( !outIter.IsAtEndOfLine() )
+  ImageLinearConstIteratorWithIndex<MetricImageType> lineIt( this->finitediffimages[0], region );
+  lineIt.SetDirection( axis );
+  for( lineIt.GoToBegin(); !lineIt.IsAtEnd(); lineIt.NextLine() )
+    {
+    const OffsetValueType first = this->finitediffimages[0]->ComputeOffset( lineIt.GetIndex() );
+    for( unsigned int k = 0; k < nsums; k++ )
+      {
+      float *value = buffers[k] + first;
+      for( long i = 0; i < length; i++ )
         {
-        hoodIt.SetLocation( outIter.GetIndex() );
-
-        suma2 = 0.0;
-        sumb2 = 0.0;
-        suma = 0.0;
-        sumb = 0.0;
-        sumab = 0.0;
-        count = 0.0;
+        line[i] = value[i*stride];
+        }
 
-        for( unsigned int indct = 2*r[0]; indct < hoodlen; indct += ( 2*r[0] + 1 ) )
+      double sum = 0;
+      for( long i = 0; i < radius && i < length; i++ )
+        {
+        sum += line[i];
+        }
+      for( long i = 0; i < length; i++ )
+        {
+        if ( i + radius < length )
           {
-          bool isInBounds = true;
-          hoodIt.GetPixel( indct, isInBounds );
-          IndexType index = hoodIt.GetIndex( indct );
-
-          if ( !isInBounds || ( this->m_FixedImageMask &&
-            this->m_FixedImageMask->GetPixel( index ) < 0.25 ) )
-            {
-            continue;
-            }
-
-          float a = this->GetFixedImage()->GetPixel( index );
-          float b = this->GetMovingImage()->GetPixel( index );
-
-          suma2 += a*a;
-          sumb2 += b*b;
-          suma += a;
-          sumb += b;
-          sumab += a*b;
-          count += 1.0;
+          sum += line[i + radius];
           }
-
-        Qsuma2.push_back( suma2 );
-        Qsumb2.push_back( sumb2 );
-        Qsuma.push_back( suma );
-        Qsumb.push_back( sumb );
-        Qsumab.push_back( sumab );
-        Qcount.push_back( count );
+        if ( i - radius - 1 >= 0 )
+          {
+          sum -= line[i - radius - 1];
+          }
+        value[i*stride] = static_cast<float>( sum );
         }
-
-      Qsuma2.pop_front();
-      Qsumb2.pop_front();
-      Qsuma.pop_front();
-      Qsumb.pop_front();
-      Qsumab.pop_front();
-      Qcount.pop_front();
       }
-
-    outIter.NextLine();
     }
-
-  //m_FixedImageGradientCalculator->SetInputImage(finitediffimages[0]);
-
-  m_MaxMag=0.0;
-  m_MinMag=9.e9;
-  m_AvgMag=0.0;
-  m_Iteration++;
-
 }
 
 
@@ -341,6 +341,22 @@ private:
   CrossCorrelationRegistrationFunction(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  /** Passes of the local sum computation:  0 .. ImageDimension-1 are
+   * running box sums along that axis, the others load the products and
+   * turn the sums into the centred values and sfm, sff, smm. */
+  enum { LoadLocalSums = ImageDimension, FinalizeLocalSums = ImageDimension + 1 };
+
+  struct LocalSumsThreadStruct
+    {
+    Self         *Function;
+    unsigned int Pass;
+    };
+
+  static ITK_THREAD_RETURN_TYPE LocalSumsThreaderCallback( void *arg );
+
+  void RunLocalSumsPass( unsigned int pass );
+  void ThreadedLocalSums( unsigned int pass, const typename MetricImageType::RegionType & region );
+
   /** Cache fixed image information. */
   typename TFixedImage::SpacingType                  m_FixedImageSpacing;
   typename TFixedImage::PointType                  m_FixedImageOrigin;
@@ -372,6 +388,7 @@ private:
 
 
   MetricImagePointer               finitediffimages[5];
+  MetricImagePointer               m_LocalCount;
   BinaryImagePointer               binaryimage;
 
 
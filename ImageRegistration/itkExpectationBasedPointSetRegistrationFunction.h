@@ -35,6 +35,8 @@
 #include "itkInterpolateImageFunction.h"
 #include "itkLinearInterpolateImageFunction.h"
 #include "itkCentralDifferenceImageFunction.h"
+#include "itkMultiThreader.h"
+#include <vector>
 
 namespace itk {
 
@@ -176,7 +178,20 @@ const
   /** Release memory for global data structure. */
   virtual void ReleaseGlobalDataPointer( void *GlobalData ) const;
 
+  /** Sinkhorn-normalized expectation correspondence over the full N x M
+   * matrix of Gaussian weights between same-label points.  It is the
+   * reference for SparseExpectationLandmarkField. */
   void ExpectationLandmarkField(float weight, bool whichdirection);
+
+  /** Same field as ExpectationLandmarkField, but each point is only
+   * matched to its KNeighborhood nearest points of the same label that lie
+   * within EuclideanDistanceThreshold, or to the nearest one if none does.
+   * The candidates come from kd-trees and are kept in compressed rows, and
+   * the Sinkhorn normalization runs over them in parallel, so time and
+   * memory grow with the number of points times KNeighborhood.  With
+   * KNeighborhood at least the size of each label set and no threshold the
+   * result is the dense one. */
+  void SparseExpectationLandmarkField(float weight, bool whichdirection);
   void FastExpectationLandmarkField(float weight, bool whichdirection, long whichlabel, bool dobsp);
 
   /** Set the object's state before each iteration. */
@@ -202,10 +217,9 @@ const
     { return m_RMSChange; }
 
 
-  /** Set/Get the threshold below which the absolute difference of
-   * intensity yields a match. When the intensities match between a
-   * moving and fixed image pixel, the update vector (for that
-   * iteration) will be the zero vector. Default is 0.001. */
+  /** Set/Get the Euclidean distance threshold, in voxels, beyond which
+   * SparseExpectationLandmarkField drops candidate matches.  Zero or less
+   * means no limit.  Default is 0.01. */
   virtual void SetEuclideanDistanceThreshold(double);
   virtual double GetEuclideanDistanceThreshold() const;
 
@@ -219,6 +233,18 @@ const
 
   void SetUseSymmetricMatching(unsigned int b) { this->m_UseSymmetricMatching=b; }
 
+  /** Match the point sets with the Sinkhorn-normalized correspondence of
+   * SparseExpectationLandmarkField instead of the per-label soft nearest
+   * neighbours of FastExpectationLandmarkField. */
+  void SetUseSinkhornMatching(bool b) { this->m_UseSinkhornMatching=b; }
+  bool GetUseSinkhornMatching() { return this->m_UseSinkhornMatching; }
+
+  /** Match with the dense ExpectationLandmarkField instead.  Its memory
+   * grows with the product of the point set sizes;  it is meant as a
+   * check of the sparse matching on small point sets. */
+  void SetUseDenseSinkhornMatching(bool b) { this->m_UseDenseSinkhornMatching=b; }
+  bool GetUseDenseSinkhornMatching() { return this->m_UseDenseSinkhornMatching; }
+
 protected:
   ExpectationBasedPointSetRegistrationFunction();
   ~ExpectationBasedPointSetRegistrationFunction() {}
@@ -243,6 +269,48 @@ private:
   ExpectationBasedPointSetRegistrationFunction(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  enum { SinkhornNeighborPass, SinkhornColumnPass, SinkhornRowPass };
+
+  /** The sparse correspondence of one direction.  Rows are the points that
+   * get a force, columns the points they are matched to;  coordinates are
+   * divided by the spacing so that kd-tree distances are the ones used in
+   * the Gaussian weights. */
+  struct SinkhornMatchingStruct
+    {
+    Self                                      *Function;
+    unsigned int                              Pass;
+    double                                    Sigma;
+    unsigned int                              KNeighbors;
+    unsigned long                             NumberOfRows;
+    unsigned long                             NumberOfColumns;
+    std::vector<MeasurementVectorType>        RowPoints;
+    std::vector<char>                         RowInside;
+    std::vector<int>                          RowLabel;
+    std::vector<ImagePointType>               ColumnPoints;
+    std::vector<typename SampleType::Pointer> LabelSamples;
+    std::vector< std::vector<unsigned long> > LabelColumns;
+
+    /** Compressed rows of candidate matches and their weights. */
+    std::vector<unsigned long>                RowStart;
+    std::vector<unsigned long>                ColumnIndex;
+    std::vector<double>                       Values;
+    std::vector<double>                       ColumnTotal;
+    std::vector<ImagePointType>               Matched;
+
+    /** Per-thread pieces, combined in thread order. */
+    std::vector< std::vector<unsigned long> > ThreadRowCounts;
+    std::vector< std::vector<unsigned long> > ThreadColumnIndex;
+    std::vector< std::vector<double> >        ThreadValues;
+    std::vector< std::vector<double> >        ThreadColumnTotal;
+    };
+
+  static ITK_THREAD_RETURN_TYPE SinkhornThreaderCallback( void *arg );
+
+  void RunSinkhornPass( SinkhornMatchingStruct & str, unsigned int pass );
+
+  void ThreadedSinkhornPass( SinkhornMatchingStruct & str, unsigned long firstRow,
+                             unsigned long lastRow, ThreadIdType threadId );
+
   /** Cache fixed image information. */
   SpacingType                     m_FixedImageSpacing;
   ImagePointType                       m_FixedImageOrigin;
@@ -297,6 +365,8 @@ private:
   bool                                                       m_Normalize;
   LabelSetType                                    m_LabelSet;
   unsigned int  m_UseSymmetricMatching;
+  bool          m_UseSinkhornMatching;
+  bool          m_UseDenseSinkhornMatching;
 
 
 
@@ -24,6 +24,8 @@
 
 #include "itkBSplineScatteredDataPointSetToImageFilter.h"
 #include "itkPointSet.h"
+#include "itkMultiThreader.h"
+#include <map>
 
 namespace itk {
 
@@ -69,6 +71,8 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
   this->m_DerivativeMovingField=NULL;
   this->m_IsPointSetMetric=true;
   this->m_UseSymmetricMatching=100000;
+  this->m_UseSinkhornMatching=false;
+  this->m_UseDenseSinkhornMatching=false;
   this->m_Iterations=0;
 
 }
@@ -153,11 +157,7 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
 
   float inweight=weight;
   this->m_LandmarkEnergy=0.0;
-  float max=0;
 
-  unsigned long bestindex=0;
-
-  std::cout << " sz1 " << sz1 << " sz2 "<<sz2 <<std::endl;
   // if whichdirection is true, then the fixed direction, else moving
   for (unsigned long ii=0; ii<sz1; ii++)
     {
@@ -169,7 +169,6 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
       else this->m_MovingPointSet->GetPointData(ii,&fixedlabel);
 
 
-      float min = 1.e9;
       ImagePointType fpt;
       IndexType oindex;
       for (int j=0; j<ImageDimension; j++) {  fpt[j]=fixedpoint[j];  fixedlms(ii,j)=fpt[j];  }
@@ -189,36 +188,28 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
       ImagePointType mpt;
       for (int j=0; j<ImageDimension; j++) { mpt[j]=movingpoint[j]; movinglms(jj,j)=movingpoint[j]; }
 
-      if (ii == sz1-2 && jj == sz2-2) std::cout << " fpt " << fpt << " mpt " << mpt << std::endl;
-
-
       this->GetMovingImage()->TransformPhysicalPointToIndex(mpt,movingindex);
       double prob=0;
       if (convok)
         {
         float mag=0.0;
-        VectorType force;
         for (int j=0; j<ImageDimension; j++)
           {
           distance[j]=movingpoint[j]-fixedpoint[j];
           mag+=distance[j]/spacing[j]*distance[j]/spacing[j];
-          force[j]=distance[j]*inweight;
           }
         float sigma=this->m_FixedPointSetSigma;
         if (!whichdirection) sigma=this->m_MovingPointSetSigma;
-        double prob=1.0/sqrt(3.14186*2.0*sigma*sigma)*exp(-1.0*mag/(2.0*sigma*sigma));
-        force=force*prob;
+        prob=1.0/sqrt(3.14186*2.0*sigma*sigma)*exp(-1.0*mag/(2.0*sigma*sigma));
         PointDataType movinglabel=0;
         if (whichdirection) this->m_MovingPointSet->GetPointData(jj,&movinglabel);
         else this->m_FixedPointSet->GetPointData(jj,&movinglabel);
 //        if (ii == 2 && jj==2) std::cout << "prob " << prob << " sigma " << sigma << "  " << mag << " fl " << fixedlabel << " ml " << movinglabel << std::endl;
         if ( fixedlabel != movinglabel) prob=0;
 // || fixedlabel !=4) prob=0;
-        mag=sqrt(mag);
         }
       EucDist(ii,jj)=prob;
     }
-      if (min < 1.e5) this->m_LandmarkEnergy+=min;
     }
 
   MatrixType sinkhorn=EucDist;
@@ -227,7 +218,7 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
     {
     for (unsigned int jj=0; jj<sz2; jj++)
       {
-      float total=0;
+      double total=0;
       for (unsigned int ii=0; ii<sz1; ii++)
     {
     total+=sinkhorn(ii,jj);
@@ -240,7 +231,7 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
       }
     for (unsigned int ii=0; ii<sz1; ii++)
       {
-      float total=0;
+      double total=0;
       for (unsigned int jj=0; jj<sz2; jj++)
     {
     total+=sinkhorn(ii,jj);
@@ -308,7 +299,6 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
 */
       if (mag > maxerr) maxerr=mag;
       energy+=mag;
-      std::cout <<" ii " << ii << " force " << force << " mag " << sqrt(mag) << " mpt " << mpt << " fpt " << fixedpoint <<  " nrg " << energy /(float)ii << std::endl;
       lmField->SetPixel(fixedindex,force+lmField->GetPixel(fixedindex));
       }
 //    lmField->SetPixel(fixedindex,sforce);
@@ -321,6 +311,300 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
 
 
 
+/*
+ * Sparse version of ExpectationLandmarkField
+ */
+template <class TFixedImage, class TMovingImage, class TDisplacementField, class TPointSet>
+void
+ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField,TPointSet>
+::SparseExpectationLandmarkField(float weight, bool whichdirection)
+{
+  SpacingType spacing = this->GetFixedImage()->GetSpacing();
+
+  // if whichdirection is true, then the fixed direction, else moving
+  SinkhornMatchingStruct str;
+  str.Function = this;
+  str.Sigma = whichdirection ? this->m_FixedPointSetSigma : this->m_MovingPointSetSigma;
+  str.NumberOfRows = whichdirection ? this->m_FixedPointSet->GetNumberOfPoints()
+    : this->m_MovingPointSet->GetNumberOfPoints();
+  str.NumberOfColumns = whichdirection ? this->m_MovingPointSet->GetNumberOfPoints()
+    : this->m_FixedPointSet->GetNumberOfPoints();
+  if ( str.NumberOfRows <= 0 || str.NumberOfColumns <= 0 )
+    {
+    return;
+    }
+
+  // the candidate matches of a point are the points of the other set with
+  // the same label, one sample per label
+  std::map<PointDataType,int> labelSlots;
+  str.ColumnPoints.resize( str.NumberOfColumns );
+  for ( unsigned long jj = 0; jj < str.NumberOfColumns; jj++ )
+    {
+    PointType movingpoint;
+    PointDataType movinglabel=0;
+    if (whichdirection) this->m_MovingPointSet->GetPoint(jj,&movingpoint);
+    else this->m_FixedPointSet->GetPoint(jj,&movingpoint);
+    if (whichdirection) this->m_MovingPointSet->GetPointData(jj,&movinglabel);
+    else this->m_FixedPointSet->GetPointData(jj,&movinglabel);
+
+    MeasurementVectorType mv;
+    for (int j=0; j<ImageDimension; j++)
+      {
+      str.ColumnPoints[jj][j]=movingpoint[j];
+      mv[j]=movingpoint[j]/spacing[j];
+      }
+    typename std::map<PointDataType,int>::iterator slot = labelSlots.find( movinglabel );
+    if ( slot == labelSlots.end() )
+      {
+      slot = labelSlots.insert( std::make_pair( movinglabel, static_cast<int>( str.LabelSamples.size() ) ) ).first;
+      typename SampleType::Pointer sample = SampleType::New();
+      sample->SetMeasurementVectorSize( MeasurementDimension );
+      str.LabelSamples.push_back( sample );
+      str.LabelColumns.push_back( std::vector<unsigned long>() );
+      }
+    str.LabelSamples[slot->second]->PushBack( mv );
+    str.LabelColumns[slot->second].push_back( jj );
+    }
+
+  str.RowPoints.resize( str.NumberOfRows );
+  str.RowInside.resize( str.NumberOfRows );
+  str.RowLabel.resize( str.NumberOfRows );
+  std::vector<ImagePointType> rowPhysicalPoints( str.NumberOfRows );
+  std::vector<IndexType> rowIndices( str.NumberOfRows );
+  for ( unsigned long ii = 0; ii < str.NumberOfRows; ii++ )
+    {
+    PointType fixedpoint;
+    PointDataType fixedlabel=0;
+    if (whichdirection) this->m_FixedPointSet->GetPoint(ii,&fixedpoint);
+    else this->m_MovingPointSet->GetPoint(ii,&fixedpoint);
+    if (whichdirection) this->m_FixedPointSet->GetPointData(ii,&fixedlabel);
+    else this->m_MovingPointSet->GetPointData(ii,&fixedlabel);
+
+    for (int j=0; j<ImageDimension; j++)
+      {
+      rowPhysicalPoints[ii][j]=fixedpoint[j];
+      str.RowPoints[ii][j]=fixedpoint[j]/spacing[j];
+      }
+    str.RowInside[ii] = this->GetFixedImage()->TransformPhysicalPointToIndex(rowPhysicalPoints[ii],rowIndices[ii]);
+    typename std::map<PointDataType,int>::const_iterator slot = labelSlots.find( fixedlabel );
+    str.RowLabel[ii] = ( slot == labelSlots.end() ) ? -1 : slot->second;
+    }
+
+  str.KNeighbors = this->m_KNeighborhood;
+  if ( str.KNeighbors < 1 ) str.KNeighbors = 1;
+
+  this->RunSinkhornPass( str, SinkhornNeighborPass );
+
+  // stitch the rows of the threads together
+  str.RowStart.assign( str.NumberOfRows + 1, 0 );
+  unsigned long row = 0;
+  for ( unsigned int t = 0; t < str.ThreadRowCounts.size(); t++ )
+    {
+    for ( unsigned long r = 0; r < str.ThreadRowCounts[t].size(); r++, row++ )
+      {
+      str.RowStart[row + 1] = str.RowStart[row] + str.ThreadRowCounts[t][r];
+      }
+    str.ColumnIndex.insert( str.ColumnIndex.end(), str.ThreadColumnIndex[t].begin(), str.ThreadColumnIndex[t].end() );
+    str.Values.insert( str.Values.end(), str.ThreadValues[t].begin(), str.ThreadValues[t].end() );
+    std::vector<unsigned long>().swap( str.ThreadColumnIndex[t] );
+    std::vector<double>().swap( str.ThreadValues[t] );
+    }
+
+  // Sinkhorn normalization, one pass over the columns then the rows as in
+  // the dense version
+  this->RunSinkhornPass( str, SinkhornColumnPass );
+  str.ColumnTotal.assign( str.NumberOfColumns, 0 );
+  for ( unsigned int t = 0; t < str.ThreadColumnTotal.size(); t++ )
+    {
+    for ( unsigned long jj = 0; jj < str.ThreadColumnTotal[t].size(); jj++ )
+      {
+      str.ColumnTotal[jj] += str.ThreadColumnTotal[t][jj];
+      }
+    std::vector<double>().swap( str.ThreadColumnTotal[t] );
+    }
+  for ( unsigned long jj = 0; jj < str.NumberOfColumns; jj++ )
+    {
+    if ( str.ColumnTotal[jj] <= 0 ) str.ColumnTotal[jj] = 1;
+    }
+  str.Matched.resize( str.NumberOfRows );
+  this->RunSinkhornPass( str, SinkhornRowPass );
+
+  // forces are added in point order since points can share a voxel
+  DisplacementFieldTypePointer lmField=this->m_DerivativeFixedField;
+  if (!whichdirection)  lmField=this->m_DerivativeMovingField;
+  float inweight=weight;
+  float energy=0;
+  for (unsigned long ii=0; ii<str.NumberOfRows; ii++)
+    {
+    if ( !str.RowInside[ii] ) continue;
+    VectorType distance;
+    VectorType force;
+    float mag=0.0;
+    for (int j=0; j<ImageDimension; j++)
+      {
+      distance[j]=str.Matched[ii][j]-rowPhysicalPoints[ii][j];
+      mag+=distance[j]/spacing[j]*distance[j]/spacing[j];
+      force[j]=distance[j]*inweight;
+      }
+    double prob=1.0/sqrt(3.14186*2.0*str.Sigma*str.Sigma)*exp(-1.0*mag/(2.0*str.Sigma*str.Sigma));
+    force=force*prob;
+    energy+=mag;
+    lmField->SetPixel(rowIndices[ii],force+lmField->GetPixel(rowIndices[ii]));
+    }
+  this->m_LandmarkEnergy=energy/(float)str.NumberOfRows;
+  this->m_Energy=this->m_LandmarkEnergy;
+}
+
+
+template <class TFixedImage, class TMovingImage, class TDisplacementField, class TPointSet>
+void
+ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField,TPointSet>
+::RunSinkhornPass( SinkhornMatchingStruct & str, unsigned int pass )
+{
+  str.Pass = pass;
+  typename MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  if ( pass == SinkhornNeighborPass )
+    {
+    str.ThreadRowCounts.assign( threader->GetNumberOfThreads(), std::vector<unsigned long>() );
+    str.ThreadColumnIndex.assign( threader->GetNumberOfThreads(), std::vector<unsigned long>() );
+    str.ThreadValues.assign( threader->GetNumberOfThreads(), std::vector<double>() );
+    }
+  if ( pass == SinkhornColumnPass )
+    {
+    str.ThreadColumnTotal.assign( threader->GetNumberOfThreads(), std::vector<double>() );
+    }
+  threader->SetSingleMethod( Self::SinkhornThreaderCallback, &str );
+  threader->SingleMethodExecute();
+}
+
+
+template <class TFixedImage, class TMovingImage, class TDisplacementField, class TPointSet>
+ITK_THREAD_RETURN_TYPE
+ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField,TPointSet>
+::SinkhornThreaderCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  SinkhornMatchingStruct *str = static_cast<SinkhornMatchingStruct *>( info->UserData );
+  ThreadIdType threadId = info->ThreadID;
+  ThreadIdType threadCount = info->NumberOfThreads;
+
+  // one block of consecutive rows per thread
+  unsigned long range = str->NumberOfRows;
+  unsigned long valuesPerThread = ( range + threadCount - 1 ) / threadCount;
+  if ( valuesPerThread == 0 || threadId*valuesPerThread >= range )
+    {
+    return ITK_THREAD_RETURN_VALUE;
+    }
+  unsigned long firstRow = threadId*valuesPerThread;
+  unsigned long lastRow = vnl_math_min( range, firstRow + valuesPerThread );
+
+  str->Function->ThreadedSinkhornPass( *str, firstRow, lastRow, threadId );
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template <class TFixedImage, class TMovingImage, class TDisplacementField, class TPointSet>
+void
+ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField,TPointSet>
+::ThreadedSinkhornPass( SinkhornMatchingStruct & str, unsigned long firstRow,
+                        unsigned long lastRow, ThreadIdType threadId )
+{
+  if ( str.Pass == SinkhornNeighborPass )
+    {
+    // The kd-tree search keeps its state in the tree, so every thread
+    // builds its own trees over the shared samples.
+    std::vector<typename TreeGeneratorType::Pointer> trees( str.LabelSamples.size() );
+    std::vector<unsigned long> & rowCounts = str.ThreadRowCounts[threadId];
+    std::vector<unsigned long> & columnIndex = str.ThreadColumnIndex[threadId];
+    std::vector<double> & values = str.ThreadValues[threadId];
+    rowCounts.assign( lastRow - firstRow, 0 );
+
+    const double threshold = this->m_EuclideanDistanceThreshold;
+    const double sigma = str.Sigma;
+    NeighborhoodIdentifierType neighbors;
+    std::vector<float> mags;
+    for ( unsigned long ii = firstRow; ii < lastRow; ii++ )
+      {
+      const int label = str.RowLabel[ii];
+      if ( !str.RowInside[ii] || label < 0 )
+        {
+        continue;
+        }
+      if ( !trees[label] )
+        {
+        trees[label] = TreeGeneratorType::New();
+        trees[label]->SetSample( str.LabelSamples[label] );
+        trees[label]->SetBucketSize( 4 );
+        trees[label]->Update();
+        }
+      const std::vector<unsigned long> & labelColumns = str.LabelColumns[label];
+      unsigned int kNeighbors = vnl_math_min( static_cast<unsigned long>( str.KNeighbors ),
+        static_cast<unsigned long>( labelColumns.size() ) );
+      trees[label]->GetOutput()->Search( str.RowPoints[ii], kNeighbors, neighbors );
+
+      // candidates beyond the distance threshold are dropped, but the
+      // nearest one is always kept so that no point is left unmatched
+      mags.resize( neighbors.size() );
+      unsigned int nearest = 0;
+      for ( unsigned int dd = 0; dd < neighbors.size(); dd++ )
+        {
+        const MeasurementVectorType & npt = str.LabelSamples[label]->GetMeasurementVector( neighbors[dd] );
+        float mag=0;
+        for (unsigned int qq=0; qq<ImageDimension; qq++)
+          mag+=(str.RowPoints[ii][qq]-npt[qq])*(str.RowPoints[ii][qq]-npt[qq]);
+        mags[dd]=mag;
+        if ( mag < mags[nearest] ) nearest=dd;
+        }
+
+      const unsigned long start = columnIndex.size();
+      for ( unsigned int dd = 0; dd < neighbors.size(); dd++ )
+        {
+        const float mag=mags[dd];
+        if ( threshold > 0 && dd != nearest && mag > threshold*threshold ) continue;
+        double prob=1.0/sqrt(3.14186*2.0*sigma*sigma)*exp(-1.0*mag/(2.0*sigma*sigma));
+        columnIndex.push_back( labelColumns[neighbors[dd]] );
+        values.push_back( prob );
+        }
+      rowCounts[ii - firstRow] = columnIndex.size() - start;
+      }
+    }
+  else if ( str.Pass == SinkhornColumnPass )
+    {
+    std::vector<double> & columnTotal = str.ThreadColumnTotal[threadId];
+    columnTotal.assign( str.NumberOfColumns, 0 );
+    for ( unsigned long k = str.RowStart[firstRow]; k < str.RowStart[lastRow]; k++ )
+      {
+      columnTotal[str.ColumnIndex[k]] += str.Values[k];
+      }
+    }
+  else
+    {
+    // normalize the columns, then the row, and take the expected match
+    for ( unsigned long ii = firstRow; ii < lastRow; ii++ )
+      {
+      double total = 0;
+      for ( unsigned long k = str.RowStart[ii]; k < str.RowStart[ii + 1]; k++ )
+        {
+        str.Values[k] /= str.ColumnTotal[str.ColumnIndex[k]];
+        total += str.Values[k];
+        }
+      if ( total <= 0 ) total = 1;
+      str.Matched[ii].Fill( 0 );
+      for ( unsigned long k = str.RowStart[ii]; k < str.RowStart[ii + 1]; k++ )
+        {
+        str.Values[k] /= total;
+        const ImagePointType & mpt = str.ColumnPoints[str.ColumnIndex[k]];
+        for (int j=0; j<ImageDimension; j++)
+          {
+          str.Matched[ii][j] += str.Values[k] * mpt[j];
+          }
+        }
+      }
+    }
+}
+
+
 /*
  * Set the function state values before each iteration
  */
@@ -408,6 +692,19 @@ ExpectationBasedPointSetRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
   this->m_bweights->Initialize();
   this->m_bcount=0;
 
+  if ( this->m_UseDenseSinkhornMatching )
+    {
+    this->ExpectationLandmarkField(1.0,true);
+    this->ExpectationLandmarkField(1.0,false);
+    return;
+    }
+  if ( this->m_UseSinkhornMatching )
+    {
+    this->SparseExpectationLandmarkField(1.0,true);
+    this->SparseExpectationLandmarkField(1.0,false);
+    return;
+    }
+
   unsigned int lct=0;
   typename LabelSetType::const_iterator it;
   for ( it = this->m_LabelSet.begin(); it != this->m_LabelSet.end(); ++it )
@@ -21,6 +21,9 @@
 #include "itkPointSetToPointSetMetric.h"
 
 #include "itkIdentityTransform.h"
+#include "itkJensenHavrdaCharvatTsallisPointSetMetric.h"
+
+#include <map>
 
 namespace itk {
 
@@ -72,6 +75,8 @@ public:
   typedef IdentityTransform<RealType, PointDimension>   DefaultTransformType;
 
   typedef std::vector<PixelType>                        LabelSetType;
+  typedef JensenHavrdaCharvatTsallisPointSetMetric
+    <PointSetType>                                      LabelMetricType;
 
   /**
    * Public function definitions
@@ -171,6 +176,10 @@ public:
   itkSetMacro( MovingKernelSigma, RealType );
   itkGetConstMacro( MovingKernelSigma, RealType );
 
+  /** See JensenHavrdaCharvatTsallisPointSetMetric. */
+  itkSetMacro( KdTreeRebuildTolerance, RealType );
+  itkGetConstMacro( KdTreeRebuildTolerance, RealType );
+
   void SetFixedLabelSet( LabelSetType labels )
     {
     typename LabelSetType::const_iterator iter;
@@ -209,6 +218,9 @@ private:
   JensenHavrdaCharvatTsallisLabeledPointSetMetric(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  typename LabelMetricType::Pointer GetLabelMetric( PixelType label,
+    std::vector<long> & fixedIndices, std::vector<long> & movingIndices ) const;
+
   bool                                     m_UseRegularizationTerm;
   bool                                     m_UseInputAsSamples;
   bool                                     m_UseAnisotropicCovariances;
@@ -227,12 +239,16 @@ private:
   unsigned long                            m_NumberOfFixedSamples;
 
   RealType                                 m_Alpha;
+  RealType                                 m_KdTreeRebuildTolerance;
 
   TransformPointer                         m_Transform;
 
   LabelSetType                             m_FixedLabelSet;
   LabelSetType                             m_MovingLabelSet;
 
+  mutable std::map<PixelType, typename LabelMetricType::Pointer>
+                                           m_LabelMetrics;
+
 };
 
 
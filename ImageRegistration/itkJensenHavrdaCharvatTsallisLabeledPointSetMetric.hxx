@@ -20,7 +20,6 @@
 
 #include "itkJensenHavrdaCharvatTsallisLabeledPointSetMetric.h"
 
-#include "itkJensenHavrdaCharvatTsallisPointSetMetric.h"
 namespace itk {
 
 template <class TPointSet>
@@ -45,6 +44,7 @@ JensenHavrdaCharvatTsallisLabeledPointSetMetric<TPointSet>
 
   this->m_Alpha = 2.0;
   this->m_UseWithRespectToTheMovingPointSet = true;
+  this->m_KdTreeRebuildTolerance = 0.0;
 
   typename DefaultTransformType::Pointer transform
     = DefaultTransformType::New();
@@ -144,82 +144,10 @@ JensenHavrdaCharvatTsallisLabeledPointSetMetric<TPointSet>
       continue;
       }
 
-    /**
-     * Collect all the fixed and moving points with the currentLabel
-     */
-    typename PointSetType::Pointer fixedLabelPoints
-      = PointSetType::New();
-    fixedLabelPoints->Initialize();
-    unsigned long fixedCount = 0;
-
-    typename PointSetType::PointsContainerConstIterator ItF =
-      this->m_FixedPointSet->GetPoints()->Begin();
-    typename PointSetType::PointDataContainerIterator ItFD =
-      this->m_FixedPointSet->GetPointData()->Begin();
-
-    while ( ItF != this->m_FixedPointSet->GetPoints()->End() )
-      {
-      if ( ItFD.Value() == currentLabel )
-        {
-        fixedLabelPoints->SetPoint( fixedCount++, ItF.Value() );
-        }
-      ++ItF;
-      ++ItFD;
-      }
-
-    typename PointSetType::Pointer movingLabelPoints
-      = PointSetType::New();
-    movingLabelPoints->Initialize();
-    unsigned long movingCount = 0;
-
-    typename PointSetType::PointsContainerConstIterator ItM =
-      this->m_MovingPointSet->GetPoints()->Begin();
-    typename PointSetType::PointDataContainerIterator ItMD =
-      this->m_MovingPointSet->GetPointData()->Begin();
-
-    while ( ItM != this->m_MovingPointSet->GetPoints()->End() )
-      {
-      if ( ItMD.Value() == currentLabel )
-        {
-        movingLabelPoints->SetPoint( movingCount++, ItM.Value() );
-        }
-      ++ItM;
-      ++ItMD;
-      }
-
-    /**
-     * Invoke the single label JensenTsallis measure
-     */
-    typedef JensenHavrdaCharvatTsallisPointSetMetric
-      <PointSetType> MetricType;
-    typename MetricType::Pointer metric = MetricType::New();
-
-    metric->SetFixedPointSet( fixedLabelPoints );
-    metric->SetNumberOfFixedSamples( this->m_NumberOfFixedSamples );
-    metric->SetFixedPointSetSigma( this->m_FixedPointSetSigma );
-    metric->SetFixedKernelSigma( this->m_FixedKernelSigma );
-    metric->SetFixedCovarianceKNeighborhood(
-      this->m_FixedCovarianceKNeighborhood );
-    metric->SetFixedEvaluationKNeighborhood(
-      this->m_FixedEvaluationKNeighborhood );
-
-    metric->SetMovingPointSet( movingLabelPoints );
-    metric->SetNumberOfMovingSamples( this->m_NumberOfMovingSamples );
-    metric->SetMovingPointSetSigma( this->m_MovingPointSetSigma );
-    metric->SetMovingKernelSigma( this->m_MovingKernelSigma );
-    metric->SetMovingCovarianceKNeighborhood(
-      this->m_MovingCovarianceKNeighborhood );
-    metric->SetMovingEvaluationKNeighborhood(
-      this->m_MovingEvaluationKNeighborhood );
-
-    metric->SetUseRegularizationTerm( this->m_UseRegularizationTerm );
-    metric->SetUseInputAsSamples( this->m_UseInputAsSamples );
-    metric->SetUseAnisotropicCovariances( this->m_UseAnisotropicCovariances );
-    metric->SetUseWithRespectToTheMovingPointSet(
-      this->m_UseWithRespectToTheMovingPointSet );
-    metric->SetAlpha( this->m_Alpha );
-
-    metric->Initialize();
+    std::vector<long> fixedIndices;
+    std::vector<long> movingIndices;
+    typename LabelMetricType::Pointer metric
+      = this->GetLabelMetric( currentLabel, fixedIndices, movingIndices );
 
     MeasureType value = metric->GetValue( parameters );
     measure[0] += value[0];
@@ -259,89 +187,10 @@ JensenHavrdaCharvatTsallisLabeledPointSetMetric<TPointSet>
       continue;
       }
 
-    /**
-     * Collect all the fixed and moving points with the currentLabel
-     */
-    typename PointSetType::Pointer fixedLabelPoints
-      = PointSetType::New();
-    fixedLabelPoints->Initialize();
-    unsigned long fixedCount = 0;
-
     std::vector<long> fixedIndices;
-    fixedIndices.clear();
-
-    typename PointSetType::PointsContainerConstIterator ItF =
-      this->m_FixedPointSet->GetPoints()->Begin();
-    typename PointSetType::PointDataContainerIterator ItFD =
-      this->m_FixedPointSet->GetPointData()->Begin();
-
-    while ( ItF != this->m_FixedPointSet->GetPoints()->End() )
-      {
-      if ( ItFD.Value() == currentLabel )
-        {
-        fixedLabelPoints->SetPoint( fixedCount++, ItF.Value() );
-        fixedIndices.push_back( ItF.Index() );
-        }
-      ++ItF;
-      ++ItFD;
-      }
-
-    typename PointSetType::Pointer movingLabelPoints
-      = PointSetType::New();
-    movingLabelPoints->Initialize();
-    unsigned long movingCount = 0;
-
     std::vector<long> movingIndices;
-    movingIndices.clear();
-
-    typename PointSetType::PointsContainerConstIterator ItM =
-      this->m_MovingPointSet->GetPoints()->Begin();
-    typename PointSetType::PointDataContainerIterator ItMD =
-      this->m_MovingPointSet->GetPointData()->Begin();
-
-    while ( ItM != this->m_MovingPointSet->GetPoints()->End() )
-      {
-      if ( ItMD.Value() == currentLabel )
-        {
-        movingLabelPoints->SetPoint( movingCount++, ItM.Value() );
-        movingIndices.push_back( ItM.Index() );
-        }
-      ++ItM;
-      ++ItMD;
-      }
-
-    /**
-     * Invoke the single label JensenTsallis measure
-     */
-    typedef JensenHavrdaCharvatTsallisPointSetMetric<PointSetType> MetricType;
-    typename MetricType::Pointer metric = MetricType::New();
-
-    metric->SetFixedPointSet( fixedLabelPoints );
-    metric->SetNumberOfFixedSamples( this->m_NumberOfFixedSamples );
-    metric->SetFixedPointSetSigma( this->m_FixedPointSetSigma );
-    metric->SetFixedKernelSigma( this->m_FixedKernelSigma );
-    metric->SetFixedCovarianceKNeighborhood(
-      this->m_FixedCovarianceKNeighborhood );
-    metric->SetFixedEvaluationKNeighborhood(
-      this->m_FixedEvaluationKNeighborhood );
-
-    metric->SetMovingPointSet( movingLabelPoints );
-    metric->SetNumberOfMovingSamples( this->m_NumberOfMovingSamples );
-    metric->SetMovingPointSetSigma( this->m_MovingPointSetSigma );
-    metric->SetMovingKernelSigma( this->m_MovingKernelSigma );
-    metric->SetMovingCovarianceKNeighborhood(
-      this->m_MovingCovarianceKNeighborhood );
-    metric->SetMovingEvaluationKNeighborhood(
-      this->m_MovingEvaluationKNeighborhood );
-
-    metric->SetUseRegularizationTerm( this->m_UseRegularizationTerm );
-    metric->SetUseInputAsSamples( this->m_UseInputAsSamples );
-    metric->SetUseAnisotropicCovariances( this->m_UseAnisotropicCovariances );
-    metric->SetUseWithRespectToTheMovingPointSet(
-      this->m_UseWithRespectToTheMovingPointSet );
-    metric->SetAlpha( this->m_Alpha );
-
-    metric->Initialize();
+    typename LabelMetricType::Pointer metric
+      = this->GetLabelMetric( currentLabel, fixedIndices, movingIndices );
 
     DerivativeType labelDerivative;
     metric->GetDerivative( parameters, labelDerivative );
@@ -422,89 +271,10 @@ JensenHavrdaCharvatTsallisLabeledPointSetMetric<TPointSet>
       continue;
       }
 
-    /**
-     * Collect all the fixed and moving points with the currentLabel
-     */
-    typename PointSetType::Pointer fixedLabelPoints
-      = PointSetType::New();
-    fixedLabelPoints->Initialize();
-    unsigned long fixedCount = 0;
-
     std::vector<long> fixedIndices;
-    fixedIndices.clear();
-
-    typename PointSetType::PointsContainerConstIterator ItF =
-      this->m_FixedPointSet->GetPoints()->Begin();
-    typename PointSetType::PointDataContainerIterator ItFD =
-      this->m_FixedPointSet->GetPointData()->Begin();
-
-    while ( ItF != this->m_FixedPointSet->GetPoints()->End() )
-      {
-      if ( ItFD.Value() == currentLabel )
-        {
-        fixedLabelPoints->SetPoint( fixedCount++, ItF.Value() );
-        fixedIndices.push_back( ItF.Index() );
-        }
-      ++ItF;
-      ++ItFD;
-      }
-
-    typename PointSetType::Pointer movingLabelPoints
-      = PointSetType::New();
-    movingLabelPoints->Initialize();
-    unsigned long movingCount = 0;
-
     std::vector<long> movingIndices;
-    movingIndices.clear();
-
-    typename PointSetType::PointsContainerConstIterator ItM =
-      this->m_MovingPointSet->GetPoints()->Begin();
-    typename PointSetType::PointDataContainerIterator ItMD =
-      this->m_MovingPointSet->GetPointData()->Begin();
-
-    while ( ItM != this->m_MovingPointSet->GetPoints()->End() )
-      {
-      if ( ItMD.Value() == currentLabel )
-        {
-        movingLabelPoints->SetPoint( movingCount++, ItM.Value() );
-        movingIndices.push_back( ItM.Index() );
-        }
-      ++ItM;
-      ++ItMD;
-      }
-
-    /**
-     * Invoke the single label JensenTsallis measure
-     */
-    typedef JensenHavrdaCharvatTsallisPointSetMetric<PointSetType> MetricType;
-    typename MetricType::Pointer metric = MetricType::New();
-
-    metric->SetFixedPointSet( fixedLabelPoints );
-    metric->SetNumberOfFixedSamples( this->m_NumberOfFixedSamples );
-    metric->SetFixedPointSetSigma( this->m_FixedPointSetSigma );
-    metric->SetFixedKernelSigma( this->m_FixedKernelSigma );
-    metric->SetFixedCovarianceKNeighborhood(
-      this->m_FixedCovarianceKNeighborhood );
-    metric->SetFixedEvaluationKNeighborhood(
-      this->m_FixedEvaluationKNeighborhood );
-
-    metric->SetMovingPointSet( movingLabelPoints );
-    metric->SetNumberOfMovingSamples( this->m_NumberOfMovingSamples );
-    metric->SetMovingPointSetSigma( this->m_MovingPointSetSigma );
-    metric->SetMovingKernelSigma( this->m_MovingKernelSigma );
-    metric->SetMovingCovarianceKNeighborhood(
-      this->m_MovingCovarianceKNeighborhood );
-    metric->SetMovingEvaluationKNeighborhood(
-      this->m_MovingEvaluationKNeighborhood );
-
-    metric->SetUseRegularizationTerm( this->m_UseRegularizationTerm );
-    metric->SetUseInputAsSamples( this->m_UseInputAsSamples );
-    metric->SetUseAnisotropicCovariances( this->m_UseAnisotropicCovariances );
-    metric->SetUseWithRespectToTheMovingPointSet(
-      this->m_UseWithRespectToTheMovingPointSet );
-    metric->SetAlpha( this->m_Alpha );
-
-    metric->Initialize();
+    typename LabelMetricType::Pointer metric
+      = this->GetLabelMetric( currentLabel, fixedIndices, movingIndices );
 
     DerivativeType labelDerivative;
     MeasureType labelValue;
@@ -555,6 +325,102 @@ JensenHavrdaCharvatTsallisLabeledPointSetMetric<TPointSet>
     }
 }
 
+/** Collect the points with the given label and set up its metric */
+template <class TPointSet>
+typename JensenHavrdaCharvatTsallisLabeledPointSetMetric<TPointSet>
+  ::LabelMetricType::Pointer
+JensenHavrdaCharvatTsallisLabeledPointSetMetric<TPointSet>
+::GetLabelMetric( PixelType currentLabel, std::vector<long> & fixedIndices,
+  std::vector<long> & movingIndices ) const
+{
+  typename PointSetType::Pointer fixedLabelPoints
+    = PointSetType::New();
+  fixedLabelPoints->Initialize();
+  unsigned long fixedCount = 0;
+
+  fixedIndices.clear();
+
+  typename PointSetType::PointsContainerConstIterator ItF =
+    this->m_FixedPointSet->GetPoints()->Begin();
+  typename PointSetType::PointDataContainerIterator ItFD =
+    this->m_FixedPointSet->GetPointData()->Begin();
+
+  while ( ItF != this->m_FixedPointSet->GetPoints()->End() )
+    {
+    if ( ItFD.Value() == currentLabel )
+      {
+      fixedLabelPoints->SetPoint( fixedCount++, ItF.Value() );
+      fixedIndices.push_back( ItF.Index() );
+      }
+    ++ItF;
+    ++ItFD;
+    }
+
+  typename PointSetType::Pointer movingLabelPoints
+    = PointSetType::New();
+  movingLabelPoints->Initialize();
+  unsigned long movingCount = 0;
+
+  movingIndices.clear();
+
+  typename PointSetType::PointsContainerConstIterator ItM =
+    this->m_MovingPointSet->GetPoints()->Begin();
+  typename PointSetType::PointDataContainerIterator ItMD =
+    this->m_MovingPointSet->GetPointData()->Begin();
+
+  while ( ItM != this->m_MovingPointSet->GetPoints()->End() )
+    {
+    if ( ItMD.Value() == currentLabel )
+      {
+      movingLabelPoints->SetPoint( movingCount++, ItM.Value() );
+      movingIndices.push_back( ItM.Index() );
+      }
+    ++ItM;
+    ++ItMD;
+    }
+
+  /**
+   * The single label metrics are kept so that their kd-trees can be
+   * reused while the points stay within the rebuild tolerance.
+   */
+  typename LabelMetricType::Pointer & metric
+    = this->m_LabelMetrics[currentLabel];
+  if ( !metric )
+    {
+    metric = LabelMetricType::New();
+    }
+
+  metric->SetFixedPointSet( fixedLabelPoints );
+  metric->SetNumberOfFixedSamples( this->m_NumberOfFixedSamples );
+  metric->SetFixedPointSetSigma( this->m_FixedPointSetSigma );
+  metric->SetFixedKernelSigma( this->m_FixedKernelSigma );
+  metric->SetFixedCovarianceKNeighborhood(
+    this->m_FixedCovarianceKNeighborhood );
+  metric->SetFixedEvaluationKNeighborhood(
+    this->m_FixedEvaluationKNeighborhood );
+
+  metric->SetMovingPointSet( movingLabelPoints );
+  metric->SetNumberOfMovingSamples( this->m_NumberOfMovingSamples );
+  metric->SetMovingPointSetSigma( this->m_MovingPointSetSigma );
+  metric->SetMovingKernelSigma( this->m_MovingKernelSigma );
+  metric->SetMovingCovarianceKNeighborhood(
+    this->m_MovingCovarianceKNeighborhood );
+  metric->SetMovingEvaluationKNeighborhood(
+    this->m_MovingEvaluationKNeighborhood );
+
+  metric->SetUseRegularizationTerm( this->m_UseRegularizationTerm );
+  metric->SetUseInputAsSamples( this->m_UseInputAsSamples );
+  metric->SetUseAnisotropicCovariances( this->m_UseAnisotropicCovariances );
+  metric->SetUseWithRespectToTheMovingPointSet(
+    this->m_UseWithRespectToTheMovingPointSet );
+  metric->SetAlpha( this->m_Alpha );
+  metric->SetKdTreeRebuildTolerance( this->m_KdTreeRebuildTolerance );
+
+  metric->Initialize();
+
+  return metric;
+}
+
 template <class TPointSet>
 void
 JensenHavrdaCharvatTsallisLabeledPointSetMetric<TPointSet>
@@ -21,6 +21,9 @@
 
 #include "itkIdentityTransform.h"
 #include "itkManifoldParzenWindowsPointSetFunction.h"
+#include "itkMultiThreader.h"
+
+#include <vector>
 
 namespace itk {
 
@@ -73,6 +76,8 @@ public:
   typedef ManifoldParzenWindowsPointSetFunction
     <PointSetType, RealType>                               DensityFunctionType;
   typedef typename DensityFunctionType::GaussianType       GaussianType;
+  typedef typename DensityFunctionType
+    ::MeasurementVectorType                                MeasurementVectorType;
   typedef IdentityTransform<RealType, PointDimension>      DefaultTransformType;
 
 
@@ -175,6 +180,14 @@ public:
   itkSetMacro( MovingKernelSigma, RealType );
   itkGetConstMacro( MovingKernelSigma, RealType );
 
+  /**
+   * Initialize() keeps the density functions, kd-trees included, of a
+   * previous call as long as no point has moved farther than this from
+   * where its kd-tree was built.  The default of 0 rebuilds whenever a
+   * point moves.
+   */
+  itkSetMacro( KdTreeRebuildTolerance, RealType );
+  itkGetConstMacro( KdTreeRebuildTolerance, RealType );
 
 protected:
   JensenHavrdaCharvatTsallisPointSetMetric();
@@ -187,6 +200,47 @@ private:
   JensenHavrdaCharvatTsallisPointSetMetric(const Self&);
   void operator=(const Self&);
 
+  /** Reuse the density function unless its settings changed or the
+   * points moved beyond the tolerance;  otherwise build a new one. */
+  void UpdateDensityFunction( typename DensityFunctionType::Pointer & density,
+    const PointSetType * points, RealType kernelSigma, RealType pointSetSigma,
+    unsigned int covarianceKNeighborhood,
+    unsigned int evaluationKNeighborhood );
+
+  struct SampleTermsThreadStruct
+    {
+    const Self                          *Metric;
+    DensityFunctionType                 *Density;
+    std::vector<MeasurementVectorType>  Samples;
+    unsigned int                        KNeighborhood;
+    RealType                            NumberOfKernels;
+    RealType                            Scale;
+    RealType                            Prefactor;
+    RealType                            Normalizer;
+    bool                                ComputeDerivative;
+    std::vector<RealType>               *Probabilities;
+    std::vector<DerivativeType>         ThreadDerivatives;
+    };
+
+  /**
+   * Scale times the density at each sample and, if requested, the sum of
+   * Prefactor * gaussian / ( probability^(2-alpha) * Normalizer ) times the
+   * kernel gradient over the neighbouring kernels, added to derivative.
+   * Threaded over the samples with one derivative per thread, summed in
+   * thread order.
+   */
+  void ComputeSampleTerms( const PointSetType * samples,
+    DensityFunctionType * density, unsigned int kNeighborhood,
+    RealType numberOfKernels, RealType scale, RealType prefactor,
+    RealType normalizer, bool computeDerivative,
+    std::vector<RealType> & probabilities, DerivativeType & derivative ) const;
+
+  static ITK_THREAD_RETURN_TYPE SampleTermsThreaderCallback( void *arg );
+
+  void ThreadedSampleTerms( SampleTermsThreadStruct & str,
+    unsigned long firstSample, unsigned long lastSample,
+    ThreadIdType threadId ) const;
+
   bool                                     m_UseRegularizationTerm;
   bool                                     m_UseInputAsSamples;
   bool                                     m_UseAnisotropicCovariances;
@@ -209,6 +263,7 @@ private:
   unsigned long                            m_NumberOfFixedSamples;
 
   RealType                                 m_Alpha;
+  RealType                                 m_KdTreeRebuildTolerance;
 
   TransformPointer                         m_Transform;
 
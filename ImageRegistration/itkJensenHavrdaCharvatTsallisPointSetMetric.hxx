@@ -43,6 +43,7 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
 
   this->m_Alpha = 2.0;
   this->m_UseWithRespectToTheMovingPointSet = true;
+  this->m_KdTreeRebuildTolerance = 0.0;
 
   typename DefaultTransformType::Pointer transform
     = DefaultTransformType::New();
@@ -62,19 +63,10 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
   /**
    * Initialize the fixed points
    */
-  this->m_FixedDensityFunction = DensityFunctionType::New();
-  this->m_FixedDensityFunction->SetBucketSize( 4 );
-  this->m_FixedDensityFunction->SetKernelSigma( this->m_FixedKernelSigma );
-  this->m_FixedDensityFunction->SetRegularizationSigma(
-    this->m_FixedPointSetSigma );
-  this->m_FixedDensityFunction->SetNormalize( true );
-  this->m_FixedDensityFunction->SetUseAnisotropicCovariances(
-    this->m_UseAnisotropicCovariances );
-  this->m_FixedDensityFunction->SetCovarianceKNeighborhood(
-      this->m_FixedCovarianceKNeighborhood );
-  this->m_FixedDensityFunction->SetEvaluationKNeighborhood(
-      this->m_FixedEvaluationKNeighborhood );
-  this->m_FixedDensityFunction->SetInputPointSet( this->m_FixedPointSet );
+  this->UpdateDensityFunction( this->m_FixedDensityFunction,
+    this->m_FixedPointSet, this->m_FixedKernelSigma,
+    this->m_FixedPointSetSigma, this->m_FixedCovarianceKNeighborhood,
+    this->m_FixedEvaluationKNeighborhood );
 
   if( !this->m_UseInputAsSamples )
     {
@@ -91,19 +83,10 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
   /**
    * Initialize the moving points
    */
-  this->m_MovingDensityFunction = DensityFunctionType::New();
-  this->m_MovingDensityFunction->SetBucketSize( 4 );
-  this->m_MovingDensityFunction->SetKernelSigma( this->m_MovingKernelSigma );
-  this->m_MovingDensityFunction->SetRegularizationSigma(
-    this->m_MovingPointSetSigma );
-  this->m_MovingDensityFunction->SetNormalize( true );
-  this->m_MovingDensityFunction->SetUseAnisotropicCovariances(
-    this->m_UseAnisotropicCovariances );
-  this->m_MovingDensityFunction->SetCovarianceKNeighborhood(
-      this->m_MovingCovarianceKNeighborhood );
-  this->m_MovingDensityFunction->SetEvaluationKNeighborhood(
-      this->m_MovingEvaluationKNeighborhood );
-  this->m_MovingDensityFunction->SetInputPointSet( this->m_MovingPointSet );
+  this->UpdateDensityFunction( this->m_MovingDensityFunction,
+    this->m_MovingPointSet, this->m_MovingKernelSigma,
+    this->m_MovingPointSetSigma, this->m_MovingCovarianceKNeighborhood,
+    this->m_MovingEvaluationKNeighborhood );
 
   if( !this->m_UseInputAsSamples )
     {
@@ -118,6 +101,36 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
     }
 }
 
+template <class TPointSet>
+void
+JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
+::UpdateDensityFunction( typename DensityFunctionType::Pointer & density,
+  const PointSetType * points, RealType kernelSigma, RealType pointSetSigma,
+  unsigned int covarianceKNeighborhood, unsigned int evaluationKNeighborhood )
+{
+  if( density
+    && density->GetKernelSigma() == kernelSigma
+    && density->GetRegularizationSigma() == pointSetSigma
+    && density->GetUseAnisotropicCovariances()
+      == this->m_UseAnisotropicCovariances
+    && density->GetCovarianceKNeighborhood() == covarianceKNeighborhood
+    && density->GetEvaluationKNeighborhood() == evaluationKNeighborhood
+    && density->UpdateInputPointSet( points, this->m_KdTreeRebuildTolerance ) )
+    {
+    return;
+    }
+
+  density = DensityFunctionType::New();
+  density->SetBucketSize( 4 );
+  density->SetKernelSigma( kernelSigma );
+  density->SetRegularizationSigma( pointSetSigma );
+  density->SetNormalize( true );
+  density->SetUseAnisotropicCovariances( this->m_UseAnisotropicCovariances );
+  density->SetCovarianceKNeighborhood( covarianceKNeighborhood );
+  density->SetEvaluationKNeighborhood( evaluationKNeighborhood );
+  density->SetInputPointSet( points );
+}
+
 /** Return the number of values, i.e the number of points in the moving set */
 template <class TPointSet>
 unsigned int
@@ -161,6 +174,8 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
 
   typename DensityFunctionType::Pointer densityFunctions[2];
 
+  unsigned int kNeighborhood;
+
   if( this->m_UseWithRespectToTheMovingPointSet )
     {
     points[0] = const_cast<PointSetType *>(
@@ -180,6 +195,8 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
       }
     densityFunctions[0] = this->m_FixedDensityFunction;
     densityFunctions[1] = this->m_MovingDensityFunction;
+
+    kNeighborhood = this->m_MovingEvaluationKNeighborhood;
     }
   else
     {
@@ -200,6 +217,8 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
       }
     densityFunctions[1] = this->m_FixedDensityFunction;
     densityFunctions[0] = this->m_MovingDensityFunction;
+
+    kNeighborhood = this->m_FixedEvaluationKNeighborhood;
     }
 
   RealType totalNumberOfPoints
@@ -216,6 +235,9 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
   RealType energyTerm1 = 0.0;
   RealType energyTerm2 = 0.0;
 
+  DerivativeType unused;
+  std::vector<RealType> probabilities;
+
   /**
     * first term
     */
@@ -224,22 +246,16 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
     {
     prefactor /= ( this->m_Alpha - 1.0 );
     }
-  typename PointSetType::PointsContainerConstIterator It
-    = samples[0]->GetPoints()->Begin();
-  while( It != samples[0]->GetPoints()->End() )
+  this->ComputeSampleTerms( samples[0], densityFunctions[1], kNeighborhood,
+    static_cast<RealType>( points[1]->GetNumberOfPoints() ),
+    static_cast<RealType>( points[1]->GetNumberOfPoints() )
+      / totalNumberOfPoints, 0.0, 1.0, false, probabilities, unused );
+  for( unsigned long i = 0; i < probabilities.size(); i++ )
     {
-    PointType samplePoint = It.Value();
-
-    RealType probabilityStar =
-//         densityFunctions[0]->Evaluate( samplePoint ) *
-//         static_cast<RealType>( points[0]->GetNumberOfPoints() ) +
-        densityFunctions[1]->Evaluate( samplePoint ) *
-        static_cast<RealType>( points[1]->GetNumberOfPoints() );
-    probabilityStar /= totalNumberOfPoints;
+    RealType probabilityStar = probabilities[i];
 
     if( probabilityStar == 0 )
       {
-      ++It;
       continue;
       }
 
@@ -252,7 +268,6 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
       energyTerm1 += vcl_pow( probabilityStar,
         static_cast<RealType>( this->m_Alpha - 1.0 ) );
       }
-    ++It;
     }
   if( this->m_Alpha != 1.0 )
     {
@@ -272,17 +287,15 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
       {
       prefactor2 /= ( this->m_Alpha - 1.0 );
       }
-    typename PointSetType::PointsContainerConstIterator It
-      = samples[1]->GetPoints()->Begin();
-    while( It != samples[1]->GetPoints()->End() )
+    this->ComputeSampleTerms( samples[1], densityFunctions[1], kNeighborhood,
+      static_cast<RealType>( points[1]->GetNumberOfPoints() ), 1.0, 0.0, 1.0,
+      false, probabilities, unused );
+    for( unsigned long i = 0; i < probabilities.size(); i++ )
       {
-      PointType samplePoint = It.Value();
-
-      RealType probability = densityFunctions[1]->Evaluate( samplePoint );
+      RealType probability = probabilities[i];
 
       if( probability == 0 )
         {
-        ++It;
         continue;
         }
 
@@ -295,7 +308,6 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
         energyTerm2 += ( prefactor2 * vcl_pow( probability,
           static_cast<RealType>( this->m_Alpha - 1.0 ) ) );
         }
-      ++It;
       }
     if( this->m_Alpha != 1.0 )
       {
@@ -384,83 +396,18 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
   derivative.SetSize( points[1]->GetPoints()->Size(), PointDimension );
   derivative.Fill( 0 );
 
+  std::vector<RealType> probabilities;
+
   /**
    * first term
    */
 
   RealType prefactor = 1.0 / ( totalNumberOfSamples * totalNumberOfPoints );
 
-  typename PointSetType::PointsContainerConstIterator It
-    = samples[0]->GetPoints()->Begin();
-  while( It != samples[0]->GetPoints()->End() )
-    {
-    PointType fixedSamplePoint = It.Value();
-
-    RealType probabilityStar =
-//         densityFunctions[0]->Evaluate( fixedSamplePoint ) *
-//         static_cast<RealType>( points[0]->GetNumberOfPoints() ) +
-        densityFunctions[1]->Evaluate( fixedSamplePoint ) *
-        static_cast<RealType>( points[1]->GetNumberOfPoints() );
-    probabilityStar /= totalNumberOfPoints;
-
-    if( probabilityStar == 0 )
-      {
-      ++It;
-      continue;
-      }
-
-    RealType probabilityStarFactor = vcl_pow( probabilityStar,
-      static_cast<RealType>( 2.0 - this->m_Alpha ) );
-
-    typename GaussianType::MeasurementVectorType sampleMeasurement;
-    for( unsigned int d = 0; d < PointDimension; d++ )
-      {
-      sampleMeasurement[d] = fixedSamplePoint[d];
-      }
-
-    typename DensityFunctionType::NeighborhoodIdentifierType neighbors
-      = densityFunctions[1]->GetNeighborhoodIdentifiers(
-        sampleMeasurement, kNeighborhood );
-
-    for( unsigned int n = 0; n < neighbors.size(); n++ )
-      {
-      RealType gaussian = densityFunctions[1]->
-        GetGaussian( neighbors[n] )->Evaluate( sampleMeasurement );
-
-      if( gaussian == 0 )
-        {
-        continue;
-        }
-
-      typename GaussianType::MeanType mean
-        = densityFunctions[1]->GetGaussian( neighbors[n] )->GetMean();
-
-      for( unsigned int d = 0; d < PointDimension; d++ )
-        {
-        mean[d] -= fixedSamplePoint[d];
-        }
-
-      if( this->m_UseAnisotropicCovariances )
-        {
-        typename GaussianType::MatrixType Ci
-          = densityFunctions[1]->GetGaussian( neighbors[n] )
-            ->GetInverseCovariance();
-        mean = Ci * mean;
-        }
-      else
-        {
-        mean /= vnl_math_sqr(
-          densityFunctions[1]->GetGaussian( neighbors[n] )->GetSigma() );
-        }
-
-      mean *= ( prefactor * gaussian / probabilityStarFactor );
-      for( unsigned int d = 0; d < PointDimension; d++ )
-        {
-        derivative(neighbors[n], d) += mean[d];
-        }
-      }
-    ++It;
-    }
+  this->ComputeSampleTerms( samples[0], densityFunctions[1], kNeighborhood,
+    static_cast<RealType>( points[1]->GetNumberOfPoints() ),
+    static_cast<RealType>( points[1]->GetNumberOfPoints() )
+      / totalNumberOfPoints, prefactor, 1.0, true, probabilities, derivative );
 
   /**
    * second term, i.e. regularization term
@@ -470,72 +417,10 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
     RealType prefactor2 = -1.0 / ( static_cast<RealType>(
       samples[1]->GetNumberOfPoints() ) * totalNumberOfPoints );
 
-    typename PointSetType::PointsContainerConstIterator It
-      = samples[1]->GetPoints()->Begin();
-    while( It != samples[1]->GetPoints()->End() )
-      {
-      PointType movingSamplePoint = It.Value();
-
-      RealType probability = densityFunctions[1]->Evaluate( movingSamplePoint );
-
-      if( probability == 0 )
-        {
-        ++It;
-        continue;
-        }
-
-      RealType probabilityFactor = vcl_pow( probability,
-        static_cast<RealType>( 2.0 - this->m_Alpha ) );
-      probabilityFactor *= ( samples[1]->GetNumberOfPoints()
-        / totalNumberOfSamples );
-
-      typename GaussianType::MeasurementVectorType sampleMeasurement;
-      for( unsigned int d = 0; d < PointDimension; d++ )
-        {
-        sampleMeasurement[d] = movingSamplePoint[d];
-        }
-
-      typename DensityFunctionType::NeighborhoodIdentifierType neighbors
-        = densityFunctions[1]->GetNeighborhoodIdentifiers(
-          sampleMeasurement, kNeighborhood );
-
-      for( unsigned int i = 0; i < neighbors.size(); i++ )
-        {
-        RealType gaussian = densityFunctions[1]->
-          GetGaussian( neighbors[i] )->Evaluate( sampleMeasurement );
-        if( gaussian == 0 )
-          {
-          continue;
-          }
-
-        typename GaussianType::MeanType mean
-          = densityFunctions[1]->GetGaussian( neighbors[i] )->GetMean();
-        for( unsigned int d = 0; d < PointDimension; d++ )
-          {
-          mean[d] -= movingSamplePoint[d];
-          }
-
-        if( this->m_UseAnisotropicCovariances )
-          {
-          typename GaussianType::MatrixType Ci
-            = densityFunctions[1]->GetGaussian( neighbors[i] )
-              ->GetInverseCovariance();
-          mean = Ci * mean;
-          }
-        else
-          {
-          mean /= vnl_math_sqr(
-            densityFunctions[1]->GetGaussian( neighbors[i] )->GetSigma() );
-          }
-
-        mean *= ( prefactor2 * gaussian / probabilityFactor );
-        for( unsigned int d = 0; d < PointDimension; d++ )
-          {
-          derivative(neighbors[i], d) += mean[d];
-          }
-        }
-      ++It;
-      }
+    this->ComputeSampleTerms( samples[1], densityFunctions[1], kNeighborhood,
+      static_cast<RealType>( points[1]->GetNumberOfPoints() ), 1.0, prefactor2,
+      samples[1]->GetNumberOfPoints() / totalNumberOfSamples, true,
+      probabilities, derivative );
     }
 
 }
@@ -632,23 +517,19 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
     }
   prefactor[1] = 1.0 / ( totalNumberOfSamples * totalNumberOfPoints );
 
-  typename PointSetType::PointsContainerConstIterator It
-    = samples[0]->GetPoints()->Begin();
-  while( It != samples[0]->GetPoints()->End() )
-    {
-    PointType fixedSamplePoint = It.Value();
-
-    RealType probabilityStar =
-//       densityFunctions[0]->Evaluate( fixedSamplePoint ) *
-//       static_cast<RealType>( points[0]->GetNumberOfPoints() ) +
-      densityFunctions[1]->Evaluate( fixedSamplePoint ) *
-      static_cast<RealType>( points[1]->GetNumberOfPoints() );
+  std::vector<RealType> probabilities;
 
-    probabilityStar /= totalNumberOfPoints;
+  this->ComputeSampleTerms( samples[0], densityFunctions[1], kNeighborhood,
+    static_cast<RealType>( points[1]->GetNumberOfPoints() ),
+    static_cast<RealType>( points[1]->GetNumberOfPoints() )
+      / totalNumberOfPoints, prefactor[1], 1.0, true, probabilities,
+    derivative );
+  for( unsigned long i = 0; i < probabilities.size(); i++ )
+    {
+    RealType probabilityStar = probabilities[i];
 
     if( probabilityStar == 0 )
       {
-      ++It;
       continue;
       }
 
@@ -661,58 +542,6 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
       energyTerm1 += ( prefactor[0] * vcl_pow( probabilityStar,
         static_cast<RealType>( this->m_Alpha - 1.0 ) ) );
       }
-
-    RealType probabilityStarFactor = vcl_pow( probabilityStar,
-      static_cast<RealType>( 2.0 - this->m_Alpha ) );
-
-    typename GaussianType::MeasurementVectorType sampleMeasurement;
-    for( unsigned int d = 0; d < PointDimension; d++ )
-      {
-      sampleMeasurement[d] = fixedSamplePoint[d];
-      }
-
-    typename DensityFunctionType::NeighborhoodIdentifierType neighbors
-      = densityFunctions[1]->GetNeighborhoodIdentifiers(
-        sampleMeasurement, kNeighborhood );
-
-    for( unsigned int n = 0; n < neighbors.size(); n++ )
-      {
-      RealType gaussian = densityFunctions[1]->
-        GetGaussian( neighbors[n] )->Evaluate( sampleMeasurement );
-
-      if( gaussian == 0 )
-        {
-        continue;
-        }
-
-      typename GaussianType::MeanType mean
-        = densityFunctions[1]->GetGaussian( neighbors[n] )->GetMean();
-
-      for( unsigned int d = 0; d < PointDimension; d++ )
-        {
-        mean[d] -= fixedSamplePoint[d];
-        }
-
-      if( this->m_UseAnisotropicCovariances )
-        {
-        typename GaussianType::MatrixType Ci
-          = densityFunctions[1]->GetGaussian( neighbors[n] )
-            ->GetInverseCovariance();
-        mean = Ci * mean;
-        }
-      else
-        {
-        mean /= vnl_math_sqr(
-          densityFunctions[1]->GetGaussian( neighbors[n] )->GetSigma() );
-        }
-
-      mean *= ( prefactor[1] * gaussian / probabilityStarFactor );
-      for( unsigned int d = 0; d < PointDimension; d++ )
-        {
-        derivative(neighbors[n], d) += mean[d];
-        }
-      }
-    ++It;
     }
   if( this->m_Alpha != 1.0 )
     {
@@ -736,17 +565,16 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
       prefactor2[0] /= ( this->m_Alpha - 1.0 );
       }
 
-    typename PointSetType::PointsContainerConstIterator It
-      = samples[1]->GetPoints()->Begin();
-    while( It != samples[1]->GetPoints()->End() )
+    this->ComputeSampleTerms( samples[1], densityFunctions[1], kNeighborhood,
+      static_cast<RealType>( points[1]->GetNumberOfPoints() ), 1.0,
+      prefactor2[1], samples[1]->GetNumberOfPoints() / totalNumberOfSamples,
+      true, probabilities, derivative );
+    for( unsigned long i = 0; i < probabilities.size(); i++ )
       {
-      PointType movingSamplePoint = It.Value();
-
-      RealType probability = densityFunctions[1]->Evaluate( movingSamplePoint );
+      RealType probability = probabilities[i];
 
       if( probability == 0 )
         {
-        ++It;
         continue;
         }
 
@@ -759,58 +587,6 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
         energyTerm2 += ( prefactor2[0] * vcl_pow( probability,
           static_cast<RealType>( this->m_Alpha - 1.0 ) ) );
         }
-
-      RealType probabilityFactor = vcl_pow( probability,
-        static_cast<RealType>( 2.0 - this->m_Alpha ) );
-      probabilityFactor *= ( samples[1]->GetNumberOfPoints()
-        / totalNumberOfSamples );
-
-      typename GaussianType::MeasurementVectorType sampleMeasurement;
-      for( unsigned int d = 0; d < PointDimension; d++ )
-        {
-        sampleMeasurement[d] = movingSamplePoint[d];
-        }
-
-      typename DensityFunctionType::NeighborhoodIdentifierType neighbors
-        = densityFunctions[1]->GetNeighborhoodIdentifiers(
-          sampleMeasurement, kNeighborhood );
-
-      for( unsigned int i = 0; i < neighbors.size(); i++ )
-        {
-        RealType gaussian = densityFunctions[1]->
-          GetGaussian( neighbors[i] )->Evaluate( sampleMeasurement );
-        if( gaussian == 0 )
-          {
-          continue;
-          }
-
-        typename GaussianType::MeanType mean
-          = densityFunctions[1]->GetGaussian( neighbors[i] )->GetMean();
-        for( unsigned int d = 0; d < PointDimension; d++ )
-          {
-          mean[d] -= movingSamplePoint[d];
-          }
-
-        if( this->m_UseAnisotropicCovariances )
-          {
-          typename GaussianType::MatrixType Ci
-            = densityFunctions[1]->GetGaussian( neighbors[i] )
-              ->GetInverseCovariance();
-          mean = Ci * mean;
-          }
-        else
-          {
-          mean /= vnl_math_sqr(
-            densityFunctions[1]->GetGaussian( neighbors[i] )->GetSigma() );
-          }
-
-        mean *= ( prefactor2[1] * gaussian / probabilityFactor );
-        for( unsigned int d = 0; d < PointDimension; d++ )
-          {
-          derivative(neighbors[i], d) += mean[d];
-          }
-        }
-      ++It;
       }
     if( this->m_Alpha != 1.0 )
       {
@@ -822,6 +598,136 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
   value[0] = energyTerm1 - energyTerm2;
 }
 
+template <class TPointSet>
+void
+JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
+::ComputeSampleTerms( const PointSetType * samples,
+  DensityFunctionType * density, unsigned int kNeighborhood,
+  RealType numberOfKernels, RealType scale, RealType prefactor,
+  RealType normalizer, bool computeDerivative,
+  std::vector<RealType> & probabilities, DerivativeType & derivative ) const
+{
+  SampleTermsThreadStruct str;
+  str.Metric = this;
+  str.Density = density;
+  str.KNeighborhood = kNeighborhood;
+  str.NumberOfKernels = numberOfKernels;
+  str.Scale = scale;
+  str.Prefactor = prefactor;
+  str.Normalizer = normalizer;
+  str.ComputeDerivative = computeDerivative;
+
+  str.Samples.reserve( samples->GetNumberOfPoints() );
+  typename PointSetType::PointsContainerConstIterator It
+    = samples->GetPoints()->Begin();
+  while( It != samples->GetPoints()->End() )
+    {
+    MeasurementVectorType sampleMeasurement;
+    for( unsigned int d = 0; d < PointDimension; d++ )
+      {
+      sampleMeasurement[d] = It.Value()[d];
+      }
+    str.Samples.push_back( sampleMeasurement );
+    ++It;
+    }
+  probabilities.assign( str.Samples.size(), 0.0 );
+  str.Probabilities = &probabilities;
+
+  typename MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  density->SetNumberOfThreads( threader->GetNumberOfThreads() );
+  if( computeDerivative )
+    {
+    str.ThreadDerivatives.resize( threader->GetNumberOfThreads() );
+    for( unsigned int t = 0; t < str.ThreadDerivatives.size(); t++ )
+      {
+      str.ThreadDerivatives[t].SetSize( derivative.rows(), derivative.cols() );
+      str.ThreadDerivatives[t].Fill( 0 );
+      }
+    }
+  threader->SetSingleMethod( Self::SampleTermsThreaderCallback, &str );
+  threader->SingleMethodExecute();
+
+  for( unsigned int t = 0; t < str.ThreadDerivatives.size(); t++ )
+    {
+    derivative += str.ThreadDerivatives[t];
+    }
+}
+
+template <class TPointSet>
+ITK_THREAD_RETURN_TYPE
+JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
+::SampleTermsThreaderCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info
+    = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  SampleTermsThreadStruct *str
+    = static_cast<SampleTermsThreadStruct *>( info->UserData );
+  ThreadIdType threadId = info->ThreadID;
+  ThreadIdType threadCount = info->NumberOfThreads;
+
+  unsigned long range = str->Samples.size();
+  unsigned long valuesPerThread = ( range + threadCount - 1 ) / threadCount;
+  if( valuesPerThread == 0 || threadId * valuesPerThread >= range )
+    {
+    return ITK_THREAD_RETURN_VALUE;
+    }
+  unsigned long firstSample = threadId * valuesPerThread;
+  unsigned long lastSample
+    = vnl_math_min( range, firstSample + valuesPerThread );
+
+  str->Metric->ThreadedSampleTerms( *str, firstSample, lastSample, threadId );
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <class TPointSet>
+void
+JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
+::ThreadedSampleTerms( SampleTermsThreadStruct & str,
+  unsigned long firstSample, unsigned long lastSample,
+  ThreadIdType threadId ) const
+{
+  typename DensityFunctionType::NeighborhoodIdentifierType neighbors;
+  std::vector<RealType> gaussians;
+  std::vector<MeasurementVectorType> directions;
+
+  for( unsigned long i = firstSample; i < lastSample; i++ )
+    {
+    str.Density->EvaluateNeighborhood( str.Samples[i], str.KNeighborhood,
+      threadId, neighbors, gaussians,
+      str.ComputeDerivative ? &directions : NULL );
+
+    RealType sum = 0.0;
+    for( unsigned int n = 0; n < gaussians.size(); n++ )
+      {
+      sum += gaussians[n];
+      }
+    RealType probability = sum / str.NumberOfKernels * str.Scale;
+    (*str.Probabilities)[i] = probability;
+
+    if( probability == 0 || !str.ComputeDerivative )
+      {
+      continue;
+      }
+
+    RealType factor = str.Prefactor / ( str.Normalizer * vcl_pow( probability,
+      static_cast<RealType>( 2.0 - this->m_Alpha ) ) );
+
+    DerivativeType & derivative = str.ThreadDerivatives[threadId];
+    for( unsigned int n = 0; n < neighbors.size(); n++ )
+      {
+      if( gaussians[n] == 0 )
+        {
+        continue;
+        }
+      for( unsigned int d = 0; d < PointDimension; d++ )
+        {
+        derivative( neighbors[n], d ) += factor * gaussians[n] * directions[n][d];
+        }
+      }
+    }
+}
+
 template <class TPointSet>
 void
 JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
@@ -835,6 +741,8 @@ JensenHavrdaCharvatTsallisPointSetMetric<TPointSet>
      << this->m_UseRegularizationTerm << std::endl;
   os << indent << "Alpha: "
      << this->m_Alpha << std::endl;
+  os << indent << "Kd-tree rebuild tolerance: "
+     << this->m_KdTreeRebuildTolerance << std::endl;
 
   os << indent << "Fixed sigma: "
      << this->m_FixedPointSetSigma << std::endl;
@@ -155,6 +155,13 @@ public:
   void SetNumberOfMovingSamples( unsigned long r )  { this->m_NumberOfMovingSamples = r; }
   unsigned long GetNumberOfMovingSamples()  { return this->m_NumberOfMovingSamples; }
 
+  /** Points may move this far before the kd-trees of the point-set metric,
+   * which is kept between iterations, are rebuilt. */
+  void SetKdTreeRebuildTolerance( RealType r )
+    { this->m_KdTreeRebuildTolerance = r; }
+  RealType GetKdTreeRebuildTolerance()
+    { return this->m_KdTreeRebuildTolerance; }
+
   void SetMeshResolution( ArrayType a )  { this->m_MeshResolution = a; }
   ArrayType GetMeshResolution()  { return this->m_MeshResolution; }
 
@@ -239,6 +246,8 @@ private:
   unsigned long                                            m_NumberOfMovingSamples;
 
   RealType                                                 m_Alpha;
+  RealType                                                 m_KdTreeRebuildTolerance;
+  typename PointSetMetricType::Pointer                     m_PointSetMetric;
 
   /**
    * Bspline related variables
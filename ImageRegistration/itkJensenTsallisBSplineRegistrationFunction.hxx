@@ -54,6 +54,8 @@ JensenTsallisBSplineRegistrationFunction<TFixedImage,
   this->m_MovingCovarianceKNeighborhood = covarianceKNeighborhood;
 
   this->m_Alpha = 2.0;
+  this->m_KdTreeRebuildTolerance = 0.0;
+  this->m_PointSetMetric = NULL;
 
 //  this->m_FixedControlPointLattice = NULL;
 //  this->m_MovingControlPointLattice = NULL;
@@ -102,8 +104,11 @@ JensenTsallisBSplineRegistrationFunction<TFixedImage,
     }
 
 
-  typename PointSetMetricType::Pointer pointSetMetric
-    = PointSetMetricType::New();
+  if( !this->m_PointSetMetric )
+    {
+    this->m_PointSetMetric = PointSetMetricType::New();
+    }
+  typename PointSetMetricType::Pointer pointSetMetric = this->m_PointSetMetric;
   pointSetMetric->SetFixedPointSet( this->m_FixedPointSet );
   pointSetMetric->SetMovingPointSet( this->m_MovingPointSet );
 
@@ -121,6 +126,7 @@ JensenTsallisBSplineRegistrationFunction<TFixedImage,
   pointSetMetric->SetMovingCovarianceKNeighborhood( this->m_MovingCovarianceKNeighborhood );
   pointSetMetric->SetMovingEvaluationKNeighborhood( this->m_MovingEvaluationKNeighborhood );
   pointSetMetric->SetAlpha( this->m_Alpha );
+  pointSetMetric->SetKdTreeRebuildTolerance( this->m_KdTreeRebuildTolerance );
 
   pointSetMetric->Initialize();
 
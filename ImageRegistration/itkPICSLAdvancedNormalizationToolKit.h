@@ -29,6 +29,9 @@
 #include "itkMacro.h"
 #include "itkANTSLabeledPointSet.h"
 
+#include <map>
+#include <string>
+
 namespace itk
 {
 
@@ -89,6 +92,18 @@ typedef double TComp;
   void SetRegistrationOptimizer( RegistrationOptimizerPointer T )
     {this->m_RegistrationOptimizer=T; }
 
+  /** Use an image in memory wherever a metric names the given file name.
+   * A copy of the image is preprocessed as the images read from disk are,
+   * so the image itself is left unchanged. */
+  void SetInputImage( const std::string & name, ImagePointer image )
+    { this->m_InputImages[name] = image; }
+
+  /** Seed of the random samples of the affine mutual information, so that
+   * concurrent registrations do not share ITK's global generator;  0, the
+   * default, seeds the samples from the global generator. */
+  itkSetMacro( AffineSamplingSeed, unsigned int );
+  itkGetConstMacro( AffineSamplingSeed, unsigned int );
+
   void InitializeTransformAndOptimizer();
   void RunRegistration();
 
@@ -117,6 +132,9 @@ private:
 
   SimilarityMetricListType                                 m_SimilarityMetrics;
 
+  std::map<std::string, ImagePointer>                      m_InputImages;
+  unsigned int                                             m_AffineSamplingSeed;
+
 };
 
 } // end namespace itk
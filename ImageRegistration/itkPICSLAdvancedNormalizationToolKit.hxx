@@ -25,6 +25,7 @@
 
 #include "itkPICSLAdvancedNormalizationToolKit.h"
 #include "itkHistogramMatchingImageFilter.h"
+#include "itkImageDuplicator.h"
 #include "itkSpatialMutualInformationRegistrationFunction.h"
 #include "itkIdentityTransform.h"
 #include "itkImageFileReader.h"
@@ -44,9 +45,10 @@
 //#include "itkRobustOpticalFlow.h"
 //#include "itkSectionMutualInformationRegistrationFunction.h"
 
-//#include "itkJensenTsallisBSplineRegistrationFunction.h"
+#include "itkJensenTsallisBSplineRegistrationFunction.h"
 
 #include "vnl/vnl_math.h"
+#include <map>
 
 #include "ANTS_affine_registration2.h"
 
@@ -57,6 +59,7 @@ template<unsigned int TDimension, class TReal>
 PICSLAdvancedNormalizationToolKit<TDimension, TReal>
 ::PICSLAdvancedNormalizationToolKit()
 {
+    this->m_AffineSamplingSeed = 0;
     this->InitializeCommandLineOptions();
 }
 
@@ -200,6 +203,17 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
 
     typename OptionType::ValueType continue_affine = this->m_Parser->GetOption( "continue-affine" )->GetValue();
     if  ( fixed_initial_affine_filename != "" ) continue_affine=std::string("false");
+
+    typename OptionType::Pointer resumeOption = this->m_Parser->GetOption( "resume" );
+    if ( resumeOption && resumeOption->GetValue() != "" &&
+         this->m_RegistrationOptimizer->ReadCheckpoint( resumeOption->GetValue() ) )
+      {
+      std::cout << "Use the affine of the checkpoint." << std::endl;
+      continue_affine=std::string("false");
+      aff_init=this->m_RegistrationOptimizer->GetCheckpointAffineTransform();
+      if ( this->m_RegistrationOptimizer->GetCheckpointFixedImageAffineTransform() )
+        fixed_aff_init=this->m_RegistrationOptimizer->GetCheckpointFixedImageAffineTransform();
+      }
     if ( continue_affine == "true" ){
         std::cout << "Continue affine registration from the input" << std::endl; //<< aff_init << std::endl;
 
@@ -220,6 +234,7 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
             std::vector<int> mi_option = this->m_Parser->template ConvertVector<int>(temp);
             affine_opt.MI_bins = mi_option[0];
             affine_opt.MI_samples = mi_option[1];
+            affine_opt.MI_sampling_seed = this->m_AffineSamplingSeed;
             temp=this->m_Parser->GetOption( "rigid-affine" )->GetValue();
         std::string temp2=this->m_Parser->GetOption( "do-rigid" )->GetValue();
             affine_opt.is_rigid = (
@@ -240,6 +255,14 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
             affine_opt.ignore_void_orgin = (temp=="true");
             std::cout << "affine_opt.ignore_void_orgin = " << affine_opt.ignore_void_orgin  << std::endl;
 
+            temp=this->m_Parser->GetOption( "affine-multi-start" )->GetValue();
+            std::vector<double> start_option = this->m_Parser->template ConvertVector<double>(temp);
+            if ( start_option.size() > 0 ) affine_opt.number_of_rotation_starts = static_cast<int>( start_option[0] );
+            if ( start_option.size() > 1 ) affine_opt.rotation_search_range = start_option[1];
+            if ( start_option.size() > 2 ) affine_opt.number_of_best_starts = static_cast<int>( start_option[2] );
+            if ( start_option.size() > 3 ) affine_opt.number_of_translation_starts = static_cast<int>( start_option[3] );
+            if ( start_option.size() > 4 ) affine_opt.translation_search_range = start_option[4];
+
 
         }
 
@@ -361,6 +384,21 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
     this->m_SimilarityMetrics.clear();
 
     typedef ImageFileReader<ImageType> ReaderType;
+    // metrics that name the same file share one image, so that the
+    // optimizer smooths and warps it once per iteration;  the images set
+    // in memory are found here before any file is read, and are
+    // preprocessed like a file would be.  The caller's image may be shared
+    // with other registrations, so a copy of it is preprocessed.
+    std::map<std::string, ImagePointer> imageCache;
+    for ( typename std::map<std::string, ImagePointer>::const_iterator
+          it = this->m_InputImages.begin(); it != this->m_InputImages.end(); ++it )
+    {
+        typedef ImageDuplicator<ImageType> DuplicatorType;
+        typename DuplicatorType::Pointer duplicator = DuplicatorType::New();
+        duplicator->SetInputImage( it->second );
+        duplicator->Update();
+        imageCache[it->first] = this->PreprocessImage( duplicator->GetOutput() );
+    }
     bool useHistMatch = this->m_Parser->template Convert<bool>( this->m_Parser->GetOption( "use-Histogram-Matching" )->GetValue() );
 
     /**
@@ -378,29 +416,41 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
             unsigned int parameterCount = 0;
 
 
-            typename ReaderType::Pointer fixedImageFileReader = ReaderType::New();
-            fixedImageFileReader->SetFileName( option->GetParameter( i, parameterCount ) );
-            fixedImageFileReader->Update();
-            ImagePointer fixedImage = this->PreprocessImage(
-                    fixedImageFileReader->GetOutput() );
+            std::string fixedImageFileName = option->GetParameter( i, parameterCount );
+            ImagePointer fixedImage = imageCache[fixedImageFileName];
+            if ( !fixedImage )
+            {
+                typename ReaderType::Pointer fixedImageFileReader = ReaderType::New();
+                fixedImageFileReader->SetFileName( fixedImageFileName );
+                fixedImageFileReader->Update();
+                fixedImage = this->PreprocessImage(
+                        fixedImageFileReader->GetOutput() );
+                imageCache[fixedImageFileName] = fixedImage;
+            }
             similarityMetric->SetFixedImage( fixedImage );
             parameterCount++;
 
             std::cout << "  Fixed image file: "
-                      << fixedImageFileReader->GetFileName() << std::endl;
-
-            typename ReaderType::Pointer movingImageFileReader = ReaderType::New();
-            movingImageFileReader->SetFileName( option->GetParameter( i, parameterCount ) );
-            movingImageFileReader->Update();
-            ImagePointer movingImage = this->PreprocessImage(
-                    movingImageFileReader->GetOutput() );
+                      << fixedImageFileName << std::endl;
+
+            std::string movingImageFileName = option->GetParameter( i, parameterCount );
+            ImagePointer movingImage = imageCache[movingImageFileName];
+            if ( !movingImage )
+            {
+                typename ReaderType::Pointer movingImageFileReader = ReaderType::New();
+                movingImageFileReader->SetFileName( movingImageFileName );
+                movingImageFileReader->Update();
+                movingImage = this->PreprocessImage(
+                        movingImageFileReader->GetOutput() );
+                imageCache[movingImageFileName] = movingImage;
+            }
             similarityMetric->SetMovingImage( movingImage );
             typename SimilarityMetricType::RadiusType radius;
             radius.Fill( 0 );
             parameterCount++;
 
             std::cout << "  Moving image file: "
-                      << movingImageFileReader->GetFileName() << std::endl;
+                      << movingImageFileName << std::endl;
 
             /**
              * Check if similarity metric is image based or point-set based.
@@ -422,10 +472,10 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
 
             if ( whichMetric == "point-set-expectation" ||
                  whichMetric == "PointSetExpectation" ||
-                 whichMetric == "PSE"
-//                whichMetric == "jensen-tsallis-bspline" ||
-//                whichMetric == "JensenTsallisBSpline" ||
-//                whichMetric == "JTB"
+                 whichMetric == "PSE" ||
+                 whichMetric == "jensen-tsallis-bspline" ||
+                 whichMetric == "JensenTsallisBSpline" ||
+                 whichMetric == "JTB"
                )
               {
               isMetricPointSetBased = true;
@@ -555,6 +605,21 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
                   std::cout << " Symmetric match iterations -- going Asymmeric for the rest " << pm << std::endl;
                   parameterCount++;
                   }
+                if ( option->GetNumberOfParameters( i ) > parameterCount )
+                  {
+                  unsigned int sinkhorn = this->m_Parser->template Convert<unsigned int>( option->GetParameter( i, parameterCount ) );
+                  metric->SetUseSinkhornMatching( sinkhorn == 1 );
+                  metric->SetUseDenseSinkhornMatching( sinkhorn == 2 );
+                  std::cout << " Sinkhorn matching " << sinkhorn << std::endl;
+                  parameterCount++;
+                  }
+                TReal distanceThreshold = 0;
+                if ( option->GetNumberOfParameters( i ) > parameterCount )
+                  {
+                  distanceThreshold = this->m_Parser->template Convert<TReal>( option->GetParameter( i, parameterCount ) );
+                  parameterCount++;
+                  }
+                metric->SetEuclideanDistanceThreshold( distanceThreshold );
 
                 similarityMetric->SetMetric( metric );
                 similarityMetric->SetMaximizeMetric( true );
@@ -562,88 +627,95 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
                 similarityMetric->SetMovingPointSet(movingPointSetReader->GetOutput() );
                 this->m_SimilarityMetrics.push_back( similarityMetric );
                 }
-//              else if ( whichMetric == "jensen-tsallis-bspline" ||
-//                        whichMetric == "JensenTsallisBSpline" ||
-//                        whichMetric == "JTB" )
-//                {
-//                typedef itk::JensenTsallisBSplineRegistrationFunction
-//                        <ImageType, PointSetType, ImageType, PointSetType, DisplacementFieldType> MetricType;
-//                typename MetricType::Pointer metric = MetricType::New();
-//                metric->SetRadius( radius );
-//                metric->SetFixedPointSet( fixedPointSetReader->GetOutput() );
-//                metric->SetMovingPointSet( movingPointSetReader->GetOutput() );
-//                metric->SetFixedPointSetSigma( pointSetSigma );
-//                metric->SetMovingPointSetSigma( pointSetSigma );
-//                metric->SetFixedEvaluationKNeighborhood( kNeighborhood );
-//                metric->SetMovingEvaluationKNeighborhood( kNeighborhood );
-//
-//                if ( option->GetNumberOfParameters( i ) > parameterCount )
-//                  {
-//                  metric->SetAlpha( this->m_Parser->template
-//                  Convert<TReal>( option->GetParameter( i, parameterCount ) ) );
-//                  parameterCount++;
-//                  }
-//                if ( option->GetNumberOfParameters( i ) > parameterCount )
-//                  {
-//                  typename RegistrationOptimizerType::ArrayType meshResolution;
-//                  std::vector<TReal> resolution = this->m_Parser->template
-//                    ConvertVector<TReal>( option->GetParameter( i, parameterCount ) );
-//                  if ( resolution.size() != TDimension )
-//                    {
-//                    itkExceptionMacro( "Mesh resolution does not match image dimension." );
-//                    }
-//                  for ( unsigned int d = 0; d < TDimension; d++ )
-//                    {
-//                    meshResolution[d] = resolution[d];
-//                    }
-//                  metric->SetMeshResolution( meshResolution );
-//                  parameterCount++;
-//                  }
-//                if ( option->GetNumberOfParameters( i ) > parameterCount )
-//                  {
-//                  metric->SetSplineOrder( this->m_Parser->template
-//                  Convert<unsigned int>( option->GetParameter( i, parameterCount ) ) );
-//                  parameterCount++;
-//                  }
-//                if ( option->GetNumberOfParameters( i ) > parameterCount )
-//                  {
-//                  metric->SetNumberOfLevels( this->m_Parser->template
-//                  Convert<unsigned int>( option->GetParameter( i, parameterCount ) ) );
-//                  parameterCount++;
-//                  }
-//                if ( option->GetNumberOfParameters( i ) > parameterCount )
-//                  {
-//                  metric->SetUseAnisotropicCovariances(
-//                    this->m_Parser->template Convert<bool>(
-//                    option->GetParameter( i, parameterCount ) ) );
-//                  parameterCount++;
-//                  }
-//
-//
-//                std::cout << "  B-spline parameters " << std::endl;
-//                std::cout << "    mesh resolution: " << metric->GetMeshResolution() << std::endl;
-//                std::cout << "    spline order: " << metric->GetSplineOrder() << std::endl;
-//                std::cout << "    number of levels: " << metric->GetNumberOfLevels() << std::endl;
-//                std::cout << "  Alpha: " << metric->GetAlpha() << std::endl;
-//                if ( metric->GetUseAnisotropicCovariances() )
-//                  {
-//                  std::cout << "  using anisotropic covariances." << std::endl;
-//                  }
-//
-//                similarityMetric->SetMetric( metric );
-//                similarityMetric->SetMaximizeMetric( true );
-//                similarityMetric->SetFixedPointSet( fixedPointSetReader->GetOutput() );
-//                similarityMetric->SetMovingPointSet( movingPointSetReader->GetOutput() );
-//                this->m_SimilarityMetrics.push_back( similarityMetric );
-//                }
+              else if ( whichMetric == "jensen-tsallis-bspline" ||
+                        whichMetric == "JensenTsallisBSpline" ||
+                        whichMetric == "JTB" )
+                {
+                typedef itk::JensenTsallisBSplineRegistrationFunction
+                        <ImageType, PointSetType, ImageType, PointSetType, DisplacementFieldType> MetricType;
+                typename MetricType::Pointer metric = MetricType::New();
+                metric->SetRadius( radius );
+                metric->SetFixedPointSet( fixedPointSetReader->GetOutput() );
+                metric->SetMovingPointSet( movingPointSetReader->GetOutput() );
+                metric->SetFixedPointSetSigma( pointSetSigma );
+                metric->SetMovingPointSetSigma( pointSetSigma );
+                metric->SetFixedEvaluationKNeighborhood( kNeighborhood );
+                metric->SetMovingEvaluationKNeighborhood( kNeighborhood );
+
+                if ( option->GetNumberOfParameters( i ) > parameterCount )
+                  {
+                  metric->SetAlpha( this->m_Parser->template
+                  Convert<TReal>( option->GetParameter( i, parameterCount ) ) );
+                  parameterCount++;
+                  }
+                if ( option->GetNumberOfParameters( i ) > parameterCount )
+                  {
+                  typename MetricType::ArrayType meshResolution;
+                  std::vector<TReal> resolution = this->m_Parser->template
+                    ConvertVector<TReal>( option->GetParameter( i, parameterCount ) );
+                  if ( resolution.size() != TDimension )
+                    {
+                    itkExceptionMacro( "Mesh resolution does not match image dimension." );
+                    }
+                  for ( unsigned int d = 0; d < TDimension; d++ )
+                    {
+                    meshResolution[d] = static_cast<unsigned int>( resolution[d] );
+                    }
+                  metric->SetMeshResolution( meshResolution );
+                  parameterCount++;
+                  }
+                if ( option->GetNumberOfParameters( i ) > parameterCount )
+                  {
+                  metric->SetSplineOrder( this->m_Parser->template
+                  Convert<unsigned int>( option->GetParameter( i, parameterCount ) ) );
+                  parameterCount++;
+                  }
+                if ( option->GetNumberOfParameters( i ) > parameterCount )
+                  {
+                  metric->SetNumberOfLevels( this->m_Parser->template
+                  Convert<unsigned int>( option->GetParameter( i, parameterCount ) ) );
+                  parameterCount++;
+                  }
+                if ( option->GetNumberOfParameters( i ) > parameterCount )
+                  {
+                  metric->SetUseAnisotropicCovariances(
+                    this->m_Parser->template Convert<bool>(
+                    option->GetParameter( i, parameterCount ) ) );
+                  parameterCount++;
+                  }
+                if ( option->GetNumberOfParameters( i ) > parameterCount )
+                  {
+                  metric->SetKdTreeRebuildTolerance( this->m_Parser->template
+                  Convert<TReal>( option->GetParameter( i, parameterCount ) ) );
+                  parameterCount++;
+                  }
+
+
+                std::cout << "  B-spline parameters " << std::endl;
+                std::cout << "    mesh resolution: " << metric->GetMeshResolution() << std::endl;
+                std::cout << "    spline order: " << metric->GetSplineOrder() << std::endl;
+                std::cout << "    number of levels: " << metric->GetNumberOfLevels() << std::endl;
+                std::cout << "  Alpha: " << metric->GetAlpha() << std::endl;
+                std::cout << "  kd-tree rebuild tolerance: " << metric->GetKdTreeRebuildTolerance() << std::endl;
+                if ( metric->GetUseAnisotropicCovariances() )
+                  {
+                  std::cout << "  using anisotropic covariances." << std::endl;
+                  }
+
+                similarityMetric->SetMetric( metric );
+                similarityMetric->SetMaximizeMetric( true );
+                similarityMetric->SetFixedPointSet( fixedPointSetReader->GetOutput() );
+                similarityMetric->SetMovingPointSet( movingPointSetReader->GetOutput() );
+                this->m_SimilarityMetrics.push_back( similarityMetric );
+                }
              }
            else  // similarity metric is image-based
               {
               std::cout << "Metric " << i << ": " << " Not a Point-set" << std::endl;
               std::cout << "  Fixed image file: "
-                        << fixedImageFileReader->GetFileName() << std::endl;
+                        << fixedImageFileName << std::endl;
               std::cout << "  Moving image file: "
-                        << movingImageFileReader->GetFileName() << std::endl;
+                        << movingImageFileName << std::endl;
 
               similarityMetric->SetFixedPointSet( NULL);
               similarityMetric->SetMovingPointSet( NULL );
@@ -954,14 +1026,15 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
         + std::string( ",weight,pointSetPercentage,pointSetSigma,boundaryPointsOnly" )
         + std::string( ",kNeighborhood" );
       std::string pseDescription( "PSE/point-set-expectation/PointSetExpectation" );
-      std::string pseOptions(", PartialMatchingIterations=100000]   \n the partial matching option assumes the complete labeling is in the first set of label parameters ... more iterations leads to more symmetry in the matching  - 0 iterations means full asymmetry " );
-//      std::string jtbDescription( "JTB/jensen-tsallis-bspline/JensenTsallisBSpline" );
+      std::string pseOptions(", PartialMatchingIterations=100000, SparseMatching=0, DistanceThreshold=0]   \n the partial matching option assumes the complete labeling is in the first set of label parameters ... more iterations leads to more symmetry in the matching  - 0 iterations means full asymmetry \n sparse matching=1 keeps only the k nearest same-label points of each point and Sinkhorn-normalizes all labels at once;  2 does the same over all point pairs, which needs memory for the product of the point set sizes and is meant for checking 1 on small point sets \n the distance threshold (voxels) drops sparse matches farther apart than it, keeping at least the nearest one;  0 means no limit " );
+      std::string jtbDescription( "JTB/jensen-tsallis-bspline/JensenTsallisBSpline" );
       std::string jtbOptions
         = std::string( ",alpha,meshResolution,splineOrder,numberOfLevels" )
-        + std::string( ",useAnisotropicCovariances]" );
+        + std::string( ",useAnisotropicCovariances,kdTreeRebuildTolerance=0]" )
+        + std::string( "   \n the kd-trees of the point densities are kept between iterations while no point has moved farther than kdTreeRebuildTolerance (physical units) from where they were built;  0 rebuilds them whenever a point moves " );
       pointBasedDescription += (
         newLineTabs + pseDescription + pointBasedOptions + pseOptions +
-        newLineTabs + /*jtbDescription + */ pointBasedOptions + jtbOptions );
+        newLineTabs + jtbDescription + pointBasedOptions + jtbOptions );
       std::string description = weightDescription + intensityBasedDescription
         + pointBasedDescription;
 
@@ -1233,6 +1306,52 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
         this->m_Parser->AddOption( option );
     }
 
+    if (true)
+    {
+        OptionType::Pointer option = OptionType::New();
+        option->SetLongName( "fused-update-field" );
+        option->SetDescription( " true / false -- if true (default), multi-metric registrations warp all metric images in one shared pass and sum the metric updates in a single threaded sweep.  false restores the per-metric loop; both report the update field time per iteration.");
+        std::string nitdefault=std::string("true");
+        option->AddValue(nitdefault);
+        this->m_Parser->AddOption( option );
+    }
+
+    if (true)
+    {
+        OptionType::Pointer option = OptionType::New();
+        option->SetLongName( "metric-sampling" );
+        option->SetDescription( " None / Regular[percentage=0.25,seed] / Random[percentage=0.25,seed] -- evaluate the deformable metric gradients on a fraction of the voxels only;  the gradient smoothing spreads them over the field.  Regular takes one voxel in each run of 1/percentage voxels, at a seeded, jittered position that shifts by one voxel per iteration, Random draws new voxels each iteration.  The percentage may be given per level, e.g. Random[0.1x0.25x1], the last value holding for the remaining levels.  Point-set metrics (PSE, JTB) are always dense, and the energy of a sampled metric is scaled from its samples to the whole image for the convergence test.  None (default) is dense.");
+        std::string nitdefault=std::string("None");
+        option->AddValue(nitdefault);
+        this->m_Parser->AddOption( option );
+    }
+
+    if (true)
+    {
+        OptionType::Pointer option = OptionType::New();
+        option->SetLongName( "checkpoint" );
+        option->SetDescription( " filename[interval=10] -- every interval iterations and at the end of each level, write the state of the deformable optimization (level, iteration, fields, affine and energy history) to filename.  The file is written in the background and replaced atomically.");
+        this->m_Parser->AddOption( option );
+    }
+
+    if (true)
+    {
+        OptionType::Pointer option = OptionType::New();
+        option->SetLongName( "resume" );
+        option->SetDescription( " filename -- continue a registration from a file written by --checkpoint.  The affine stored in it is used and the affine optimization is skipped;  the other options must match those of the interrupted run, except that a level which stopped at its iteration limit goes on when -i allows it more iterations.");
+        this->m_Parser->AddOption( option );
+    }
+
+    if (true)
+    {
+        OptionType::Pointer option = OptionType::New();
+        option->SetLongName( "exponential-integration" );
+        option->SetDescription( " Euler / ScalingAndSquaring[NumberOfSquarings=0,float|double] -- how Exp and SyN-exp velocity fields are integrated.  Euler (default) composes the velocity NTimeSteps times.  ScalingAndSquaring exponentiates it with a threaded, tiled scaling and squaring that computes the forward and inverse fields together;  0 squarings chooses the count from the field magnitude and the intermediate fields are kept in the given precision.");
+        std::string nitdefault=std::string("Euler");
+        option->AddValue(nitdefault);
+        this->m_Parser->AddOption( option );
+    }
+
     //added by songgang
     if (true){
         OptionType::Pointer option = OptionType::New();
@@ -1342,6 +1461,15 @@ PICSLAdvancedNormalizationToolKit<TDimension, TReal>
         this->m_Parser->AddOption( option );
     }
 
+    if (true) {
+        OptionType::Pointer option = OptionType::New();
+        option->SetLongName( "affine-multi-start" );
+        option->SetDescription( "multi-start search of the initial affine on the coarsest level, for badly oriented images: rotation_steps x rotation_range(degrees) x number_of_best_starts x translation_steps x translation_range. rotation_steps angles per axis are scored in parallel with a subsampled MI and the best starts are refined. 0 (default) is off, e.g. 6x180x3 searches all orientations in 60 degree steps. " );
+        std::string nitdefault=std::string("0");
+        option->AddValue(nitdefault);
+        this->m_Parser->AddOption( option );
+    }
+
     if( true )
       {
       std::string description =
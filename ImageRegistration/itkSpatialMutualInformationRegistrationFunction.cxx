@@ -27,6 +27,7 @@
 #include "vnl/vnl_math.h"
 #include "itkDiscreteGaussianImageFilter.h"
 #include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkMultiThreader.h"
 
 namespace itk
 {
@@ -75,6 +76,8 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
   m_FixedImageGradientCalculator = GradientCalculatorType::New();
   m_MovingImageGradientCalculator = GradientCalculatorType::New();
   this->m_Padding=0;
+  this->m_DerivativeTableOversampling=4;
+  this->m_DerivativeTableSize=0;
 
 
   typename DefaultInterpolatorType::Pointer interp =  DefaultInterpolatorType::New();
@@ -125,6 +128,8 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
   os << m_MovingImageBinSize << std::endl;
   os << indent << "InterpolatorIsBSpline: ";
   os << m_InterpolatorIsBSpline << std::endl;
+  os << indent << "DerivativeTableOversampling: ";
+  os << m_DerivativeTableOversampling << std::endl;
 
 }
 
@@ -379,7 +384,15 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
   for (int i=0; i<ImageDimension; i++)
     m_NormalizeMetric*=this->m_FixedImage->GetLargestPossibleRegion().GetSize()[i];
 
-//  std::cout << " F " << std::endl;
+//  std::cout << " Ga " << std::endl;
+
+  this->GetProbabilities();
+//  std::cout << " G " << std::endl;
+ this->ComputeSpatialMutualInformation();
+ // std::cout << " H " << std::endl;
+
+  // the B-spline coefficients are computed in SetInputImage, so the
+  // interpolators are attached once the histograms are filled
   pdfinterpolator->SetInputImage(m_JointPDF);
   pdfinterpolator->SetSplineOrder(3);
   this->pdfinterpolatorXuY->SetInputImage(this->m_JointPDFXuY);
@@ -403,15 +416,43 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
   pdfinterpolator2->SetSplineOrder(3);
   pdfinterpolator3->SetSplineOrder(3);
 
-//  std::cout << " Ga " << std::endl;
+  this->ComputeDerivativeTables();
+}
 
-  this->GetProbabilities();
-//  std::cout << " G " << std::endl;
- this->ComputeSpatialMutualInformation();
- // std::cout << " H " << std::endl;
 
+/**
+ * Tabulate the metric terms on a grid aligned with the histogram bins
+ */
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+void
+SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::ComputeDerivativeTables()
+{
+  this->m_DerivativeTableSize = 0;
+  this->m_DerivativeTable.clear();
+  if ( this->m_DerivativeTableOversampling == 0 )
+    {
+    return;
+    }
 
+  // FitContIndexInBins maps [0,1] to [Padding,NumberOfHistogramBins];  the
+  // nodes fall on the bin centres and in between.
+  const unsigned int intervals =
+    ( m_NumberOfHistogramBins - this->m_Padding ) * this->m_DerivativeTableOversampling;
+  const unsigned int n = intervals + 1;
+  this->m_DerivativeTable.resize( n * n );
 
+  typename  pdfintType::ContinuousIndexType pdfind;
+  for ( unsigned int j = 0; j < n; j++ )
+    {
+    pdfind[1] = this->m_Padding + static_cast<double>( j ) / this->m_DerivativeTableOversampling;
+    for ( unsigned int i = 0; i < n; i++ )
+      {
+      pdfind[0] = this->m_Padding + static_cast<double>( i ) / this->m_DerivativeTableOversampling;
+      this->m_DerivativeTable[i + j * n] = this->ComputeDerivativeTerm( pdfind );
+      }
+    }
+  this->m_DerivativeTableSize = n;
 }
 
 
@@ -425,9 +466,6 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
 ::GetProbabilities()
 {
 
-  typedef ImageRegionConstIteratorWithIndex<FixedImageType> RandomIterator;
-  RandomIterator randIter( this->m_FixedImage, this->m_FixedImage->GetLargestPossibleRegion() );
-
   for ( unsigned int j = 0; j < m_NumberOfHistogramBins; j++ )
     {
       MarginalPDFIndexType mind;
@@ -435,147 +473,37 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
       m_FixedImageMarginalPDF->SetPixel(mind,0);
       m_MovingImageMarginalPDF->SetPixel(mind,0);
     }
-
-  // Reset the joint pdfs to zero
-  m_JointPDF->FillBuffer( 0.0 );
-  m_JointPDFXuY->FillBuffer( 0.0 );
-  m_JointPDFXYu->FillBuffer( 0.0 );
-  m_JointPDFXlY->FillBuffer( 0.0 );
-  m_JointPDFXYl->FillBuffer( 0.0 );
-  m_JointPDFXuYl->FillBuffer( 0.0 );
-  m_JointPDFXlYu->FillBuffer( 0.0 );
-  m_JointPDFXrYu->FillBuffer( 0.0 );
-  m_JointPDFXuYr->FillBuffer( 0.0 );
   m_JointHist->FillBuffer( 0.0 );
 
-  unsigned long nSamples=0;
-  RandomIterator iter( this->m_FixedImage, this->m_FixedImage->GetLargestPossibleRegion() );
-
-  for( iter.GoToBegin(); !iter.IsAtEnd(); ++iter )
-  {
-     bool takesample=true;
-      if (this->m_FixedImageMask) if (this->m_FixedImageMask->GetPixel( iter.GetIndex() ) < 1.e-6 ) takesample=false;
-
-      if (takesample)
+  // One sweep fills all nine histograms.  Each thread counts into its own
+  // buffer and the integer counts are summed in a fixed order, so the
+  // result does not depend on the number of threads.
+  JointHistogramThreadStruct str;
+  str.Function = this;
+
+  typename MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  const unsigned long numberOfBins = m_NumberOfHistogramBins * m_NumberOfHistogramBins;
+  str.Histograms.assign( threader->GetNumberOfThreads(),
+    std::vector<unsigned long>( NumberOfJointHistograms * numberOfBins, 0 ) );
+  threader->SetSingleMethod( Self::JointHistogramThreaderCallback, &str );
+  threader->SingleMethodExecute();
+
+  JointPDFType *jointPDFs[NumberOfJointHistograms] = { m_JointPDF, m_JointPDFXuY, m_JointPDFXYu,
+    m_JointPDFXlY, m_JointPDFXYl, m_JointPDFXuYl, m_JointPDFXlYu, m_JointPDFXrYu, m_JointPDFXuYr };
+  for ( unsigned int h = 0; h < NumberOfJointHistograms; h++ )
+    {
+    JointPDFValueType *pdfPtr = jointPDFs[h]->GetBufferPointer();
+    for ( unsigned long bin = 0; bin < numberOfBins; bin++ )
       {
-          // Get sampled index
-          FixedImageIndexType index = iter.GetIndex();
-          FixedImageIndexType IndexU = index;
-          FixedImageIndexType IndexL = index;
-          FixedImageIndexType IndexR = index;
-
-          // check the neighboring voxel to be in the image
-          typename FixedImageType::SizeType imagesize=this->m_FixedImage->GetLargestPossibleRegion().GetSize();
-          bool inimage=true;
-          for (unsigned int dd=0; dd<ImageDimension; dd++)
-          {
-            if ( index[dd] < 1 || index[dd] > static_cast<typename IndexType::IndexValueType>(imagesize[dd]-2) )
-              inimage=false;
-          }
-
-//            std::cout << " Image size? " << imagesize << std::endl;
-
-          if (inimage)
-          {
-            IndexU[0] = index[0] - 1;
-            IndexL[1] = index[1] - 1;
-            IndexR[1] = index[1] + 1;
-
-              double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( index )  );
-              double fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( index )  );
-              unsigned int movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              unsigned int fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              JointPDFValueType *pdfPtr = m_JointPDF->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              int pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( index )  );
-              fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( IndexU )  );
-              movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              pdfPtr = m_JointPDFXuY->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( IndexU )  );
-              fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( index )  );
-              movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              pdfPtr = m_JointPDFXYu->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( index )  );
-              fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( IndexL )  );
-              movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              pdfPtr = m_JointPDFXlY->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( IndexL )  );
-              fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( index )  );
-              movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              pdfPtr = m_JointPDFXYl->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( IndexL )  );
-              fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( IndexU )  );
-              movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              pdfPtr = m_JointPDFXuYl->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( IndexU )  );
-              fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( IndexL )  );
-              movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              pdfPtr = m_JointPDFXlYu->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( IndexU )  );
-              fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( IndexR )  );
-              movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              pdfPtr = m_JointPDFXrYu->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( IndexR )  );
-              fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( IndexU )  );
-              movingImageParzenWindowIndex=this->FitIndexInBins(  movingImageValue );
-              fixedImageParzenWindowIndex=this->FitIndexInBins( fixedImageValue  );
-
-              pdfPtr = m_JointPDFXuYr->GetBufferPointer() + ( fixedImageParzenWindowIndex* m_NumberOfHistogramBins );
-              pdfMovingIndex = static_cast<int>( movingImageParzenWindowIndex );
-              pdfPtr += pdfMovingIndex;
-              *(pdfPtr) += static_cast<PDFValueType>( 1 );
-
-              ++nSamples;
-          }
+      unsigned long count = 0;
+      for ( unsigned int t = 0; t < str.Histograms.size(); t++ )
+        {
+        count += str.Histograms[t][h * numberOfBins + bin];
+        }
+      pdfPtr[bin] = static_cast<PDFValueType>( count );
       }
-  }
-//    std::cout << " Image Rotation Number " << nSamples << std::endl;
+    }
 
   /**
    * Normalize the PDFs, compute moving image marginal PDF
@@ -706,6 +634,97 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
 
 
 
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+ITK_THREAD_RETURN_TYPE
+SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::JointHistogramThreaderCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  JointHistogramThreadStruct *str = static_cast<JointHistogramThreadStruct *>( info->UserData );
+  ThreadIdType threadId = info->ThreadID;
+  ThreadIdType threadCount = info->NumberOfThreads;
+
+  // one slab of the fixed image per thread
+  typename FixedImageType::RegionType region =
+    str->Function->m_FixedImage->GetLargestPossibleRegion();
+  const unsigned int splitAxis = ImageDimension - 1;
+  unsigned long range = region.GetSize()[splitAxis];
+  unsigned long valuesPerThread = ( range + threadCount - 1 ) / threadCount;
+  if ( valuesPerThread == 0 || threadId*valuesPerThread >= range || threadId >= str->Histograms.size() )
+    {
+    return ITK_THREAD_RETURN_VALUE;
+    }
+  unsigned long extent = vnl_math_min( valuesPerThread, range - threadId*valuesPerThread );
+  IndexType sindex = region.GetIndex();
+  SizeType ssize = region.GetSize();
+  sindex[splitAxis] += threadId*valuesPerThread;
+  ssize[splitAxis] = extent;
+  region.SetIndex( sindex );
+  region.SetSize( ssize );
+
+  str->Function->ThreadedJointHistograms( region, str->Histograms[threadId] );
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+void
+SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::ThreadedJointHistograms( const typename FixedImageType::RegionType & region,
+                           std::vector<unsigned long> & histograms )
+{
+  typedef ImageRegionConstIteratorWithIndex<FixedImageType> IteratorType;
+  IteratorType iter( this->m_FixedImage, region );
+
+  const unsigned long nbins = m_NumberOfHistogramBins;
+  const unsigned long numberOfBins = nbins * nbins;
+  typename FixedImageType::SizeType imagesize=this->m_FixedImage->GetLargestPossibleRegion().GetSize();
+
+  for( iter.GoToBegin(); !iter.IsAtEnd(); ++iter )
+    {
+    FixedImageIndexType index = iter.GetIndex();
+    if (this->m_FixedImageMask) if (this->m_FixedImageMask->GetPixel( index ) < 1.e-6 ) continue;
+
+    // check the neighboring voxels to be in the image
+    bool inimage=true;
+    for (unsigned int dd=0; dd<ImageDimension; dd++)
+      {
+      if ( index[dd] < 1 || index[dd] > static_cast<typename IndexType::IndexValueType>(imagesize[dd]-2) )
+        inimage=false;
+      }
+    if (!inimage) continue;
+
+    FixedImageIndexType IndexU = index;
+    FixedImageIndexType IndexL = index;
+    FixedImageIndexType IndexR = index;
+    IndexU[0] = index[0] - 1;
+    IndexL[1] = index[1] - 1;
+    IndexR[1] = index[1] + 1;
+
+    // bins of the fixed and moving intensities at the voxel and at its
+    // upper, left and right neighbours
+    const unsigned long fX = this->FitIndexInBins( this->GetFixedParzenTerm( iter.Get() ) );
+    const unsigned long fU = this->FitIndexInBins( this->GetFixedParzenTerm( this->m_FixedImage->GetPixel( IndexU ) ) );
+    const unsigned long fL = this->FitIndexInBins( this->GetFixedParzenTerm( this->m_FixedImage->GetPixel( IndexL ) ) );
+    const unsigned long fR = this->FitIndexInBins( this->GetFixedParzenTerm( this->m_FixedImage->GetPixel( IndexR ) ) );
+    const unsigned long mX = this->FitIndexInBins( this->GetMovingParzenTerm( this->m_MovingImage->GetPixel( index ) ) );
+    const unsigned long mU = this->FitIndexInBins( this->GetMovingParzenTerm( this->m_MovingImage->GetPixel( IndexU ) ) );
+    const unsigned long mL = this->FitIndexInBins( this->GetMovingParzenTerm( this->m_MovingImage->GetPixel( IndexL ) ) );
+    const unsigned long mR = this->FitIndexInBins( this->GetMovingParzenTerm( this->m_MovingImage->GetPixel( IndexR ) ) );
+
+    histograms[ HistXY   * numberOfBins + fX * nbins + mX ]++;
+    histograms[ HistXuY  * numberOfBins + fU * nbins + mX ]++;
+    histograms[ HistXYu  * numberOfBins + fX * nbins + mU ]++;
+    histograms[ HistXlY  * numberOfBins + fL * nbins + mX ]++;
+    histograms[ HistXYl  * numberOfBins + fX * nbins + mL ]++;
+    histograms[ HistXuYl * numberOfBins + fU * nbins + mL ]++;
+    histograms[ HistXlYu * numberOfBins + fL * nbins + mU ]++;
+    histograms[ HistXrYu * numberOfBins + fR * nbins + mU ]++;
+    histograms[ HistXuYr * numberOfBins + fU * nbins + mR ]++;
+    }
+}
+
+
 /**
  * Get the both Value and Derivative Measure
  */
@@ -715,27 +734,38 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
 ::GetValueAndDerivative(IndexType oindex, MeasureType& valuei,
             DerivativeType& derivative1,DerivativeType& derivative2)
 {
-  double value=0;
-  DerivativeType zero(ImageDimension);
-  zero.Fill(0);
+  return this->GetDerivativeTerm( oindex );
+}
 
 
-  double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( oindex )  );
-  double fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( oindex )  );
-  double movingImageParzenWindowContIndex=this->FitContIndexInBins(  movingImageValue );
-  double fixedImageParzenWindowContIndex=this->FitContIndexInBins( fixedImageValue  );
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+double
+SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::GetValueAndDerivativeInv(IndexType oindex,
+            MeasureType& valuei,
+            DerivativeType& derivative1,DerivativeType& derivative2)
+{
+  // the inverse term is switched off
+  return 0;
+}
+
 
+/**
+ * The metric term at a continuous bin position
+ */
+template < class TFixedImage, class TMovingImage  , class TDisplacementField>
+double
+SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
+::ComputeDerivativeTerm( const typename pdfintType::ContinuousIndexType & pdfind )
+{
+  double value=0;
   double dJPDF=0,jointPDFValue=0;
 
-
-  double jointPDFValueXuY = 0, dJPDFXuY = 0, jointPDFValueXYu = 0, dJPDFXYu = 0, jointPDFValueXlY = 0, dJPDFXlY = 0, jointPDFValueXYl = 0;
-  double dJPDFXYl = 0, jointPDFValueXuYl = 0, dJPDFXuYl = 0, jointPDFValueXlYu = 0,    dJPDFXlYu = 0, jointPDFValueXuYr = 0, dJPDFXuYr = 0, jointPDFValueXrYu = 0,    dJPDFXrYu = 0;
+    double jointPDFValueXuY = 0, dJPDFXuY = 0, jointPDFValueXYu = 0, dJPDFXYu = 0, jointPDFValueXlY = 0, dJPDFXlY = 0, jointPDFValueXYl = 0;
+    double dJPDFXYl = 0, jointPDFValueXuYl = 0, dJPDFXuYl = 0, jointPDFValueXlYu = 0,    dJPDFXlYu = 0, jointPDFValueXuYr = 0, dJPDFXuYr = 0, jointPDFValueXrYu = 0,    dJPDFXrYu = 0;
 
     {
         /** take derivative of joint pdf with respect to the b-spline */
-        typename  pdfintType::ContinuousIndexType pdfind;
-        pdfind[1]= fixedImageParzenWindowContIndex;
-        pdfind[0]= movingImageParzenWindowContIndex;
         jointPDFValue = pdfinterpolator->EvaluateAtContinuousIndex(pdfind);
         dJPDF = (1.0)*(pdfinterpolator->EvaluateDerivativeAtContinuousIndex( pdfind ))[1];
 
@@ -778,74 +808,6 @@ SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacem
 }
 
 
-template < class TFixedImage, class TMovingImage  , class TDisplacementField>
-double
-SpatialMutualInformationRegistrationFunction<TFixedImage,TMovingImage,TDisplacementField>
-::GetValueAndDerivativeInv(IndexType oindex,
-            MeasureType& valuei,
-            DerivativeType& derivative1,DerivativeType& derivative2)
-{
-  double value=0;
-  DerivativeType zero(ImageDimension);
-  zero.Fill(0);
-
-  double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( oindex )  );
-  double fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( oindex )  );
-  double movingImageParzenWindowContIndex=this->FitContIndexInBins(  movingImageValue );
-  double fixedImageParzenWindowContIndex=this->FitContIndexInBins( fixedImageValue  );
-
-  double dJPDF=0,jointPDFValue=0;
-
-    double jointPDFValueXuY = 0, dJPDFXuY = 0, jointPDFValueXYu = 0, dJPDFXYu = 0, jointPDFValueXlY = 0, dJPDFXlY = 0, jointPDFValueXYl = 0;
-    double dJPDFXYl = 0, jointPDFValueXuYl = 0, dJPDFXuYl = 0, jointPDFValueXlYu = 0,    dJPDFXlYu = 0, jointPDFValueXuYr = 0, dJPDFXuYr = 0, jointPDFValueXrYu = 0,    dJPDFXrYu = 0;
-
-    {
-        /** take derivative of joint pdf with respect to the b-spline */
-        typename  pdfintType::ContinuousIndexType pdfind;
-        pdfind[1]= fixedImageParzenWindowContIndex;
-        pdfind[0]= movingImageParzenWindowContIndex;
-        jointPDFValue = pdfinterpolator->EvaluateAtContinuousIndex(pdfind);
-        dJPDF = (1.0)*(pdfinterpolator->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-        jointPDFValueXuY = pdfinterpolatorXuY->EvaluateAtContinuousIndex(pdfind);
-        dJPDFXuY = (1.0)*(pdfinterpolatorXuY->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-        jointPDFValueXYu = pdfinterpolatorXYu->EvaluateAtContinuousIndex(pdfind);
-        dJPDFXYu = (1.0)*(pdfinterpolatorXYu->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-        jointPDFValueXlY = pdfinterpolatorXlY->EvaluateAtContinuousIndex(pdfind);
-        dJPDFXlY = (1.0)*(pdfinterpolatorXlY->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-        jointPDFValueXYl = pdfinterpolatorXYl->EvaluateAtContinuousIndex(pdfind);
-        dJPDFXYl = (1.0)*(pdfinterpolatorXYl->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-        jointPDFValueXuYl = pdfinterpolatorXuYl->EvaluateAtContinuousIndex(pdfind);
-        dJPDFXuYl = (1.0)*(pdfinterpolatorXuYl->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-        jointPDFValueXlYu = pdfinterpolatorXlYu->EvaluateAtContinuousIndex(pdfind);
-        dJPDFXlYu = (1.0)*(pdfinterpolatorXlYu->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-        jointPDFValueXuYr = pdfinterpolatorXuYr->EvaluateAtContinuousIndex(pdfind);
-        dJPDFXuYr = (1.0)*(pdfinterpolatorXuYr->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-        jointPDFValueXrYu = pdfinterpolatorXrYu->EvaluateAtContinuousIndex(pdfind);
-        dJPDFXrYu = (1.0)*(pdfinterpolatorXrYu->EvaluateDerivativeAtContinuousIndex( pdfind ))[0];
-
-    }
-
-    double eps=1.e-12;
-    if( jointPDFValue > eps &&  jointPDFValueXuY > eps && jointPDFValueXYu > eps && jointPDFValueXlY > eps && jointPDFValueXYl > eps && jointPDFValueXuYl > eps && jointPDFValueXlYu > eps && jointPDFValueXrYu > eps && jointPDFValueXuYr > eps)
-    {
-        value = 4 * dJPDF / jointPDFValue + dJPDFXuYl / jointPDFValueXuYl +  dJPDFXlYu / jointPDFValueXlYu + dJPDFXuYr / jointPDFValueXuYr + dJPDFXrYu / jointPDFValueXrYu
-        - 2 * dJPDFXYu / jointPDFValueXYu - 2 * dJPDFXuY / jointPDFValueXuY - 2 * dJPDFXYl / jointPDFValueXYl - 2 * dJPDFXlY / jointPDFValueXlY;
-
-    }  // end if-block to check non-zero bin contribution
-    else value = 0;
-    // return 0;
-    return (value/4)*(0);
-}
-
-
 
 
 
@@ -38,6 +38,9 @@
 #include "itkGradientRecursiveGaussianImageFilter.h"
 #include "itkSpatialObject.h"
 #include "itkConstNeighborhoodIterator.h"
+#include "itkMultiThreader.h"
+#include "vnl/vnl_math.h"
+#include <vector>
 
 namespace itk
 {
@@ -294,6 +297,38 @@ public:
 
   void GetProbabilities();
 
+  /** The per-voxel metric term depends only on the continuous bin position
+   * of the intensity pair.  After the histograms are built it is
+   * tabulated with this many nodes per bin and looked up bilinearly;  0
+   * evaluates the nine B-spline interpolators at every voxel. */
+  itkSetMacro( DerivativeTableOversampling, unsigned int );
+  itkGetConstMacro( DerivativeTableOversampling, unsigned int );
+
+  /** The metric term at one voxel, for the moving image gradient. */
+  inline double GetDerivativeTerm( const IndexType & oindex )
+  {
+    double movingImageValue = this->GetMovingParzenTerm(  this->m_MovingImage->GetPixel( oindex )  );
+    double fixedImageValue = this->GetFixedParzenTerm(  this->m_FixedImage->GetPixel( oindex )  );
+    typename  pdfintType::ContinuousIndexType pdfind;
+    pdfind[1]= this->FitContIndexInBins( fixedImageValue  );
+    pdfind[0]= this->FitContIndexInBins(  movingImageValue );
+
+    const unsigned int n = this->m_DerivativeTableSize;
+    const double x = ( pdfind[0] - this->m_Padding ) * this->m_DerivativeTableOversampling;
+    const double y = ( pdfind[1] - this->m_Padding ) * this->m_DerivativeTableOversampling;
+    if ( n > 1 && x >= 0 && x <= n - 1 && y >= 0 && y <= n - 1 )
+      {
+      const unsigned int i = vnl_math_min( static_cast<unsigned int>( x ), n - 2 );
+      const unsigned int j = vnl_math_min( static_cast<unsigned int>( y ), n - 2 );
+      const double fx = x - i;
+      const double fy = y - j;
+      const double *t = &this->m_DerivativeTable[i + j * n];
+      return ( 1.0 - fy ) * ( ( 1.0 - fx ) * t[0] + fx * t[1] ) +
+        fy * ( ( 1.0 - fx ) * t[n] + fx * t[n + 1] );
+      }
+    return this->ComputeDerivativeTerm( pdfind );
+  }
+
 
   double ComputeMutualInformation()
     {
@@ -435,13 +470,10 @@ public:
 
     CovariantVectorType fixedGradient;
     double loce=0.0;
-    ParametersType fdvec1(ImageDimension);
-    ParametersType fdvec2(ImageDimension);
-    fdvec1.Fill(0);
-    fdvec2.Fill(0);
     fixedGradient = m_FixedImageGradientCalculator->EvaluateAtIndex( oindex );
     double nccm1=0;
-    loce=this->GetValueAndDerivativeInv(oindex,nccm1,fdvec1,fdvec2);
+    DerivativeType unused;
+    loce=this->GetValueAndDerivativeInv(oindex,nccm1,unused,unused);
     float eps=10;
     if ( loce > eps ) loce=eps;
     if ( loce < eps*(-1.0) ) loce=eps*(-1.0);
@@ -516,14 +548,9 @@ public:
 
     CovariantVectorType movingGradient;
     double loce=0.0;
-    ParametersType fdvec1(ImageDimension);
-    ParametersType fdvec2(ImageDimension);
-    fdvec1.Fill(0);
-    fdvec2.Fill(0);
     movingGradient = m_MovingImageGradientCalculator->EvaluateAtIndex( oindex );
 
-    double nccm1=0;
-    loce=this->GetValueAndDerivative(oindex,nccm1,fdvec1,fdvec2);
+    loce=this->GetDerivativeTerm(oindex);
 
     float eps=10;
     if ( loce > eps ) loce=eps;
@@ -607,12 +634,41 @@ private:
   SpatialMutualInformationRegistrationFunction(const Self&); //purposely not implemented
   void operator=(const Self&); //purposely not implemented
 
+  typedef BSplineInterpolateImageFunction<JointPDFType,double> pdfintType;
+
+  /** Exact metric term at a continuous bin position, from the nine joint
+   * PDF interpolators. */
+  double ComputeDerivativeTerm( const typename pdfintType::ContinuousIndexType & pdfind );
+
+  /** Tabulate the metric term over the histogram domain. */
+  void ComputeDerivativeTables();
+
+  /** The joint histogram and the eight neighbour-offset histograms, in the
+   * order they are laid out in the per-thread buffers. */
+  enum { HistXY, HistXuY, HistXYu, HistXlY, HistXYl, HistXuYl, HistXlYu, HistXrYu, HistXuYr, NumberOfJointHistograms };
+
+  /** Each thread bins one slab of the fixed image into its own buffer of
+   * all nine histograms;  GetProbabilities adds them up. */
+  struct JointHistogramThreadStruct
+    {
+    Self                                     *Function;
+    std::vector< std::vector<unsigned long> > Histograms;
+    };
+
+  static ITK_THREAD_RETURN_TYPE JointHistogramThreaderCallback( void *arg );
+
+  void ThreadedJointHistograms( const typename FixedImageType::RegionType & region,
+                                std::vector<unsigned long> & histograms );
+
+  unsigned int        m_DerivativeTableOversampling;
+  unsigned int        m_DerivativeTableSize;
+  std::vector<double> m_DerivativeTable;
+
 
    typename JointPDFType::Pointer m_JointHist;
   typename JointPDFDerivativesType::Pointer m_JointPDFDerivatives;
 
 
-  typedef BSplineInterpolateImageFunction<JointPDFType,double> pdfintType;
   typename pdfintType::Pointer pdfinterpolator;
 
   //  typename JointPDFType::Pointer m_JointEntropy;
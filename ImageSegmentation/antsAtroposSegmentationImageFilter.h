@@ -23,6 +23,7 @@
 
 #include "antsListSampleFunction.h"
 #include "antsListSampleToListSampleFilter.h"
+#include "antsSparseProbabilityImage.h"
 
 #include "itkArray.h"
 #include "itkBSplineScatteredDataPointSetToImageFilter.h"
@@ -30,11 +31,15 @@
 #include "itkFixedArray.h"
 #include "itkListSample.h"
 #include "itkMersenneTwisterRandomVariateGenerator.h"
+#include "itkMultiThreader.h"
 #include "itkNeighborhoodIterator.h"
 #include "itkPointSet.h"
 #include "itkSymmetricSecondRankTensor.h"
 #include "itkVector.h"
 
+#include "vnl/vnl_matrix.h"
+#include "vnl/vnl_random.h"
+
 #include <algorithm>
 #include <vector>
 #include <map>
@@ -107,8 +112,7 @@ public:
   typedef typename RealImageType::Pointer             RealImagePointer;
 
   typedef FixedArray<unsigned, ImageDimension>        ArrayType;
-  typedef PointSet<RealType, 1>                       SparseImageType;
-  typedef typename SparseImageType::Pointer           SparseImagePointer;
+  typedef SparseProbabilityImage<RealImageType>      SparseImageType;
 
   /** Mixture model component typedefs */
   typedef Array<RealType>                             MeasurementVectorType;
@@ -412,6 +416,13 @@ public:
    */
   itkGetConstMacro( ProbabilityThreshold, RealType );
 
+  /**
+   * Seed the random number generator used for the random initialization and
+   * the ICM visiting order.  By default it is seeded from the clock, so that
+   * repeated runs differ;  a fixed seed makes them reproducible.
+   */
+  void SetRandomSeed( unsigned int seed );
+
   // The following parameters are used for adaptive smoothing of one or more of
   // the intensity images.
 
@@ -528,6 +539,15 @@ public:
    */
   RealImagePointer GetPriorProbabilityImage( unsigned int whichClass ) const;
 
+  /**
+   * Get the prior probability of a class at a voxel without building the
+   * prior image.  Returns false if there are no prior images or the class
+   * is a partial volume class, and throws for a class out of range, as
+   * GetPriorProbabilityImage() does.
+   */
+  bool GetPriorProbability( unsigned int whichClass, const IndexType & index,
+    RealType & priorProbability ) const;
+
   /**
    * Set the prior label image which is assumed to have intensity values \in
    * {1,...,numberOfClasses}
@@ -793,8 +813,32 @@ private:
   void EvaluateMRFNeighborhoodWeights(
     ConstNeighborhoodIterator<ClassifiedImageType>, Array<RealType> & );
 
+  /**
+   * Relabel the center voxel of the iterator given the likelihoods of all
+   * classes in a column of a class-by-voxel matrix.  The randomizer picks
+   * the label of a voxel at which every posterior probability vanishes.
+   */
   RealType PerformLocalLabelingUpdate(
-    NeighborhoodIterator<ClassifiedImageType> );
+    NeighborhoodIterator<ClassifiedImageType> &, const vnl_matrix<RealType> &,
+    unsigned int, vnl_random & );
+
+  /**
+   * Asynchronous updating:  the voxels of one ICM code are updated in blocks
+   * on all threads.  The likelihoods of a block are evaluated class by class
+   * with EvaluateBlock() before its voxels are relabeled.  Each block has its
+   * own randomizer seeded beforehand, and the block sums are added in block
+   * order, so that the labeling does not depend on the number of threads.
+   */
+  struct ICMThreadStruct
+    {
+    Self                                   *Filter;
+    const std::vector<OffsetValueType>     *Voxels;
+    unsigned long                          BlockSize;
+    std::vector<unsigned long>             BlockSeeds;
+    std::vector<RealType>                  BlockPosteriorSums;
+    };
+
+  static ITK_THREAD_RETURN_TYPE ICMThreaderCallback( void *arg );
 
 
   // ivars
@@ -835,6 +879,7 @@ private:
 
   unsigned int                                   m_MaximumICMCode;
   ClassifiedImagePointer                         m_ICMCodeImage;
+  std::vector<std::vector<OffsetValueType> >     m_ICMCodeVoxels;
   bool                                           m_UseAsynchronousUpdating;
   unsigned int                                   m_MaximumNumberOfICMIterations;
 
@@ -843,7 +888,7 @@ private:
   LabelParameterMapType                          m_PriorLabelParameterMap;
   RealType                                       m_ProbabilityThreshold;
   std::vector<RealImagePointer>                  m_PriorProbabilityImages;
-  std::vector<SparseImagePointer>                m_PriorProbabilitySparseImages;
+  std::vector<SparseImageType>                   m_PriorProbabilitySparseImages;
 
   unsigned int                                   m_SplineOrder;
   ArrayType                                      m_NumberOfLevels;
@@ -864,44 +909,6 @@ private:
 
   typename ClassifiedImageType::ConstPointer     m_PriorLabelImage;
   typename MaskImageType::ConstPointer           m_MaskImage;
-
-  // inline functions to help with the sparse image creation
-
-  inline typename RealImageType::IndexType NumberToIndex(
-    unsigned long number, const SizeType size ) const
-    {
-    IndexType k;
-    k[0] = 1;
-
-    for ( unsigned int i = 1; i < ImageDimension; i++ )
-      {
-      k[i] = size[i-1]*k[i-1];
-      }
-    IndexType index;
-    for ( unsigned int i = 0; i < ImageDimension; i++ )
-      {
-      index[ImageDimension-i-1]
-        = static_cast<unsigned long>( number/k[ImageDimension-i-1] );
-      number %= k[ImageDimension-i-1];
-      }
-    return index;
-    }
-
-  inline unsigned long IndexToNumber( const IndexType k,
-    const SizeType size ) const
-    {
-    unsigned long number = k[0];
-    for ( unsigned int i = 1; i < ImageDimension; i++ )
-      {
-      unsigned long s = 1;
-      for( unsigned int j = 0; j < i; j++ )
-        {
-        s *= size[j];
-        }
-      number += s*k[i];
-      }
-    return number;
-    }
 };
 
 } // namespace ants
@@ -123,6 +123,15 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
 {
 }
 
+template <class TInputImage, class TMaskImage, class TClassifiedImage>
+void
+AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
+::SetRandomSeed( unsigned int seed )
+{
+  this->m_Randomizer->Initialize( seed );
+  this->Modified();
+}
+
 template <class TInputImage, class TMaskImage, class TClassifiedImage>
 void
 AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
@@ -183,45 +192,14 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
     }
   if( this->m_MinimizeMemoryUsage )
     {
-    // To make matters simpler, we force the index to be zero
-    //   for each priorImage image.
-
-    typename RealImageType::IndexType startIndex =
-      priorImage->GetRequestedRegion().GetIndex();
-
-    typename SparseImageType::Pointer sparsePriorImage = SparseImageType::New();
-    sparsePriorImage->Initialize();
-
-    unsigned long count = 0;
-
-    ImageRegionConstIteratorWithIndex<RealImageType> It( priorImage,
-      priorImage->GetRequestedRegion() );
-    for( It.GoToBegin(); !It.IsAtEnd(); ++It )
-      {
-      if( It.Get() > this->m_ProbabilityThreshold )
-        {
-        typename RealImageType::IndexType index = It.GetIndex();
-        for( unsigned int d = 0; d < ImageDimension; d++ )
-          {
-          index[d] -= startIndex[d];
-          }
-
-        unsigned long number = this->IndexToNumber(
-         index, priorImage->GetRequestedRegion().GetSize() );
-
-        typename SparseImageType::PointType imageNumberIndex;
-        imageNumberIndex[0] = number;
-
-        sparsePriorImage->SetPoint( count, imageNumberIndex );
-        sparsePriorImage->SetPointData( count, It.Get() );
-        count++;
-        }
-      }
+    // Only the voxels above the probability threshold are kept.  Indices
+    //   are relative to the start index of each priorImage image.
     if( this->m_PriorProbabilitySparseImages.size() < whichClass )
       {
       this->m_PriorProbabilitySparseImages.resize( whichClass );
       }
-    this->m_PriorProbabilitySparseImages[whichClass-1] = sparsePriorImage;
+    this->m_PriorProbabilitySparseImages[whichClass-1].SetImage( priorImage,
+      this->m_ProbabilityThreshold );
     }
   else
     {
@@ -283,29 +261,58 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
     priorImage->Allocate();
     priorImage->FillBuffer( 0 );
 
-    typename SparseImageType::Pointer sparsePriorImage =
-      this->m_PriorProbabilitySparseImages[whichClass-1];
+    this->m_PriorProbabilitySparseImages[whichClass-1].FillImage( priorImage );
+    return priorImage;
+    }
+  else
+    {
+    return this->m_PriorProbabilityImages[whichClass-1];
+    }
+}
 
-    typename SparseImageType::PointsContainer::ConstIterator It =
-      sparsePriorImage->GetPoints()->Begin();
-    typename SparseImageType::PointDataContainer::ConstIterator ItD =
-      sparsePriorImage->GetPointData()->Begin();
-    while( It != sparsePriorImage->GetPoints()->End() )
+template <class TInputImage, class TMaskImage, class TClassifiedImage>
+bool
+AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
+::GetPriorProbability( unsigned int whichClass, const IndexType & index,
+  RealType & priorProbability ) const
+{
+  if( this->m_InitializationStrategy != PriorProbabilityImages )
+    {
+    return false;
+    }
+  if( whichClass < 1 || ( this->m_NumberOfPartialVolumeClasses == 0 &&
+    whichClass > this->m_NumberOfTissueClasses ) )
+    {
+    itkExceptionMacro( "The requested prior probability image = "
+      << whichClass << " should be in the range [1, "
+      << this->m_NumberOfTissueClasses << "]" );
+    }
+  else if( whichClass > this->m_NumberOfTissueClasses )
+    {
+    return false;
+    }
+  if( this->m_MinimizeMemoryUsage )
+    {
+    if( this->m_PriorProbabilitySparseImages.size() != this->m_NumberOfTissueClasses )
       {
-      unsigned long number = static_cast<unsigned long>( It.Value()[0] );
-      typename RealImageType::IndexType index2 =
-        this->NumberToIndex( number, priorImage->GetRequestedRegion().GetSize() );
-      priorImage->SetPixel( index2, ItD.Value() );
-
-      ++It;
-      ++ItD;
+      itkExceptionMacro( "The number of prior probability images does not "
+        << "equal the number of classes." );
       }
-    return priorImage;
+    // The sparse images index from zero, as GetPriorProbabilityImage() does.
+    priorProbability =
+      this->m_PriorProbabilitySparseImages[whichClass-1].GetValue( index );
     }
   else
     {
-    return this->m_PriorProbabilityImages[whichClass-1];
+    if( this->m_PriorProbabilityImages.size() != this->m_NumberOfTissueClasses )
+      {
+      itkExceptionMacro( "The number of prior probability images does not "
+        << "equal the number of classes." );
+      }
+    priorProbability =
+      this->m_PriorProbabilityImages[whichClass-1]->GetPixel( index );
     }
+  return true;
 }
 
 template <class TInputImage, class TMaskImage, class TClassifiedImage>
@@ -639,10 +646,9 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
         {
         continue;
         }
-      RealImagePointer priorProbabilityImage =
-        this->GetPriorProbabilityImage( label );
-      weights[label-1].SetElement( count[label-1]++,
-        priorProbabilityImage->GetPixel( ItO.GetIndex() ) );
+      RealType priorProbability = 0.0;
+      this->GetPriorProbability( label, ItO.GetIndex(), priorProbability );
+      weights[label-1].SetElement( count[label-1]++, priorProbability );
       }
     }
 
@@ -1256,13 +1262,9 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
       this->ComputeICMCodeImage();
       }
 
-    typename NeighborhoodIterator<ClassifiedImageType>::RadiusType radius;
-    for( unsigned int d = 0; d < ImageDimension; d++ )
-      {
-      radius[d] = this->m_MRFRadius[d];
-      }
-    NeighborhoodIterator<ClassifiedImageType> ItO( radius, this->GetOutput(),
-      this->GetOutput()->GetRequestedRegion() );
+    ICMThreadStruct str;
+    str.Filter = this;
+    str.BlockSize = 1024;
 
     maxPosteriorSum = 0.0;
     RealType oldMaxPosteriorSum = -1.0;
@@ -1293,14 +1295,32 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
         icmCodeSet[j] = tmp;
         }
 
+      // Voxels sharing an ICM code are outside each other's MRF
+      // neighborhoods, so those of one code can be relabeled concurrently.
       for( unsigned int n = 0; n < icmCodeSet.Size(); n++ )
         {
-        for( ItO.GoToBegin(); !ItO.IsAtEnd(); ++ItO )
+        str.Voxels = &this->m_ICMCodeVoxels[icmCodeSet[n]-1];
+        unsigned long numberOfBlocks =
+          ( str.Voxels->size() + str.BlockSize - 1 ) / str.BlockSize;
+        str.BlockSeeds.resize( numberOfBlocks );
+        for( unsigned long b = 0; b < numberOfBlocks; b++ )
           {
-          if( this->m_ICMCodeImage->GetPixel( ItO.GetIndex() ) == icmCodeSet[n] )
-            {
-            maxPosteriorSum += this->PerformLocalLabelingUpdate( ItO );
-            }
+          str.BlockSeeds[b] = this->m_Randomizer->GetIntegerVariate();
+          }
+        str.BlockPosteriorSums.assign( numberOfBlocks, 0.0 );
+
+        this->GetMultiThreader()->SetNumberOfThreads( this->GetNumberOfThreads() );
+        for( unsigned int k = 0; k < this->m_MixtureModelComponents.size(); k++ )
+          {
+          this->m_MixtureModelComponents[k]->SetNumberOfThreads(
+            this->GetMultiThreader()->GetNumberOfThreads() );
+          }
+        this->GetMultiThreader()->SetSingleMethod( this->ICMThreaderCallback, &str );
+        this->GetMultiThreader()->SingleMethodExecute();
+
+        for( unsigned long b = 0; b < numberOfBlocks; b++ )
+          {
+          maxPosteriorSum += str.BlockPosteriorSums[b];
           }
         }
       itkDebugMacro( "ICM posterior probability sum: "  << maxPosteriorSum );
@@ -1589,14 +1609,12 @@ template <class TInputImage, class TMaskImage, class TClassifiedImage>
 typename AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
 ::RealType
 AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
-::PerformLocalLabelingUpdate( NeighborhoodIterator<ClassifiedImageType> It )
+::PerformLocalLabelingUpdate( NeighborhoodIterator<ClassifiedImageType> & It,
+  const vnl_matrix<RealType> & likelihoods, unsigned int column,
+  vnl_random & randomizer )
 {
-  MeasurementVectorType measurement;
-  measurement.SetSize( this->m_NumberOfIntensityImages );
-  for( unsigned int i = 0; i < this->m_NumberOfIntensityImages; i++ )
-    {
-    measurement[i] = this->GetIntensityImage( i )->GetPixel( It.GetIndex() );
-    }
+  unsigned int totalNumberOfClasses = this->m_NumberOfTissueClasses +
+    this->m_NumberOfPartialVolumeClasses;
 
   RealType mrfSmoothingFactor = this->m_MRFSmoothingFactor;
   if( this->m_MRFCoefficientImage )
@@ -1604,49 +1622,49 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
     mrfSmoothingFactor = this->m_MRFCoefficientImage->GetPixel( It.GetIndex() );
     }
 
-  Array<RealType> mrfNeighborhoodWeights;
-  this->EvaluateMRFNeighborhoodWeights( It, mrfNeighborhoodWeights );
+  // The mrf prior probabilities share the normalization over the tissue
+  // classes, so the exponentials are taken once per class.
 
-  LabelType maxLabel =
-    this->m_Randomizer->GetIntegerVariate( this->m_NumberOfTissueClasses - 1 ) + 1;
-  RealType maxPosteriorProbability = 0.0;
-  RealType sumPosteriorProbability = 0.0;
-
-  unsigned int totalNumberOfClasses = this->m_NumberOfTissueClasses +
-    this->m_NumberOfPartialVolumeClasses;
-
-  for ( unsigned int k = 0; k < totalNumberOfClasses; k++ )
+  Array<RealType> mrfPriorProbabilities( totalNumberOfClasses );
+  mrfPriorProbabilities.Fill( 1.0 );
+  if( mrfSmoothingFactor > 0.0 && ( It.GetNeighborhood() ).Size() > 1 )
     {
-    // Calculate likelihood probability
+    Array<RealType> mrfNeighborhoodWeights;
+    this->EvaluateMRFNeighborhoodWeights( It, mrfNeighborhoodWeights );
 
-    RealType likelihood =
-      this->m_MixtureModelComponents[k]->Evaluate( measurement );
-
-    // Calculate the mrf prior probability
-
-    RealType mrfPriorProbability = 1.0;
-    if( mrfSmoothingFactor > 0.0 && ( It.GetNeighborhood() ).Size() > 1 )
+    Array<RealType> numerators( totalNumberOfClasses );
+    RealType denominator = 0.0;
+    for( unsigned int k = 0; k < totalNumberOfClasses; k++ )
       {
-      RealType numerator = vcl_exp( -mrfSmoothingFactor * mrfNeighborhoodWeights[k] );
-      RealType denominator = 0.0;
-      for( unsigned int n = 0; n < this->m_NumberOfTissueClasses; n++ )
+      numerators[k] = vcl_exp( -mrfSmoothingFactor * mrfNeighborhoodWeights[k] );
+      if( k < this->m_NumberOfTissueClasses )
         {
-        denominator += vcl_exp( -mrfSmoothingFactor * mrfNeighborhoodWeights[n] );
+        denominator += numerators[k];
         }
-      if( denominator > 0.0 )
+      }
+    if( denominator > 0.0 )
+      {
+      for( unsigned int k = 0; k < totalNumberOfClasses; k++ )
         {
-        mrfPriorProbability = numerator / denominator;
+        mrfPriorProbabilities[k] = numerators[k] / denominator;
         }
       }
+    }
+
+  LabelType maxLabel = static_cast<LabelType>(
+    randomizer.lrand32( 1, this->m_NumberOfTissueClasses ) );
+  RealType maxPosteriorProbability = 0.0;
+  RealType sumPosteriorProbability = 0.0;
+
+  for ( unsigned int k = 0; k < totalNumberOfClasses; k++ )
+    {
+    RealType likelihood = likelihoods( k, column );
+    RealType mrfPriorProbability = mrfPriorProbabilities[k];
 
     // Get the spatial prior probability
 
     RealType priorProbability = 1.0;
-    if( this->GetPriorProbabilityImage( k + 1 ) )
-      {
-      priorProbability =
-        this->GetPriorProbabilityImage( k + 1 )->GetPixel( It.GetIndex() );
-      }
+    this->GetPriorProbability( k + 1, It.GetIndex(), priorProbability );
 
     //
     // Calculate the local posterior probability.  Given that the
@@ -1685,6 +1703,74 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
   return maxPosteriorProbability;
 }
 
+template <class TInputImage, class TMaskImage, class TClassifiedImage>
+ITK_THREAD_RETURN_TYPE
+AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
+::ICMThreaderCallback( void *arg )
+{
+  typedef MultiThreader::ThreadInfoStruct ThreadInfoType;
+  ThreadInfoType *info = static_cast<ThreadInfoType *>( arg );
+  ICMThreadStruct *str = static_cast<ICMThreadStruct *>( info->UserData );
+  const unsigned int threadId = info->ThreadID;
+  const unsigned int threadCount = info->NumberOfThreads;
+
+  Self *filter = str->Filter;
+
+  typename NeighborhoodIterator<ClassifiedImageType>::RadiusType radius;
+  for( unsigned int d = 0; d < ImageDimension; d++ )
+    {
+    radius[d] = filter->m_MRFRadius[d];
+    }
+  NeighborhoodIterator<ClassifiedImageType> It( radius, filter->GetOutput(),
+    filter->GetOutput()->GetRequestedRegion() );
+
+  const unsigned int totalNumberOfClasses = filter->m_NumberOfTissueClasses +
+    filter->m_NumberOfPartialVolumeClasses;
+
+  std::vector<IndexType> indices;
+  typename LikelihoodFunctionType::InputMeasurementVectorBlockType measurements;
+  vnl_matrix<RealType> likelihoods;
+
+  const std::vector<OffsetValueType> & voxels = *str->Voxels;
+  for( unsigned long b = threadId; b < str->BlockSeeds.size(); b += threadCount )
+    {
+    unsigned long first = b * str->BlockSize;
+    unsigned long last = vnl_math_min( static_cast<unsigned long>( voxels.size() ),
+      first + str->BlockSize );
+    unsigned long numberOfVoxels = last - first;
+
+    indices.resize( numberOfVoxels );
+    measurements.resize( numberOfVoxels );
+    for( unsigned long i = 0; i < numberOfVoxels; i++ )
+      {
+      indices[i] = filter->m_ICMCodeImage->ComputeIndex( voxels[first + i] );
+      measurements[i].SetSize( filter->m_NumberOfIntensityImages );
+      for( unsigned int j = 0; j < filter->m_NumberOfIntensityImages; j++ )
+        {
+        measurements[i][j] = filter->GetIntensityImage( j )->GetPixel( indices[i] );
+        }
+      }
+
+    likelihoods.set_size( totalNumberOfClasses, numberOfVoxels );
+    for( unsigned int k = 0; k < totalNumberOfClasses; k++ )
+      {
+      filter->m_MixtureModelComponents[k]->EvaluateBlock( measurements,
+        likelihoods[k], threadId );
+      }
+
+    vnl_random randomizer( str->BlockSeeds[b] );
+    RealType blockPosteriorSum = 0.0;
+    for( unsigned long i = 0; i < numberOfVoxels; i++ )
+      {
+      It.SetLocation( indices[i] );
+      blockPosteriorSum += filter->PerformLocalLabelingUpdate( It, likelihoods,
+        i, randomizer );
+      }
+    str->BlockPosteriorSums[b] = blockPosteriorSum;
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
 template <class TInputImage, class TMaskImage, class TClassifiedImage>
 typename AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
 ::SamplePointer
@@ -1807,6 +1893,7 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
       }
     case Plato:
       {
+      RealType priorProbability = 0.0;
       if( this->m_InitializationStrategy == PriorLabelImage &&
         this->GetPriorLabelImage() &&
         this->GetPriorLabelImage()->GetPixel( index ) == whichClass )
@@ -1815,8 +1902,8 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
         likelihood = 1.0;
         mrfPriorProbability = 1.0;
         }
-      else if( this->GetPriorProbabilityImage( whichClass ) &&
-        this->GetPriorProbabilityImage( whichClass )->GetPixel( index ) == 1.0 )
+      else if( this->GetPriorProbability( whichClass, index, priorProbability ) &&
+        priorProbability == 1.0 )
         {
         spatialPriorProbability = 1.0;
         likelihood = 1.0;
@@ -3225,6 +3312,20 @@ AtroposSegmentationImageFilter<TInputImage, TMaskImage, TClassifiedImage>
       }
     }
   this->m_MaximumICMCode--;
+
+  // List the voxels of each code in buffer order for the ICM updates.
+  this->m_ICMCodeVoxels.assign( this->m_MaximumICMCode,
+    std::vector<OffsetValueType>() );
+  ImageRegionConstIterator<ClassifiedImageType> ItC( this->m_ICMCodeImage,
+    this->m_ICMCodeImage->GetRequestedRegion() );
+  for( ItC.GoToBegin(); !ItC.IsAtEnd(); ++ItC )
+    {
+    if( ItC.Get() > 0 && ItC.Get() <= this->m_MaximumICMCode )
+      {
+      this->m_ICMCodeVoxels[ItC.Get()-1].push_back(
+        this->m_ICMCodeImage->ComputeOffset( ItC.GetIndex() ) );
+      }
+    }
 }
 
 template <class TInputImage, class TMaskImage, class TClassifiedImage>
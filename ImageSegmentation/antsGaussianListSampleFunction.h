@@ -51,6 +51,8 @@ public:
   typedef typename Superclass::InputListSampleType          InputListSampleType;
   typedef typename Superclass::InputMeasurementVectorType   InputMeasurementVectorType;
   typedef typename Superclass::InputMeasurementType         InputMeasurementType;
+  typedef typename Superclass::InputMeasurementVectorBlockType
+                                                            InputMeasurementVectorBlockType;
 
   /** List sample typedef support. */
   typedef TListSample                                       ListSampleType;
@@ -72,6 +74,11 @@ public:
 
   virtual TOutput Evaluate( const InputMeasurementVectorType& measurement ) const;
 
+  /** Evaluates the Gaussian over a block stored dimension by dimension, so
+   * that the inner loops run over the block and vectorize. */
+  virtual void EvaluateBlock( const InputMeasurementVectorBlockType & measurements,
+    TOutput *output, ThreadIdType threadId = 0 ) const;
+
 protected:
   GaussianListSampleFunction();
   virtual ~GaussianListSampleFunction();
@@ -85,6 +92,12 @@ private:
   void operator=( const Self& );
 
   typename GaussianType::Pointer                                  m_Gaussian;
+
+  /** Mean, inverse covariance and normalization of m_Gaussian for
+   * EvaluateBlock();  empty until a list sample has been set. */
+  vnl_vector<double>                                              m_Mean;
+  vnl_matrix<double>                                              m_InverseCovariance;
+  double                                                          m_PreFactor;
 };
 
 } // end of namespace Statistics
@@ -35,6 +35,7 @@ GaussianListSampleFunction<TListSample, TOutput, TCoordRep>
 ::GaussianListSampleFunction()
 {
   this->m_Gaussian = GaussianType::New();
+  this->m_PreFactor = 0.0;
 }
 
 template <class TListSample, class TOutput, class TCoordRep>
@@ -50,6 +51,10 @@ GaussianListSampleFunction<TListSample, TOutput, TCoordRep>
 {
   Superclass::SetInputListSample( ptr );
 
+  this->m_Mean.clear();
+  this->m_InverseCovariance.clear();
+  this->m_PreFactor = 0.0;
+
   if( !this->GetInputListSample() )
     {
     return;
@@ -121,6 +126,19 @@ GaussianListSampleFunction<TListSample, TOutput, TCoordRep>
     itkExceptionMacro( "Covariance is singular (determinant = "
       << det << " < 1.0e-6)" );
     }
+
+  if( this->GetInputListSample()->Size() > 1 )
+    {
+    unsigned int D = this->GetInputListSample()->GetMeasurementVectorSize();
+    this->m_Mean.set_size( D );
+    for( unsigned int d = 0; d < D; d++ )
+      {
+      this->m_Mean[d] = this->m_Gaussian->GetMean()[d];
+      }
+    this->m_InverseCovariance = inv_cov.inverse();
+    this->m_PreFactor = 1.0 / ( vcl_sqrt( det ) *
+      vcl_pow( 2.0 * vnl_math::pi, 0.5 * static_cast<double>( D ) ) );
+    }
 }
 
 template <class TListSample, class TOutput, class TCoordRep>
@@ -138,6 +156,63 @@ GaussianListSampleFunction<TListSample, TOutput, TCoordRep>
     }
 }
 
+template <class TListSample, class TOutput, class TCoordRep>
+void
+GaussianListSampleFunction<TListSample, TOutput, TCoordRep>
+::EvaluateBlock( const InputMeasurementVectorBlockType &measurements,
+  TOutput *output, ThreadIdType threadId ) const
+{
+  const unsigned int D = this->m_Mean.size();
+  const unsigned long N = measurements.size();
+
+  bool isBlockValid = ( D > 0 );
+  for( unsigned long n = 0; isBlockValid && n < N; n++ )
+    {
+    isBlockValid = ( measurements[n].Size() == D );
+    }
+  if( !isBlockValid )
+    {
+    Superclass::EvaluateBlock( measurements, output, threadId );
+    return;
+    }
+
+  // Store the differences from the mean dimension by dimension and
+  // accumulate the squared Mahalanobis distances over the upper triangle
+  // of the symmetric inverse covariance.
+
+  std::vector<double> differences( D * N );
+  for( unsigned int d = 0; d < D; d++ )
+    {
+    double *difference = &differences[d * N];
+    const double mean = this->m_Mean[d];
+    for( unsigned long n = 0; n < N; n++ )
+      {
+      difference[n] = static_cast<double>( measurements[n][d] ) - mean;
+      }
+    }
+
+  std::vector<double> distances( N, 0.0 );
+  for( unsigned int r = 0; r < D; r++ )
+    {
+    const double *x = &differences[r * N];
+    for( unsigned int c = r; c < D; c++ )
+      {
+      const double *y = &differences[c * N];
+      const double a = ( r == c ? 1.0 : 2.0 ) * this->m_InverseCovariance( r, c );
+      for( unsigned long n = 0; n < N; n++ )
+        {
+        distances[n] += a * x[n] * y[n];
+        }
+      }
+    }
+
+  for( unsigned long n = 0; n < N; n++ )
+    {
+    output[n] = static_cast<TOutput>(
+      this->m_PreFactor * vcl_exp( -0.5 * distances[n] ) );
+    }
+}
+
 /**
  * Standard "PrintSelf" method
  */
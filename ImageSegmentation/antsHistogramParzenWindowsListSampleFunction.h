@@ -24,6 +24,9 @@
 #include "itkImage.h"
 #include "itkBSplineInterpolateImageFunction.h"
 #include "itkLinearInterpolateImageFunction.h"
+#include "itkMultiThreader.h"
+
+#include <vector>
 
 namespace itk {
 namespace ants {
@@ -31,6 +34,14 @@ namespace Statistics {
 
 /** \class HistogramParzenWindowsListSampleFunction.h
  * \brief point set filter.
+ *
+ * The marginal histograms are accumulated on all threads, each over fixed
+ * chunks of the list sample which are then added in chunk order, so the
+ * histograms do not depend on the number of threads.  Evaluate() takes the
+ * cubic B-spline interpolant of each smoothed histogram.  With
+ * UseLookupTable on (default off) the interpolants are sampled on dense
+ * tables instead and Evaluate() interpolates linearly in the tables, which
+ * is faster but differs slightly from the B-spline values.
  */
 
 template <class TListSample, class TOutput = double, class TCoordRep = double>
@@ -53,6 +64,7 @@ public:
   typedef typename Superclass::InputListSampleType          InputListSampleType;
   typedef typename Superclass::InputMeasurementVectorType   InputMeasurementVectorType;
   typedef typename Superclass::InputMeasurementType         InputMeasurementType;
+  typedef typename Superclass::ListSampleWeightArrayType    ListSampleWeightArrayType;
 
   /** List sample typedef support. */
   typedef TListSample                                       ListSampleType;
@@ -77,6 +89,19 @@ public:
   itkSetMacro( NumberOfHistogramBins, unsigned int );
   itkGetConstMacro( NumberOfHistogramBins, unsigned int );
 
+  /** Evaluate from linear lookup tables instead of the B-spline
+   * interpolants (default off). */
+  itkSetMacro( UseLookupTable, bool );
+  itkGetConstMacro( UseLookupTable, bool );
+  itkBooleanMacro( UseLookupTable );
+
+  /** Number of lookup table samples per histogram bin (default 8). */
+  itkSetMacro( NumberOfLookupTableSamplesPerBin, unsigned int );
+  itkGetConstMacro( NumberOfLookupTableSamplesPerBin, unsigned int );
+
+  /** Memory held by the histograms and the lookup tables. */
+  unsigned long GetLookupTableSizeInBytes() const;
+
   virtual void SetInputListSample( const InputListSampleType * ptr );
 
   virtual TOutput Evaluate( const InputMeasurementVectorType& measurement ) const;
@@ -93,10 +118,34 @@ private:
   HistogramParzenWindowsListSampleFunction( const Self& );
   void operator=( const Self& );
 
+  struct HistogramThreadStruct
+    {
+    const InputListSampleType                  *ListSample;
+    const ListSampleWeightArrayType            *Weights;
+    unsigned int                               Dimension;
+    unsigned long                              ChunkSize;
+    std::vector<double>                        Origins;
+    std::vector<double>                        Spacings;
+    std::vector<unsigned long>                 Sizes;
+    std::vector<unsigned long>                 Offsets;
+    std::vector<std::vector<double> >          ChunkMinima;
+    std::vector<std::vector<double> >          ChunkMaxima;
+    std::vector<std::vector<double> >          ChunkHistograms;
+    };
+
+  static ITK_THREAD_RETURN_TYPE MinMaxThreaderCallback( void *arg );
+  static ITK_THREAD_RETURN_TYPE HistogramThreaderCallback( void *arg );
+
   unsigned int                                         m_NumberOfHistogramBins;
   RealType                                             m_Sigma;
-  InterpolatorPointer m_Interpolator;
   std::vector<typename HistogramImageType::Pointer>    m_HistogramImages;
+  std::vector<InterpolatorPointer>                     m_Interpolators;
+
+  bool                                                 m_UseLookupTable;
+  unsigned int                                         m_NumberOfLookupTableSamplesPerBin;
+  std::vector<std::vector<RealType> >                  m_LookupTables;
+  std::vector<double>                                  m_LookupTableOrigins;
+  std::vector<double>                                  m_LookupTableSpacings;
 };
 
 } // end of namespace Statistics
@@ -36,11 +36,10 @@ template <class TListSample, class TOutput, class TCoordRep>
 HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
 ::HistogramParzenWindowsListSampleFunction()
 {
-  this->m_Interpolator=InterpolatorType::New();
-  this->m_Interpolator->SetSplineOrder( 3 );
-
   this->m_NumberOfHistogramBins = 32;
   this->m_Sigma = 1.0;
+  this->m_UseLookupTable = false;
+  this->m_NumberOfLookupTableSamplesPerBin = 8;
 }
 
 template <class TListSample, class TOutput, class TCoordRep>
@@ -49,6 +48,94 @@ HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
 {
 }
 
+template <class TListSample, class TOutput, class TCoordRep>
+ITK_THREAD_RETURN_TYPE
+HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::MinMaxThreaderCallback( void *arg )
+{
+  typedef MultiThreader::ThreadInfoStruct ThreadInfoType;
+  ThreadInfoType *info = static_cast<ThreadInfoType *>( arg );
+  HistogramThreadStruct *str = static_cast<HistogramThreadStruct *>( info->UserData );
+  const unsigned int threadId = info->ThreadID;
+  const unsigned int threadCount = info->NumberOfThreads;
+
+  const unsigned long numberOfSamples = str->ListSample->Size();
+  for( unsigned long c = threadId; c < str->ChunkMinima.size(); c += threadCount )
+    {
+    std::vector<double> & minValues = str->ChunkMinima[c];
+    std::vector<double> & maxValues = str->ChunkMaxima[c];
+    minValues.assign( str->Dimension, NumericTraits<double>::max() );
+    maxValues.assign( str->Dimension, NumericTraits<double>::NonpositiveMin() );
+
+    unsigned long last = vnl_math_min( numberOfSamples, ( c + 1 ) * str->ChunkSize );
+    for( unsigned long n = c * str->ChunkSize; n < last; n++ )
+      {
+      const InputMeasurementVectorType & measurement =
+        str->ListSample->GetMeasurementVector( n );
+      for( unsigned int d = 0; d < str->Dimension; d++ )
+        {
+        minValues[d] = vnl_math_min( minValues[d], static_cast<double>( measurement[d] ) );
+        maxValues[d] = vnl_math_max( maxValues[d], static_cast<double>( measurement[d] ) );
+        }
+      }
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+ITK_THREAD_RETURN_TYPE
+HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::HistogramThreaderCallback( void *arg )
+{
+  typedef MultiThreader::ThreadInfoStruct ThreadInfoType;
+  ThreadInfoType *info = static_cast<ThreadInfoType *>( arg );
+  HistogramThreadStruct *str = static_cast<HistogramThreadStruct *>( info->UserData );
+  const unsigned int threadId = info->ThreadID;
+  const unsigned int threadCount = info->NumberOfThreads;
+
+  const unsigned long numberOfSamples = str->ListSample->Size();
+  const bool useWeights = ( str->Weights &&
+    str->Weights->Size() == numberOfSamples );
+
+  for( unsigned long c = threadId; c < str->ChunkHistograms.size(); c += threadCount )
+    {
+    std::vector<double> & histograms = str->ChunkHistograms[c];
+    histograms.assign( str->Offsets[str->Dimension], 0.0 );
+
+    unsigned long last = vnl_math_min( numberOfSamples, ( c + 1 ) * str->ChunkSize );
+    for( unsigned long n = c * str->ChunkSize; n < last; n++ )
+      {
+      const InputMeasurementVectorType & measurement =
+        str->ListSample->GetMeasurementVector( n );
+
+      double newWeight = 1.0;
+      if( useWeights )
+        {
+        newWeight = ( *str->Weights )[n];
+        }
+
+      for( unsigned int d = 0; d < str->Dimension; d++ )
+        {
+        double cidx = ( static_cast<double>( measurement[d] ) - str->Origins[d] )
+          / str->Spacings[d];
+        long idx = static_cast<long>( vcl_floor( cidx ) );
+        double *histogram = &histograms[str->Offsets[d]];
+
+        if( idx >= 0 && idx < static_cast<long>( str->Sizes[d] ) )
+          {
+          histogram[idx] += ( 1.0 - ( cidx - idx ) ) * newWeight;
+          }
+        idx++;
+        if( idx >= 0 && idx < static_cast<long>( str->Sizes[d] ) )
+          {
+          histogram[idx] += ( 1.0 - ( idx - cidx ) ) * newWeight;
+          }
+        }
+      }
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
 template <class TListSample, class TOutput, class TCoordRep>
 void
 HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
@@ -56,6 +143,12 @@ HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
 {
   Superclass::SetInputListSample( ptr );
 
+  this->m_HistogramImages.clear();
+  this->m_Interpolators.clear();
+  this->m_LookupTables.clear();
+  this->m_LookupTableOrigins.clear();
+  this->m_LookupTableSpacings.clear();
+
   if( !this->GetInputListSample() )
     {
     return;
@@ -71,36 +164,44 @@ HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
   const unsigned int Dimension =
     this->GetInputListSample()->GetMeasurementVectorSize();
 
+  HistogramThreadStruct str;
+  str.ListSample = this->GetInputListSample();
+  str.Weights = this->GetListSampleWeights();
+  str.Dimension = Dimension;
+  str.ChunkSize = 16384;
+
+  unsigned long numberOfChunks = ( this->GetInputListSample()->Size() +
+    str.ChunkSize - 1 ) / str.ChunkSize;
+
+  MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+
   /**
    * Find the min/max values to define the histogram domain
    */
+  str.ChunkMinima.resize( numberOfChunks );
+  str.ChunkMaxima.resize( numberOfChunks );
+  threader->SetSingleMethod( Self::MinMaxThreaderCallback, &str );
+  threader->SingleMethodExecute();
 
   Array<RealType> minValues( Dimension );
   minValues.Fill( NumericTraits<RealType>::max() );
   Array<RealType> maxValues( Dimension );
   maxValues.Fill( NumericTraits<RealType>::NonpositiveMin() );
-
-  typename InputListSampleType::ConstIterator It
-    = this->GetInputListSample()->Begin();
-  while( It != this->GetInputListSample()->End() )
+  for( unsigned long c = 0; c < numberOfChunks; c++ )
     {
-    InputMeasurementVectorType inputMeasurement = It.GetMeasurementVector();
-
     for( unsigned int d = 0; d < Dimension; d++ )
       {
-      if( inputMeasurement[d] < minValues[d] )
-        {
-        minValues[d] = inputMeasurement[d];
-        }
-      if( inputMeasurement[d] > maxValues[d] )
-        {
-        maxValues[d] = inputMeasurement[d];
-        }
+      minValues[d] = vnl_math_min( minValues[d],
+        static_cast<RealType>( str.ChunkMinima[c][d] ) );
+      maxValues[d] = vnl_math_max( maxValues[d],
+        static_cast<RealType>( str.ChunkMaxima[c][d] ) );
       }
-    ++It;
     }
+  str.ChunkMinima.clear();
+  str.ChunkMaxima.clear();
 
-  this->m_HistogramImages.clear();
+  str.Offsets.push_back( 0 );
   for( unsigned int d = 0; d < Dimension; d++ )
     {
     this->m_HistogramImages.push_back( HistogramImageType::New() );
@@ -122,51 +223,34 @@ HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
     this->m_HistogramImages[d]->SetRegions( size );
     this->m_HistogramImages[d]->Allocate();
     this->m_HistogramImages[d]->FillBuffer( 0 );
-    }
 
-  unsigned long count = 0;
-  It = this->GetInputListSample()->Begin();
-  while( It != this->GetInputListSample()->End() )
-    {
-    InputMeasurementVectorType inputMeasurement = It.GetMeasurementVector();
+    str.Origins.push_back( this->m_HistogramImages[d]->GetOrigin()[0] );
+    str.Spacings.push_back( this->m_HistogramImages[d]->GetSpacing()[0] );
+    str.Sizes.push_back( size[0] );
+    str.Offsets.push_back( str.Offsets[d] + size[0] );
+    }
 
-    RealType newWeight = 1.0;
-    if( this->GetListSampleWeights()->Size() == this->GetInputListSample()->Size() )
-      {
-      newWeight = ( *this->GetListSampleWeights() )[count];
-      }
+  /**
+   * Accumulate the histograms chunk by chunk and add the chunks in order
+   */
+  str.ChunkHistograms.resize( numberOfChunks );
+  threader->SetSingleMethod( Self::HistogramThreaderCallback, &str );
+  threader->SingleMethodExecute();
 
-    for( unsigned int d = 0; d < Dimension; d++ )
+  for( unsigned int d = 0; d < Dimension; d++ )
+    {
+    RealType *buffer = this->m_HistogramImages[d]->GetBufferPointer();
+    for( unsigned long i = 0; i < str.Sizes[d]; i++ )
       {
-      typename HistogramImageType::PointType point;
-      point[0] = inputMeasurement[d];
-
-      ContinuousIndex<double, 1> cidx;
-      this->m_HistogramImages[d]->TransformPhysicalPointToContinuousIndex(
-        point, cidx );
-
-      typename HistogramImageType::IndexType idx;
-
-      idx[0] = static_cast<typename
-        HistogramImageType::IndexType::IndexValueType>( vcl_floor( cidx[0] ) );
-      if( this->m_HistogramImages[d]->GetLargestPossibleRegion().IsInside( idx ) )
+      double sum = 0.0;
+      for( unsigned long c = 0; c < numberOfChunks; c++ )
         {
-        RealType oldWeight = this->m_HistogramImages[d]->GetPixel( idx );
-        this->m_HistogramImages[d]->SetPixel( idx,
-          ( 1.0 - ( cidx[0] - idx[0] ) ) * newWeight + oldWeight );
-        }
-
-      idx[0]++;
-      if( this->m_HistogramImages[d]->GetLargestPossibleRegion().IsInside( idx ) )
-        {
-        RealType oldWeight = this->m_HistogramImages[d]->GetPixel( idx );
-        this->m_HistogramImages[d]->SetPixel( idx,
-          ( 1.0 - ( idx[0] - cidx[0] ) ) * newWeight + oldWeight );
+        sum += str.ChunkHistograms[c][str.Offsets[d] + i];
         }
+      buffer[i] = static_cast<RealType>( sum );
       }
-    ++count;
-    ++It;
     }
+  str.ChunkHistograms.clear();
 
   for( unsigned int d = 0; d < Dimension; d++ )
     {
@@ -192,6 +276,49 @@ HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
     divider->Update();
     this->m_HistogramImages[d] = divider->GetOutput();
     }
+
+  for( unsigned int d = 0; d < Dimension; d++ )
+    {
+    InterpolatorPointer interpolator = InterpolatorType::New();
+    interpolator->SetSplineOrder( 3 );
+    interpolator->SetInputImage( this->m_HistogramImages[d] );
+    this->m_Interpolators.push_back( interpolator );
+    }
+
+  if( !this->m_UseLookupTable )
+    {
+    return;
+    }
+
+  /**
+   * Sample the cubic B-spline interpolant of each histogram over the extent
+   * of its buffer, i.e. to half a bin beyond the first and last bin centers.
+   */
+  const unsigned int samplesPerBin =
+    vnl_math_max( this->m_NumberOfLookupTableSamplesPerBin, 1u );
+  for( unsigned int d = 0; d < Dimension; d++ )
+    {
+    const InterpolatorType *interpolator = this->m_Interpolators[d];
+
+    const double spacing = this->m_HistogramImages[d]->GetSpacing()[0];
+    const double origin = this->m_HistogramImages[d]->GetOrigin()[0] - 0.5 * spacing;
+    const unsigned long numberOfSamples = str.Sizes[d] * samplesPerBin + 1;
+
+    this->m_LookupTableOrigins.push_back( origin );
+    this->m_LookupTableSpacings.push_back( spacing / samplesPerBin );
+    this->m_LookupTables.push_back( std::vector<RealType>( numberOfSamples ) );
+
+    // the outer half bins take the values at the first and last bin centers
+    for( unsigned long i = 0; i < numberOfSamples; i++ )
+      {
+      typename InterpolatorType::ContinuousIndexType cidx;
+      cidx[0] = vnl_math_min( vnl_math_max(
+        static_cast<double>( i ) / samplesPerBin - 0.5, 0.0 ),
+        static_cast<double>( str.Sizes[d] - 1 ) );
+      this->m_LookupTables[d][i] = static_cast<RealType>(
+        interpolator->EvaluateAtContinuousIndex( cidx ) );
+      }
+    }
 }
 
 template <class TListSample, class TOutput, class TCoordRep>
@@ -199,32 +326,70 @@ TOutput
 HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
 ::Evaluate( const InputMeasurementVectorType &measurement ) const
 {
-
-  try
+  if( this->m_LookupTables.empty() )
     {
-
-    RealType probability = 1.0;
-    for( unsigned int d = 0; d < this->m_HistogramImages.size(); d++ )
+    try
       {
-      typename HistogramImageType::PointType point;
-      point[0] = measurement[d];
-
-      this->m_Interpolator->SetInputImage( this->m_HistogramImages[d] );
-      if( this->m_Interpolator->IsInsideBuffer( point ) )
+      RealType probability = 1.0;
+      for( unsigned int d = 0; d < this->m_Interpolators.size(); d++ )
         {
-        probability *= this->m_Interpolator->Evaluate( point );
-        }
-      else
-        {
-        return 0;
+        typename HistogramImageType::PointType point;
+        point[0] = measurement[d];
+
+        if( this->m_Interpolators[d]->IsInsideBuffer( point ) )
+          {
+          probability *= this->m_Interpolators[d]->Evaluate( point );
+          }
+        else
+          {
+          return 0;
+          }
         }
+      return probability;
+      }
+    catch(...)
+      {
+      return 0;
+      }
+    }
+
+  RealType probability = 1.0;
+  for( unsigned int d = 0; d < this->m_LookupTables.size(); d++ )
+    {
+    const std::vector<RealType> & table = this->m_LookupTables[d];
+
+    double u = ( static_cast<double>( measurement[d] ) -
+      this->m_LookupTableOrigins[d] ) / this->m_LookupTableSpacings[d];
+    if( !( u >= 0.0 && u <= static_cast<double>( table.size() - 1 ) ) )
+      {
+      return 0;
       }
-    return probability;
+    unsigned long i = vnl_math_min( static_cast<unsigned long>( u ),
+      static_cast<unsigned long>( table.size() - 2 ) );
+    double t = u - static_cast<double>( i );
+
+    probability *= static_cast<RealType>(
+      ( 1.0 - t ) * table[i] + t * table[i + 1] );
+    }
+  return probability;
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+unsigned long
+HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::GetLookupTableSizeInBytes() const
+{
+  unsigned long numberOfValues = 0;
+  for( unsigned int d = 0; d < this->m_LookupTables.size(); d++ )
+    {
+    numberOfValues += this->m_LookupTables[d].size();
     }
-  catch(...)
+  for( unsigned int d = 0; d < this->m_HistogramImages.size(); d++ )
     {
-    return 0;
+    numberOfValues += this->m_HistogramImages[d]->
+      GetBufferedRegion().GetNumberOfPixels();
     }
+  return numberOfValues * sizeof( RealType );
 }
 
 /**
@@ -241,6 +406,12 @@ HistogramParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
                << this->m_Sigma << std::endl;
   os << indent << "Number of histogram bins: "
                << this->m_NumberOfHistogramBins << std::endl;
+  os << indent << "Use lookup table: "
+               << this->m_UseLookupTable << std::endl;
+  os << indent << "Number of lookup table samples per bin: "
+               << this->m_NumberOfLookupTableSamplesPerBin << std::endl;
+  os << indent << "Lookup table memory (bytes): "
+               << this->GetLookupTableSizeInBytes() << std::endl;
 }
 
 } // end of namespace Statistics
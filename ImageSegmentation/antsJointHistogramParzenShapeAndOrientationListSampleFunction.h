@@ -108,7 +108,7 @@ private:
   RealType                                        m_MinimumEigenvalue1;
   RealType                                        m_MinimumEigenvalue2;
   JointHistogramImagePointer                      m_JointHistogramImages[3];
-  InterpolatorPointer m_Interpolator;
+  InterpolatorPointer                             m_Interpolators[3];
   bool                                         m_UseNearestNeighborIncrements;
 
 };
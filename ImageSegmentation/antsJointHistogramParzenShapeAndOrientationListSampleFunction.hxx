@@ -43,8 +43,6 @@ JointHistogramParzenShapeAndOrientationListSampleFunction<TListSample, TOutput,
   this->m_MaximumEigenvalue2 = 0;
   this->m_MinimumEigenvalue1 = 1;
   this->m_MinimumEigenvalue2 = 1;
-  this->m_Interpolator=InterpolatorType::New();
-  this->m_Interpolator->SetSplineOrder( 3 );
   this->m_JointHistogramImages[0] = NULL;
   this->m_JointHistogramImages[1] = NULL;
   this->m_JointHistogramImages[2] = NULL;
@@ -587,6 +585,10 @@ JointHistogramParzenShapeAndOrientationListSampleFunction<TListSample, TOutput,
     divider->Update();
     this->m_JointHistogramImages[d] = divider->GetOutput();
 
+    // one interpolator per histogram so that Evaluate() changes nothing
+    this->m_Interpolators[d] = InterpolatorType::New();
+    this->m_Interpolators[d]->SetSplineOrder( 3 );
+    this->m_Interpolators[d]->SetInputImage( this->m_JointHistogramImages[d] );
     }
 }
 
@@ -603,10 +605,9 @@ JointHistogramParzenShapeAndOrientationListSampleFunction<TListSample, TOutput,
       typename JointHistogramImageType::PointType point;
       point[0] = measurement[d];
 
-      this->m_Interpolator->SetInputImage( this->m_JointHistogramImages[d] );
-      if( this->m_Interpolator->IsInsideBuffer( point ) )
+      if( this->m_Interpolators[d]->IsInsideBuffer( point ) )
         {
-        probability *= this->m_Interpolator->Evaluate( point );
+        probability *= this->m_Interpolators[d]->Evaluate( point );
         }
       else
         {
@@ -22,6 +22,9 @@
 #include "itkFunctionBase.h"
 
 #include "itkArray.h"
+#include "itkIntTypes.h"
+
+#include <vector>
 
 namespace itk {
 namespace ants {
@@ -66,6 +69,9 @@ public:
   typedef typename InputListSampleType::MeasurementVectorType   InputMeasurementVectorType;
   typedef typename InputListSampleType::MeasurementType         InputMeasurementType;
 
+  /** Block of measurement vectors for EvaluateBlock(). */
+  typedef std::vector<InputMeasurementVectorType>               InputMeasurementVectorBlockType;
+
   /** OutputType typedef support. */
   typedef TOutput                                       OutputType;
 
@@ -107,6 +113,19 @@ public:
    * Subclasses must provide this method. */
   virtual TOutput Evaluate( const InputMeasurementVectorType& measurement ) const = 0;
 
+  /** Evaluate the function at every measurement of a block and write the
+   * values to output[0], ..., output[measurements.size()-1].  The default
+   * calls Evaluate() once per measurement;  subclasses override it where
+   * the measurements of a block can share work.  Blocks evaluated at the
+   * same time must pass different thread ids, below the number of threads
+   * given to SetNumberOfThreads(). */
+  virtual void EvaluateBlock( const InputMeasurementVectorBlockType & measurements,
+    TOutput *output, ThreadIdType threadId = 0 ) const;
+
+  /** Number of threads that may call EvaluateBlock() at the same time.
+   * Subclasses with per-thread search state override it. */
+  virtual void SetNumberOfThreads( unsigned int ) {}
+
 protected:
   ListSampleFunction();
   ~ListSampleFunction() {}
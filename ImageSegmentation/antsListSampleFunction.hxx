@@ -121,6 +121,17 @@ ListSampleFunction<TInputListSample, TOutput, TCoordRep>
     }
 }
 
+template <class TInputListSample, class TOutput, class TCoordRep>
+void
+ListSampleFunction<TInputListSample, TOutput, TCoordRep>
+::EvaluateBlock( const InputMeasurementVectorBlockType & measurements,
+  TOutput *output, ThreadIdType itkNotUsed( threadId ) ) const
+{
+  for( unsigned long n = 0; n < measurements.size(); n++ )
+    {
+    output[n] = this->Evaluate( measurements[n] );
+    }
+}
 
 } // end of namespace Statistics
 } // end of namespace ants
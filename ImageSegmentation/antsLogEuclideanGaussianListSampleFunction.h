@@ -51,6 +51,8 @@ public:
   typedef typename Superclass::InputListSampleType          InputListSampleType;
   typedef typename Superclass::InputMeasurementVectorType   InputMeasurementVectorType;
   typedef typename Superclass::InputMeasurementType         InputMeasurementType;
+  typedef typename Superclass::InputMeasurementVectorBlockType
+                                                            InputMeasurementVectorBlockType;
 
   /** Other typedef */
   typedef TOutput                                           RealType;
@@ -63,6 +65,11 @@ public:
 
   virtual TOutput Evaluate( const InputMeasurementVectorType& measurement ) const;
 
+  /** Takes the logarithm of each tensor of the block and then evaluates
+   * the Gaussian of the log-Euclidean distances in one pass. */
+  virtual void EvaluateBlock( const InputMeasurementVectorBlockType & measurements,
+    TOutput *output, ThreadIdType threadId = 0 ) const;
+
 protected:
   LogEuclideanGaussianListSampleFunction();
   virtual ~LogEuclideanGaussianListSampleFunction();
@@ -74,7 +81,11 @@ protected:
   TensorType ExpTensorTransform( const TensorType & ) const;
   RealType CalculateTensorDistance( const TensorType &, const TensorType & ) const;
 
+  /** Squared log-Euclidean distance of a measurement from the mean tensor. */
+  RealType CalculateSquaredDistanceToMean( const InputMeasurementVectorType & ) const;
+
   TensorType                                                m_MeanTensor;
+  TensorType                                                m_LogMeanTensor;
   RealType                                                  m_Dispersion;
 
 private:
@@ -25,6 +25,8 @@
 
 #include "vnl/vnl_trace.h"
 
+#include <algorithm>
+
 namespace itk {
 namespace ants {
 namespace Statistics {
@@ -98,6 +100,7 @@ LogEuclideanGaussianListSampleFunction<TListSample, TOutput, TCoordRep>
       this->m_MeanTensor /= totalWeight;
       }
     this->m_MeanTensor = this->ExpTensorTransform( this->m_MeanTensor );
+    this->m_LogMeanTensor = this->LogTensorTransform( this->m_MeanTensor );
 
     /**
      * Now calculate the dispersion (i.e. variance)
@@ -215,9 +218,10 @@ LogEuclideanGaussianListSampleFunction<TListSample, TOutput, TCoordRep>
 }
 
 template <class TListSample, class TOutput, class TCoordRep>
-TOutput
+typename LogEuclideanGaussianListSampleFunction<TListSample, TOutput, TCoordRep>
+::RealType
 LogEuclideanGaussianListSampleFunction<TListSample, TOutput, TCoordRep>
-::Evaluate( const InputMeasurementVectorType &measurement ) const
+::CalculateSquaredDistanceToMean( const InputMeasurementVectorType &measurement ) const
 {
   unsigned int D = this->m_MeanTensor.Rows();
 
@@ -232,15 +236,68 @@ LogEuclideanGaussianListSampleFunction<TListSample, TOutput, TCoordRep>
       T( j, i ) = T( i, j );
       }
     }
-  RealType distance = this->CalculateTensorDistance( T, this->m_MeanTensor );
+
+  // The logarithm of the mean is kept from SetInputListSample(), and the
+  // trace of the squared (symmetric) difference is its sum of squares.
+  TensorType logT = this->LogTensorTransform( T );
+  RealType distanceSquared = 0.0;
+  for( unsigned int i = 0; i < D; i++ )
+    {
+    for( unsigned int j = 0; j < D; j++ )
+      {
+      distanceSquared += vnl_math_sqr( logT( i, j ) - this->m_LogMeanTensor( i, j ) );
+      }
+    }
+  return distanceSquared;
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+TOutput
+LogEuclideanGaussianListSampleFunction<TListSample, TOutput, TCoordRep>
+::Evaluate( const InputMeasurementVectorType &measurement ) const
+{
+  if( this->m_MeanTensor.Rows() == 0 ||
+    this->m_LogMeanTensor.Rows() != this->m_MeanTensor.Rows() )
+    {
+    return 0.0;
+    }
   RealType preFactor = 1.0 /
     ( vcl_sqrt( 2.0 * vnl_math::pi * this->m_Dispersion ) );
   RealType probability = preFactor * vcl_exp( -0.5 *
-    vnl_math_sqr( distance ) / this->m_Dispersion );
+    this->CalculateSquaredDistanceToMean( measurement ) / this->m_Dispersion );
 
   return probability;
 }
 
+template <class TListSample, class TOutput, class TCoordRep>
+void
+LogEuclideanGaussianListSampleFunction<TListSample, TOutput, TCoordRep>
+::EvaluateBlock( const InputMeasurementVectorBlockType &measurements,
+  TOutput *output, ThreadIdType itkNotUsed( threadId ) ) const
+{
+  const unsigned long N = measurements.size();
+  if( this->m_MeanTensor.Rows() == 0 ||
+    this->m_LogMeanTensor.Rows() != this->m_MeanTensor.Rows() )
+    {
+    std::fill( output, output + N, static_cast<TOutput>( 0.0 ) );
+    return;
+    }
+
+  std::vector<RealType> distancesSquared( N );
+  for( unsigned long n = 0; n < N; n++ )
+    {
+    distancesSquared[n] = this->CalculateSquaredDistanceToMean( measurements[n] );
+    }
+
+  const RealType preFactor = 1.0 /
+    ( vcl_sqrt( 2.0 * vnl_math::pi * this->m_Dispersion ) );
+  const RealType scale = -0.5 / this->m_Dispersion;
+  for( unsigned long n = 0; n < N; n++ )
+    {
+    output[n] = preFactor * vcl_exp( scale * distancesSquared[n] );
+    }
+}
+
 /**
  * Standard "PrintSelf" method
  */
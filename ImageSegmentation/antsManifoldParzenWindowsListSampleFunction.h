@@ -22,6 +22,7 @@
 #include "antsListSampleFunction.h"
 
 #include "itkGaussianMembershipFunction.h"
+#include "itkMultiThreader.h"
 #include "itkWeightedCentroidKdTreeGenerator.h"
 
 #include <vector>
@@ -32,6 +33,18 @@ namespace Statistics {
 
 /** \class ManifoldParzenWindowsListSampleFunction.h
  * \brief point set filter.
+ *
+ * For measurements of up to four components and with UseLookupGrid on
+ * (default off) the density is tabulated on a dense grid when the list
+ * sample is set, so that Evaluate() is a multilinear interpolation instead
+ * of a kd-tree search and kernel sum, at the price of a small difference
+ * from the exact density.
+ * A grid node holds the exact density at the node, the sum of its
+ * EvaluationKNeighborhood nearest kernels, and the grid is computed on all
+ * threads.  Its spacing is at most half the smallest kernel standard
+ * deviation along each axis;  if that needs more nodes than there are
+ * samples or than MaximumNumberOfLookupGridNodes, or outside the grid, the
+ * density is evaluated exactly.
  */
 
 template <class TListSample, class TOutput = double, class TCoordRep = double>
@@ -89,10 +102,29 @@ public:
   itkSetMacro( KernelSigma, RealType );
   itkGetConstMacro( KernelSigma, RealType );
 
+  itkSetMacro( UseLookupGrid, bool );
+  itkGetConstMacro( UseLookupGrid, bool );
+  itkBooleanMacro( UseLookupGrid );
+
+  itkSetMacro( MaximumNumberOfLookupGridNodes, unsigned long );
+  itkGetConstMacro( MaximumNumberOfLookupGridNodes, unsigned long );
+
+  /** Memory held by the lookup grid, zero if none was built. */
+  unsigned long GetLookupGridSizeInBytes() const
+    {
+    return this->m_LookupGrid.size() * sizeof( RealType );
+    }
+
   virtual void SetInputListSample( const InputListSampleType * ptr );
 
   virtual TOutput Evaluate( const InputMeasurementVectorType& measurement ) const;
 
+  /** Evaluates the block with the kd-tree of the given thread. */
+  virtual void EvaluateBlock( const InputMeasurementVectorBlockType & measurements,
+    TOutput *output, ThreadIdType threadId = 0 ) const;
+
+  virtual void SetNumberOfThreads( unsigned int n );
+
 protected:
   ManifoldParzenWindowsListSampleFunction();
   virtual ~ManifoldParzenWindowsListSampleFunction();
@@ -100,6 +132,15 @@ protected:
 
   void GenerateData();
 
+  void GenerateLookupGrid();
+
+  /** The kd-tree searched by the given thread:  the function's own for
+   * thread 0, a copy built on first use for the others. */
+  KdTreeType * GetThreadKdTree( ThreadIdType threadId ) const;
+
+  TOutput EvaluateWithKdTree( const InputMeasurementVectorType& measurement,
+    KdTreeType *tree ) const;
+
 private:
   //purposely not implemented
   ManifoldParzenWindowsListSampleFunction( const Self& );
@@ -112,8 +153,31 @@ private:
   RealType                                      m_NormalizationFactor;
 
   typename TreeGeneratorType::Pointer           m_KdTreeGenerator;
+  /** The kd-tree keeps its search state in the tree, so every thread but
+   * the first searches a copy of its own. */
+  mutable std::vector<typename TreeGeneratorType::Pointer>
+                                                m_ThreadKdTreeGenerators;
 
   GaussianContainerType                         m_Gaussians;
+
+  itkStaticConstMacro( MaximumLookupGridDimension, unsigned int, 4 );
+
+  struct LookupGridThreadStruct
+    {
+    Self                                        *Function;
+    std::vector<vnl_matrix<double> >            InverseCovariances;
+    std::vector<double>                         PreFactors;
+    };
+
+  static ITK_THREAD_RETURN_TYPE LookupGridThreaderCallback( void *arg );
+
+  bool                                          m_UseLookupGrid;
+  unsigned long                                 m_MaximumNumberOfLookupGridNodes;
+  unsigned int                                  m_LookupGridDimension;
+  double                                        m_LookupGridOrigin[MaximumLookupGridDimension];
+  double                                        m_LookupGridSpacing[MaximumLookupGridDimension];
+  unsigned long                                 m_LookupGridSize[MaximumLookupGridDimension];
+  std::vector<RealType>                         m_LookupGrid;
 };
 
 } // end of namespace Statistics
@@ -21,6 +21,8 @@
 
 #include "antsManifoldParzenWindowsListSampleFunction.h"
 
+#include "vnl/algo/vnl_matrix_inverse.h"
+
 namespace itk {
 namespace ants {
 namespace Statistics {
@@ -36,6 +38,12 @@ ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
 
   this->m_CovarianceKNeighborhood = 0;
   this->m_KernelSigma = 0.0;
+
+  this->m_UseLookupGrid = false;
+  this->m_MaximumNumberOfLookupGridNodes = 1 << 20;
+  this->m_LookupGridDimension = 0;
+
+  this->m_ThreadKdTreeGenerators.resize( 1 );
 }
 
 template <class TListSample, class TOutput, class TCoordRep>
@@ -49,7 +57,12 @@ void
 ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
 ::SetInputListSample( const InputListSampleType * ptr )
 {
-  this->SetInputListSample( ptr );
+  Superclass::SetInputListSample( ptr );
+
+  this->m_LookupGrid.clear();
+  this->m_LookupGridDimension = 0;
+  this->m_ThreadKdTreeGenerators.assign( this->m_ThreadKdTreeGenerators.size(),
+    typename TreeGeneratorType::Pointer() );
 
   if( !this->GetInputListSample() )
     {
@@ -183,14 +196,313 @@ ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
       this->m_NormalizationFactor += 1.0;
       }
     }
+
+  if( this->m_UseLookupGrid )
+    {
+    this->GenerateLookupGrid();
+    }
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+void
+ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::GenerateLookupGrid()
+{
+  const unsigned int Dimension =
+    this->GetInputListSample()->GetMeasurementVectorSize();
+  if( Dimension == 0 || Dimension > MaximumLookupGridDimension ||
+    this->m_Gaussians.empty() || this->m_NormalizationFactor <= 0.0 )
+    {
+    return;
+    }
+
+  /**
+   * Kernel parameters, grid domain and the spacing resolving the narrowest
+   * kernel along each axis
+   */
+  LookupGridThreadStruct str;
+  str.Function = this;
+  str.InverseCovariances.resize( this->m_Gaussians.size() );
+  str.PreFactors.resize( this->m_Gaussians.size() );
+
+  double minValues[MaximumLookupGridDimension];
+  double maxValues[MaximumLookupGridDimension];
+  double minStandardDeviations[MaximumLookupGridDimension];
+  for( unsigned int d = 0; d < Dimension; d++ )
+    {
+    minValues[d] = NumericTraits<double>::max();
+    maxValues[d] = NumericTraits<double>::NonpositiveMin();
+    minStandardDeviations[d] = NumericTraits<double>::max();
+    }
+
+  for( unsigned long j = 0; j < this->m_Gaussians.size(); j++ )
+    {
+    const CovarianceMatrixType & covariance = this->m_Gaussians[j]->GetCovariance();
+    vnl_matrix_inverse<double> inverse( covariance.GetVnlMatrix() );
+    double determinant = inverse.determinant_magnitude();
+    if( determinant <= 0.0 )
+      {
+      itkDebugMacro( "Singular kernel covariance, no lookup grid." );
+      return;
+      }
+    str.InverseCovariances[j] = inverse.inverse();
+    str.PreFactors[j] = 1.0 / ( vcl_sqrt( determinant ) *
+      vcl_pow( 2.0 * vnl_math::pi, 0.5 * static_cast<double>( Dimension ) ) );
+
+    for( unsigned int d = 0; d < Dimension; d++ )
+      {
+      double sigma = vcl_sqrt( vnl_math_max( covariance( d, d ), 0.0 ) );
+      double mean = this->m_Gaussians[j]->GetMean()[d];
+      minValues[d] = vnl_math_min( minValues[d], mean - 4.0 * sigma );
+      maxValues[d] = vnl_math_max( maxValues[d], mean + 4.0 * sigma );
+      minStandardDeviations[d] = vnl_math_min( minStandardDeviations[d], sigma );
+      }
+    }
+
+  /**
+   * A node costs a neighborhood search and kernel sum, as an exact
+   * evaluation does.  The grid is rebuilt for every list sample, so it is
+   * only built if it has no more nodes than there are samples (each sample
+   * is evaluated at least once), and never more than
+   * MaximumNumberOfLookupGridNodes.
+   */
+  const double maximumNumberOfNodes = vnl_math_min(
+    static_cast<double>( this->m_MaximumNumberOfLookupGridNodes ),
+    static_cast<double>( this->m_Gaussians.size() ) );
+
+  double numberOfNodes = 1.0;
+  for( unsigned int d = 0; d < Dimension; d++ )
+    {
+    if( !( minStandardDeviations[d] > 0.0 ) )
+      {
+      return;
+      }
+    double size = vcl_ceil( ( maxValues[d] - minValues[d] ) /
+      ( 0.5 * minStandardDeviations[d] ) ) + 1.0;
+    this->m_LookupGridSize[d] = static_cast<unsigned long>( vnl_math_max( size, 2.0 ) );
+    this->m_LookupGridOrigin[d] = minValues[d];
+    this->m_LookupGridSpacing[d] = ( maxValues[d] - minValues[d] ) /
+      static_cast<double>( this->m_LookupGridSize[d] - 1 );
+    numberOfNodes *= static_cast<double>( this->m_LookupGridSize[d] );
+    }
+  if( numberOfNodes > maximumNumberOfNodes )
+    {
+    itkDebugMacro( "The lookup grid would need " << numberOfNodes
+      << " nodes, more than " << maximumNumberOfNodes
+      << ";  the density is evaluated exactly." );
+    return;
+    }
+
+  this->m_LookupGrid.assign( static_cast<unsigned long>( numberOfNodes ), 0.0 );
+  this->m_LookupGridDimension = Dimension;
+
+  MultiThreader::Pointer threader = MultiThreader::New();
+  threader->SetNumberOfThreads( MultiThreader::GetGlobalDefaultNumberOfThreads() );
+  if( this->m_ThreadKdTreeGenerators.size() < threader->GetNumberOfThreads() )
+    {
+    this->m_ThreadKdTreeGenerators.resize( threader->GetNumberOfThreads() );
+    }
+  threader->SetSingleMethod( Self::LookupGridThreaderCallback, &str );
+  threader->SingleMethodExecute();
+
+  itkDebugMacro( "Lookup grid of " << this->m_LookupGrid.size() << " nodes ("
+    << this->GetLookupGridSizeInBytes() << " bytes)." );
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+ITK_THREAD_RETURN_TYPE
+ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::LookupGridThreaderCallback( void *arg )
+{
+  typedef MultiThreader::ThreadInfoStruct ThreadInfoType;
+  ThreadInfoType *info = static_cast<ThreadInfoType *>( arg );
+  LookupGridThreadStruct *str = static_cast<LookupGridThreadStruct *>( info->UserData );
+  const unsigned int threadId = info->ThreadID;
+  const unsigned int threadCount = info->NumberOfThreads;
+
+  Self *function = str->Function;
+  const unsigned int Dimension = function->m_LookupGridDimension;
+
+  // Each thread fills a range of nodes.  A node sums the kernels Evaluate()
+  // would sum there, the EvaluationKNeighborhood nearest, in the order the
+  // kd-tree returns them, so the grid does not depend on the thread count.
+  const unsigned long numberOfNodes = function->m_LookupGrid.size();
+  const unsigned long nodesPerThread = ( numberOfNodes + threadCount - 1 ) / threadCount;
+  const unsigned long firstNode = threadId * nodesPerThread;
+  const unsigned long lastNode = vnl_math_min( numberOfNodes, firstNode + nodesPerThread );
+
+  const unsigned int numberOfNeighbors = vnl_math_min(
+    function->m_EvaluationKNeighborhood,
+    static_cast<unsigned int>( function->m_Gaussians.size() ) );
+  const bool useAllKernels = ( numberOfNeighbors == function->m_Gaussians.size() );
+  KdTreeType *tree = useAllKernels ? NULL : function->GetThreadKdTree( threadId );
+
+  NeighborhoodIdentifierType neighbors;
+  if( useAllKernels )
+    {
+    neighbors.resize( numberOfNeighbors );
+    for( unsigned int j = 0; j < numberOfNeighbors; j++ )
+      {
+      neighbors[j] = j;
+      }
+    }
+
+  const double normalization = 1.0 / function->m_NormalizationFactor;
+
+  InputMeasurementVectorType point =
+    function->GetInputListSample()->GetMeasurementVector( 0 );
+  double coordinate[MaximumLookupGridDimension];
+  double difference[MaximumLookupGridDimension];
+  for( unsigned long n = firstNode; n < lastNode; n++ )
+    {
+    unsigned long index = n;
+    for( unsigned int d = 0; d < Dimension; d++ )
+      {
+      coordinate[d] = function->m_LookupGridOrigin[d] +
+        static_cast<double>( index % function->m_LookupGridSize[d] ) *
+        function->m_LookupGridSpacing[d];
+      point[d] = coordinate[d];
+      index /= function->m_LookupGridSize[d];
+      }
+
+    if( !useAllKernels )
+      {
+      tree->Search( point, numberOfNeighbors, neighbors );
+      }
+
+    double sum = 0.0;
+    for( unsigned int k = 0; k < numberOfNeighbors; k++ )
+      {
+      const unsigned long j = neighbors[k];
+      const typename GaussianType::MeanVectorType & mean =
+        function->m_Gaussians[j]->GetMean();
+      for( unsigned int d = 0; d < Dimension; d++ )
+        {
+        difference[d] = coordinate[d] - mean[d];
+        }
+      const vnl_matrix<double> & inverseCovariance = str->InverseCovariances[j];
+      double distance = 0.0;
+      for( unsigned int r = 0; r < Dimension; r++ )
+        {
+        for( unsigned int c = 0; c < Dimension; c++ )
+          {
+          distance += difference[r] * inverseCovariance( r, c ) * difference[c];
+          }
+        }
+      sum += str->PreFactors[j] * vcl_exp( -0.5 * distance );
+      }
+    function->m_LookupGrid[n] = static_cast<RealType>( sum * normalization );
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+TOutput
+ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::SetNumberOfThreads( unsigned int n )
+{
+  this->m_ThreadKdTreeGenerators.resize( vnl_math_max( n, 1u ) );
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+typename ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>::KdTreeType *
+ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::GetThreadKdTree( ThreadIdType threadId ) const
+{
+  if( threadId == 0 || !this->m_KdTreeGenerator )
+    {
+    return this->m_KdTreeGenerator ? this->m_KdTreeGenerator->GetOutput() : NULL;
+    }
+  typename TreeGeneratorType::Pointer & copy = this->m_ThreadKdTreeGenerators[threadId];
+  if( !copy )
+    {
+    copy = TreeGeneratorType::New();
+    copy->SetSample( const_cast<InputListSampleType *>(
+      this->GetInputListSample() ) );
+    copy->SetBucketSize( 16 );
+    copy->Update();
+    }
+  return copy->GetOutput();
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+void
+ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::EvaluateBlock( const InputMeasurementVectorBlockType &measurements,
+  TOutput *output, ThreadIdType threadId ) const
+{
+  KdTreeType *tree = this->GetThreadKdTree( threadId );
+  for( unsigned long n = 0; n < measurements.size(); n++ )
+    {
+    output[n] = this->EvaluateWithKdTree( measurements[n], tree );
+    }
 }
 
 template <class TListSample, class TOutput, class TCoordRep>
 TOutput
 ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
 ::Evaluate( const InputMeasurementVectorType &measurement ) const
+{
+  return this->EvaluateWithKdTree( measurement, this->GetThreadKdTree( 0 ) );
+}
+
+template <class TListSample, class TOutput, class TCoordRep>
+TOutput
+ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
+::EvaluateWithKdTree( const InputMeasurementVectorType &measurement,
+  KdTreeType *tree ) const
 {
 
+  if( this->m_LookupGridDimension > 0 )
+    {
+    const unsigned int Dimension = this->m_LookupGridDimension;
+
+    unsigned long base = 0;
+    unsigned long stride = 1;
+    unsigned long strides[MaximumLookupGridDimension];
+    double weights[MaximumLookupGridDimension];
+    bool isInside = true;
+    for( unsigned int d = 0; d < Dimension && isInside; d++ )
+      {
+      double u = ( measurement[d] - this->m_LookupGridOrigin[d] ) /
+        this->m_LookupGridSpacing[d];
+      isInside = ( u >= 0.0 &&
+        u <= static_cast<double>( this->m_LookupGridSize[d] - 1 ) );
+      if( isInside )
+        {
+        unsigned long i = vnl_math_min( static_cast<unsigned long>( u ),
+          this->m_LookupGridSize[d] - 2 );
+        weights[d] = u - static_cast<double>( i );
+        strides[d] = stride;
+        base += i * stride;
+        stride *= this->m_LookupGridSize[d];
+        }
+      }
+    if( isInside )
+      {
+      double value = 0.0;
+      for( unsigned int corner = 0; corner < ( 1u << Dimension ); corner++ )
+        {
+        double weight = 1.0;
+        unsigned long offset = base;
+        for( unsigned int d = 0; d < Dimension; d++ )
+          {
+          if( corner & ( 1u << d ) )
+            {
+            weight *= weights[d];
+            offset += strides[d];
+            }
+          else
+            {
+            weight *= 1.0 - weights[d];
+            }
+          }
+        value += weight * this->m_LookupGrid[offset];
+        }
+      return static_cast<OutputType>( value );
+      }
+    }
+
   try
     {
     unsigned int numberOfNeighbors = vnl_math_min(
@@ -211,8 +523,7 @@ ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
       {
       typename TreeGeneratorType::KdTreeType
         ::InstanceIdentifierVectorType neighbors;
-      this->m_KdTreeGenerator->GetOutput()->Search( measurement,
-        numberOfNeighbors, neighbors );
+      tree->Search( measurement, numberOfNeighbors, neighbors );
 
       for( unsigned int j = 0; j < numberOfNeighbors; j++ )
         {
@@ -249,6 +560,18 @@ ManifoldParzenWindowsListSampleFunction<TListSample, TOutput, TCoordRep>
     os << indent << "Kernel sigma: "
                  << this->m_KernelSigma << std::endl;
     }
+  if( this->m_LookupGridDimension > 0 )
+    {
+    os << indent << "Lookup grid size: [";
+    for( unsigned int d = 0; d < this->m_LookupGridDimension; d++ )
+      {
+      os << this->m_LookupGridSize[d]
+         << ( d + 1 < this->m_LookupGridDimension ? ", " : "]" );
+      }
+    os << std::endl;
+    }
+  os << indent << "Lookup grid memory (bytes): "
+               << this->GetLookupGridSizeInBytes() << std::endl;
 }
 
 } // end of namespace Statistics
@@ -0,0 +1,167 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: antsSparseProbabilityImage.h,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: $
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+  http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt
+  for details.
+
+  This software is distributed WITHOUT ANY WARRANTY; without even
+  the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+  PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __antsSparseProbabilityImage_h
+#define __antsSparseProbabilityImage_h
+
+#include "itkImageRegionConstIterator.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace itk {
+namespace ants {
+
+/** \class SparseProbabilityImage
+ * \brief Compact store of the non-negligible voxels of a probability image.
+ *
+ * The voxels above a threshold are kept row by row, a row being a line of
+ * the image along its first dimension:  the column of each stored voxel and
+ * its value sit in two arrays sorted in buffer order, and a table gives the
+ * first entry of every row.  GetValue() finds a voxel with a binary search
+ * within its row and returns zero for voxels that were not stored, so a
+ * lookup costs O(log(row length)) and allocates nothing.
+ *
+ * Indices are taken relative to a zero start index, whatever the start
+ * index of the image the store was built from.
+ */
+template <class TImage>
+class SparseProbabilityImage
+{
+public:
+  typedef TImage                                ImageType;
+  typedef typename ImageType::PixelType         RealType;
+  typedef typename ImageType::IndexType         IndexType;
+  typedef typename ImageType::SizeType          SizeType;
+  typedef typename ImageType::RegionType        RegionType;
+
+  itkStaticConstMacro( ImageDimension, unsigned int, ImageType::ImageDimension );
+
+  SparseProbabilityImage()
+    {
+    this->m_Size.Fill( 0 );
+    }
+
+  /** Keep the voxels of the requested region of image above threshold. */
+  void SetImage( const ImageType *image, RealType threshold )
+    {
+    const RegionType & region = image->GetRequestedRegion();
+    this->m_Size = region.GetSize();
+    const unsigned long rowLength = this->m_Size[0];
+    const unsigned long numberOfRows = ( rowLength > 0 )
+      ? region.GetNumberOfPixels() / rowLength : 0;
+
+    this->m_Columns.clear();
+    this->m_Values.clear();
+    this->m_RowStarts.assign( numberOfRows + 1, 0 );
+
+    ImageRegionConstIterator<ImageType> It( image, region );
+    It.GoToBegin();
+    for( unsigned long row = 0; row < numberOfRows; row++ )
+      {
+      this->m_RowStarts[row] = this->m_Values.size();
+      for( unsigned long column = 0; column < rowLength; column++, ++It )
+        {
+        if( It.Get() > threshold )
+          {
+          this->m_Columns.push_back( column );
+          this->m_Values.push_back( It.Get() );
+          }
+        }
+      }
+    this->m_RowStarts[numberOfRows] = this->m_Values.size();
+
+    // drop the slack of the growing arrays
+    std::vector<unsigned int>( this->m_Columns ).swap( this->m_Columns );
+    std::vector<RealType>( this->m_Values ).swap( this->m_Values );
+    }
+
+  /** The stored value, or zero, at an index relative to a zero start. */
+  inline RealType GetValue( const IndexType & index ) const
+    {
+    unsigned long row = 0;
+    unsigned long stride = 1;
+    for( unsigned int d = 1; d < ImageDimension; d++ )
+      {
+      if( index[d] < 0 || static_cast<unsigned long>( index[d] ) >= this->m_Size[d] )
+        {
+        return 0;
+        }
+      row += stride * index[d];
+      stride *= this->m_Size[d];
+      }
+    if( index[0] < 0 || static_cast<unsigned long>( index[0] ) >= this->m_Size[0] )
+      {
+      return 0;
+      }
+
+    const unsigned int column = static_cast<unsigned int>( index[0] );
+    std::vector<unsigned int>::const_iterator first =
+      this->m_Columns.begin() + this->m_RowStarts[row];
+    std::vector<unsigned int>::const_iterator last =
+      this->m_Columns.begin() + this->m_RowStarts[row + 1];
+    std::vector<unsigned int>::const_iterator it =
+      std::lower_bound( first, last, column );
+    if( it == last || *it != column )
+      {
+      return 0;
+      }
+    return this->m_Values[it - this->m_Columns.begin()];
+    }
+
+  /** Write the stored values into image, which must be zero filled and
+   * at least as large as the store. */
+  void FillImage( ImageType *image ) const
+    {
+    const RegionType & region = image->GetRequestedRegion();
+    const unsigned long numberOfRows = ( this->m_RowStarts.empty() )
+      ? 0 : this->m_RowStarts.size() - 1;
+    for( unsigned long row = 0; row < numberOfRows; row++ )
+      {
+      IndexType index = region.GetIndex();
+      unsigned long remainder = row;
+      for( unsigned int d = 1; d < ImageDimension; d++ )
+        {
+        index[d] += remainder % this->m_Size[d];
+        remainder /= this->m_Size[d];
+        }
+      for( unsigned long i = this->m_RowStarts[row]; i < this->m_RowStarts[row + 1]; i++ )
+        {
+        index[0] = region.GetIndex()[0] + this->m_Columns[i];
+        image->SetPixel( index, this->m_Values[i] );
+        }
+      }
+    }
+
+  /** Number of stored voxels. */
+  unsigned long GetNumberOfValues() const
+    {
+    return this->m_Values.size();
+    }
+
+private:
+  SizeType                   m_Size;
+  std::vector<unsigned long> m_RowStarts;
+  std::vector<unsigned int>  m_Columns;
+  std::vector<RealType>      m_Values;
+};
+
+} // namespace ants
+} // namespace itk
+
+#endif
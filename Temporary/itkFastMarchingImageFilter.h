@@ -19,6 +19,7 @@ Program:   Advanced Normalization Tools
 #define __itkFastMarchingImageFilter_h
 
 #include "itkArray.h"
+#include "itkFastMarchingTrialQueue.h"
 #include "itkImageToImageFilter.h"
 #include "itkIndex.h"
 #include "itkLevelSet.h"
@@ -42,7 +43,7 @@ namespace itk
  *
  * Updates are preformed using an entropy satisfy scheme where only
  * "upwind" neighborhoods are used. This implementation of Fast Marching
- * uses a std::priority_queue to locate the next proper grid position to
+ * uses an indexed min-heap to locate the next proper grid position to
  * update.
  *
  * Fast Marching sweeps through N grid points in (N log N) steps to obtain
@@ -87,17 +88,15 @@ namespace itk
  * and SetOutputOrigin(). Else if the speed image is not NULL, the output information
  * is copied from the input speed image.
  *
- * Possible Improvements:
- * In the current implemenation, std::priority_queue only allows
- * taking nodes out from the front and putting nodes in from the back.
- * To update a value already on the heap, a new node is added to the heap.
- * The defunct old node is left on the heap. When it is removed from the
- * top, it will be recognized as invalid and not used.
- * Future implementations can implement the heap in a different way
- * allowing the values to be updated. This will generally require
- * some sift-up and sift-down functions and
- * an image of back-pointers going from the image to heap in order
- * to locate the node which is to be updated.
+ * Trial points are kept in a 4-ary min-heap indexed by buffer offset, so
+ * a trial point whose value improves is moved within the heap rather than
+ * added a second time.  Setting the TrialQueue to BucketQueue trades exact
+ * ordering for speed:  trial points are binned by value in buckets of
+ * width BucketWidth and those within one bucket are accepted in any order,
+ * which perturbs the arrival times by at most about one bucket width.
+ * PriorityQueue keeps the std::priority_queue of earlier versions, which
+ * adds an improved trial point a second time and skips the stale entry
+ * when it is popped;  it is kept as a reference for the other two.
  *
  * \sa LevelSetTypeDefault
  * \ingroup LevelSetSegmentation
@@ -267,6 +266,21 @@ public:
 
   enum TopologyCheckType { None, NoHandles, Strict };
 
+  enum TrialQueueType { IndexedHeap, BucketQueue, PriorityQueue };
+
+  /** Set/Get the queue holding the trial points.  IndexedHeap, the
+   * default, gives the exact fast marching order;  BucketQueue is faster
+   * but only orders trial points up to the bucket width;  PriorityQueue
+   * is the exact std::priority_queue used before the indexed heap. */
+  itkSetMacro( TrialQueue, TrialQueueType );
+  itkGetConstReferenceMacro( TrialQueue, TrialQueueType );
+
+  /** Set/Get the bucket width of the BucketQueue, in arrival time units.
+   * A value of zero or less, the default, uses a tenth of the smallest
+   * output spacing. */
+  itkSetMacro( BucketWidth, double );
+  itkGetConstReferenceMacro( BucketWidth, double );
+
   /** Set/Get boolean macro indicating whether the user wants to check topology. */
   itkSetMacro( TopologyCheck, TopologyCheckType );
   itkGetConstReferenceMacro( TopologyCheck, TopologyCheckType );
@@ -380,12 +394,22 @@ private:
   /** Trial points are stored in a min-heap. This allow efficient access
    * to the trial point with minimum value which is the next grid point
    * the algorithm processes. */
-  typedef std::vector<AxisNodeType>  HeapContainer;
-  typedef std::greater<AxisNodeType> NodeComparer;
-  typedef std::priority_queue< AxisNodeType, HeapContainer, NodeComparer >
-                                     HeapType;
-
-  HeapType    m_TrialHeap;
+  typedef FastMarchingTrialHeap<PixelType>        HeapType;
+  typedef FastMarchingTrialBucketQueue<PixelType> BucketQueueType;
+  typedef std::vector<AxisNodeType>               PriorityQueueContainer;
+  typedef std::greater<AxisNodeType>              NodeComparer;
+  typedef std::priority_queue< AxisNodeType, PriorityQueueContainer, NodeComparer >
+                                                  PriorityQueueType;
+
+  void PushTrialPoint( const IndexType & index, PixelType value );
+  void PopTrialPoint( AxisNodeType & node );
+  bool IsTrialQueueEmpty() const;
+
+  HeapType          m_TrialHeap;
+  BucketQueueType   m_TrialBucketQueue;
+  PriorityQueueType m_TrialPriorityQueue;
+  TrialQueueType    m_TrialQueue;
+  double            m_BucketWidth;
 
   double    m_NormalizationFactor;
 
@@ -35,7 +35,9 @@ namespace itk
 template <class TLevelSet, class TSpeedImage>
 FastMarchingImageFilter<TLevelSet,TSpeedImage>
 ::FastMarchingImageFilter()
-  : m_TrialHeap( )
+  : m_TrialHeap( ),
+    m_TrialBucketQueue( ),
+    m_TrialPriorityQueue( )
 {
   this->ProcessObject::SetNumberOfRequiredInputs(0);
 
@@ -66,6 +68,9 @@ FastMarchingImageFilter<TLevelSet,TSpeedImage>
 
   this->m_NormalizationFactor = 1.0;
   this->m_TopologyCheck = None;
+
+  this->m_TrialQueue = IndexedHeap;
+  this->m_BucketWidth = 0.0;
 }
 
 template <class TLevelSet, class TSpeedImage>
@@ -101,6 +106,20 @@ FastMarchingImageFilter<TLevelSet,TSpeedImage>
       os << "Strict" << std::endl;
       }
     }
+  os << indent << "Trial queue: ";
+  if ( this->m_TrialQueue == BucketQueue )
+    {
+    os << "Bucket queue" << std::endl;
+    }
+  else if ( this->m_TrialQueue == PriorityQueue )
+    {
+    os << "Priority queue" << std::endl;
+    }
+  else
+    {
+    os << "Indexed heap" << std::endl;
+    }
+  os << indent << "Bucket width: " << this->m_BucketWidth << std::endl;
   os << indent << "Collect points: " << this->m_CollectPoints << std::endl;
   os << indent << "OverrideOutputInformation: ";
   os << this->m_OverrideOutputInformation << std::endl;
@@ -273,10 +292,26 @@ FastMarchingImageFilter<TLevelSet,TSpeedImage>
     this->m_ConnectedComponentImage = relabeler->GetOutput();
     }
 
-  // make sure the heap is empty
-  while ( !this->m_TrialHeap.empty() )
+  // make sure the trial queue is empty
+  this->m_TrialHeap.Release();
+  this->m_TrialBucketQueue.Release();
+  this->m_TrialPriorityQueue = PriorityQueueType();
+  if ( this->m_TrialQueue == BucketQueue )
+    {
+    double bucketWidth = this->m_BucketWidth;
+    if ( bucketWidth <= 0.0 )
+      {
+      bucketWidth = 0.1 * output->GetSpacing()[0];
+      for ( unsigned int d = 1; d < SetDimension; d++ )
+        {
+        bucketWidth = vnl_math_min( bucketWidth, 0.1 * output->GetSpacing()[d] );
+        }
+      }
+    this->m_TrialBucketQueue.Initialize( bucketWidth );
+    }
+  else if ( this->m_TrialQueue == IndexedHeap )
     {
-    this->m_TrialHeap.pop();
+    this->m_TrialHeap.Initialize( this->m_BufferedRegion.GetNumberOfPixels() );
     }
 
   // process the input trial points
@@ -308,7 +343,7 @@ FastMarchingImageFilter<TLevelSet,TSpeedImage>
       outputPixel = node.GetValue();
       output->SetPixel( node.GetIndex(), outputPixel );
 
-      this->m_TrialHeap.push( node );
+      this->PushTrialPoint( node.GetIndex(), node.GetValue() );
 
       }
     }
@@ -355,11 +390,10 @@ FastMarchingImageFilter<TLevelSet,TSpeedImage>
 
   this->UpdateProgress( 0.0 ); // Send first progress event
 
-  while ( !this->m_TrialHeap.empty() )
+  while ( !this->IsTrialQueueEmpty() )
     {
     // get the node with the smallest value
-    node = this->m_TrialHeap.top();
-    this->m_TrialHeap.pop();
+    this->PopTrialPoint( node );
 
     // does this node contain the current value ?
     currentValue = (double) output->GetPixel( node.GetIndex() );
@@ -523,6 +557,78 @@ FastMarchingImageFilter<TLevelSet,TSpeedImage>
         }
       }
     }
+
+  // the position table of the heap is as large as the output
+  this->m_TrialHeap.Release();
+  this->m_TrialBucketQueue.Release();
+  this->m_TrialPriorityQueue = PriorityQueueType();
+}
+
+template <class TLevelSet, class TSpeedImage>
+void
+FastMarchingImageFilter<TLevelSet,TSpeedImage>
+::PushTrialPoint( const IndexType & index, PixelType value )
+{
+  const OffsetValueType offset =
+    this->GetOutput()->ComputeOffset( index );
+  if ( this->m_TrialQueue == BucketQueue )
+    {
+    this->m_TrialBucketQueue.Push( offset, value );
+    }
+  else if ( this->m_TrialQueue == PriorityQueue )
+    {
+    AxisNodeType node;
+    node.SetValue( value );
+    node.SetIndex( index );
+    this->m_TrialPriorityQueue.push( node );
+    }
+  else
+    {
+    this->m_TrialHeap.Push( offset, value );
+    }
+}
+
+template <class TLevelSet, class TSpeedImage>
+void
+FastMarchingImageFilter<TLevelSet,TSpeedImage>
+::PopTrialPoint( AxisNodeType & node )
+{
+  OffsetValueType offset;
+  if ( this->m_TrialQueue == BucketQueue )
+    {
+    typename BucketQueueType::EntryType entry = this->m_TrialBucketQueue.Pop();
+    node.SetValue( entry.Value );
+    offset = entry.Offset;
+    }
+  else if ( this->m_TrialQueue == PriorityQueue )
+    {
+    node = this->m_TrialPriorityQueue.top();
+    this->m_TrialPriorityQueue.pop();
+    return;
+    }
+  else
+    {
+    typename HeapType::EntryType entry = this->m_TrialHeap.Pop();
+    node.SetValue( entry.Value );
+    offset = entry.Offset;
+    }
+  node.SetIndex( this->GetOutput()->ComputeIndex( offset ) );
+}
+
+template <class TLevelSet, class TSpeedImage>
+bool
+FastMarchingImageFilter<TLevelSet,TSpeedImage>
+::IsTrialQueueEmpty() const
+{
+  if ( this->m_TrialQueue == BucketQueue )
+    {
+    return this->m_TrialBucketQueue.Empty();
+    }
+  if ( this->m_TrialQueue == PriorityQueue )
+    {
+    return this->m_TrialPriorityQueue.empty();
+    }
+  return this->m_TrialHeap.Empty();
 }
 
 template <class TLevelSet, class TSpeedImage>
@@ -687,9 +793,7 @@ FastMarchingImageFilter<TLevelSet,TSpeedImage>
 
     // insert point into trial heap
     this->m_LabelImage->SetPixel( index, TrialPoint );
-    node.SetValue( static_cast<PixelType>( solution ) );
-    node.SetIndex( index );
-    this->m_TrialHeap.push( node );
+    this->PushTrialPoint( index, static_cast<PixelType>( solution ) );
     }
 
   return solution;
@@ -0,0 +1,304 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: itkFastMarchingTrialQueue.h,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __itkFastMarchingTrialQueue_h
+#define __itkFastMarchingTrialQueue_h
+
+#include "itkIntTypes.h"
+#include "vcl_cmath.h"
+#include "vnl/vnl_math.h"
+
+#include <vector>
+
+namespace itk
+{
+
+/** \class FastMarchingTrialHeap
+ * \brief Indexed 4-ary min-heap of trial points keyed by buffer offset.
+ *
+ * Every buffer offset has a slot holding its position in the heap, so
+ * Push() on a point already in the heap changes its value in place
+ * (decrease-key, or increase-key) instead of adding a second entry.  The
+ * heap therefore never holds more entries than there are trial points.
+ * The position table costs four bytes per voxel of the buffer.
+ */
+template <class TValue>
+class FastMarchingTrialHeap
+{
+public:
+  typedef TValue ValueType;
+
+  struct EntryType
+    {
+    ValueType       Value;
+    OffsetValueType Offset;
+    };
+
+  /** Size the position table for a buffer and empty the heap. */
+  void Initialize( SizeValueType numberOfOffsets )
+    {
+    this->m_Entries.clear();
+    this->m_Positions.assign( numberOfOffsets, NotInHeap() );
+    }
+
+  /** Free the heap and the position table. */
+  void Release()
+    {
+    std::vector<EntryType>().swap( this->m_Entries );
+    std::vector<unsigned int>().swap( this->m_Positions );
+    }
+
+  bool Empty() const
+    {
+    return this->m_Entries.empty();
+    }
+
+  SizeValueType Size() const
+    {
+    return this->m_Entries.size();
+    }
+
+  /** Insert a point, or change its value if it is already in the heap. */
+  void Push( OffsetValueType offset, ValueType value )
+    {
+    unsigned int position = this->m_Positions[offset];
+    if( position == NotInHeap() )
+      {
+      EntryType entry;
+      entry.Value = value;
+      entry.Offset = offset;
+      this->m_Entries.push_back( entry );
+      this->SiftUp( this->m_Entries.size() - 1 );
+      }
+    else if( value < this->m_Entries[position].Value )
+      {
+      this->m_Entries[position].Value = value;
+      this->SiftUp( position );
+      }
+    else
+      {
+      this->m_Entries[position].Value = value;
+      this->SiftDown( position );
+      }
+    }
+
+  /** Remove the entry of smallest value. */
+  EntryType Pop()
+    {
+    EntryType top = this->m_Entries[0];
+    this->m_Positions[top.Offset] = NotInHeap();
+
+    EntryType last = this->m_Entries.back();
+    this->m_Entries.pop_back();
+    if( !this->m_Entries.empty() )
+      {
+      this->m_Entries[0] = last;
+      this->m_Positions[last.Offset] = 0;
+      this->SiftDown( 0 );
+      }
+    return top;
+    }
+
+private:
+  static unsigned int NotInHeap()
+    {
+    return static_cast<unsigned int>( -1 );
+    }
+
+  void SiftUp( SizeValueType position )
+    {
+    EntryType entry = this->m_Entries[position];
+    while( position > 0 )
+      {
+      SizeValueType parent = ( position - 1 ) >> 2;
+      if( !( entry.Value < this->m_Entries[parent].Value ) )
+        {
+        break;
+        }
+      this->m_Entries[position] = this->m_Entries[parent];
+      this->m_Positions[this->m_Entries[position].Offset] =
+        static_cast<unsigned int>( position );
+      position = parent;
+      }
+    this->m_Entries[position] = entry;
+    this->m_Positions[entry.Offset] = static_cast<unsigned int>( position );
+    }
+
+  void SiftDown( SizeValueType position )
+    {
+    const SizeValueType size = this->m_Entries.size();
+    EntryType entry = this->m_Entries[position];
+    while( true )
+      {
+      SizeValueType first = ( position << 2 ) + 1;
+      if( first >= size )
+        {
+        break;
+        }
+      SizeValueType last = vnl_math_min( first + 4, size );
+      SizeValueType smallest = first;
+      for( SizeValueType child = first + 1; child < last; child++ )
+        {
+        if( this->m_Entries[child].Value < this->m_Entries[smallest].Value )
+          {
+          smallest = child;
+          }
+        }
+      if( !( this->m_Entries[smallest].Value < entry.Value ) )
+        {
+        break;
+        }
+      this->m_Entries[position] = this->m_Entries[smallest];
+      this->m_Positions[this->m_Entries[position].Offset] =
+        static_cast<unsigned int>( position );
+      position = smallest;
+      }
+    this->m_Entries[position] = entry;
+    this->m_Positions[entry.Offset] = static_cast<unsigned int>( position );
+    }
+
+  std::vector<EntryType>    m_Entries;
+  std::vector<unsigned int> m_Positions;
+};
+
+/** \class FastMarchingTrialBucketQueue
+ * \brief Untidy priority queue of trial points for approximate marching.
+ *
+ * Values are binned in buckets of a fixed width kept in a circular array,
+ * and Pop() returns any entry of the lowest non-empty bucket, so trial
+ * points within one bucket width are accepted out of order.  Push() and
+ * Pop() take constant time.  An improved value is pushed again, and the
+ * caller skips entries whose value is no longer current, as with
+ * std::priority_queue.  The array grows when the values in the queue span
+ * more buckets than it has.
+ */
+template <class TValue>
+class FastMarchingTrialBucketQueue
+{
+public:
+  typedef TValue ValueType;
+
+  struct EntryType
+    {
+    ValueType       Value;
+    OffsetValueType Offset;
+    };
+
+  FastMarchingTrialBucketQueue() : m_BucketWidth( 1.0 ), m_Size( 0 ),
+    m_LowestBucket( 0 ), m_HighestBucket( 0 ) {}
+
+  void Initialize( double bucketWidth )
+    {
+    this->m_BucketWidth = bucketWidth;
+    this->m_Buckets.assign( 256, std::vector<EntryType>() );
+    this->m_Size = 0;
+    this->m_LowestBucket = 0;
+    this->m_HighestBucket = 0;
+    }
+
+  void Release()
+    {
+    std::vector<std::vector<EntryType> >().swap( this->m_Buckets );
+    this->m_Size = 0;
+    }
+
+  bool Empty() const
+    {
+    return this->m_Size == 0;
+    }
+
+  SizeValueType Size() const
+    {
+    return this->m_Size;
+    }
+
+  void Push( OffsetValueType offset, ValueType value )
+    {
+    long bucket = static_cast<long>( vcl_floor(
+      static_cast<double>( value ) / this->m_BucketWidth ) );
+    if( this->m_Size == 0 )
+      {
+      this->m_LowestBucket = bucket;
+      this->m_HighestBucket = bucket;
+      }
+    else
+      {
+      long lowest = vnl_math_min( this->m_LowestBucket, bucket );
+      long highest = vnl_math_max( this->m_HighestBucket, bucket );
+      if( highest - lowest >= static_cast<long>( this->m_Buckets.size() ) )
+        {
+        this->Grow( highest - lowest + 1 );
+        }
+      this->m_LowestBucket = lowest;
+      this->m_HighestBucket = highest;
+      }
+
+    EntryType entry;
+    entry.Value = value;
+    entry.Offset = offset;
+    this->m_Buckets[this->Slot( bucket )].push_back( entry );
+    this->m_Size++;
+    }
+
+  EntryType Pop()
+    {
+    while( this->m_Buckets[this->Slot( this->m_LowestBucket )].empty() )
+      {
+      this->m_LowestBucket++;
+      }
+    std::vector<EntryType> & entries =
+      this->m_Buckets[this->Slot( this->m_LowestBucket )];
+    EntryType entry = entries.back();
+    entries.pop_back();
+    this->m_Size--;
+    return entry;
+    }
+
+private:
+  SizeValueType Slot( long bucket ) const
+    {
+    long size = static_cast<long>( this->m_Buckets.size() );
+    long slot = bucket % size;
+    return static_cast<SizeValueType>( slot < 0 ? slot + size : slot );
+    }
+
+  /** Rehash the buckets in use into an array of at least span buckets. */
+  void Grow( long span )
+    {
+    SizeValueType size = this->m_Buckets.size();
+    while( static_cast<long>( size ) < span )
+      {
+      size *= 2;
+      }
+    std::vector<std::vector<EntryType> > buckets( size );
+    for( long bucket = this->m_LowestBucket; bucket <= this->m_HighestBucket; bucket++ )
+      {
+      long slot = bucket % static_cast<long>( size );
+      buckets[slot < 0 ? slot + size : slot].swap(
+        this->m_Buckets[this->Slot( bucket )] );
+      }
+    this->m_Buckets.swap( buckets );
+    }
+
+  double                               m_BucketWidth;
+  std::vector<std::vector<EntryType> > m_Buckets;
+  SizeValueType                        m_Size;
+  long                                 m_LowestBucket;
+  long                                 m_HighestBucket;
+};
+
+} // end namespace itk
+
+#endif
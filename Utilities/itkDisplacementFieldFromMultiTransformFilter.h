@@ -60,7 +60,7 @@ public:
         Superclass::GenerateInputRequestedRegion();
     }
 
-    virtual void BeforeThreadedGenerateData() {};
+    virtual void BeforeThreadedGenerateData() { this->UpdateFieldSamplers(); };
 
     virtual void AfterThreadedGenerateData() {};
 
@@ -0,0 +1,172 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: itkDisplacementFieldLinearSampler.h,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef ITKDISPLACEMENTFIELDLINEARSAMPLER_H_
+#define ITKDISPLACEMENTFIELDLINEARSAMPLER_H_
+
+#include "itkContinuousIndex.h"
+#include "itkNumericTraits.h"
+#include "itkPoint.h"
+#include "itkVector.h"
+#include "itkMath.h"
+
+namespace itk
+{
+
+/** \class DisplacementFieldLinearSampler
+ * \brief Inline linear interpolation of a vector displacement field.
+ *
+ * A plain value class for the inner loops of the multi-transform warpers.
+ * Initialize() caches the buffer pointer, strides, origin and the
+ * physical-to-index matrix of the field, so that Evaluate() maps a point and
+ * interpolates it without virtual calls or smart pointer traffic.  The
+ * image dimension is a template constant and the loops over it unroll, which
+ * gives the 2D and 3D cases straight-line code.
+ *
+ * The arithmetic follows Image::TransformPhysicalPointToContinuousIndex and
+ * VectorLinearInterpolateImageFunction term by term, so the results are the
+ * same as those of the generic path.  The inside test and the clamping of
+ * neighbours use the buffered region, which is the largest possible region
+ * unless the field is streamed.
+ *
+ * The sampler does not hold a reference to the field;  call Initialize()
+ * again whenever the field buffer changes.
+ */
+template <class TDisplacementField, class TCoordRep = double>
+class DisplacementFieldLinearSampler
+{
+public:
+    typedef TDisplacementField                           FieldType;
+    itkStaticConstMacro(ImageDimension, unsigned int, FieldType::ImageDimension);
+
+    typedef typename FieldType::PixelType                VectorType;
+    typedef typename VectorType::ValueType               ValueType;
+    itkStaticConstMacro(VectorDimension, unsigned int, VectorType::Dimension);
+
+    typedef typename NumericTraits<ValueType>::RealType  RealType;
+    typedef Vector<RealType, itkGetStaticConstMacro(VectorDimension)> OutputType;
+
+    typedef typename FieldType::RegionType               RegionType;
+    typedef typename FieldType::IndexType                IndexType;
+    typedef typename IndexType::IndexValueType           IndexValueType;
+    typedef Point<TCoordRep, itkGetStaticConstMacro(ImageDimension)> PointType;
+    typedef ContinuousIndex<TCoordRep, itkGetStaticConstMacro(ImageDimension)> ContinuousIndexType;
+
+    DisplacementFieldLinearSampler() : m_Buffer(NULL) {}
+
+    void Initialize(const FieldType *field)
+    {
+        m_Buffer = NULL;
+        if (!field) return;
+
+        m_Region = field->GetBufferedRegion();
+        m_Buffer = field->GetBufferPointer();
+        const typename FieldType::DirectionType & toIndex = field->GetPhysicalPointToIndex();
+
+        OffsetValueType stride = 1;
+        for (unsigned int d = 0; d < ImageDimension; d++) {
+            m_Start[d] = m_Region.GetIndex()[d];
+            m_End[d] = m_Start[d] + static_cast<IndexValueType>( m_Region.GetSize()[d] ) - 1;
+            m_Stride[d] = stride;
+            stride *= m_Region.GetSize()[d];
+            m_Origin[d] = field->GetOrigin()[d];
+            for (unsigned int c = 0; c < ImageDimension; c++) m_ToIndex[d][c] = toIndex[d][c];
+        }
+        if (m_Region.GetNumberOfPixels() == 0) m_Buffer = NULL;
+    }
+
+    inline void TransformPhysicalPointToContinuousIndex(const PointType &point, ContinuousIndexType &cindex) const
+    {
+        double cvector[ImageDimension];
+        for (unsigned int k = 0; k < ImageDimension; k++) cvector[k] = point[k] - m_Origin[k];
+        for (unsigned int r = 0; r < ImageDimension; r++) {
+            double sum = NumericTraits<double>::Zero;
+            for (unsigned int c = 0; c < ImageDimension; c++) sum += m_ToIndex[r][c] * cvector[c];
+            cindex[r] = static_cast<TCoordRep>( sum );
+        }
+    }
+
+    template <class TIndexCoordRep>
+    inline bool IsInside(const ContinuousIndex<TIndexCoordRep, ImageDimension> &cindex) const
+    {
+        return m_Buffer && m_Region.IsInside( cindex );
+    }
+
+    /** Interpolate at a continuous index that IsInside() accepted. */
+    template <class TIndexCoordRep>
+    inline void EvaluateAtContinuousIndex(const ContinuousIndex<TIndexCoordRep, ImageDimension> &cindex, OutputType &output) const
+    {
+        IndexValueType base[ImageDimension];
+        double distance[ImageDimension];
+        for (unsigned int d = 0; d < ImageDimension; d++) {
+            base[d] = Math::Floor<IndexValueType>( cindex[d] );
+            distance[d] = cindex[d] - static_cast<double>( base[d] );
+        }
+
+        output.Fill( NumericTraits<RealType>::Zero );
+        for (unsigned int counter = 0; counter < (1u << ImageDimension); counter++) {
+            double overlap = 1.0;
+            OffsetValueType offset = 0;
+            unsigned int upper = counter;
+            for (unsigned int d = 0; d < ImageDimension; d++) {
+                IndexValueType neighbor;
+                if (upper & 1) {
+                    neighbor = base[d] + 1;
+                    if (neighbor > m_End[d]) neighbor = m_End[d];
+                    overlap *= distance[d];
+                }
+                else {
+                    neighbor = base[d];
+                    if (neighbor < m_Start[d]) neighbor = m_Start[d];
+                    overlap *= 1.0 - distance[d];
+                }
+                offset += ( neighbor - m_Start[d] ) * m_Stride[d];
+                upper >>= 1;
+            }
+            if (overlap) {
+                const VectorType & value = m_Buffer[offset];
+                for (unsigned int k = 0; k < VectorDimension; k++)
+                    output[k] += overlap * static_cast<RealType>( value[k] );
+            }
+        }
+    }
+
+    /** Map a physical point and interpolate;  outside the field the
+     * displacement is zero and false is returned. */
+    inline bool Evaluate(const PointType &point, OutputType &output) const
+    {
+        ContinuousIndexType cindex;
+        this->TransformPhysicalPointToContinuousIndex( point, cindex );
+        if ( !this->IsInside( cindex ) ) {
+            output.Fill( NumericTraits<RealType>::Zero );
+            return false;
+        }
+        this->EvaluateAtContinuousIndex( cindex, output );
+        return true;
+    }
+
+private:
+    const VectorType *m_Buffer;
+    RegionType        m_Region;
+    IndexValueType    m_Start[ImageDimension];
+    IndexValueType    m_End[ImageDimension];
+    OffsetValueType   m_Stride[ImageDimension];
+    double            m_Origin[ImageDimension];
+    double            m_ToIndex[ImageDimension][ImageDimension];
+};
+
+} // end namespace itk
+
+#endif /*ITKDISPLACEMENTFIELDLINEARSAMPLER_H_*/
@@ -26,6 +26,7 @@
 #include "itkMatrix.h"
 #include "itkMersenneTwisterRandomVariateGenerator.h"
 #include "itkMeshSource.h"
+#include "itkMultiThreader.h"
 #include "itkPointSet.h"
 #include "itkVector.h"
 #include "itkWeightedCentroidKdTreeGenerator.h"
@@ -115,6 +116,12 @@ public:
 
   virtual void SetInputPointSet( const InputPointSetType * ptr );
 
+  /** Move the kernels to the points of ptr, given in the order of the
+   * current input, keeping the kd-tree and the covariances.  Nothing is
+   * changed and false is returned if the point count differs or a point
+   * is farther than tolerance from where the kd-tree put it. */
+  bool UpdateInputPointSet( const InputPointSetType * ptr, RealType tolerance );
+
   virtual TOutput Evaluate( const InputPointType& point ) const;
 
   PointType GenerateRandomSample();
@@ -149,6 +156,22 @@ public:
   NeighborhoodIdentifierType GetNeighborhoodIdentifiers(
     InputPointType, unsigned int );
 
+  /** Number of threads that may call EvaluateNeighborhood() at once. */
+  void SetNumberOfThreads( unsigned int n );
+
+  /**
+   * Find the numberOfNeighbors nearest kernels of point and evaluate them.
+   * If directions is given it receives, per kernel, the inverse covariance
+   * applied to the mean minus the point.  Isotropic kernels are evaluated
+   * from flat arrays.  Safe for concurrent calls with distinct threadIds
+   * below the number of threads;  the kd-tree keeps search state, so every
+   * thread but the first searches its own copy.
+   */
+  void EvaluateNeighborhood( const MeasurementVectorType & point,
+    unsigned int numberOfNeighbors, ThreadIdType threadId,
+    NeighborhoodIdentifierType & neighbors, std::vector<RealType> & values,
+    std::vector<MeasurementVectorType> * directions = NULL ) const;
+
 protected:
   ManifoldParzenWindowsPointSetFunction();
   virtual ~ManifoldParzenWindowsPointSetFunction();
@@ -156,6 +179,9 @@ protected:
 
   void GenerateData();
 
+  /** Copy the means and widths of isotropic kernels to flat arrays. */
+  void UpdateKernelArrays();
+
 private:
   //purposely not implemented
   ManifoldParzenWindowsPointSetFunction( const Self& );
@@ -168,12 +194,19 @@ private:
   RealType                                      m_KernelSigma;
 
   typename TreeGeneratorType::Pointer           m_KdTreeGenerator;
+  mutable std::vector<typename TreeGeneratorType::Pointer>
+                                                m_ThreadKdTreeGenerators;
   typename SampleType::Pointer                  m_SamplePoints;
 
   typename RandomizerType::Pointer              m_Randomizer;
   GaussianContainerType                         m_Gaussians;
   bool                                          m_Normalize;
   bool                                          m_UseAnisotropicCovariances;
+
+  bool                                          m_IsotropicKernels;
+  std::vector<RealType>                         m_KernelMeans;
+  std::vector<RealType>                         m_KernelPeaks;
+  std::vector<RealType>                         m_KernelPrecisions;
 };
 
 } // end namespace itk
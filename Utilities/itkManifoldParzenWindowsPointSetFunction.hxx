@@ -44,6 +44,9 @@ ManifoldParzenWindowsPointSetFunction<TPointSet, TOutput, TCoordRep>
   this->m_Normalize = true;
   this->m_UseAnisotropicCovariances = true;
 
+  this->m_IsotropicKernels = false;
+  this->m_ThreadKdTreeGenerators.resize( 1 );
+
   this->m_Randomizer = RandomizerType::New();
   this->m_Randomizer->SetSeed();
 }
@@ -188,6 +191,109 @@ ManifoldParzenWindowsPointSetFunction<TPointSet, TOutput, TCoordRep>
       }
     ++It;
     }
+
+  this->m_IsotropicKernels = !( this->m_CovarianceKNeighborhood > 0
+    && this->m_UseAnisotropicCovariances );
+  this->UpdateKernelArrays();
+  this->m_ThreadKdTreeGenerators.assign( this->m_ThreadKdTreeGenerators.size(),
+    typename TreeGeneratorType::Pointer() );
+}
+
+template <class TPointSet, class TOutput, class TCoordRep>
+bool
+ManifoldParzenWindowsPointSetFunction<TPointSet, TOutput, TCoordRep>
+::UpdateInputPointSet( const InputPointSetType * ptr, RealType tolerance )
+{
+  if( !ptr || !this->m_KdTreeGenerator
+    || ptr->GetNumberOfPoints() != this->m_SamplePoints->Size()
+    || ptr->GetNumberOfPoints() != this->m_Gaussians.size() )
+    {
+    return false;
+    }
+
+  /**
+   * The kd-tree holds the points it was built from, so the test is
+   * against those and small moves cannot add up.
+   */
+  unsigned long count = 0;
+  PointsContainerConstIterator It = ptr->GetPoints()->Begin();
+  while( It != ptr->GetPoints()->End() )
+    {
+    PointType point = It.Value();
+    MeasurementVectorType mv
+      = this->m_SamplePoints->GetMeasurementVector( count++ );
+
+    RealType distance = 0.0;
+    for( unsigned int d = 0; d < Dimension; d++ )
+      {
+      distance += vnl_math_sqr( point[d] - mv[d] );
+      }
+    if( distance > tolerance * tolerance )
+      {
+      return false;
+      }
+    ++It;
+    }
+
+  this->m_PointSet = ptr;
+
+  It = ptr->GetPoints()->Begin();
+  while( It != ptr->GetPoints()->End() )
+    {
+    PointType point = It.Value();
+
+    typename GaussianType::MeanType mean( Dimension );
+    for( unsigned int d = 0; d < Dimension; d++ )
+      {
+      mean[d] = point[d];
+      }
+    this->m_Gaussians[It.Index()]->SetMean( mean );
+    ++It;
+    }
+  this->UpdateKernelArrays();
+
+  return true;
+}
+
+template <class TPointSet, class TOutput, class TCoordRep>
+void
+ManifoldParzenWindowsPointSetFunction<TPointSet, TOutput, TCoordRep>
+::UpdateKernelArrays()
+{
+  this->m_KernelMeans.clear();
+  this->m_KernelPeaks.clear();
+  this->m_KernelPrecisions.clear();
+  if( !this->m_IsotropicKernels )
+    {
+    return;
+    }
+
+  this->m_KernelMeans.resize( this->m_Gaussians.size() * Dimension );
+  this->m_KernelPeaks.resize( this->m_Gaussians.size() );
+  this->m_KernelPrecisions.resize( this->m_Gaussians.size() );
+  for( unsigned long i = 0; i < this->m_Gaussians.size(); i++ )
+    {
+    typename GaussianType::MeanType mean = this->m_Gaussians[i]->GetMean();
+
+    MeasurementVectorType mv;
+    for( unsigned int d = 0; d < Dimension; d++ )
+      {
+      mv[d] = mean[d];
+      this->m_KernelMeans[i * Dimension + d] = mean[d];
+      }
+    this->m_KernelPeaks[i] = static_cast<RealType>(
+      this->m_Gaussians[i]->Evaluate( mv ) );
+    this->m_KernelPrecisions[i] = 1.0 /
+      vnl_math_sqr( static_cast<RealType>( this->m_Gaussians[i]->GetSigma() ) );
+    }
+}
+
+template <class TPointSet, class TOutput, class TCoordRep>
+void
+ManifoldParzenWindowsPointSetFunction<TPointSet, TOutput, TCoordRep>
+::SetNumberOfThreads( unsigned int n )
+{
+  this->m_ThreadKdTreeGenerators.resize( vnl_math_max( n, 1u ) );
 }
 
 template <class TPointSet, class TOutput, class TCoordRep>
@@ -218,6 +324,12 @@ ManifoldParzenWindowsPointSetFunction<TPointSet, TOutput, TCoordRep>
   this->m_KdTreeGenerator->SetSample( this->m_SamplePoints );
   this->m_KdTreeGenerator->SetBucketSize( this->m_BucketSize );
   this->m_KdTreeGenerator->Update();
+
+  // the kernels may have been replaced with SetGaussian()
+  this->m_IsotropicKernels = false;
+  this->UpdateKernelArrays();
+  this->m_ThreadKdTreeGenerators.assign( this->m_ThreadKdTreeGenerators.size(),
+    typename TreeGeneratorType::Pointer() );
 }
 
 template <class TPointSet, class TOutput, class TCoordRep>
@@ -316,6 +428,90 @@ ManifoldParzenWindowsPointSetFunction<TPointSet, TOutput, TCoordRep>
 }
 
 
+template <class TPointSet, class TOutput, class TCoordRep>
+void
+ManifoldParzenWindowsPointSetFunction<TPointSet, TOutput, TCoordRep>
+::EvaluateNeighborhood( const MeasurementVectorType & point,
+  unsigned int numberOfNeighbors, ThreadIdType threadId,
+  NeighborhoodIdentifierType & neighbors, std::vector<RealType> & values,
+  std::vector<MeasurementVectorType> * directions ) const
+{
+  TreeGeneratorType *generator = this->m_KdTreeGenerator;
+  if( threadId > 0 )
+    {
+    typename TreeGeneratorType::Pointer & copy
+      = this->m_ThreadKdTreeGenerators[threadId];
+    if( !copy )
+      {
+      copy = TreeGeneratorType::New();
+      copy->SetSample( this->m_SamplePoints );
+      copy->SetBucketSize( this->m_BucketSize );
+      copy->Update();
+      }
+    generator = copy;
+    }
+
+  numberOfNeighbors = vnl_math_min( numberOfNeighbors,
+    static_cast<unsigned int>( generator->GetOutput()->Size() ) );
+  generator->GetOutput()->Search( point, numberOfNeighbors, neighbors );
+
+  values.resize( neighbors.size() );
+  if( directions )
+    {
+    directions->resize( neighbors.size() );
+    }
+
+  if( this->m_IsotropicKernels )
+    {
+    for( unsigned int n = 0; n < neighbors.size(); n++ )
+      {
+      const RealType *mean = &this->m_KernelMeans[neighbors[n] * Dimension];
+      RealType distance = 0.0;
+      for( unsigned int d = 0; d < Dimension; d++ )
+        {
+        distance += ( mean[d] - point[d] ) * ( mean[d] - point[d] );
+        }
+      values[n] = -0.5 * distance * this->m_KernelPrecisions[neighbors[n]];
+      }
+    for( unsigned int n = 0; n < neighbors.size(); n++ )
+      {
+      values[n] = this->m_KernelPeaks[neighbors[n]] * vcl_exp( values[n] );
+      }
+    if( directions )
+      {
+      for( unsigned int n = 0; n < neighbors.size(); n++ )
+        {
+        const RealType *mean = &this->m_KernelMeans[neighbors[n] * Dimension];
+        for( unsigned int d = 0; d < Dimension; d++ )
+          {
+          (*directions)[n][d] = ( mean[d] - point[d] )
+            * this->m_KernelPrecisions[neighbors[n]];
+          }
+        }
+      }
+    return;
+    }
+
+  for( unsigned int n = 0; n < neighbors.size(); n++ )
+    {
+    const GaussianType *gaussian = this->m_Gaussians[neighbors[n]].GetPointer();
+    values[n] = static_cast<RealType>( gaussian->Evaluate( point ) );
+    if( directions )
+      {
+      typename GaussianType::MeanType mean = gaussian->GetMean();
+      typename GaussianType::MatrixType Ci = gaussian->GetInverseCovariance();
+      for( unsigned int d = 0; d < Dimension; d++ )
+        {
+        (*directions)[n][d] = 0.0;
+        for( unsigned int e = 0; e < Dimension; e++ )
+          {
+          (*directions)[n][d] += Ci( d, e ) * ( mean[e] - point[e] );
+          }
+        }
+      }
+    }
+}
+
 template <class TPointSet, class TOutput, class TCoordRep>
 typename ManifoldParzenWindowsPointSetFunction
   <TPointSet, TOutput, TCoordRep>::PointType
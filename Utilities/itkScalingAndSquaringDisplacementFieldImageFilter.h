@@ -0,0 +1,195 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: itkScalingAndSquaringDisplacementFieldImageFilter.h,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __itkScalingAndSquaringDisplacementFieldImageFilter_h
+#define __itkScalingAndSquaringDisplacementFieldImageFilter_h
+
+#include "itkImageToImageFilter.h"
+#include "itkVectorLinearInterpolateImageFunction.h"
+
+namespace itk
+{
+
+/**
+ * \class ScalingAndSquaringDisplacementFieldImageFilter
+ *
+ * \brief Exponentiates a stationary velocity field by scaling and squaring.
+ *
+ * \par
+ * The velocity field is scaled by Scale / 2^N and the resulting small
+ * displacement is composed with itself N times,
+ * phi_{k+1}( x ) = phi_k( x ) + phi_k( x + phi_k( x ) ).
+ * Points that leave the field contribute a zero displacement, as in
+ * ANTSImageRegistrationOptimizer::ComposeDiffs.  When ComputeInverse is on,
+ * the exponential of the negated field is carried through the same
+ * squaring passes and is available from GetInverseOutput().
+ *
+ * \par
+ * Every squaring step is threaded over slabs of the output region and each
+ * slab is visited in tiles of TileSize voxels so that the interpolated
+ * neighbourhood stays in cache.  The intermediate fields are stored with
+ * TRealType components, which need not be the output precision.  A
+ * NumberOfSquaringSteps of zero picks the smallest N for which the scaled
+ * field moves no point by more than half a voxel.
+ */
+
+template <class TInputImage, class TOutputImage = TInputImage,
+  class TRealType = typename TOutputImage::PixelType::ComponentType>
+class ScalingAndSquaringDisplacementFieldImageFilter
+  : public ImageToImageFilter<TInputImage, TOutputImage>
+{
+public:
+  typedef ScalingAndSquaringDisplacementFieldImageFilter Self;
+  typedef ImageToImageFilter<TInputImage, TOutputImage>  Superclass;
+  typedef SmartPointer<Self>                             Pointer;
+  typedef SmartPointer<const Self>                       ConstPointer;
+
+  /** Method for creation through the object factory. */
+  itkNewMacro( Self );
+
+  /** Run-time type information (and related methods). */
+  itkTypeMacro( ScalingAndSquaringDisplacementFieldImageFilter, ImageToImageFilter );
+
+  /** Extract dimension from input image. */
+  itkStaticConstMacro( ImageDimension, unsigned int,
+    TInputImage::ImageDimension );
+
+  /** Upper bound on the number of squarings, i.e. on N in exp(v/2^N). */
+  itkStaticConstMacro( MaximumNumberOfSquaringSteps, unsigned int, 32 );
+
+  typedef TInputImage                             InputFieldType;
+  typedef TOutputImage                            OutputFieldType;
+
+  typedef typename OutputFieldType::PixelType     OutputVectorType;
+  typedef typename OutputFieldType::RegionType    RegionType;
+  typedef typename OutputFieldType::IndexType     IndexType;
+  typedef typename OutputFieldType::SizeType      SizeType;
+  typedef typename OutputFieldType::PointType     PointType;
+
+  /** Intermediate fields are held in the computation precision. */
+  typedef TRealType                               RealType;
+  typedef Vector<RealType,
+    itkGetStaticConstMacro( ImageDimension )>     RealVectorType;
+  typedef Image<RealVectorType,
+    itkGetStaticConstMacro( ImageDimension )>     RealFieldType;
+  typedef typename RealFieldType::Pointer         RealFieldPointer;
+  typedef VectorLinearInterpolateImageFunction
+    <RealFieldType, RealType>                     InterpolatorType;
+
+  /** Set/Get the velocity field to exponentiate. */
+  void SetVelocityField( const InputFieldType *field )
+    {
+    this->SetInput( 0, field );
+    }
+  const InputFieldType* GetVelocityField() const
+    {
+    return this->GetInput( 0 );
+    }
+
+  /** Integration time;  the result is exp( Scale * v ). */
+  itkSetMacro( Scale, RealType );
+  itkGetConstMacro( Scale, RealType );
+
+  /** Number of squarings, 0 chooses it from the field magnitude.  Values
+   * above MaximumNumberOfSquaringSteps are clamped. */
+  itkSetMacro( NumberOfSquaringSteps, unsigned int );
+  itkGetConstMacro( NumberOfSquaringSteps, unsigned int );
+
+  /** Number of squarings used by the last update. */
+  itkGetConstMacro( NumberOfSquaringStepsUsed, unsigned int );
+
+  /** Edge length, in voxels, of the tiles each thread works through. */
+  itkSetMacro( TileSize, unsigned int );
+  itkGetConstMacro( TileSize, unsigned int );
+
+  /** Also produce exp( -Scale * v ) in the second output. */
+  itkSetMacro( ComputeInverse, bool );
+  itkGetConstMacro( ComputeInverse, bool );
+  itkBooleanMacro( ComputeInverse );
+
+  /** The inverse exponential, valid when ComputeInverse is on;  otherwise
+   * it holds no buffer. */
+  OutputFieldType * GetInverseOutput()
+    {
+    return dynamic_cast<OutputFieldType *>( this->ProcessObject::GetOutput( 1 ) );
+    }
+
+protected:
+
+  /** Constructor */
+  ScalingAndSquaringDisplacementFieldImageFilter();
+
+  /** Deconstructor */
+  virtual ~ScalingAndSquaringDisplacementFieldImageFilter() {}
+
+  /** Standard print self function **/
+  void PrintSelf( std::ostream& os, Indent indent ) const;
+
+  /** The squaring steps depend on the whole field. */
+  void GenerateInputRequestedRegion();
+  void EnlargeOutputRequestedRegion( DataObject *output );
+
+  /** The inverse output is only allocated when ComputeInverse is on. */
+  void AllocateOutputs();
+
+  /** Runs the scaling pass and the squaring passes, each threaded. */
+  void GenerateData();
+
+private:
+  ScalingAndSquaringDisplacementFieldImageFilter( const Self& ); //purposely not implemented
+  void operator=( const Self& );                              //purposely not implemented
+
+  enum PassType { ScalePass, SquarePass, CopyPass };
+
+  struct ThreadStruct
+    {
+    Self     *Filter;
+    PassType Pass;
+    RealType ScaleFactor;
+    };
+
+  static ITK_THREAD_RETURN_TYPE ThreaderCallback( void *arg );
+
+  /** One pass of the given type over one slab of the output region. */
+  void ThreadedPass( PassType pass, RealType scaleFactor, const RegionType & region );
+
+  /** Visit region tile by tile in the order of the image buffer. */
+  void ThreadedScale( RealType scaleFactor, const RegionType & region );
+  void ThreadedSquare( const RegionType & region );
+  void ThreadedCopy( const RegionType & region );
+
+  void RunPass( PassType pass, RealType scaleFactor );
+
+  RealFieldPointer AllocateRealField() const;
+
+  RealType                             m_Scale;
+  unsigned int                         m_NumberOfSquaringSteps;
+  unsigned int                         m_NumberOfSquaringStepsUsed;
+  unsigned int                         m_TileSize;
+  bool                                 m_ComputeInverse;
+
+  /** Ping-pong buffers for the forward and inverse fields. */
+  RealFieldPointer                     m_Current[2];
+  RealFieldPointer                     m_Next[2];
+  typename InterpolatorType::Pointer   m_Interpolator[2];
+};
+
+} // end namespace itk
+
+#ifndef ITK_MANUAL_INSTANTIATION
+#include "itkScalingAndSquaringDisplacementFieldImageFilter.hxx"
+#endif
+
+#endif
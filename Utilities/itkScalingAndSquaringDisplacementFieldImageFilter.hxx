@@ -0,0 +1,360 @@
+/*=========================================================================
+
+  Program:   Advanced Normalization Tools
+  Module:    $RCSfile: itkScalingAndSquaringDisplacementFieldImageFilter.hxx,v $
+  Language:  C++
+
+  Copyright (c) ConsortiumOfANTS. All rights reserved.
+  See accompanying COPYING.txt or
+ http://sourceforge.net/projects/advants/files/ANTS/ANTSCopyright.txt for details.
+
+     This software is distributed WITHOUT ANY WARRANTY; without even
+     the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+     PURPOSE.  See the above copyright notices for more information.
+
+=========================================================================*/
+#ifndef __itkScalingAndSquaringDisplacementFieldImageFilter_hxx
+#define __itkScalingAndSquaringDisplacementFieldImageFilter_hxx
+
+#include "itkScalingAndSquaringDisplacementFieldImageFilter.h"
+
+#include "itkImageRegionConstIterator.h"
+#include "itkImageRegionConstIteratorWithIndex.h"
+#include "itkImageRegionIterator.h"
+#include "itkMultiThreader.h"
+#include "vnl/vnl_math.h"
+#include "vcl_cmath.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace itk
+{
+
+template<class TInputImage, class TOutputImage, class TRealType>
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::ScalingAndSquaringDisplacementFieldImageFilter()
+{
+  this->SetNumberOfRequiredInputs( 1 );
+  this->SetNumberOfRequiredOutputs( 2 );
+  this->SetNthOutput( 1, OutputFieldType::New() );
+
+  this->m_Scale = 1.0;
+  this->m_NumberOfSquaringSteps = 0;
+  this->m_NumberOfSquaringStepsUsed = 0;
+  this->m_TileSize = 16;
+  this->m_ComputeInverse = false;
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::GenerateInputRequestedRegion()
+{
+  Superclass::GenerateInputRequestedRegion();
+
+  InputFieldType *input = const_cast<InputFieldType *>( this->GetInput() );
+  if( input )
+    {
+    input->SetRequestedRegionToLargestPossibleRegion();
+    }
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::EnlargeOutputRequestedRegion( DataObject *output )
+{
+  Superclass::EnlargeOutputRequestedRegion( output );
+  output->SetRequestedRegionToLargestPossibleRegion();
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::AllocateOutputs()
+{
+  const unsigned int numberOfFields = this->m_ComputeInverse ? 2 : 1;
+  for( unsigned int i = 0; i < 2; i++ )
+    {
+    OutputFieldType *output = ( i == 0 ) ? this->GetOutput() : this->GetInverseOutput();
+    if( i < numberOfFields )
+      {
+      output->SetBufferedRegion( output->GetRequestedRegion() );
+      output->Allocate();
+      }
+    else
+      {
+      output->Initialize();
+      }
+    }
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+typename ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>::RealFieldPointer
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::AllocateRealField() const
+{
+  const InputFieldType *input = this->GetInput();
+
+  RealFieldPointer field = RealFieldType::New();
+  field->SetOrigin( input->GetOrigin() );
+  field->SetSpacing( input->GetSpacing() );
+  field->SetDirection( input->GetDirection() );
+  field->SetRegions( input->GetLargestPossibleRegion() );
+  field->Allocate();
+  return field;
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::GenerateData()
+{
+  const InputFieldType *input = this->GetInput();
+
+  this->AllocateOutputs();
+
+  /** Choose the number of squarings so the first step is under half a voxel. */
+  unsigned int numberOfSteps = vnl_math_min( this->m_NumberOfSquaringSteps,
+    static_cast<unsigned int>( Self::MaximumNumberOfSquaringSteps ) );
+  if( numberOfSteps == 0 )
+    {
+    typename InputFieldType::SpacingType spacing = input->GetSpacing();
+    RealType maxNorm = 0;
+    ImageRegionConstIterator<InputFieldType> It( input, input->GetLargestPossibleRegion() );
+    for( It.GoToBegin(); !It.IsAtEnd(); ++It )
+      {
+      RealType norm = 0;
+      for( unsigned int d = 0; d < ImageDimension; d++ )
+        {
+        RealType x = It.Get()[d] / spacing[d];
+        norm += x * x;
+        }
+      maxNorm = vnl_math_max( maxNorm, norm );
+      }
+    maxNorm = vcl_sqrt( maxNorm ) * vnl_math_abs( this->m_Scale );
+    while( maxNorm > 0.5 && numberOfSteps < Self::MaximumNumberOfSquaringSteps )
+      {
+      maxNorm *= 0.5;
+      numberOfSteps++;
+      }
+    }
+  this->m_NumberOfSquaringStepsUsed = numberOfSteps;
+
+  const unsigned int numberOfFields = this->m_ComputeInverse ? 2 : 1;
+  for( unsigned int i = 0; i < numberOfFields; i++ )
+    {
+    this->m_Current[i] = this->AllocateRealField();
+    this->m_Next[i] = this->AllocateRealField();
+    this->m_Interpolator[i] = InterpolatorType::New();
+    }
+
+  this->RunPass( ScalePass, this->m_Scale
+                 / static_cast<RealType>( std::ldexp( 1.0, static_cast<int>( numberOfSteps ) ) ) );
+  for( unsigned int n = 0; n < numberOfSteps; n++ )
+    {
+    for( unsigned int i = 0; i < numberOfFields; i++ )
+      {
+      this->m_Interpolator[i]->SetInputImage( this->m_Current[i] );
+      }
+    this->RunPass( SquarePass, 0 );
+    for( unsigned int i = 0; i < numberOfFields; i++ )
+      {
+      std::swap( this->m_Current[i], this->m_Next[i] );
+      }
+    }
+  this->RunPass( CopyPass, 0 );
+
+  for( unsigned int i = 0; i < 2; i++ )
+    {
+    this->m_Current[i] = NULL;
+    this->m_Next[i] = NULL;
+    this->m_Interpolator[i] = NULL;
+    }
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::RunPass( PassType pass, RealType scaleFactor )
+{
+  ThreadStruct str;
+  str.Filter = this;
+  str.Pass = pass;
+  str.ScaleFactor = scaleFactor;
+
+  this->GetMultiThreader()->SetNumberOfThreads( this->GetNumberOfThreads() );
+  this->GetMultiThreader()->SetSingleMethod( this->ThreaderCallback, &str );
+  this->GetMultiThreader()->SingleMethodExecute();
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+ITK_THREAD_RETURN_TYPE
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::ThreaderCallback( void *arg )
+{
+  MultiThreader::ThreadInfoStruct *info
+    = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+  ThreadIdType threadId = info->ThreadID;
+  ThreadIdType threadCount = info->NumberOfThreads;
+  ThreadStruct *str = static_cast<ThreadStruct *>( info->UserData );
+
+  /** Slabs along the slowest axis keep each thread on its own memory. */
+  RegionType splitRegion;
+  ThreadIdType total = str->Filter->SplitRequestedRegion( threadId, threadCount, splitRegion );
+  if( threadId < total )
+    {
+    str->Filter->ThreadedPass( str->Pass, str->ScaleFactor, splitRegion );
+    }
+  return ITK_THREAD_RETURN_VALUE;
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::ThreadedPass( PassType pass, RealType scaleFactor, const RegionType & region )
+{
+  const unsigned int tileSize = vnl_math_max( this->m_TileSize, 1u );
+
+  SizeType numberOfTilesPerAxis;
+  unsigned long numberOfTiles = 1;
+  for( unsigned int d = 0; d < ImageDimension; d++ )
+    {
+    numberOfTilesPerAxis[d] = ( region.GetSize()[d] + tileSize - 1 ) / tileSize;
+    numberOfTiles *= numberOfTilesPerAxis[d];
+    }
+
+  for( unsigned long t = 0; t < numberOfTiles; t++ )
+    {
+    IndexType tileIndex;
+    SizeType tileExtent;
+    unsigned long remainder = t;
+    for( unsigned int d = 0; d < ImageDimension; d++ )
+      {
+      unsigned long td = remainder % numberOfTilesPerAxis[d];
+      remainder /= numberOfTilesPerAxis[d];
+      tileIndex[d] = region.GetIndex()[d] + static_cast<long>( td * tileSize );
+      tileExtent[d] = vnl_math_min( static_cast<unsigned long>( tileSize ),
+        static_cast<unsigned long>( region.GetIndex()[d] + region.GetSize()[d] - tileIndex[d] ) );
+      }
+    RegionType tile( tileIndex, tileExtent );
+
+    switch( pass )
+      {
+      case ScalePass:
+        this->ThreadedScale( scaleFactor, tile );
+        break;
+      case SquarePass:
+        this->ThreadedSquare( tile );
+        break;
+      case CopyPass:
+        this->ThreadedCopy( tile );
+        break;
+      }
+    }
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::ThreadedScale( RealType scaleFactor, const RegionType & region )
+{
+  ImageRegionConstIterator<InputFieldType> ItV( this->GetInput(), region );
+  ImageRegionIterator<RealFieldType> ItF( this->m_Current[0], region );
+  for( ItV.GoToBegin(), ItF.GoToBegin(); !ItV.IsAtEnd(); ++ItV, ++ItF )
+    {
+    RealVectorType disp;
+    for( unsigned int d = 0; d < ImageDimension; d++ )
+      {
+      disp[d] = static_cast<RealType>( ItV.Get()[d] ) * scaleFactor;
+      }
+    ItF.Set( disp );
+    }
+  if( this->m_ComputeInverse )
+    {
+    ImageRegionConstIterator<RealFieldType> ItP( this->m_Current[0], region );
+    ImageRegionIterator<RealFieldType> ItI( this->m_Current[1], region );
+    for( ItP.GoToBegin(), ItI.GoToBegin(); !ItP.IsAtEnd(); ++ItP, ++ItI )
+      {
+      ItI.Set( -ItP.Get() );
+      }
+    }
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::ThreadedSquare( const RegionType & region )
+{
+  const unsigned int numberOfFields = this->m_ComputeInverse ? 2 : 1;
+  for( unsigned int i = 0; i < numberOfFields; i++ )
+    {
+    const RealFieldType *current = this->m_Current[i];
+    const InterpolatorType *interpolator = this->m_Interpolator[i];
+
+    ImageRegionConstIteratorWithIndex<RealFieldType> ItC( current, region );
+    ImageRegionIterator<RealFieldType> ItN( this->m_Next[i], region );
+    for( ItC.GoToBegin(), ItN.GoToBegin(); !ItC.IsAtEnd(); ++ItC, ++ItN )
+      {
+      RealVectorType disp = ItC.Get();
+
+      typename InterpolatorType::PointType point;
+      current->TransformIndexToPhysicalPoint( ItC.GetIndex(), point );
+      for( unsigned int d = 0; d < ImageDimension; d++ )
+        {
+        point[d] += disp[d];
+        }
+      if( interpolator->IsInsideBuffer( point ) )
+        {
+        typename InterpolatorType::OutputType disp2 = interpolator->Evaluate( point );
+        for( unsigned int d = 0; d < ImageDimension; d++ )
+          {
+          disp[d] += static_cast<RealType>( disp2[d] );
+          }
+        }
+      ItN.Set( disp );
+      }
+    }
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::ThreadedCopy( const RegionType & region )
+{
+  const unsigned int numberOfFields = this->m_ComputeInverse ? 2 : 1;
+  for( unsigned int i = 0; i < numberOfFields; i++ )
+    {
+    OutputFieldType *output = ( i == 0 ) ? this->GetOutput() : this->GetInverseOutput();
+
+    ImageRegionConstIterator<RealFieldType> ItC( this->m_Current[i], region );
+    ImageRegionIterator<OutputFieldType> ItO( output, region );
+    for( ItC.GoToBegin(), ItO.GoToBegin(); !ItC.IsAtEnd(); ++ItC, ++ItO )
+      {
+      OutputVectorType disp;
+      for( unsigned int d = 0; d < ImageDimension; d++ )
+        {
+        disp[d] = static_cast<typename OutputVectorType::ComponentType>( ItC.Get()[d] );
+        }
+      ItO.Set( disp );
+      }
+    }
+}
+
+template<class TInputImage, class TOutputImage, class TRealType>
+void
+ScalingAndSquaringDisplacementFieldImageFilter<TInputImage, TOutputImage, TRealType>
+::PrintSelf( std::ostream& os, Indent indent ) const
+{
+  Superclass::PrintSelf( os, indent );
+  os << indent << "Scale: " << this->m_Scale << std::endl;
+  os << indent << "Number of squaring steps: "
+     << this->m_NumberOfSquaringSteps << std::endl;
+  os << indent << "Tile size: " << this->m_TileSize << std::endl;
+  os << indent << "Compute inverse: " << this->m_ComputeInverse << std::endl;
+}
+
+}  //end namespace itk
+
+#endif
@@ -26,7 +26,10 @@
 #include "itkPoint.h"
 #include "itkFixedArray.h"
 #include "itkRecursiveGaussianImageFilter.h"
+#include "itkDisplacementFieldLinearSampler.h"
+#include "itkMultiThreader.h"
 #include <list>
+#include <vector>
 
 namespace itk
 {
@@ -152,6 +155,9 @@ public:
     typedef VectorGaussianInterpolateImageFunction<DisplacementFieldType,CoordRepType> DefaultVectorInterpolatorType2;
     typedef typename DefaultVectorInterpolatorType::Pointer VectorInterpolatorPointer;
 
+    /** Inline linear interpolator used for the fields in the inner loop. */
+    typedef DisplacementFieldLinearSampler<DisplacementFieldType,CoordRepType> DisplacementFieldSamplerType;
+
 
     /** Point type */
     typedef Point<CoordRepType,itkGetStaticConstMacro(ImageDimension)> PointType;
@@ -159,6 +165,7 @@ public:
     typedef struct _DeformationTypeEx{
         DisplacementFieldPointer field;
         VectorInterpolatorPointer vinterp;
+        DisplacementFieldSamplerType sampler;
     } DeformationTypeEx;
 
     typedef struct _AffineTypeEx{
@@ -209,6 +216,18 @@ public:
 
 
 
+    /** Streaming mode:  request only the input image and displacement field
+     * sub-regions needed by each requested output region, so a downstream
+     * writer or StreamingImageFilter can produce the output in slabs with
+     * bounded memory.  Displacement fields that come out of a pipeline (e.g.
+     * an ImageFileReader that has only read its header) are updated for each
+     * slab;  others must be buffered over the part the slab reads.  The edge
+     * padding value is then taken as set rather than from the first input
+     * pixel. */
+    itkSetMacro( UseStreaming, bool );
+    itkGetConstMacro( UseStreaming, bool );
+    itkBooleanMacro( UseStreaming );
+
     /** Set the edge padding value */
     itkSetMacro( EdgePaddingValue, PixelType );
 
@@ -219,6 +238,21 @@ public:
         return m_TransformList;
     }
 
+    /** Append the transform list of another multi-transform filter with the
+     * same displacement field and transform types, e.g. to hand the chain of
+     * a warper to DisplacementFieldFromMultiTransformFilter and compose it
+     * once into a single field. */
+    template <class TOtherFilter>
+    void PushBackTransformList(TOtherFilter *other){
+        typename TOtherFilter::TransformListType::iterator it = other->GetTransformList().begin();
+        for(; it != other->GetTransformList().end(); it++){
+            if (it->first == TOtherFilter::EnumAffineType)
+                this->PushBackAffineTransform(it->second.aex.aff);
+            else
+                this->PushBackDisplacementFieldTransform(it->second.dex.field);
+        }
+    }
+
 
 
     void PrintTransformList();
@@ -235,7 +269,16 @@ public:
      * thing to do is to request for the whole input image.
      *
      * For the deformation field, the input requested region
-     * set to be the same as that of the output requested region. */
+     * set to be the same as that of the output requested region.
+     *
+     * In streaming mode every voxel of the requested output region is
+     * instead mapped through the transform list, one transform at a time on
+     * all threads.  Before a displacement field is applied it is updated for
+     * the bounding box of the points that reach it, widened by one voxel,
+     * and the input image is asked for the bounding box of the final points
+     * in the same way.  This is exact for the linear and nearest neighbor
+     * interpolators;  with any other interpolator the whole input is
+     * requested.  The mapped points are kept for ThreadedGenerateData(). */
     virtual void GenerateInputRequestedRegion();
 
     /** This method is used to set the state of the filter before
@@ -259,6 +302,9 @@ public:
     bool MultiInverseAffineOnlySinglePoint(const PointType &point1, PointType &point2);
     bool MultiTransformSinglePoint(const PointType &point1, PointType &point2);
     bool MultiTransformPoint(const PointType &point1, PointType &point2, bool bFisrtDeformNoInterp, const IndexType &index);
+    /** Refresh the inline samplers after the field buffers changed. */
+    void UpdateFieldSamplers();
+    bool SingleTransformPoint(const SingleTransformItemType &item, const PointType &point1, PointType &point2, bool bDeformNoInterp, const IndexType &index);
     void DetermineFirstDeformNoInterp();
     inline bool IsOutOfNumericBoundary(const PointType &p);
 
@@ -306,8 +352,48 @@ protected:
 
     double                     m_SmoothScale;
 
+    bool                       m_UseStreaming;
+
     InputImagePointer          m_CachedSmoothImage;
 
+    /** Streaming mode:  the voxels of m_StreamedRegion mapped through the
+     * transform list during region negotiation, in region order, with the
+     * StreamedPointState flags of each. */
+    enum StreamedPointState { StreamedPointInside = 1, StreamedPointValid = 2 };
+    typedef ImageBase<itkGetStaticConstMacro(ImageDimension)> ImageBaseType;
+    typedef typename ImageBaseType::RegionType             ImageBaseRegionType;
+    OutputImageRegionType      m_StreamedRegion;
+    std::vector<PointType>     m_StreamedPoints;
+    std::vector<unsigned char> m_StreamedPointStates;
+
+    struct StreamedPointsThreadStruct
+    {
+        Self *                          Filter;
+        const SingleTransformItemType * Item;
+        bool                            NoInterp;
+        const ImageBaseType *           Target;
+        bool                            InsideOnly;
+        std::vector<IndexType>          Lower;
+        std::vector<IndexType>          Upper;
+        std::vector<char>               Any;
+    };
+
+    /** Applies item (or, when it is NULL, maps the voxels of m_StreamedRegion
+     * to physical points) to the streamed points on all threads, and returns
+     * the bounding box of the continuous indices of the results in target,
+     * widened by one voxel and cropped to it.  With InsideOnly set only the
+     * points that end inside the last transform count.  Returns false when
+     * no point lands in target. */
+    bool MapStreamedPoints(const SingleTransformItemType *item, bool noInterp,
+            const ImageBaseType *target, bool insideOnly, ImageBaseRegionType &box);
+    void MapStreamedPointRange(StreamedPointsThreadStruct *str, ThreadIdType threadId,
+            unsigned long begin, unsigned long end);
+    static ITK_THREAD_RETURN_TYPE MapStreamedPointsThreaderCallback( void *arg );
+
+    /** Brings a streamed displacement field up to date for region. */
+    void RequestFieldRegion(SingleTransformItemType &item,
+            const typename DisplacementFieldType::RegionType &region);
+
 private:
     WarpImageMultiTransformFilter(const Self&); //purposely not implemented
     void operator=(const Self&); //purposely not implemented
@@ -22,9 +22,14 @@
 #include "itkImageRegionIterator.h"
 #include "itkImageRegionIteratorWithIndex.h"
 #include "itkNumericTraits.h"
+#include "itkNearestNeighborInterpolateImageFunction.h"
 #include "itkProgressReporter.h"
 #include "itkVectorLinearInterpolateImageFunction.h"
+#include "itkContinuousIndex.h"
+#include "vcl_cmath.h"
+#include "vnl/vnl_math.h"
 #include <limits>
+#include <vector>
 
 namespace itk
 {
@@ -52,6 +57,8 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
 
     m_SmoothScale = -1;
 
+    m_UseStreaming = false;
+
     // m_bOutputDisplacementField = false;
 
     // m_TransformOrder = AffineFirst;
@@ -107,6 +114,7 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
     os << indent << "Interpolator: " << m_Interpolator.GetPointer() << std::endl;
 
     os << indent << "m_bFirstDeformNoInterp = " << m_bFirstDeformNoInterp << std::endl;
+    os << indent << "UseStreaming: " << m_UseStreaming << std::endl;
 
 
 }
@@ -160,12 +168,34 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
     // Connect input image to interpolator
     // m_Interpolator->SetInputImage( this->GetInput() );
 
-    if (m_CachedSmoothImage.IsNull() && (this->GetInput() )){
+    // the cached image is only ever the input itself (see SetSmoothScale), so
+    // refresh it in case the input was replaced since the last update
+    if (this->GetInput()){
         m_CachedSmoothImage = const_cast<InputImageType *> (this->GetInput());
     }
 
     m_Interpolator->SetInputImage( m_CachedSmoothImage );
 
+    UpdateFieldSamplers();
+
+    if ( m_UseStreaming && ( !m_StreamedRegion.IsInside( this->GetOutput()->GetRequestedRegion() ) ||
+         m_StreamedPoints.size() != m_StreamedRegion.GetNumberOfPixels() ) )
+    {
+        itkExceptionMacro(<< "The streamed points do not cover the requested region " << this->GetOutput()->GetRequestedRegion());
+    }
+
+}
+
+template <class TInputImage,class TOutputImage,class TDisplacementField, class TTransform>
+void
+WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
+::UpdateFieldSamplers()
+{
+    typename TransformListType::iterator it = m_TransformList.begin();
+    for(;it!=m_TransformList.end(); it++){
+        if (it->first == EnumDisplacementFieldType)
+            it->second.dex.sampler.Initialize( it->second.dex.field );
+    }
 }
 
 /**
@@ -179,6 +209,10 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
     // Disconnect input image from interpolator
     m_Interpolator->SetInputImage( NULL );
 
+    // the streamed points belong to this slab only
+    std::vector<PointType>().swap( m_StreamedPoints );
+    std::vector<unsigned char>().swap( m_StreamedPointStates );
+
 }
 
 
@@ -194,9 +228,88 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
     // request the largest possible region for the input image
     InputImagePointer inputPtr = const_cast< InputImageType * >( this->GetInput() );
 
-    if( inputPtr )
+    if ( !m_UseStreaming )
     {
-        inputPtr->SetRequestedRegionToLargestPossibleRegion();
+        if( inputPtr )
+        {
+            inputPtr->SetRequestedRegionToLargestPossibleRegion();
+        }
+        return;
+    }
+
+    // Map every voxel of the requested output region through the transform
+    // list, one transform at a time, exactly as ThreadedGenerateData() would.
+    // Each displacement field is brought up to date for the bounding box of
+    // the points that reach it before it is applied, and the input image is
+    // asked for the bounding box of the final points.
+    OutputImagePointer outputPtr = this->GetOutput();
+    const OutputImageRegionType outputRegion = outputPtr->GetRequestedRegion();
+    m_StreamedRegion = outputRegion;
+    m_StreamedPoints.resize( outputRegion.GetNumberOfPixels() );
+    m_StreamedPointStates.resize( outputRegion.GetNumberOfPixels() );
+
+    // Only the linear and nearest neighbor interpolators read no more than
+    // the voxels around the mapped point;  the others get the whole input.
+    typedef NearestNeighborInterpolateImageFunction<InputImageType,CoordRepType> NearestNeighborInterpolatorType;
+    const bool boundedInterpolator =
+        dynamic_cast<DefaultInterpolatorType *>( m_Interpolator.GetPointer() ) ||
+        dynamic_cast<NearestNeighborInterpolatorType *>( m_Interpolator.GetPointer() );
+
+    const SingleTransformItemType *previous = NULL;
+    bool previousNoInterp = false;
+    ImageBaseRegionType box;
+    typename TransformListType::iterator it = m_TransformList.begin();
+    for(;;it++){
+        if ( it == m_TransformList.end() ) {
+            const ImageBaseType *target = ( inputPtr && boundedInterpolator ) ? inputPtr.GetPointer() : NULL;
+            bool any = this->MapStreamedPoints( previous, previousNoInterp, target, true, box );
+            if ( !inputPtr ) break;
+            typename InputImageType::RegionType inputRegion = inputPtr->GetLargestPossibleRegion();
+            if ( !boundedInterpolator ) {
+                inputPtr->SetRequestedRegionToLargestPossibleRegion();
+            }
+            else if ( any ) {
+                inputRegion.SetIndex( box.GetIndex() );
+                inputRegion.SetSize( box.GetSize() );
+                inputPtr->SetRequestedRegion( inputRegion );
+            }
+            else {
+                // nothing lands in the input;  keep a single voxel resident
+                typename InputImageType::SizeType size;
+                size.Fill(1);
+                inputRegion.SetSize(size);
+                inputPtr->SetRequestedRegion( inputRegion );
+            }
+            break;
+        }
+
+        const bool noInterp = ( m_bFirstDeformNoInterp && it == m_TransformList.begin() );
+        const ImageBaseType *target = NULL;
+        if ( it->first == EnumDisplacementFieldType && !noInterp ) target = it->second.dex.field.GetPointer();
+        bool any = this->MapStreamedPoints( previous, previousNoInterp, target, false, box );
+
+        if ( it->first == EnumDisplacementFieldType ) {
+            DisplacementFieldPointer field = it->second.dex.field;
+            typename DisplacementFieldType::RegionType fieldRegion = field->GetLargestPossibleRegion();
+            if ( noInterp ) {
+                // looked up at the output index, on the same lattice
+                fieldRegion = outputRegion;
+                fieldRegion.Crop( field->GetLargestPossibleRegion() );
+            }
+            else if ( any ) {
+                fieldRegion.SetIndex( box.GetIndex() );
+                fieldRegion.SetSize( box.GetSize() );
+            }
+            else {
+                // nothing lands in this field;  keep a single voxel resident
+                typename DisplacementFieldType::SizeType size;
+                size.Fill(1);
+                fieldRegion.SetSize(size);
+            }
+            this->RequestFieldRegion( *it, fieldRegion );
+        }
+        previous = &(*it);
+        previousNoInterp = noInterp;
     }
 
     return;
@@ -205,6 +318,137 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
 }
 
 
+template <class TInputImage,class TOutputImage,class TDisplacementField, class TTransform>
+void
+WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
+::RequestFieldRegion(SingleTransformItemType &item, const typename DisplacementFieldType::RegionType &region)
+{
+    DisplacementFieldPointer field = item.second.dex.field;
+    if ( field->GetSource() ) {
+        field->SetRequestedRegion( region );
+        field->PropagateRequestedRegion();
+        field->UpdateOutputData();
+    }
+    else if ( !field->GetBufferedRegion().IsInside( region ) ) {
+        itkExceptionMacro(<< "Streaming needs every displacement field either to come out of a pipeline or to be buffered over " << region);
+    }
+    item.second.dex.vinterp->SetInputImage( field );
+    item.second.dex.sampler.Initialize( field );
+}
+
+
+template <class TInputImage,class TOutputImage,class TDisplacementField, class TTransform>
+bool
+WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
+::MapStreamedPoints(const SingleTransformItemType *item, bool noInterp,
+        const ImageBaseType *target, bool insideOnly, ImageBaseRegionType &box)
+{
+    StreamedPointsThreadStruct str;
+    str.Filter = this;
+    str.Item = item;
+    str.NoInterp = noInterp;
+    str.Target = target;
+    str.InsideOnly = insideOnly;
+    str.Lower.resize( this->GetNumberOfThreads() );
+    str.Upper.resize( this->GetNumberOfThreads() );
+    str.Any.assign( this->GetNumberOfThreads(), 0 );
+
+    typename MultiThreader::Pointer threader = MultiThreader::New();
+    threader->SetNumberOfThreads( this->GetNumberOfThreads() );
+    threader->SetSingleMethod( Self::MapStreamedPointsThreaderCallback, &str );
+    threader->SingleMethodExecute();
+
+    if ( !target ) return false;
+    IndexType lower, upper;
+    bool any = false;
+    for (unsigned int t = 0; t < str.Any.size(); t++) {
+        if ( !str.Any[t] ) continue;
+        for (unsigned int d = 0; d < ImageDimension; d++) {
+            if (!any || str.Lower[t][d] < lower[d]) lower[d] = str.Lower[t][d];
+            if (!any || str.Upper[t][d] > upper[d]) upper[d] = str.Upper[t][d];
+        }
+        any = true;
+    }
+    if ( !any ) return false;
+    typename ImageBaseRegionType::SizeType size;
+    for (unsigned int d = 0; d < ImageDimension; d++) size[d] = upper[d] - lower[d] + 1;
+    box.SetIndex( lower );
+    box.SetSize( size );
+    return box.Crop( target->GetLargestPossibleRegion() );
+}
+
+
+template <class TInputImage,class TOutputImage,class TDisplacementField, class TTransform>
+ITK_THREAD_RETURN_TYPE
+WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
+::MapStreamedPointsThreaderCallback( void *arg )
+{
+    MultiThreader::ThreadInfoStruct *info = static_cast<MultiThreader::ThreadInfoStruct *>( arg );
+    StreamedPointsThreadStruct *str = static_cast<StreamedPointsThreadStruct *>( info->UserData );
+    const ThreadIdType threadId = info->ThreadID;
+    const ThreadIdType threadCount = info->NumberOfThreads;
+
+    const unsigned long count = str->Filter->m_StreamedPoints.size();
+    const unsigned long chunk = ( count + threadCount - 1 ) / threadCount;
+    const unsigned long begin = vnl_math_min( count, static_cast<unsigned long>( threadId ) * chunk );
+    const unsigned long end = vnl_math_min( count, begin + chunk );
+    str->Filter->MapStreamedPointRange( str, threadId, begin, end );
+    return ITK_THREAD_RETURN_VALUE;
+}
+
+
+template <class TInputImage,class TOutputImage,class TDisplacementField, class TTransform>
+void
+WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
+::MapStreamedPointRange(StreamedPointsThreadStruct *str, ThreadIdType threadId,
+        unsigned long begin, unsigned long end)
+{
+    const long kPad = 1;
+    OutputImagePointer outputPtr = this->GetOutput();
+    IndexType & lower = str->Lower[threadId];
+    IndexType & upper = str->Upper[threadId];
+    bool any = false;
+    for (unsigned long k = begin; k < end; k++)
+    {
+        // the output is not buffered yet, so walk the region by index
+        IndexType index;
+        unsigned long rest = k;
+        for (unsigned int d = 0; d < ImageDimension; d++) {
+            index[d] = m_StreamedRegion.GetIndex()[d] + static_cast<long>( rest % m_StreamedRegion.GetSize()[d] );
+            rest /= m_StreamedRegion.GetSize()[d];
+        }
+
+        PointType & point = m_StreamedPoints[k];
+        unsigned char & state = m_StreamedPointStates[k];
+        if ( !str->Item ) {
+            // as in MultiTransformPoint(), an empty list maps nothing inside
+            outputPtr->TransformIndexToPhysicalPoint( index, point );
+            state = StreamedPointValid;
+        }
+        else if ( state & StreamedPointValid ) {
+            PointType point2;
+            const bool isinside = SingleTransformPoint( *str->Item, point, point2, str->NoInterp, index );
+            state = StreamedPointValid | ( isinside ? StreamedPointInside : 0 );
+            if ( IsOutOfNumericBoundary(point2) ) state = 0;
+            point = point2;
+        }
+
+        if ( !str->Target || !( state & StreamedPointValid ) ) continue;
+        if ( str->InsideOnly && !( state & StreamedPointInside ) ) continue;
+        ContinuousIndex<CoordRepType, ImageDimension> contind;
+        str->Target->TransformPhysicalPointToContinuousIndex( point, contind );
+        for (unsigned int d = 0; d < ImageDimension; d++) {
+            long lo = static_cast<long>( vcl_floor(contind[d]) ) - kPad;
+            long hi = static_cast<long>( vcl_ceil(contind[d]) ) + kPad;
+            if (!any || lo < lower[d]) lower[d] = lo;
+            if (!any || hi > upper[d]) upper[d] = hi;
+        }
+        any = true;
+    }
+    str->Any[threadId] = any;
+}
+
+
 template <class TInputImage,class TOutputImage,class TDisplacementField, class TTransform>
 void
 WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
@@ -325,7 +569,7 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
 
     IndexType index;
     index.Fill(0);
-    this->m_EdgePaddingValue=inputPtr->GetPixel(index);
+    if ( !m_UseStreaming ) this->m_EdgePaddingValue=inputPtr->GetPixel(index);
 
     // support progress methods/callbacks
     ProgressReporter progress(this, threadId, outputRegionForThread.GetNumberOfPixels());
@@ -339,9 +583,22 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
 
         // get the output image index
         IndexType index = outputIt.GetIndex();
-        outputPtr->TransformIndexToPhysicalPoint( index, point1 );
 
-        bool isinside = MultiTransformPoint(point1, point2, m_bFirstDeformNoInterp, index);
+        bool isinside;
+        if ( m_UseStreaming ) {
+            // mapped already while the regions were negotiated
+            unsigned long offset = 0, stride = 1;
+            for (unsigned int d = 0; d < ImageDimension; d++) {
+                offset += ( index[d] - m_StreamedRegion.GetIndex()[d] ) * stride;
+                stride *= m_StreamedRegion.GetSize()[d];
+            }
+            point2 = m_StreamedPoints[offset];
+            isinside = ( m_StreamedPointStates[offset] & StreamedPointInside ) != 0;
+        }
+        else {
+            outputPtr->TransformIndexToPhysicalPoint( index, point1 );
+            isinside = MultiTransformPoint(point1, point2, m_bFirstDeformNoInterp, index);
+        }
 
         // std::cout << "point1:" << point1 << "  point2:" << point2 << " index:" << index << std::endl;
         // exit(-1);
@@ -406,6 +663,7 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
         t1.dex.vinterp = DefaultVectorInterpolatorType::New();
         t1.dex.vinterp->SetInputImage(t1.dex.field);
 //    t1.dex.vinterp->SetParameters(NULL,1);
+        t1.dex.sampler.Initialize(t1.dex.field);
         m_TransformList.push_back(SingleTransformItemType(EnumDisplacementFieldType, t1));
     }
 
@@ -539,46 +797,7 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
 
     typename TransformListType::iterator it = m_TransformList.begin();
     for(;it!=m_TransformList.end(); it++){
-        SingleTransformType ttype = it->first;
-        switch(ttype){
-        case EnumAffineType:
-        {
-            TransformTypePointer aff = it->second.aex.aff;
-            point2 = aff->TransformPoint(point1);
-            point1 = point2;
-            isinside = true;
-        }
-        break;
-        case EnumDisplacementFieldType:
-        {
-            DisplacementFieldPointer fieldPtr = it->second.dex.field;
-            if (bFisrtDeformNoInterp && it==m_TransformList.begin() ){
-                // use discrete coordinates
-                DisplacementType displacement = fieldPtr->GetPixel(index);
-                for(int j = 0; j<ImageDimension; j++) point2[j] = point1[j] + displacement[j];
-                isinside = true;
-            }
-            else{
-                // use continous coordinates
-                typename DefaultVectorInterpolatorType::ContinuousIndexType  contind;
-
-                // use ITK implementation to use orientation header
-                fieldPtr->TransformPhysicalPointToContinuousIndex(point1, contind);
-
-                isinside = fieldPtr->GetLargestPossibleRegion().IsInside( contind );
-
-                VectorInterpolatorPointer vinterp = it->second.dex.vinterp;
-                typename DefaultVectorInterpolatorType::OutputType disp2;
-                if (isinside) disp2 = vinterp->EvaluateAtContinuousIndex( contind );
-                else disp2.Fill(0);
-
-                for (int jj=0; jj<ImageDimension; jj++) point2[jj]=disp2[jj]+point1[jj];
-            }
-        }
-        break;
-        default:
-            itkExceptionMacro(<< "Single Transform Not Supported!");
-        }
+        isinside = SingleTransformPoint(*it, point1, point2, bFisrtDeformNoInterp && it==m_TransformList.begin(), index);
 
         if (IsOutOfNumericBoundary(point2)) {isinside = false; break;}
 
@@ -590,6 +809,47 @@ WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTran
     return isinside;
 }
 
+template <class TInputImage,class TOutputImage,class TDisplacementField, class TTransform>
+bool
+WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
+::SingleTransformPoint(const SingleTransformItemType &item, const PointType &point1, PointType &point2, bool bDeformNoInterp, const IndexType &index)
+{
+    bool isinside = false;
+    switch(item.first){
+    case EnumAffineType:
+    {
+        TransformTypePointer aff = item.second.aex.aff;
+        point2 = aff->TransformPoint(point1);
+        isinside = true;
+    }
+    break;
+    case EnumDisplacementFieldType:
+    {
+        DisplacementFieldPointer fieldPtr = item.second.dex.field;
+        if (bDeformNoInterp){
+            // use discrete coordinates
+            DisplacementType displacement = fieldPtr->GetPixel(index);
+            for(int j = 0; j<ImageDimension; j++) point2[j] = point1[j] + displacement[j];
+            isinside = true;
+        }
+        else{
+            // use continous coordinates;  the inline sampler does what
+            // TransformPhysicalPointToContinuousIndex and the linear vector
+            // interpolator would, against the buffered region of the field
+            typename DisplacementFieldSamplerType::OutputType disp2;
+            isinside = item.second.dex.sampler.Evaluate( point1, disp2 );
+
+            for (int jj=0; jj<ImageDimension; jj++) point2[jj]=disp2[jj]+point1[jj];
+        }
+    }
+    break;
+    default:
+        itkExceptionMacro(<< "Single Transform Not Supported!");
+    }
+
+    return isinside;
+}
+
 template <class TInputImage,class TOutputImage,class TDisplacementField, class TTransform>
 void
 WarpImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
@@ -24,6 +24,7 @@
 #include "itkPoint.h"
 #include "itkFixedArray.h"
 #include "itkRecursiveGaussianImageFilter.h"
+#include "itkDisplacementFieldLinearSampler.h"
 
 namespace itk
 {
@@ -146,6 +147,9 @@ public:
     typedef LinearInterpolateImageFunction<InputImageType,CoordRepType>
     DefaultInterpolatorType;
 
+    /** Inline linear interpolator for the deformation field. */
+    typedef DisplacementFieldLinearSampler<DisplacementFieldType,CoordRepType> DisplacementFieldSamplerType;
+
     /** Point type */
     typedef Point<CoordRepType,itkGetStaticConstMacro(ImageDimension)> PointType;
 
@@ -419,6 +419,10 @@ WarpImageWAffineFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
 
     std::cout << "m_TransformOrder: " << m_TransformOrder << std::endl;
 
+    // one inline sampler per thread instead of an interpolator per voxel
+    DisplacementFieldSamplerType fieldSampler;
+    fieldSampler.Initialize( fieldPtr );
+
     int cnt = 0;
     while( !outputIt.IsAtEnd() )
     {
@@ -448,20 +452,16 @@ WarpImageWAffineFilter<TInputImage,TOutputImage,TDisplacementField, TTransform>
         {
             point2 = aff->TransformPoint(point1);
 
-            typedef itk::VectorLinearInterpolateImageFunction<DisplacementFieldType,float> DefaultInterpolatorType;
-            typename DefaultInterpolatorType::Pointer vinterp =  DefaultInterpolatorType::New();
-            vinterp->SetInputImage(fieldPtr);
-
-            typename DefaultInterpolatorType::ContinuousIndexType  contind;
+            ContinuousIndex<float, ImageDimension>  contind;
             // isinside = fieldPtr->TransformPhysicalPointToContinuousIndex(point2, contind);
             // explicitly written to avoid double / float type dismatching
             for (unsigned int i = 0; i < ImageDimension; i++) {
                 contind[i] = ( (point2[i]- fieldPtr->GetOrigin()[i]) / fieldPtr->GetSpacing()[i] );
             }
-            isinside = fieldPtr->GetLargestPossibleRegion().IsInside( contind );
+            isinside = fieldSampler.IsInside( contind );
 
-            typename DefaultInterpolatorType::OutputType disp2;
-            if (isinside) disp2 = vinterp->EvaluateAtContinuousIndex( contind );
+            typename DisplacementFieldSamplerType::OutputType disp2;
+            if (isinside) fieldSampler.EvaluateAtContinuousIndex( contind, disp2 );
             else disp2.Fill(0);
 
             for (int jj=0; jj<ImageDimension; jj++) point3[jj]=disp2[jj]+point2[jj];
@@ -25,6 +25,7 @@
 #include "itkPoint.h"
 #include "itkFixedArray.h"
 #include "itkRecursiveGaussianImageFilter.h"
+#include "itkDisplacementFieldLinearSampler.h"
 #include <list>
 
 namespace itk
@@ -150,6 +151,9 @@ public:
     typedef VectorLinearInterpolateImageFunction<DisplacementFieldType,CoordRepType> DefaultVectorInterpolatorType;
     typedef typename DefaultVectorInterpolatorType::Pointer VectorInterpolatorPointer;
 
+    /** Inline linear interpolator used for the fields in the inner loop. */
+    typedef DisplacementFieldLinearSampler<DisplacementFieldType,CoordRepType> DisplacementFieldSamplerType;
+
 
     /** Point type */
     typedef Point<CoordRepType,itkGetStaticConstMacro(ImageDimension)> PointType;
@@ -157,6 +161,7 @@ public:
     typedef struct _DeformationTypeEx{
         DisplacementFieldPointer field;
         VectorInterpolatorPointer vinterp;
+        DisplacementFieldSamplerType sampler;
     } DeformationTypeEx;
 
     typedef struct _AffineTypeEx{
@@ -169,6 +169,13 @@ WarpTensorImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField,
 
     m_Interpolator->SetInputImage( m_CachedSmoothImage );
 
+    // the field buffers may have changed since they were pushed back
+    typename TransformListType::iterator it = m_TransformList.begin();
+    for(;it!=m_TransformList.end(); it++){
+        if (it->first == EnumDisplacementFieldType)
+            it->second.dex.sampler.Initialize( it->second.dex.field );
+    }
+
 }
 
 /**
@@ -408,6 +415,7 @@ WarpTensorImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField,
         t1.dex.field = const_cast<DisplacementFieldType *> (t);
         t1.dex.vinterp = DefaultVectorInterpolatorType::New();
         t1.dex.vinterp->SetInputImage(t1.dex.field);
+        t1.dex.sampler.Initialize(t1.dex.field);
 
         m_TransformList.push_back(SingleTransformItemType(EnumDisplacementFieldType, t1));
     }
@@ -562,18 +570,9 @@ WarpTensorImageMultiTransformFilter<TInputImage,TOutputImage,TDisplacementField,
                 isinside = true;
             }
             else{
-                // use continous coordinates
-                typename DefaultVectorInterpolatorType::ContinuousIndexType  contind;
-
-                // use ITK implementation to use orientation header
-                fieldPtr->TransformPhysicalPointToContinuousIndex(point1, contind);
-
-                isinside = fieldPtr->GetLargestPossibleRegion().IsInside( contind );
-
-                VectorInterpolatorPointer vinterp = it->second.dex.vinterp;
-                typename DefaultVectorInterpolatorType::OutputType disp2;
-                if (isinside) disp2 = vinterp->EvaluateAtContinuousIndex( contind );
-                else disp2.Fill(0);
+                // use continous coordinates, through the inline sampler
+                typename DisplacementFieldSamplerType::OutputType disp2;
+                isinside = it->second.dex.sampler.Evaluate( point1, disp2 );
 
                 for (int jj=0; jj<ImageDimension; jj++) point2[jj]=disp2[jj]+point1[jj];
             }